@@ -2,6 +2,9 @@
 #include "config.hpp"
 #include "app.hpp"
 
+#include "hash.hpp"
+#include "thread_pool.hpp"
+#include "vertex_packing.hpp"
 #include "webgpu_utils.hpp"
 
 #include <glm/gtx/polar_coordinates.hpp>
@@ -12,7 +15,12 @@
 #include <backends/imgui_impl_wgpu.h>
 #include <backends/imgui_impl_glfw.h>
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <random>
+#include <thread>
 #include <vector>
 #include <cassert>
 
@@ -21,37 +29,92 @@
 constexpr auto NaNf = std::numeric_limits<float>::quiet_NaN();
 #endif
 
+namespace {
 
-bool Application::Initialize() {
-    // Initialize GLFW
-    if (!glfwInit()) {
-        std::cerr << "Could not initialize GLFW!" << std::endl;
-        return false;
+// Whether `task` has a result, without blocking
+bool isReady(const std::future<bool>& task) {
+    return task.valid() && task.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+// Frames drawn on demand after an event, for the GUI to settle and the
+// occlusion culling to catch up with the camera
+constexpr uint32_t settleFrames = 3;
+
+// As offered by the surface
+const char* presentModeName(wgpu::PresentMode mode) {
+    switch (mode) {
+        case wgpu::PresentMode::Fifo: return "Fifo (vsync)";
+        case wgpu::PresentMode::FifoRelaxed: return "Fifo relaxed";
+        case wgpu::PresentMode::Immediate: return "Immediate";
+        case wgpu::PresentMode::Mailbox: return "Mailbox";
+        default: return "Undefined";
     }
+}
 
-    // Create the window
-    CreateWindow();
-    if (!window) {
-        std::cerr << "Could not create GLFW window!" << std::endl;
-        glfwTerminate();
-        return false;
+} // namespace
+
+bool Application::Initialize(const ApplicationOptions& options) {
+    this->options = options;
+
+    // Read and decode the assets on the thread pool while the window and
+    // the device are created
+    startupTimeline.start();
+    LaunchStartupTasks();
+
+    if (options.headless) {
+        // Render at the initial window size, without a window
+        width = fbWidth = config::initial_width;
+        height = fbHeight = config::initial_height;
+    }
+    else {
+        size_t windowStage = startupTimeline.begin("window");
+
+        // Initialize GLFW
+        if (!glfwInit()) {
+            std::cerr << "Could not initialize GLFW!" << std::endl;
+            WaitForStartupTasks();
+            return false;
+        }
+
+        // Create the window
+        CreateWindow();
+        if (!window) {
+            std::cerr << "Could not create GLFW window!" << std::endl;
+            WaitForStartupTasks();
+            glfwTerminate();
+            return false;
+        }
+        startupTimeline.end(windowStage);
     }
 
     // Create WebGPU instance
     auto instance = CreateInstance();
     if (!instance) {
         std::cerr << "Could not initialize WebGPU!" << std::endl;
+        WaitForStartupTasks();
         return false;
     }
 
     // Request WebGPU adapter
-    auto adapter = RequestAdapter(instance);
+    auto adapter = startupTimeline.measure("adapter", [&]() { return RequestAdapter(instance); });
 
     // Request WebGPU device
-    RequestDevice(adapter);
-
-    // Configure surface
-    ConfigureSurface(instance, adapter);
+#if defined(WEBGPU_BACKEND_DAWN)
+    pipelineBlobStore.setDirectory(config::pipelineCacheDirectory);
+#endif
+    startupTimeline.measure("device", [&]() { RequestDevice(adapter); });
+    pipelineCache.initialize(device);
+
+    // Configure surface, or the offscreen target replacing it
+    if (options.headless) {
+        if (!InitializeOffscreenTarget()) {
+            WaitForStartupTasks();
+            return false;
+        }
+    }
+    else {
+        ConfigureSurface(instance, adapter);
+    }
 
     // Destroy WebGPU instance and adapter
     instance.release();
@@ -60,18 +123,32 @@ bool Application::Initialize() {
     // Get queue
     queue = wgpuDeviceGetQueue(device);
 
-    // Initialize buffers
-    InitializeBuffers();
-
-    // Initialize textures
-    InitializeTextures();
+    // Initialize the depth texture first, the path tracer's display
+    // pipeline needs its format
     InitializeDepthTexture();
 
-    // Initialize pipeline
-    InitializePipline();
+    // A bundle per region of the upload ring, whose offsets they capture
+    sceneBundles.initialize(device, surfaceFormat, depthTextureFormat, config::framesInFlight);
+    renderBundles = config::renderBundles;
 
-    // Initialize bind group
-    InitializeBindGroups();
+    // Initialize the per-frame uniforms, which need no asset
+    InitializeUniforms();
+
+    // Time the scene pass, and the GUI pass when there is one
+    if (!gpuTimer.initialize(device, options.headless ? 1 : 2)) {
+        std::cerr << "Timestamp queries are not supported, GPU pass times are unavailable" << std::endl;
+    }
+
+    animateLights = options.headless || config::animateLights;
+
+    // Buffers, textures, pipeline and bind groups follow as their assets
+    // arrive, see ContinueStartup(). A headless run has no loading screen
+    // to show meanwhile.
+    if (options.headless) {
+        FinishStartup();
+        headlessStart = std::chrono::steady_clock::now();
+        return true;
+    }
 
     // Initialize GUI
     if (!InitGui()) {
@@ -79,21 +156,148 @@ bool Application::Initialize() {
         return false;
     }
 
+    framePacer.setFrameRateLimit(config::frameRateLimit);
+    framePacer.setJustInTime(config::justInTimeInput);
+    renderOnDemand = config::renderOnDemand;
+
     return true;
 };
 
+void Application::LaunchStartupTasks() {
+    startupAssets = std::make_unique<StartupAssets>();
+    StartupAssets& assets = *startupAssets;
+    ThreadPool& pool = ThreadPool::shared();
+
+    // Shader first, the pipeline compile is the longest GPU-side step
+    shaderTask = pool.submit([this, &assets]() {
+        return startupTimeline.measure("shader read", [&assets]() {
+            return ResourceManager::readShaderFile(config::shaderSrcFile, assets.shaderSource);
+        });
+    });
+    meshTask = pool.submit([this, &assets]() {
+        return startupTimeline.measure("mesh load", [&assets]() { return LoadMeshAssets(assets); });
+    });
+    textureTask = pool.submit([this, &assets]() {
+        return startupTimeline.measure("texture decode", [&assets]() {
+            // The compressed chain comes from its KTX2 cache after the first run
+            if (config::compressTextures && ResourceManager::loadCompressedTexture(
+                    config::textureFile, assets.compressedTexture, config::highQualityTextureCompression)) {
+                return true;
+            }
+            // The GPU generator builds the mips from level 0 alone
+            return ResourceManager::decodeTexture(config::textureFile, assets.texture, !config::generateMipMapsOnGpu);
+        });
+    });
+}
+
+void Application::WaitForStartupTasks() {
+    for (std::future<bool>* task : { &shaderTask, &meshTask, &textureTask }) {
+        if (task->valid()) task->wait();
+    }
+}
+
+bool Application::ContinueStartup() {
+    // Hand over the pipelines compiled on the thread pool, later
+    // permutations included
+    pipelineCache.collect();
+    if (startupComplete) return true;
+
+    if (!pipelineRequested && isReady(shaderTask)) {
+        if (!shaderTask.get()) {
+            std::cerr << "Could not load shader at: " << config::shaderSrcFile << std::endl;
+            exit(1);
+        }
+        pipelineStage = startupTimeline.begin("pipeline");
+        InitializePipline();
+        pipelineRequested = true;
+    }
+
+    if (!buffersReady && isReady(meshTask)) {
+        if (!meshTask.get()) {
+            std::cerr << "Could not load geometry file at: " << config::shapeModelFile << std::endl;
+            exit(1);
+        }
+        startupTimeline.measure("mesh upload", [this]() { InitializeBuffers(); });
+        buffersReady = true;
+    }
+
+    if (!texturesReady && isReady(textureTask)) {
+        if (!textureTask.get()) {
+            std::cerr << "Could not load texture at: " << config::textureFile << std::endl;
+            exit(1);
+        }
+        startupTimeline.measure("texture upload", [this]() { InitializeTextures(); });
+        texturesReady = true;
+    }
+
+    // The pipeline may still be compiling in the background
+    if (!pipeline || !buffersReady || !texturesReady) return false;
+
+    InitializeBindGroups();
+    if (options.pathTraced && pathTracerAvailable) {
+        renderMode = RenderMode::PathTracer;
+    }
+
+    // The CPU copies of the assets are uploaded now
+    startupAssets.reset();
+    startupComplete = true;
+    firstFrameStage = startupTimeline.begin("first frame");
+    return true;
+}
+
+void Application::FinishStartup() {
+    while (!ContinueStartup()) {
+#if defined(WEBGPU_BACKEND_DAWN)
+        device.tick();
+#elif defined(WEBGPU_BACKEND_WGPU)
+        device.poll(false, nullptr);
+#endif
+        std::this_thread::yield();
+    }
+}
+
 void Application::Terminate() {
+    // Closed while loading, let the startup run out so everything below exists
+    FinishStartup();
+
+    sceneBundles.terminate();
     bindGroup.release();
-    pipeline.release();
+    pipelineCache.terminate();
     pipelineLayout.release();
     bindGroupLayout.release();
     textureView.release();
     texture.release();
     sampler.release();
+    mipMapGenerator.terminate();
     depthTexture.release();
-    uniformBuffer.release();
+    uploadRing.terminate();
     lightingUniformBuffer.release();
     vertexBuffer.release();
+    indexBuffer.release();
+    sceneInstances.terminate();
+    gpuCuller.terminate();
+    clusteredLights.terminate();
+    pathTracer.terminate();
+    gpuTimer.terminate();
+
+    if (options.headless) {
+        // Wait for the frames still in flight before timing the run
+        frameReadback.terminate();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - headlessStart).count();
+        const FrameReadback::Stats& stats = frameReadback.stats();
+        std::cout << "Rendered " << frameIndex << " frames in " << seconds << " s ("
+                  << static_cast<double>(frameIndex) / seconds << " frames/s), wrote "
+                  << stats.framesWritten << " to " << options.outputDirectory
+                  << ", " << stats.stallMilliseconds << " ms waiting for readback" << std::endl;
+        if (!frameStats.writeCsv(options.outputDirectory / config::frameStatsCsvFile)) {
+            std::cerr << "Could not write frame times to " << options.outputDirectory << std::endl;
+        }
+        offscreenTexture.release();
+        queue.release();
+        device.release();
+        return;
+    }
+
     surface.unconfigure();
     surface.release();
     queue.release();
@@ -104,29 +308,142 @@ void Application::Terminate() {
 };
 
 void Application::MainLoop() {
-    glfwPollEvents();
-    UpdateDragInertia();
+    // On demand, sleep until the events or the time bring something new
+    if (!options.headless && renderOnDemand && !IsFrameNeeded()) {
+        auto idleStart = std::chrono::steady_clock::now();
+        glfwWaitEventsTimeout(config::idleWaitSeconds);
+        idleDuration += std::chrono::steady_clock::now() - idleStart;
+        if (!IsFrameNeeded()) {
+            skippedFrames++;
+            return;
+        }
+    }
 
-    // Update uniform buffer
-    //UpdateModelMatrix(glfwGetTime());
-    UpdateMyUniforms();
+    auto frameStart = std::chrono::steady_clock::now();
 
-    // Update lighting uniform buffer
-    UpdateLighting();
+    // Just in time, the input is read once the surface texture is acquired,
+    // which may block, and as late as the frame limit allows
+    bool lateInput = !options.headless && framePacer.isJustInTime();
+    if (!options.headless && !lateInput) {
+        framePacer.wait();
+        ProcessInput();
+        framePacer.beginWork();
+    }
+
+    // Follow the window and presentation changes of the last events
+    if (resizePending) {
+        ResizeWindow();
+    }
+    else if (presentModePending) {
+        ReconfigureSurface();
+    }
+
+    // Pick up the assets loaded since the last frame
+    bool startupDone = ContinueStartup();
+
+    // Write moved objects, the bind group follows the buffer if it grew and
+    // the GPU culler's visible lists if they were laid out again
+    if (startupDone) {
+        bool gpuCullingActive = IsGpuCullingActive();
+        bool recreated = sceneInstances.upload(queue);
+        recreated = (gpuCullingAvailable && gpuCuller.update(sceneInstances)) || recreated;
+        if (recreated) {
+            bindGroup.release();
+            InitializeBindGroups();
+        }
+        // Too many objects for the device's bindings take the CPU culling
+        if (IsGpuCullingActive() != gpuCullingActive) {
+            RequestScenePipeline();
+        }
+    }
 
     // Get texture view
-    auto targetView = GetNextSurfaceTextureView();
-    if (!targetView) return;
+    auto targetView = options.headless ? GetOffscreenTextureView() : GetNextSurfaceTextureView();
+    if (!targetView) {
+        if (lateInput) ProcessInput();
+        return;
+    }
 
     // Get depth texture view
     auto depthTextureView = GetNextDepthTextureView();
     if (!depthTextureView) return;
 
+    if (lateInput) {
+        framePacer.wait();
+        ProcessInput();
+        framePacer.beginWork();
+    }
+
+    // Write this frame's uniforms into its region of the upload ring
+    uploadRing.beginFrame();
+    //UpdateModelMatrix(glfwGetTime());
+    UpdateMyUniforms();
+    UpdateLighting();
+
+    // Move the local lights, headless runs step a fixed time per frame so
+    // that their frames are reproducible
+    bool clusteringLights = startupDone && renderMode == RenderMode::Raster && shading.localLights && clusteredLightsAvailable;
+    if (clusteringLights) {
+        if (animateLights) {
+            lightsTime = options.headless
+                ? static_cast<float>(frameIndex) / 60.0f
+                : std::chrono::duration<float>(std::chrono::steady_clock::now() - lightsStart).count();
+        }
+        UpdateLocalLights(lightsTime);
+    }
+
+    // Keep the draws to what the camera sees, the shader applies modelMatrix
+    // on top of each object's transform. The GPU culls once the pipeline
+    // reading its visible lists is in place.
+    glm::mat4x4 viewProjection = uniforms.projectionMatrix * uniforms.viewMatrix * uniforms.modelMatrix;
+    bool gpuCulled = startupDone && renderMode == RenderMode::Raster && pipelineGpuCulled;
+    if (startupDone && renderMode == RenderMode::Raster && !gpuCulled) {
+        // Levels of detail are picked in the space of the object transforms,
+        // before modelMatrix
+        LodView lodView;
+        if (levelsOfDetail) {
+            lodView.eye = glm::vec3(glm::inverse(uniforms.modelMatrix) * glm::vec4(uniforms.cameraWorldPosition, 1.0f));
+            lodView.pixelScale = 0.5f * static_cast<float>(fbHeight) * uniforms.projectionMatrix[1][1];
+            lodView.threshold = lodPixelError;
+        }
+        sceneInstances.cull(viewProjection, lodView);
+    }
+    else if (gpuCulled) {
+        gpuCuller.prepare(uploadRing, viewProjection, uniforms.projectionMatrix, static_cast<uint32_t>(hiZLevel));
+    }
+
     // Create a command encoder for the draw call 
     wgpu::CommandEncoderDescriptor encoderDesc = {};
     encoderDesc.label = "My command encoder"_wgpu;
     wgpu::CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
 
+    // One copy for all of the frame's uploads, before any pass reads them
+    uploadRing.endFrame(encoder);
+
+    // The path tracer binds the lights at a fixed place, refresh it from
+    // the ring when they change
+    if (lightingUniformsChanged) {
+        encoder.copyBufferToBuffer(uploadRing.buffer(), lightingUniformsOffset, lightingUniformBuffer, 0, sizeof(LightingUniforms));
+        lightingUniformsChanged = false;
+    }
+
+    gpuTimer.beginFrame(frameIndex);
+
+    // Add a sample to the path traced image before displaying it
+    if (renderMode == RenderMode::PathTracer) {
+        pathTracer.trace(encoder, { uniforms.projectionMatrix, uniforms.viewMatrix, uniforms.modelMatrix, uniforms.cameraWorldPosition });
+    }
+
+    // Fill the indirect draws of the scene pass
+    if (gpuCulled) {
+        gpuCuller.cull(encoder);
+    }
+
+    // List the local lights of each cluster
+    if (clusteringLights) {
+        clusteredLights.assign(encoder);
+    }
+
     // Create render pass that clears the screen with our color
     wgpu::RenderPassColorAttachment renderPassColorAttachment = {};
     renderPassColorAttachment.view = targetView;
@@ -159,44 +476,142 @@ void Application::MainLoop() {
     renderPassDesc.colorAttachmentCount = 1;
     renderPassDesc.colorAttachments = &renderPassColorAttachment;
     renderPassDesc.depthStencilAttachment = &depthStencilAttachment;
-    renderPassDesc.timestampWrites = nullptr;
+    renderPassDesc.timestampWrites = gpuTimer.renderPassWrites(0);
 
     // Create the render pass and end it immediately
     wgpu::RenderPassEncoder renderPass = encoder.beginRenderPass(renderPassDesc);
-    renderPass.setPipeline(pipeline);
-    renderPass.setVertexBuffer(0, vertexBuffer, 0, vertexCount*sizeof(VertexAttributes));
-    renderPass.setBindGroup(0, bindGroup, 0, nullptr);
+    if (renderMode == RenderMode::PathTracer) {
+        pathTracer.draw(renderPass);
+    }
+    else if (startupDone) {
+        // In binding order, uniforms, lighting, the visible list, which the
+        // GPU culler sets per draw, then the local lights and their uniforms
+        uint32_t dynamicOffsets[] = {
+            myUniformsOffset, lightingUniformsOffset, 0,
+            clusteredLights.lightOffset(), clusteredLights.uniformOffset()
+        };
+        auto encodeStart = std::chrono::steady_clock::now();
+        if (renderBundles) {
+            // The GPU culler's draws only change with the bind group, the
+            // CPU culling's as the camera moves, unless culling is off
+            if (!gpuCulled && sceneInstances.drawListVersion() != bundledDrawList) {
+                sceneBundles.invalidate();
+                bundledDrawList = sceneInstances.drawListVersion();
+            }
+            WGPURenderBundle bundle = sceneBundles.bundle(dynamicOffsets, [&](wgpu::RenderBundleEncoder bundleEncoder) {
+                EncodeScene(bundleEncoder, dynamicOffsets, gpuCulled);
+            });
+            if (bundle) wgpuRenderPassEncoderExecuteBundles(renderPass, 1, &bundle);
+        }
+        else {
+            EncodeScene(renderPass, dynamicOffsets, gpuCulled);
+        }
+        sceneEncodeMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - encodeStart).count();
 
-    renderPass.draw(vertexCount, 1, 0, 0);
-    
-    // Update the GUI
-    UpdateGui(renderPass);
+        if (gpuCulled && showHiZ) {
+            gpuCuller.drawHiZ(renderPass);
+        }
+    }
 
     renderPass.end();
     renderPass.release();
 
+    // Occluders for the next frame's culling
+    if (gpuCulled) {
+        gpuCuller.buildHiZ(encoder);
+    }
+
+    // Update the GUI in a pass of its own, so that it is timed apart
+    if (!options.headless) {
+        renderPassColorAttachment.loadOp = wgpu::LoadOp::Load;
+        depthStencilAttachment.depthLoadOp = wgpu::LoadOp::Load;
+        renderPassDesc.timestampWrites = gpuTimer.renderPassWrites(1);
+
+        wgpu::RenderPassEncoder guiPass = encoder.beginRenderPass(renderPassDesc);
+        UpdateGui(guiPass);
+        guiPass.end();
+        guiPass.release();
+    }
+
+    // Read the pass timestamps back with the frame
+    gpuTimer.resolve(encoder);
+
+    // Copy the frame out for readback
+    if (options.headless) {
+        frameReadback.capture(encoder, offscreenTexture);
+    }
+
     // Finally encode and submit the render pass
     wgpu::CommandBufferDescriptor cmdBufferDesc = {};
     cmdBufferDesc.label = "Command buffer"_wgpu;
     wgpu::CommandBuffer command = encoder.finish(cmdBufferDesc);
     encoder.release();
 
-    queue.submit(command);
+    if (options.headless) {
+        frameReadback.submit(queue, command);
+    }
+    else {
+        queue.submit(command);
+    }
     command.release();
+    gpuTimer.submitted();
+    gpuCuller.submitted();
+    uploadRing.submitted(queue);
+
+    // Input latency as seen from the callbacks, which run within
+    // glfwPollEvents(), up to the submission showing it
+    double inputLatency = std::numeric_limits<double>::quiet_NaN();
+    if (inputTime) {
+        inputLatency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - *inputTime).count();
+        inputTime.reset();
+    }
+    framePacer.endWork();
+
+    // The startup ends with the first frame showing the scene
+    if (startupDone && firstFrameStage) {
+        startupTimeline.end(*firstFrameStage);
+        firstFrameStage.reset();
+        startupTimeline.print(std::cout);
+    }
 
     // Release texture view
     targetView.release();
     depthTextureView.release();
-    surface.present();
+    if (!options.headless) {
+        surface.present();
+    }
 
 #if defined(WEBGPU_BACKEND_DAWN)
     device.tick();
 #elif defined(WEBGPU_BACKEND_WGPU)
     device.poll(false, nullptr);
 #endif
+
+    // Hand the frames read back so far to the writers
+    if (options.headless) {
+        frameReadback.collect();
+    }
+
+    gpuTimer.collect([this](uint64_t index, std::span<const double> passMilliseconds) {
+        frameStats.addGpuFrame(index, passMilliseconds);
+    });
+    gpuCuller.collect();
+
+    // The CPU frame time spans from one frame start to the next, so the
+    // first frame has none, and leaves out the sleep of rendering on demand
+    if (lastFrameStart != std::chrono::steady_clock::time_point{}) {
+        frameStats.addCpuFrame(frameIndex, std::chrono::duration<double, std::milli>(frameStart - lastFrameStart - idleDuration).count(), inputLatency);
+    }
+    lastFrameStart = frameStart;
+    idleDuration = {};
+    if (pendingFrames > 0) pendingFrames--;
+    frameIndex++;
 };
 
 bool Application::IsRunning() {
+    if (options.headless) {
+        return frameIndex < options.frameCount;
+    }
     return !glfwWindowShouldClose(window);
 };
 
@@ -219,7 +634,7 @@ void Application::CreateWindow() {
     // Set the window callbacks
     glfwSetFramebufferSizeCallback(window, [](GLFWwindow* window, int, int) {
         auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
-        if (that != nullptr) that->ResizeWindow();
+        if (that != nullptr) that->resizePending = true;
     });
     glfwSetCursorPosCallback(window, [](GLFWwindow* window, double xpos, double ypos) {
         auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
@@ -233,6 +648,17 @@ void Application::CreateWindow() {
         auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
         if (that != nullptr) that->MouseScroll(xoffset, yoffset);
     });
+    // Only timed, the GUI installs its key callback over this one and
+    // chains to it
+    glfwSetKeyCallback(window, [](GLFWwindow* window, int, int, int, int) {
+        auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+        if (that != nullptr) that->RecordInput();
+    });
+    // The window needs drawing again, when uncovered for instance
+    glfwSetWindowRefreshCallback(window, [](GLFWwindow* window) {
+        auto that = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+        if (that != nullptr) that->pendingFrames = std::max(that->pendingFrames, settleFrames);
+    });
 };
 
 void Application::ResizeWindow() {
@@ -246,22 +672,21 @@ void Application::ResizeWindow() {
     height = static_cast<int>(fbHeight / hscale);
 
     // Re-configure the surface
-    wgpu::SurfaceConfiguration config;
-    config.width = static_cast<uint32_t>(fbWidth);
-    config.height = static_cast<uint32_t>(fbHeight);
-    config.usage = wgpu::TextureUsage::RenderAttachment;
-    config.format = surfaceFormat;
+    ReconfigureSurface();
+    resizePending = false;
 
-    config.viewFormatCount = 0;
-    config.viewFormats = nullptr;
-    config.device = device;
-    config.presentMode = wgpu::PresentMode::Fifo;
-    config.alphaMode = wgpu::CompositeAlphaMode::Auto;
-    surface.configure(config);
-
-    // Recreate the depth texture
+    // Recreate the depth texture, and the Hi-Z pyramid built from it
     depthTexture.release();
     InitializeDepthTexture();
+    if (gpuCullingAvailable) {
+        gpuCuller.resize(depthTexture, static_cast<uint32_t>(fbWidth), static_cast<uint32_t>(fbHeight));
+    }
+
+    // Restart the accumulation at the new size, the end of the startup
+    // sizes it otherwise
+    if (startupComplete) {
+        pathTracer.resize(static_cast<uint32_t>(fbWidth), static_cast<uint32_t>(fbHeight));
+    }
 
     ImGui_ImplWGPU_InvalidateDeviceObjects();
     ImGui_ImplWGPU_CreateDeviceObjects();
@@ -278,7 +703,7 @@ bool Application::InitGui() {
 
     ImGui_ImplWGPU_InitInfo init_info;
     init_info.Device = device;
-    init_info.NumFramesInFlight = 3;
+    init_info.NumFramesInFlight = config::framesInFlight;
     init_info.RenderTargetFormat = surfaceFormat;
     init_info.DepthStencilFormat = depthTextureFormat;
     ImGui_ImplWGPU_Init(&init_info);
@@ -306,31 +731,228 @@ void Application::UpdateGui(wgpu::RenderPassEncoder renderPass) {
     ImGui_ImplWGPU_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
-    
 
+    if (startupComplete) {
+        UpdateSceneGui();
+    }
+    else {
+        UpdateLoadingGui();
+    }
+
+    // Draw the UI
+    ImGui::EndFrame();
+    // Convert the UI to low-level drawing commands
+    ImGui::Render();
+    // Execute low-level drawing commands
+    ImGui_ImplWGPU_RenderDrawData(ImGui::GetDrawData(), renderPass);
+}
+
+void Application::UpdateLoadingGui() {
+    ImGui::Begin("Loading", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+    for (const StartupTimeline::Stage& stage : startupTimeline.stages()) {
+        if (stage.endMilliseconds < 0.0) {
+            ImGui::Text("%-14s ...", stage.name.c_str());
+        }
+        else {
+            ImGui::Text("%-14s %8.1f ms", stage.name.c_str(), stage.endMilliseconds - stage.startMilliseconds);
+        }
+    }
+    ImGui::End();
+}
+
+void Application::UpdateSceneGui() {
     bool changed = false;
     ImGui::Begin("Lighting");                      
     changed = ImGui::ColorEdit3("Color #0", glm::value_ptr(lightingUniforms.colors[0])) || changed;
     changed = ImGui::DragDirection("Direction #0", lightingUniforms.directions[0]) || changed;
     changed = ImGui::ColorEdit3("Color #1", glm::value_ptr(lightingUniforms.colors[1])) || changed;
     changed = ImGui::DragDirection("Direction #1", lightingUniforms.directions[1]) || changed;
-    
-    // Uncomment for framerate
-    //ImGuiIO& io = ImGui::GetIO();
-    //ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
 
+    // Each combination is a pipeline of its own, switched to once released
+    bool shadingChanged = false;
+    if (clusteredLightsAvailable) {
+        ImGui::SeparatorText("Local lights");
+        shadingChanged = ImGui::Checkbox("Clustered lights", &shading.localLights) || shadingChanged;
+        if (shading.localLights) {
+            ImGui::SliderInt("Light count", &localLightCount, 0, static_cast<int>(clusteredLights.capacity()), "%d", ImGuiSliderFlags_Logarithmic);
+            // Resume where they were paused
+            if (ImGui::Checkbox("Animate", &animateLights) && animateLights) {
+                lightsStart = std::chrono::steady_clock::now() - std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(lightsTime));
+            }
+            shadingChanged = ImGui::Checkbox("Lights per cluster", &shading.lightHeatmap) || shadingChanged;
+            const glm::uvec3& grid = clusteredLights.gridSize();
+            ImGui::Text("%u x %u x %u clusters, %u lights each at most", grid.x, grid.y, grid.z, ClusteredLights::maxLightsPerCluster);
+        }
+    }
+
+    ImGui::SeparatorText("Shading");
+    shadingChanged = ImGui::Checkbox("Specular", &shading.specular) || shadingChanged;
+    shadingChanged = ImGui::Checkbox("Gamma correction", &shading.gammaCorrection) || shadingChanged;
+    ImGui::SliderInt("Lights", &shading.lightCount, 0, 2);
+    shadingChanged = ImGui::IsItemDeactivatedAfterEdit() || shadingChanged;
+    ImGui::SliderFloat("Hardness", &shading.hardness, 1.0f, 128.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+    shadingChanged = ImGui::IsItemDeactivatedAfterEdit() || shadingChanged;
+    ImGui::SliderFloat("Diffuse", &shading.kd, 0.0f, 2.0f);
+    shadingChanged = ImGui::IsItemDeactivatedAfterEdit() || shadingChanged;
+    ImGui::SliderFloat("Specular strength", &shading.ks, 0.0f, 2.0f);
+    shadingChanged = ImGui::IsItemDeactivatedAfterEdit() || shadingChanged;
+    if (shadingChanged) RequestScenePipeline();
+    const PipelineCache::Stats& cacheStats = pipelineCache.stats();
+    ImGui::Text("%zu pipelines cached, %u hits, %u misses", pipelineCache.pipelineCount(), cacheStats.pipelineHits, cacheStats.pipelineMisses);
     ImGui::End();
     lightingUniformsChanged = changed;
+    if (changed) pathTracer.reset();
 
-    // Draw the UI
-    ImGui::EndFrame();
-    // Convert the UI to low-level drawing commands
-    ImGui::Render();
-    // Execute low-level drawing commands
-    ImGui_ImplWGPU_RenderDrawData(ImGui::GetDrawData(), renderPass);
+    ImGui::Begin("Rendering");
+    ImGuiIO& io = ImGui::GetIO();
+    ImGui::BeginDisabled(!pathTracerAvailable);
+    int mode = static_cast<int>(renderMode);
+    if (ImGui::Combo("Mode", &mode, "Raster\0Path tracer\0")) {
+        renderMode = static_cast<RenderMode>(mode);
+        pathTracer.reset();
+    }
+    ImGui::EndDisabled();
+    ImGui::Text("%.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
+    if (renderMode == RenderMode::PathTracer) {
+        if (ImGui::SliderInt("Bounces", &pathTracerBounces, 0, 16)) {
+            pathTracer.setMaxBounces(static_cast<uint32_t>(pathTracerBounces));
+        }
+        // One sample per pixel per frame
+        float samplesPerSecond = static_cast<float>(fbWidth) * static_cast<float>(fbHeight) * io.Framerate;
+        ImGui::Text("%u samples per pixel", pathTracer.sampleCount());
+        ImGui::Text("%.1f Msamples/s", samplesPerSecond * 1e-6f);
+    }
+    else {
+        if (ImGui::SliderInt("Instance grid", &instanceGridSize, 1, 317)) {
+            UpdateInstances();
+        }
+        uint32_t drawCount = pipelineGpuCulled ? gpuCuller.drawCount() : sceneInstances.drawCount();
+        ImGui::Text("%zu instances, %u draw calls", sceneInstances.objectCount(), drawCount);
+        bool instancing = sceneInstances.isInstancingEnabled();
+        if (ImGui::Checkbox("Instancing", &instancing)) {
+            sceneInstances.setInstancingEnabled(instancing);
+        }
+        ImGui::Checkbox("Render bundles", &renderBundles);
+        ImGui::Text("Scene encoding: %.3f ms", sceneEncodeMilliseconds);
+        if (renderBundles) {
+            const RenderBundleCache::Stats& bundled = sceneBundles.stats();
+            ImGui::Text("Bundles: %u recorded (last %.3f ms), %llu replays", bundled.recordCount, bundled.recordMilliseconds, static_cast<unsigned long long>(bundled.replayCount));
+        }
+
+        // Switching to or from the GPU waits for the matching pipeline
+        int culling = static_cast<int>(cullingMode);
+        const char* cullingModes = gpuCullingAvailable ? "Off\0CPU frustum\0GPU frustum + occlusion\0" : "Off\0CPU frustum\0";
+        if (ImGui::Combo("Culling", &culling, cullingModes)) {
+            cullingMode = static_cast<CullingMode>(culling);
+            sceneInstances.setCullingEnabled(cullingMode != CullingMode::Off);
+            RequestScenePipeline();
+        }
+
+        // The culling pass only knows the full mesh, picking a level of
+        // detail takes the CPU culling
+        if (ImGui::Checkbox("Levels of detail", &levelsOfDetail) && cullingMode == CullingMode::Gpu && gpuCullingAvailable) {
+            RequestScenePipeline();
+        }
+        if (cullingMode == CullingMode::Gpu && gpuCullingAvailable && levelsOfDetail) {
+            ImGui::TextDisabled("GPU culling has no levels of detail, culling on the CPU");
+        }
+        else if (cullingMode == CullingMode::Gpu && gpuCullingAvailable && !gpuCuller.fitsDeviceLimits()) {
+            ImGui::TextDisabled("Too many objects for GPU culling, culling on the CPU");
+        }
+
+        if (pipelineGpuCulled) {
+            bool occlusion = gpuCuller.isOcclusionEnabled();
+            if (ImGui::Checkbox("Occlusion culling", &occlusion)) {
+                gpuCuller.setOcclusionEnabled(occlusion);
+            }
+            const GpuCuller::Stats& culled = gpuCuller.stats();
+            ImGui::Text("Chunks: %u visible, %u outside, %u occluded", culled.visible, culled.frustumCulled, culled.occlusionCulled);
+            ImGui::Checkbox("Show Hi-Z", &showHiZ);
+            if (showHiZ) {
+                ImGui::SliderInt("Hi-Z level", &hiZLevel, 0, std::max(static_cast<int>(gpuCuller.hiZLevelCount()) - 1, 0));
+            }
+        }
+        else {
+            const SceneInstances::CullingStats& culled = sceneInstances.cullingStats();
+            ImGui::Text("Objects: %u visible, %u culled", culled.visibleObjects, culled.culledObjects);
+            ImGui::Text("Chunks: %u visible, %u culled", culled.visibleChunks, culled.culledChunks);
+            ImGui::Text("Culling: %.3f ms (%s)", culled.milliseconds, FrustumCuller::instructionSet());
+            if (levelsOfDetail) {
+                ImGui::SliderFloat("Pixel error", &lodPixelError, 0.25f, 16.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+                ImGui::Text("Objects per level:");
+                for (size_t level = 0; level < culled.lodObjects.size(); level++) {
+                    if (culled.lodObjects[level] == 0) continue;
+                    ImGui::SameLine();
+                    ImGui::Text("%zu: %u", level, culled.lodObjects[level]);
+                }
+            }
+            ImGui::Text("%.2f M triangles drawn", static_cast<double>(culled.triangles) * 1e-6);
+        }
+    }
+    ImGui::End();
+
+    ImGui::Begin("Performance");
+    const auto& frames = frameStats.frames();
+    FrameStats::Percentiles cpu = frameStats.cpuPercentiles();
+    ImGui::Text("CPU frame  p50 %.2f  p95 %.2f  p99 %.2f ms", cpu.p50, cpu.p95, cpu.p99);
+    FrameStats::Percentiles latency = frameStats.inputLatencyPercentiles();
+    ImGui::Text("Input to submit  p50 %.2f  p95 %.2f  p99 %.2f ms", latency.p50, latency.p95, latency.p99);
+    if (gpuTimer.isAvailable()) {
+        for (size_t pass = 0; pass < frameStats.gpuPassNames().size(); pass++) {
+            FrameStats::Percentiles gpu = frameStats.gpuPercentiles(pass);
+            ImGui::Text("GPU %-6s p50 %.2f  p95 %.2f  p99 %.2f ms", frameStats.gpuPassNames()[pass].c_str(), gpu.p50, gpu.p95, gpu.p99);
+        }
+    }
+    else {
+        ImGui::TextDisabled("GPU timestamps unavailable");
+    }
+    if (!frames.empty()) {
+        ImGui::PlotLines("CPU ms", [](void* data, int i) {
+            return static_cast<float>((*static_cast<const std::deque<FrameStats::Frame>*>(data))[static_cast<size_t>(i)].cpuMilliseconds);
+        }, const_cast<std::deque<FrameStats::Frame>*>(&frames), static_cast<int>(frames.size()), 0, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 60.0f));
+    }
+    ImGui::Text("%zu frames", frames.size());
+    if (ImGui::Button("Export CSV")) {
+        if (frameStats.writeCsv(config::frameStatsCsvFile)) {
+            std::cout << "Wrote frame times to " << config::frameStatsCsvFile << std::endl;
+        }
+        else {
+            std::cerr << "Could not write frame times to " << config::frameStatsCsvFile << std::endl;
+        }
+    }
+
+    // Taken into account from the next frame on
+    ImGui::SeparatorText("Presentation");
+    if (ImGui::BeginCombo("Present mode", presentModeName(presentMode))) {
+        for (wgpu::PresentMode mode : presentModes) {
+            if (ImGui::Selectable(presentModeName(mode), mode == presentMode) && mode != presentMode) {
+                presentMode = mode;
+                presentModePending = true;
+            }
+        }
+        ImGui::EndCombo();
+    }
+    int frameRateLimit = static_cast<int>(framePacer.frameRateLimit());
+    if (ImGui::SliderInt("Frame limit", &frameRateLimit, 0, 480, frameRateLimit > 0 ? "%d FPS" : "Off")) {
+        framePacer.setFrameRateLimit(static_cast<double>(frameRateLimit));
+    }
+    bool justInTime = framePacer.isJustInTime();
+    if (ImGui::Checkbox("Just-in-time input", &justInTime)) {
+        framePacer.setJustInTime(justInTime);
+    }
+    if (framePacer.frameRateLimit() > 0.0) {
+        ImGui::Text("Waited %.2f ms, spinning the last %.2f ms", framePacer.waitMilliseconds(), framePacer.spinMarginMilliseconds());
+        if (justInTime) {
+            ImGui::Text("Input read %.2f ms ahead of submission", framePacer.workEstimateMilliseconds());
+        }
+    }
+    ImGui::Checkbox("Render on demand", &renderOnDemand);
+    ImGui::Text("%u frames rendered, %llu skipped", frameIndex, static_cast<unsigned long long>(skippedFrames));
+    ImGui::End();
 }
 
 void Application::MouseMove(double xpos, double ypos) {
+    RecordInput();
     if (dragState.active) {
         // Base move
         glm::vec2 currentMouse = glm::vec2(-(float)xpos, (float)ypos);
@@ -347,6 +969,8 @@ void Application::MouseMove(double xpos, double ypos) {
 };
 
 void Application::MouseButton(int button, int action, [[maybe_unused]] int mods) {
+    RecordInput();
+
     // Return if mouse is interacting with the GUI
     ImGuiIO& io = ImGui::GetIO();
     if (io.WantCaptureMouse) return;
@@ -368,17 +992,17 @@ void Application::MouseButton(int button, int action, [[maybe_unused]] int mods)
 };
 
 void Application::MouseScroll([[maybe_unused]] double xoffset, double yoffset) {
+    RecordInput();
     cameraState.zoom += dragState.scrollSensitivity * static_cast<float>(yoffset);
     cameraState.zoom = glm::clamp(cameraState.zoom, -2.0f, 2.0f);
     UpdateViewMatrix();
 };
 
 void Application::UpdateDragInertia() {
-    constexpr float eps = 1e-4f;
     // Apply inertia only when the user released the click
     if (!dragState.active) {
         // Avoid updating the matrix when the velocity is no longer noticeable
-        if (std::abs(dragState.velocity.x) < eps && std::abs(dragState.velocity.y) < eps) {
+        if (!dragState.coasting()) {
             return;
         }
         cameraState.angles += dragState.velocity;
@@ -390,6 +1014,32 @@ void Application::UpdateDragInertia() {
     }
 };
 
+void Application::ProcessInput() {
+    glfwPollEvents();
+    UpdateDragInertia();
+}
+
+void Application::RecordInput() {
+    if (!inputTime) inputTime = std::chrono::steady_clock::now();
+    pendingFrames = std::max(pendingFrames, settleFrames);
+}
+
+bool Application::IsFrameNeeded() const {
+    // Loading, or accumulating samples
+    if (!startupComplete || renderMode == RenderMode::PathTracer) return true;
+
+    // Moving on its own. The default scene does not: once the frames asked
+    // for by startup and the events are drawn, an untouched window only
+    // waits, which the skipped frames of the panel count.
+    bool lightsMoving = animateLights && shading.localLights && clusteredLightsAvailable && localLightCount > 0;
+    if (dragState.coasting() || lightsMoving) return true;
+
+    // Changed by the events, or waiting for a pipeline picked up by the
+    // device polls of the frames
+    return pendingFrames > 0 || myUniformsChanged || lightingUniformsChanged
+        || resizePending || presentModePending || scenePipelinePending;
+}
+
 wgpu::Instance Application::CreateInstance() {
     wgpu::InstanceDescriptor desc = {};
     return wgpu::createInstance(desc);
@@ -401,6 +1051,7 @@ wgpu::Adapter Application::RequestAdapter(wgpu::Instance instance) {
 #endif
 
     wgpu::RequestAdapterOptions adapterOpts = wgpu::Default;
+    adapterOpts.forceFallbackAdapter = options.forceFallbackAdapter;
     wgpu::Adapter adapter = instance.requestAdapter(adapterOpts);
 
 #ifdef PRINT_EXTRA_INFO
@@ -424,12 +1075,27 @@ void Application::ConfigureSurface(wgpu::Instance instance, wgpu::Adapter adapte
     // Get preferred format from capabilities
     surfaceFormat = surfaceCapabilities.formats[0];
 
+    // Fifo is always there, the others are offered as supported
+    presentModes.clear();
+    for (size_t i = 0; i < surfaceCapabilities.presentModeCount; i++) {
+        presentModes.push_back(static_cast<wgpu::PresentMode>(surfaceCapabilities.presentModes[i]));
+    }
+    wgpuSurfaceCapabilitiesFreeMembers(surfaceCapabilities);
+
 #ifdef PRINT_EXTRA_INFO
     std::cout << "Surface format: " << magic_enum::enum_name<WGPUTextureFormat>(surfaceFormat) << std::endl;
     std::cout << std::endl;
 #endif
 
     // Configure surface
+    ReconfigureSurface();
+};
+
+void Application::ReconfigureSurface() {
+    if (std::find(presentModes.begin(), presentModes.end(), presentMode) == presentModes.end()) {
+        presentMode = wgpu::PresentMode::Fifo;
+    }
+
     wgpu::SurfaceConfiguration config = {};
     config.nextInChain = nullptr;
     config.width = static_cast<uint32_t>(fbWidth);
@@ -439,10 +1105,11 @@ void Application::ConfigureSurface(wgpu::Instance instance, wgpu::Adapter adapte
     config.viewFormats = nullptr;
     config.usage = wgpu::TextureUsage::RenderAttachment;
     config.device = device;
-    config.presentMode = wgpu::PresentMode::Fifo;
+    config.presentMode = presentMode;
     config.alphaMode = wgpu::CompositeAlphaMode::Auto;
     surface.configure(config);
-};
+    presentModePending = false;
+}
 
 void Application::RequestDevice(wgpu::Adapter adapter) {
 #ifdef PRINT_EXTRA_INFO
@@ -452,11 +1119,23 @@ void Application::RequestDevice(wgpu::Adapter adapter) {
     // Get required limits
     auto requiredLimits = GetRequiredLimits(adapter);
 
+    // Time the render passes when the adapter can
+    std::vector<wgpu::FeatureName> requiredFeatures;
+    if (adapter.hasFeature(wgpu::FeatureName::TimestampQuery)) {
+        requiredFeatures.push_back(wgpu::FeatureName::TimestampQuery);
+    }
+
+    // Sample block compressed textures when the adapter can
+    if (config::compressTextures && adapter.hasFeature(wgpu::FeatureName::TextureCompressionBC)) {
+        requiredFeatures.push_back(wgpu::FeatureName::TextureCompressionBC);
+    }
+
     // Request device
     wgpu::DeviceDescriptor deviceDesc = {};
     deviceDesc.nextInChain = nullptr;
     deviceDesc.label = "My Device"_wgpu;
-    deviceDesc.requiredFeatureCount = 0;
+    deviceDesc.requiredFeatureCount = requiredFeatures.size();
+    deviceDesc.requiredFeatures = (WGPUFeatureName*)requiredFeatures.data();
     deviceDesc.requiredLimits = &requiredLimits;
     deviceDesc.defaultQueue.nextInChain = nullptr;
     deviceDesc.defaultQueue.label = "The default queue"_wgpu;
@@ -464,6 +1143,22 @@ void Application::RequestDevice(wgpu::Adapter adapter) {
     deviceDesc.deviceLostCallbackInfo.callback = onDeviceLost;
     deviceDesc.uncapturedErrorCallbackInfo.nextInChain = nullptr;
     deviceDesc.uncapturedErrorCallbackInfo.callback = onDeviceError;
+
+#if defined(WEBGPU_BACKEND_DAWN)
+    // Keep Dawn's compiled shaders and pipelines across launches
+    wgpu::DawnCacheDeviceDescriptor cacheDesc;
+    cacheDesc.chain.next = nullptr;
+    cacheDesc.chain.sType = wgpu::SType::DawnCacheDeviceDescriptor;
+    cacheDesc.isolationKey = "WGPURaytracer"_wgpu;
+    cacheDesc.loadDataFunction = [](const void* key, size_t keySize, void* value, size_t valueSize, void* userdata) {
+        return static_cast<PipelineBlobStore*>(userdata)->load(key, keySize, value, valueSize);
+    };
+    cacheDesc.storeDataFunction = [](const void* key, size_t keySize, const void* value, size_t valueSize, void* userdata) {
+        static_cast<PipelineBlobStore*>(userdata)->store(key, keySize, value, valueSize);
+    };
+    cacheDesc.functionUserdata = &pipelineBlobStore;
+    deviceDesc.nextInChain = &cacheDesc.chain;
+#endif
     device = adapter.requestDevice(deviceDesc);
 
 #ifdef PRINT_EXTRA_INFO
@@ -474,53 +1169,181 @@ void Application::RequestDevice(wgpu::Adapter adapter) {
 #endif
 }
 
-void Application::InitializeBuffers() {
+bool Application::LoadMeshAssets(StartupAssets& assets) {
     // Load geometry data
-    std::vector<VertexAttributes> vertexData;
-    if (!ResourceManager::loadGeometryFromObj(config::shapeModelFile, vertexData)) {
-        std::cerr << "Could not load geometry file at: " << config::shapeModelFile << std::endl;
-        exit(1);
+    MeshOptimizerOptions optimizerOptions;
+    optimizerOptions.reduceOverdraw = config::reduceMeshOverdraw;
+    optimizerOptions.chunkTriangleCount = config::meshChunkTriangleCount;
+    optimizerOptions.lodCount = config::meshLodCount;
+    optimizerOptions.lodTriangleRatio = config::meshLodTriangleRatio;
+    if (!ResourceManager::loadMesh(config::shapeModelFile, assets.mesh, assets.meshCacheFile, assets.meshData, optimizerOptions)) {
+        return false;
+    }
+
+    // Quantize vertices for the compact layout
+    if (config::packedVertices) {
+        const MeshView& meshData = assets.meshData;
+        PositionEncoding encoding = config::packedPositionsFloat16 ? PositionEncoding::Float16 : PositionEncoding::Unorm16;
+        assets.quantization = VertexPacker::quantization(meshData.bounds, encoding);
+        VertexPacker::pack(meshData.vertices, assets.quantization, encoding, assets.packedVertices);
     }
+    return true;
+}
+
+void Application::InitializeBuffers() {
+    // Geometry loaded by the startup task
+    const MeshView& meshData = startupAssets->meshData;
+    const std::vector<PackedVertex>& packedVertices = startupAssets->packedVertices;
+    const VertexQuantization& quantization = startupAssets->quantization;
+    uniforms.positionScale = glm::vec4(quantization.scale, 0.0f);
+    uniforms.positionOffset = glm::vec4(quantization.offset, 0.0f);
 
     // Create vertex buffer
+    const void* vertexData = config::packedVertices
+        ? static_cast<const void*>(packedVertices.data())
+        : static_cast<const void*>(meshData.vertices.data());
     wgpu::BufferDescriptor bufferDesc;
-    bufferDesc.size = vertexData.size() * sizeof(VertexAttributes);
+    bufferDesc.size = config::packedVertices
+        ? packedVertices.size() * sizeof(PackedVertex)
+        : meshData.vertices.size_bytes();
     bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Vertex;
     bufferDesc.mappedAtCreation = false;
     vertexBuffer = device.createBuffer(bufferDesc);
 
-    vertexCount = static_cast<uint32_t>(vertexData.size());
-    queue.writeBuffer(vertexBuffer, 0, vertexData.data(), bufferDesc.size);
+    vertexCount = static_cast<uint32_t>(meshData.vertices.size());
+    queue.writeBuffer(vertexBuffer, 0, vertexData, bufferDesc.size);
 
-    // Create uniform buffer
-    bufferDesc.size = sizeof(MyUniforms); 
-    bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Uniform;
+    // Create index buffer
+    bufferDesc.size = meshData.indices.size_bytes();
+    bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Index;
     bufferDesc.mappedAtCreation = false;
-    uniformBuffer = device.createBuffer(bufferDesc);
+    indexBuffer = device.createBuffer(bufferDesc);
+
+    indexCount = static_cast<uint32_t>(meshData.indices.size());
+    queue.writeBuffer(indexBuffer, 0, meshData.indices.data(), bufferDesc.size);
+
+    // Place the mesh in the scene
+    sceneInstances.initialize(device);
+    // The levels of detail follow the full mesh in the index buffer
+    uint32_t baseIndexCount = static_cast<uint32_t>(meshData.baseIndices().size());
+    sceneMesh = sceneInstances.addMesh({ 0, baseIndexCount, 0 }, meshData.bounds, meshData.chunks, meshData.lods);
+    meshBounds = meshData.bounds;
+    instanceGridSize = config::instanceGridSize;
+    levelsOfDetail = config::levelsOfDetail;
+    lodPixelError = config::lodPixelError;
+    UpdateInstances();
+    sceneInstances.upload(queue);
+
+    // The GPU culler follows the same objects, its visible lists are bound
+    // by InitializeBindGroups() whichever culls
+    gpuCullingAvailable = gpuCuller.initialize(device, config::gpuCullingShaderFile, surfaceFormat, depthTextureFormat, uploadRing.buffer(), config::framesInFlight);
+    if (gpuCullingAvailable) {
+        gpuCuller.resize(depthTexture, static_cast<uint32_t>(fbWidth), static_cast<uint32_t>(fbHeight));
+        gpuCuller.update(sceneInstances);
+    }
+    else {
+        std::cerr << "Could not initialize GPU culling, culling on the CPU" << std::endl;
+    }
+    cullingMode = !config::frustumCulling ? CullingMode::Off
+        : config::gpuCulling && gpuCullingAvailable ? CullingMode::Gpu
+        : CullingMode::Cpu;
+    sceneInstances.setCullingEnabled(cullingMode != CullingMode::Off);
+
+    // Local lights over the instance grid, shaded by the CLUSTERED_LIGHTS
+    // permutation once their lists are in place
+    clusteredLightsAvailable = config::clusteredLights && clusteredLights.initialize(
+        device, config::lightClusteringShaderFile, config::maxLocalLightCount,
+        glm::uvec3(config::lightClusterGrid[0], config::lightClusterGrid[1], config::lightClusterGrid[2]),
+        uploadRing.buffer()
+    );
+    if (config::clusteredLights && !clusteredLightsAvailable) {
+        std::cerr << "Could not initialize clustered lights, shading without local lights" << std::endl;
+    }
+    InitializeLocalLights();
+
+    // A pipeline requested before now could not read the visible lists or
+    // the light clusters
+    if (pipelineLayout && (IsGpuCullingActive() || (clusteredLightsAvailable && shading.localLights))) {
+        RequestScenePipeline();
+    }
+
+    // The path tracer keeps its own copy of the mesh, as a BVH
+    pathTracerAvailable = pathTracer.initialize(device, config::pathTracerShaderFile, surfaceFormat, depthTextureFormat)
+        && pathTracer.uploadScene(meshData);
+    if (!pathTracerAvailable) {
+        std::cerr << "Could not initialize the path tracer" << std::endl;
+    }
+    pathTracerBounces = config::pathTracerMaxBounces;
+    pathTracer.setMaxBounces(static_cast<uint32_t>(pathTracerBounces));
+}
+
+void Application::InitializeUniforms() {
+    // Uniforms and local lights are written every frame into the upload
+    // ring, which has a region per frame in flight
+    uint64_t frameSize = config::uploadRingFrameSize;
+    if (config::clusteredLights) {
+        frameSize += ClusteredLights::lightBindingSize(config::maxLocalLightCount);
+    }
+    if (!uploadRing.initialize(device, config::framesInFlight, frameSize)) {
+        std::cerr << "Could not create the upload ring" << std::endl;
+        exit(1);
+    }
 
     UpdateModelMatrix(0.0f);
     UpdateViewMatrix();
     UpdateProjectionMatrix();
-    UpdateMyUniforms();
 
-    // Create lighting uniform buffer
+    // The path tracer reads the lights from a buffer of their own, filled
+    // from the ring
+    wgpu::BufferDescriptor bufferDesc;
     bufferDesc.size = sizeof(LightingUniforms);
     bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Uniform;
     bufferDesc.mappedAtCreation = false;
     lightingUniformBuffer = device.createBuffer(bufferDesc);
 
     // Initial values
-    lightingUniforms.directions[0] = { 0.5f, -0.9f, 0.1f, 0.0f };
-    lightingUniforms.directions[1] = { 0.2f, 0.4f, 0.3f, 0.0f };
-    lightingUniforms.colors[0] = { 1.0f, 0.9f, 0.6f, 1.0f };
-    lightingUniforms.colors[1] = { 0.6f, 0.9f, 1.0f, 1.0f };
+    lightingUniforms = Scene::defaultLights();
     lightingUniformsChanged = true;
-    UpdateLighting();
 }
 
 void Application::InitializeTextures() {
-    // Load texture  
-    if (!(texture = ResourceManager::loadTexture(config::textureFile, device, &textureView))) {
+    StartupAssets& assets = *startupAssets;
+
+    // Upload the compressed chain as is when the device can sample it
+    if (!assets.compressedTexture.levels.empty() && device.hasFeature(wgpu::FeatureName::TextureCompressionBC)) {
+        texture = ResourceManager::createCompressedTexture(assets.compressedTexture, device, &textureView);
+#ifdef PRINT_EXTRA_INFO
+        size_t uncompressedSize = 0;
+        for (const CompressedLevel& level : assets.compressedTexture.levels) {
+            uncompressedSize += 4 * static_cast<size_t>(level.width) * level.height;
+        }
+        std::cout << "Texture uses " << assets.compressedTexture.totalSize() << " bytes block compressed ("
+                  << (assets.compressedTexture.format == BlockFormat::BC1 ? "BC1" : "BC7") << ") instead of "
+                  << uncompressedSize << std::endl;
+#endif
+    }
+    else {
+        // Prepare the compute mipmap path
+        MipMapGenerator* generator = nullptr;
+        if (config::generateMipMapsOnGpu) {
+            if (mipMapGenerator.initialize(device, config::mipMapShaderFile)) {
+                generator = &mipMapGenerator;
+            }
+            else {
+                std::cerr << "Could not initialize GPU mipmap generation, falling back to CPU" << std::endl;
+            }
+        }
+
+        // The startup task skipped the RGBA8 decode for a compressed chain
+        // this device cannot use, decode here
+        if (!assets.texture.pixels) {
+            ResourceManager::decodeTexture(config::textureFile, assets.texture, generator == nullptr);
+        }
+
+        // Upload the texture decoded by the startup task
+        texture = ResourceManager::createTexture(assets.texture, device, &textureView, MipFilter::Box, generator);
+    }
+    if (!texture) {
         std::cerr << "Could not load texture at: " << config::textureFile << std::endl;
         exit(1);
     }
@@ -549,23 +1372,44 @@ void Application::InitializeDepthTexture() {
     textureDesc.sampleCount = 1;
     textureDesc.dimension = wgpu::TextureDimension::_2D;
     textureDesc.size = { static_cast<uint32_t>(fbWidth), static_cast<uint32_t>(fbHeight), 1 };
-    textureDesc.usage = wgpu::TextureUsage::RenderAttachment;
+    // GPU culling reads it back into the Hi-Z pyramid
+    textureDesc.usage = wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::TextureBinding;
     textureDesc.viewFormatCount = 1;
     textureDesc.viewFormats = (WGPUTextureFormat*)&depthTextureFormat;
     depthTexture = device.createTexture(textureDesc);
 }
 
-void Application::InitializePipline() {
-    // Load the shader module
-    auto shaderModule = ResourceManager::loadShaderModule(config::shaderSrcFile, device);
+bool Application::InitializeOffscreenTarget() {
+    // Stands in for the surface, with a format the readback understands
+    surfaceFormat = wgpu::TextureFormat::RGBA8UnormSrgb;
+
+    wgpu::TextureDescriptor textureDesc;
+    textureDesc.label = "Offscreen color target"_wgpu;
+    textureDesc.format = surfaceFormat;
+    textureDesc.mipLevelCount = 1;
+    textureDesc.sampleCount = 1;
+    textureDesc.dimension = wgpu::TextureDimension::_2D;
+    textureDesc.size = { static_cast<uint32_t>(fbWidth), static_cast<uint32_t>(fbHeight), 1 };
+    textureDesc.usage = wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::CopySrc;
+    textureDesc.viewFormatCount = 0;
+    textureDesc.viewFormats = nullptr;
+    offscreenTexture = device.createTexture(textureDesc);
+
+    return frameReadback.initialize(
+        device, textureDesc.size.width, textureDesc.size.height, surfaceFormat,
+        options.readbackRingSize, options.outputDirectory
+    );
+}
 
+void Application::InitializePipline() {
     // Create a bind group layouts
-    std::vector<wgpu::BindGroupLayoutEntry> bindingLayouts(4);
+    std::vector<wgpu::BindGroupLayoutEntry> bindingLayouts(9);
     // === Uniform buffer binding
     wgpu::BindGroupLayoutEntry& uniformBindingLayout = bindingLayouts[0];
     uniformBindingLayout.binding = 0; // the @binding index used in the shader
     uniformBindingLayout.visibility = wgpu::ShaderStage::Vertex | wgpu::ShaderStage::Fragment;
     uniformBindingLayout.buffer.type = wgpu::BufferBindingType::Uniform;
+    uniformBindingLayout.buffer.hasDynamicOffset = true;
     uniformBindingLayout.buffer.minBindingSize = sizeof(MyUniforms);
 
     // === Texture binding
@@ -586,8 +1430,46 @@ void Application::InitializePipline() {
     lightingUniformBindingLayout.binding = 3; // the @binding index used in the shader
     lightingUniformBindingLayout.visibility = wgpu::ShaderStage::Fragment;
     lightingUniformBindingLayout.buffer.type = wgpu::BufferBindingType::Uniform;
+    lightingUniformBindingLayout.buffer.hasDynamicOffset = true;
     lightingUniformBindingLayout.buffer.minBindingSize = sizeof(LightingUniforms);
 
+    // === Instance transforms binding
+    wgpu::BindGroupLayoutEntry& instanceBindingLayout = bindingLayouts[4];
+    instanceBindingLayout.binding = 4;
+    instanceBindingLayout.visibility = wgpu::ShaderStage::Vertex;
+    instanceBindingLayout.buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
+    instanceBindingLayout.buffer.minBindingSize = sizeof(glm::mat4x4);
+
+    // === Visible instances binding, one list per chunk drawn with GPU culling
+    wgpu::BindGroupLayoutEntry& visibleBindingLayout = bindingLayouts[5];
+    visibleBindingLayout.binding = 5;
+    visibleBindingLayout.visibility = wgpu::ShaderStage::Vertex;
+    visibleBindingLayout.buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
+    visibleBindingLayout.buffer.hasDynamicOffset = true;
+    visibleBindingLayout.buffer.minBindingSize = sizeof(uint32_t);
+
+    // === Local lights, the light list of each cluster and the clusters'
+    // uniforms, read by the CLUSTERED_LIGHTS permutation
+    wgpu::BindGroupLayoutEntry& localLightBindingLayout = bindingLayouts[6];
+    localLightBindingLayout.binding = 6;
+    localLightBindingLayout.visibility = wgpu::ShaderStage::Fragment;
+    localLightBindingLayout.buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
+    localLightBindingLayout.buffer.hasDynamicOffset = true;
+    localLightBindingLayout.buffer.minBindingSize = sizeof(LocalLight);
+
+    wgpu::BindGroupLayoutEntry& clusterBindingLayout = bindingLayouts[7];
+    clusterBindingLayout.binding = 7;
+    clusterBindingLayout.visibility = wgpu::ShaderStage::Fragment;
+    clusterBindingLayout.buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
+    clusterBindingLayout.buffer.minBindingSize = sizeof(uint32_t);
+
+    wgpu::BindGroupLayoutEntry& clusterUniformBindingLayout = bindingLayouts[8];
+    clusterUniformBindingLayout.binding = 8;
+    clusterUniformBindingLayout.visibility = wgpu::ShaderStage::Fragment;
+    clusterUniformBindingLayout.buffer.type = wgpu::BufferBindingType::Uniform;
+    clusterUniformBindingLayout.buffer.hasDynamicOffset = true;
+    clusterUniformBindingLayout.buffer.minBindingSize = ClusteredLights::uniformBindingSize();
+
     wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc{};
     bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayouts.size();
     bindGroupLayoutDesc.entries = bindingLayouts.data();
@@ -600,6 +1482,21 @@ void Application::InitializePipline() {
     pipelineLayoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
     pipelineLayout = device.createPipelineLayout(pipelineLayoutDesc);
 
+    // Permutations of the shader are compiled from this source later on
+    sceneShaderSource = std::move(startupAssets->shaderSource);
+    RequestScenePipeline();
+}
+
+void Application::RequestScenePipeline() {
+    // Modules and pipelines of permutations seen before come from the cache
+    ShaderPermutation permutation = ShadingPermutation();
+    wgpu::ShaderModule shaderModule = pipelineCache.shaderModule(sceneShaderSource, permutation);
+    if (!shaderModule) {
+        std::cerr << "Could not compile the shader permutation" << std::endl;
+        if (!pipeline) exit(1);
+        return;
+    }
+
     // Create vertex buffer layout
     wgpu::VertexBufferLayout vertexBufferLayout;
 
@@ -624,9 +1521,21 @@ void Application::InitializePipline() {
     vertexAttribs[3].format = wgpu::VertexFormat::Float32x2;
     vertexAttribs[3].offset = offsetof(VertexAttributes, uv);
 
+    // === Packed layout, decoded by vs_main_packed
+    if (config::packedVertices) {
+        vertexAttribs[0].format = config::packedPositionsFloat16 ? wgpu::VertexFormat::Float16x4 : wgpu::VertexFormat::Unorm16x4;
+        vertexAttribs[0].offset = offsetof(PackedVertex, position);
+        vertexAttribs[1].format = wgpu::VertexFormat::Snorm16x2;
+        vertexAttribs[1].offset = offsetof(PackedVertex, normal);
+        vertexAttribs[2].format = wgpu::VertexFormat::Unorm8x4;
+        vertexAttribs[2].offset = offsetof(PackedVertex, color);
+        vertexAttribs[3].format = wgpu::VertexFormat::Float16x2;
+        vertexAttribs[3].offset = offsetof(PackedVertex, uv);
+    }
+
     vertexBufferLayout.attributeCount = static_cast<uint32_t>(vertexAttribs.size());
     vertexBufferLayout.attributes = vertexAttribs.data();
-    vertexBufferLayout.arrayStride = sizeof(VertexAttributes);
+    vertexBufferLayout.arrayStride = config::packedVertices ? sizeof(PackedVertex) : sizeof(VertexAttributes);
     vertexBufferLayout.stepMode = wgpu::VertexStepMode::Vertex;
 
     // Describe the pipeline
@@ -637,7 +1546,7 @@ void Application::InitializePipline() {
     pipelineDesc.vertex.bufferCount = 1;
     pipelineDesc.vertex.buffers = &vertexBufferLayout;
     pipelineDesc.vertex.module = shaderModule;
-    pipelineDesc.vertex.entryPoint = "vs_main"_wgpu;
+    pipelineDesc.vertex.entryPoint = config::packedVertices ? "vs_main_packed"_wgpu : "vs_main"_wgpu;
     pipelineDesc.vertex.constantCount = 0;
     pipelineDesc.vertex.constants = nullptr;
 
@@ -680,16 +1589,62 @@ void Application::InitializePipline() {
     pipelineDesc.multisample.mask = ~0u;
     pipelineDesc.multisample.alphaToCoverageEnabled = false;
 
-    pipeline = device.createRenderPipeline(pipelineDesc);
+    // Everything in the descriptor that the permutation does not cover
+    uint32_t state[4] = {
+        static_cast<uint32_t>(surfaceFormat), static_cast<uint32_t>(depthTextureFormat),
+        config::packedVertices, config::packedPositionsFloat16
+    };
+
+    // Compiled in the background where the backend can, the app keeps
+    // showing the loading screen, or the previous permutation, meanwhile.
+    // Only the latest request switches the pipeline, should an older one
+    // finish compiling after it, and the way objects are culled with it.
+    uint32_t request = ++scenePipelineRequest;
+    scenePipelinePending = true;
+    bool gpuCulled = permutation.isDefined("GPU_CULLING");
+    pipelineCache.renderPipeline(pipelineDesc, permutation, hashBytes(state, sizeof(state)), [this, request, gpuCulled](wgpu::RenderPipeline result) {
+        if (request != scenePipelineRequest) return;
+        scenePipelinePending = false;
+        pendingFrames = std::max(pendingFrames, settleFrames);
+        if (!result) {
+            // Only fatal without a pipeline to fall back on
+            if (!pipeline) exit(1);
+            return;
+        }
+        bool first = !pipeline;
+        pipeline = result;
+        sceneBundles.invalidate();
+        pipelineGpuCulled = gpuCulled;
+        if (first) startupTimeline.end(pipelineStage);
+    });
+}
+
+bool Application::IsGpuCullingActive() const {
+    return cullingMode == CullingMode::Gpu && gpuCullingAvailable && gpuCuller.fitsDeviceLimits() && !levelsOfDetail;
+}
 
-    shaderModule.release();
+ShaderPermutation Application::ShadingPermutation() const {
+    ShaderPermutation permutation;
+    if (shading.specular) permutation.define("SPECULAR");
+    if (shading.gammaCorrection) permutation.define("GAMMA_CORRECTION");
+    // Not shading strictly, but the scene pipeline is specialized for it too
+    if (IsGpuCullingActive()) permutation.define("GPU_CULLING");
+    if (shading.localLights && clusteredLightsAvailable) {
+        permutation.define("CLUSTERED_LIGHTS");
+        if (shading.lightHeatmap) permutation.define("LIGHT_HEATMAP");
+    }
+    permutation.set("lightCount", shading.lightCount);
+    permutation.set("hardness", shading.hardness);
+    permutation.set("kd", shading.kd);
+    permutation.set("ks", shading.ks);
+    return permutation;
 }
 
 void Application::InitializeBindGroups() {
-    std::vector<wgpu::BindGroupEntry> bindings(4);
+    std::vector<wgpu::BindGroupEntry> bindings(9);
 
     bindings[0].binding = 0; // the @binding index used in the shader
-    bindings[0].buffer = uniformBuffer;
+    bindings[0].buffer = uploadRing.buffer();
     bindings[0].offset = 0;
     bindings[0].size = sizeof(MyUniforms);
 
@@ -700,16 +1655,66 @@ void Application::InitializeBindGroups() {
     bindings[2].sampler = sampler;
 
     bindings[3].binding = 3;
-    bindings[3].buffer = lightingUniformBuffer;
+    bindings[3].buffer = uploadRing.buffer();
     bindings[3].offset = 0;
     bindings[3].size = sizeof(LightingUniforms);
 
+    bindings[4].binding = 4;
+    bindings[4].buffer = sceneInstances.buffer();
+    bindings[4].offset = 0;
+    bindings[4].size = sceneInstances.bindingSize();
+
+    // Only the GPU_CULLING permutation reads it, without the culler any
+    // storage buffer fills the slot
+    bindings[5].binding = 5;
+    bindings[5].buffer = gpuCullingAvailable ? gpuCuller.visibleInstanceBuffer() : sceneInstances.buffer();
+    bindings[5].offset = 0;
+    bindings[5].size = gpuCullingAvailable ? gpuCuller.visibleBindingSize() : sceneInstances.bindingSize();
+
+    // Only the CLUSTERED_LIGHTS permutation reads them, lights and uniforms
+    // come from the ring, the instance buffer stands in for the lights and
+    // the cluster lists without clustered lights
+    bindings[6].binding = 6;
+    bindings[6].buffer = clusteredLightsAvailable ? uploadRing.buffer() : sceneInstances.buffer();
+    bindings[6].offset = 0;
+    bindings[6].size = clusteredLightsAvailable ? clusteredLights.lightBindingSize() : sceneInstances.bindingSize();
+
+    bindings[7].binding = 7;
+    bindings[7].buffer = clusteredLightsAvailable ? clusteredLights.clusterBuffer() : sceneInstances.buffer();
+    bindings[7].offset = 0;
+    bindings[7].size = clusteredLightsAvailable ? clusteredLights.clusterBindingSize() : sceneInstances.bindingSize();
+
+    bindings[8].binding = 8;
+    bindings[8].buffer = uploadRing.buffer();
+    bindings[8].offset = 0;
+    bindings[8].size = ClusteredLights::uniformBindingSize();
+
     wgpu::BindGroupDescriptor bindGroupDesc;
     bindGroupDesc.label = "My bind group"_wgpu;
     bindGroupDesc.layout = bindGroupLayout;
     bindGroupDesc.entryCount = (uint32_t)bindings.size();
     bindGroupDesc.entries = bindings.data();
     bindGroup = device.createBindGroup(bindGroupDesc);
+    sceneBundles.invalidate();
+
+    // The path tracer shades with the same texture and lights
+    pathTracer.setShading(textureView, sampler, lightingUniformBuffer);
+    pathTracer.resize(static_cast<uint32_t>(fbWidth), static_cast<uint32_t>(fbHeight));
+}
+
+template <typename Encoder>
+void Application::EncodeScene(Encoder encoder, std::span<const uint32_t> dynamicOffsets, bool gpuCulled) {
+    encoder.setPipeline(pipeline);
+    encoder.setVertexBuffer(0, vertexBuffer, 0, vertexCount*sizeof(VertexAttributes));
+    encoder.setIndexBuffer(indexBuffer, wgpu::IndexFormat::Uint32, 0, indexCount*sizeof(uint32_t));
+    encoder.setBindGroup(0, bindGroup, dynamicOffsets.size(), dynamicOffsets.data());
+
+    if (gpuCulled) {
+        gpuCuller.draw(encoder, bindGroup, dynamicOffsets, 2);
+    }
+    else {
+        sceneInstances.draw(encoder);
+    }
 }
 
 wgpu::Limits Application::GetRequiredLimits(wgpu::Adapter adapter) {
@@ -723,7 +1728,10 @@ wgpu::Limits Application::GetRequiredLimits(wgpu::Adapter adapter) {
     requiredLimits.maxVertexAttributes = 4;
     requiredLimits.maxVertexBuffers = 1;
 
-    requiredLimits.maxBufferSize = 1000000 * sizeof(VertexAttributes);
+    // The path tracer's BVH and accumulation buffers grow with the mesh and
+    // the framebuffer
+    requiredLimits.maxBufferSize = supportedLimits.maxBufferSize;
+    requiredLimits.maxStorageBufferBindingSize = supportedLimits.maxStorageBufferBindingSize;
     requiredLimits.maxVertexBufferArrayStride = sizeof(VertexAttributes);
 
     requiredLimits.maxInterStageShaderVariables = 11;
@@ -732,7 +1740,8 @@ wgpu::Limits Application::GetRequiredLimits(wgpu::Adapter adapter) {
     requiredLimits.maxBindingsPerBindGroup = supportedLimits.maxBindingsPerBindGroup;
     requiredLimits.maxDynamicUniformBuffersPerPipelineLayout = supportedLimits.maxDynamicUniformBuffersPerPipelineLayout;
 
-    requiredLimits.maxUniformBuffersPerShaderStage = 2;
+    // The fragment stage reads the frame, lighting and cluster uniforms
+    requiredLimits.maxUniformBuffersPerShaderStage = 3;
     requiredLimits.maxUniformBufferBindingSize = 16 * 4 * sizeof(float);
 
     requiredLimits.maxTextureDimension1D = supportedLimits.maxTextureDimension1D;
@@ -779,6 +1788,19 @@ wgpu::TextureView Application::GetNextSurfaceTextureView() {
     return targetView;
 }
 
+wgpu::TextureView Application::GetOffscreenTextureView() {
+    wgpu::TextureViewDescriptor viewDesc;
+    viewDesc.label = "Offscreen texture view"_wgpu;
+    viewDesc.format = surfaceFormat;
+    viewDesc.dimension = wgpu::TextureViewDimension::_2D;
+    viewDesc.baseMipLevel = 0;
+    viewDesc.mipLevelCount = 1;
+    viewDesc.baseArrayLayer = 0;
+    viewDesc.arrayLayerCount = 1;
+    viewDesc.aspect = wgpu::TextureAspect::All;
+    return offscreenTexture.createView(viewDesc);
+}
+
 wgpu::TextureView Application::GetNextDepthTextureView() {
     // Get depth texture view
     wgpu::TextureViewDescriptor viewDesc;
@@ -795,14 +1817,10 @@ wgpu::TextureView Application::GetNextDepthTextureView() {
 }
 
 void Application::UpdateViewMatrix() {
-    float cx = glm::cos(cameraState.angles.x);
-    float cy = glm::cos(cameraState.angles.y);
-    float sx = glm::sin(cameraState.angles.x);
-    float sy = glm::sin(cameraState.angles.y);
-
-    uniforms.cameraWorldPosition = glm::vec3(cx * cy, sx * cy, sy) * std::exp(-cameraState.zoom);
-    uniforms.viewMatrix = glm::lookAt(uniforms.cameraWorldPosition, glm::vec3(0.0f), glm::vec3(0, 0, 1));
+    uniforms.cameraWorldPosition = Scene::cameraWorldPosition(cameraState);
+    uniforms.viewMatrix = Scene::viewMatrix(cameraState);
     myUniformsChanged = true;
+    pathTracer.reset();
 }
 
 void Application::UpdateModelMatrix(float time) {
@@ -825,20 +1843,82 @@ void Application::UpdateProjectionMatrix() {
     float fov = 2.0f * glm::atan(1.0f / focalLength);
     uniforms.projectionMatrix = glm::perspective(fov, ratio, near, far);
 
-    uniforms.projectionMatrix = glm::perspective(45 * PI / 180, 640.0f / 480.0f, 0.01f, 100.0f);
+    uniforms.projectionMatrix = Scene::projectionMatrix(Scene::defaultAspectRatio);
     myUniformsChanged = true;
+    pathTracer.reset();
 }
 
 void Application::UpdateMyUniforms() {
-    if (myUniformsChanged){
-        queue.writeBuffer(uniformBuffer, 0, &uniforms, sizeof(MyUniforms));
-        myUniformsChanged = false;
+    myUniformsOffset = static_cast<uint32_t>(uploadRing.push(uniforms));
+    myUniformsChanged = false;
+}
+
+void Application::UpdateInstances() {
+    sceneInstances.clearObjects();
+
+    // A grid in the ground plane, scaled to cover about the footprint of a
+    // single copy
+    uint32_t n = static_cast<uint32_t>(std::max(instanceGridSize, 1));
+    glm::vec3 size = meshBounds.isEmpty() ? glm::vec3(1.0f) : meshBounds.max - meshBounds.min;
+    float spacing = 1.25f * std::max(size.x, size.y);
+    float center = 0.5f * static_cast<float>(n - 1);
+    glm::mat4x4 scale = glm::scale(glm::mat4x4(1.0f), glm::vec3(1.0f / static_cast<float>(n)));
+    for (uint32_t y = 0; y < n; y++) {
+        for (uint32_t x = 0; x < n; x++) {
+            glm::vec3 offset = spacing * glm::vec3(static_cast<float>(x) - center, static_cast<float>(y) - center, 0.0f);
+            sceneInstances.addObject(sceneMesh, glm::translate(scale, offset));
+        }
     }
 }
 
 void Application::UpdateLighting() {
-    if (lightingUniformsChanged) {
-        queue.writeBuffer(lightingUniformBuffer, 0, &lightingUniforms, sizeof(LightingUniforms));
-        lightingUniformsChanged = false;
+    lightingUniformsOffset = static_cast<uint32_t>(uploadRing.push(lightingUniforms));
+}
+
+void Application::InitializeLocalLights() {
+    localLightCount = std::min(config::localLightCount, static_cast<int>(clusteredLights.capacity()));
+    lightsStart = std::chrono::steady_clock::now();
+
+    // A disc covering the instance grid, which spans about 1.25 times the
+    // footprint of one copy whatever its size, from the bottom of the mesh
+    // to a bit above its top
+    glm::vec3 size = meshBounds.isEmpty() ? glm::vec3(1.0f) : meshBounds.max - meshBounds.min;
+    float bottom = meshBounds.isEmpty() ? 0.0f : meshBounds.min.z;
+    lightAreaRadius = 0.9f * std::max(size.x, size.y);
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    lightOrbits.resize(config::maxLocalLightCount);
+    for (size_t i = 0; i < lightOrbits.size(); i++) {
+        LightOrbit& orbit = lightOrbits[i];
+        orbit.radius = lightAreaRadius * std::sqrt(unit(random));
+        orbit.phase = 2.0f * PI * unit(random);
+        orbit.speed = (unit(random) < 0.5f ? -1.0f : 1.0f) * (0.1f + 0.4f * unit(random));
+        orbit.height = bottom + 1.2f * size.z * unit(random);
+        // Saturated hues, one light in four a spot looking down
+        glm::vec3 hue = glm::clamp(glm::abs(glm::mod(6.0f * unit(random) + glm::vec3(0.0f, 4.0f, 2.0f), 6.0f) - 3.0f) - 1.0f, 0.0f, 1.0f);
+        orbit.color = 0.5f * hue;
+        orbit.spot = i % 4 == 3;
+    }
+}
+
+void Application::UpdateLocalLights(float time) {
+    // Each light reaches about the same number of neighbors whatever the
+    // count, so that lights per cluster stay level
+    uint32_t count = static_cast<uint32_t>(std::clamp(localLightCount, 0, static_cast<int>(lightOrbits.size())));
+    float range = 3.0f * lightAreaRadius / std::sqrt(static_cast<float>(std::max(count, 1u)));
+
+    localLights.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        const LightOrbit& orbit = lightOrbits[i];
+        float angle = orbit.phase + orbit.speed * time;
+        glm::vec3 position(orbit.radius * std::cos(angle), orbit.radius * std::sin(angle), orbit.height);
+        localLights[i] = orbit.spot
+            ? LocalLight::spot(position, glm::vec3(0.0f, 0.0f, -1.0f), 2.0f * range, orbit.color, 0.35f, 0.6f)
+            : LocalLight::point(position, range, orbit.color);
     }
+    clusteredLights.update(
+        uploadRing, localLights, uniforms.viewMatrix, uniforms.projectionMatrix,
+        static_cast<uint32_t>(fbWidth), static_cast<uint32_t>(fbHeight)
+    );
 }
\ No newline at end of file
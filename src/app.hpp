@@ -10,14 +10,54 @@
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 
+#include "clustered_lights.hpp"
+#include "frame_pacer.hpp"
+#include "frame_readback.hpp"
+#include "frame_stats.hpp"
+#include "gpu_culler.hpp"
+#include "gpu_timer.hpp"
 #include "resource_manager.hpp"
+#include "mipmap_generator.hpp"
+#include "path_tracer.hpp"
+#include "pipeline_cache.hpp"
+#include "render_bundle_cache.hpp"
+#include "scene.hpp"
+#include "scene_instances.hpp"
+#include "startup_timeline.hpp"
+#include "upload_ring.hpp"
+#include "vertex_packing.hpp"
 
 #include <array>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+/**
+ * How the application runs. A headless run needs no window or surface: it
+ * renders `frameCount` frames into an offscreen target and writes them to
+ * `outputDirectory`.
+ */
+struct ApplicationOptions {
+    bool headless = false;
+    uint32_t frameCount = 100;
+    std::filesystem::path outputDirectory = "frames";
+    // Frames that can be in flight between rendering and readback
+    uint32_t readbackRingSize = 3;
+    // Ask for a software adapter, for machines without a GPU
+    bool forceFallbackAdapter = false;
+    // Start in the path traced render mode
+    bool pathTraced = false;
+};
 
 class Application {
 public:
     // Initialize everything and return true if it went all right
-    bool Initialize();
+    bool Initialize(const ApplicationOptions& options = {});
 
     // Uninitialize everything that was initialized
     void Terminate();
@@ -29,6 +69,18 @@ public:
     bool IsRunning();
 
 private:
+    enum class RenderMode {
+        Raster,
+        PathTracer,
+    };
+
+    // Who culls the objects of the raster pipeline
+    enum class CullingMode {
+        Off,
+        Cpu,
+        Gpu,
+    };
+
     struct MyUniforms {
         glm::mat4x4 projectionMatrix;
         glm::mat4x4 viewMatrix;
@@ -36,19 +88,52 @@ private:
         glm::vec4 color;
         glm::vec3 cameraWorldPosition;
         float time;
-        //float _pad[1];
+        // Maps packed vertex positions back to model space
+        glm::vec4 positionScale;
+        glm::vec4 positionOffset;
     };
     static_assert(sizeof(MyUniforms) % 16 == 0);
+    static_assert(sizeof(MyUniforms) <= 256, "maxUniformBufferBindingSize");
+
+    using LightingUniforms = SceneLights;
+
+    /**
+     * CPU side of the assets, loaded on the thread pool while the device is
+     * created and released once uploaded
+     */
+    struct StartupAssets {
+        Mesh mesh;
+        MappedFile meshCacheFile;
+        MeshView meshData;
+        std::vector<PackedVertex> packedVertices;
+        VertexQuantization quantization;
+        DecodedTexture texture;
+        // Filled instead of `texture` when the image could be block compressed
+        CompressedTexture compressedTexture;
+        std::string shaderSource;
+    };
 
-    struct LightingUniforms {
-        std::array<glm::vec4, 2> directions;
-        std::array<glm::vec4, 2> colors;
+    // Shading permutation of the raster pipeline, see shader.wgsl
+    struct ShadingSettings {
+        bool specular = true;
+        bool gammaCorrection = true;
+        int lightCount = 2;
+        float hardness = 16.0f;
+        float kd = 1.0f;
+        float ks = 0.5f;
+        // Local lights through their clusters, or how many each one has
+        bool localLights = true;
+        bool lightHeatmap = false;
     };
-    static_assert(sizeof(LightingUniforms) % 16 == 0);
 
-    struct CameraState {
-        glm::vec2 angles = { 0.8f, 0.5f };
-        float zoom = -1.2f;
+    // Local light circling the vertical axis, see UpdateLocalLights()
+    struct LightOrbit {
+        float radius;
+        float phase;
+        float speed;
+        float height;
+        glm::vec3 color;
+        bool spot;
     };
 
     struct DragState {
@@ -67,6 +152,13 @@ private:
         // Constant settings
         float sensitivity = 0.01f;
         float scrollSensitivity = 0.1f;
+        // Inertia stops below this velocity
+        float minVelocity = 1e-4f;
+
+        // Whether the camera still moves after the drag was released
+        bool coasting() const {
+            return !active && (std::abs(velocity.x) >= minVelocity || std::abs(velocity.y) >= minVelocity);
+        }
     };
 
 private:
@@ -77,6 +169,19 @@ private:
     bool InitGui();
     void TerminateGui();
     void UpdateGui(wgpu::RenderPassEncoder renderPass);
+    void UpdateSceneGui();
+    // Stage list shown until the scene is ready
+    void UpdateLoadingGui();
+
+    // Asynchronous startup
+    void LaunchStartupTasks();
+    // Create what the finished tasks allow, and return true once all is ready
+    bool ContinueStartup();
+    // Block until ContinueStartup() is done
+    void FinishStartup();
+    // Let the tasks run out before bailing out of Initialize()
+    void WaitForStartupTasks();
+    static bool LoadMeshAssets(StartupAssets& assets);
 
     // Event handling
     void ResizeWindow();
@@ -84,6 +189,12 @@ private:
     void MouseButton(int button, int action, int mods);
     void MouseScroll(double xoffset, double yoffset);
     void UpdateDragInertia();
+    // Poll the window events and apply what they moved
+    void ProcessInput();
+    // Note when the input of the next submitted frame first arrived
+    void RecordInput();
+    // Whether rendering on demand has something new to show
+    bool IsFrameNeeded() const;
 
     // WebGPU initialization
     wgpu::Instance CreateInstance();
@@ -91,17 +202,32 @@ private:
     wgpu::Adapter RequestAdapter(wgpu::Instance instance);
     void RequestDevice(wgpu::Adapter adapter);
     void ConfigureSurface(wgpu::Instance instance, wgpu::Adapter adapter);
+    // Configure the surface at the framebuffer size with presentMode
+    void ReconfigureSurface();
 
+    void InitializeUniforms();
     void InitializeBuffers();
     void InitializeTextures();
     void InitializeDepthTexture();
     void InitializePipline();
+    // Switch to the pipeline of the current shading, once it is compiled
+    void RequestScenePipeline();
+    ShaderPermutation ShadingPermutation() const;
+    // GPU culling was picked and can run, within the device's limits for
+    // the objects of the scene. It has no levels of detail so the CPU culls
+    // while they are on
+    bool IsGpuCullingActive() const;
     void InitializeBindGroups();
+    // Record the draws of the scene pass into a pass or a render bundle
+    template <typename Encoder>
+    void EncodeScene(Encoder encoder, std::span<const uint32_t> dynamicOffsets, bool gpuCulled);
+    bool InitializeOffscreenTarget();
 
     wgpu::Limits GetRequiredLimits(wgpu::Adapter adapter);
 
     // WebGPU rendering
     wgpu::TextureView GetNextSurfaceTextureView();
+    wgpu::TextureView GetOffscreenTextureView();
     wgpu::TextureView GetNextDepthTextureView();
 
     // Scene transformation
@@ -112,10 +238,20 @@ private:
 
     // Lighting transforms
     void UpdateLighting();
+    // Scatter the orbits of the local lights over the instance grid
+    void InitializeLocalLights();
+    // Move the first `localLightCount` local lights to where they are at
+    // `time` and write them into the frame's region of the upload ring
+    void UpdateLocalLights(float time);
+
+    // Lay out `instanceGridSize` x `instanceGridSize` copies of the mesh
+    void UpdateInstances();
 
 private:
-    // Window
-    GLFWwindow *window;
+    ApplicationOptions options;
+
+    // Window, null when headless
+    GLFWwindow *window = nullptr;
     int width, height, fbWidth, fbHeight;
 
     // User interaction
@@ -127,19 +263,77 @@ private:
     wgpu::Surface surface;
     wgpu::Queue queue;
 
-    bool myUniformsChanged = false;
+    // Presentation, the surface is configured again at the start of the
+    // frame following a change, never while holding its texture
+    std::vector<wgpu::PresentMode> presentModes;
+    wgpu::PresentMode presentMode = wgpu::PresentMode::Fifo;
+    bool resizePending = false;
+    bool presentModePending = false;
+    FramePacer framePacer;
+    // Render on demand, sleeping while nothing changes. Events leave
+    // pendingFrames frames to draw.
+    bool renderOnDemand = false;
+    uint32_t pendingFrames = 0;
+    uint64_t skippedFrames = 0;
+    // Spent waiting for events since the last frame
+    std::chrono::steady_clock::duration idleDuration{};
+    // Callback time of the first input event not yet submitted, if any
+    std::optional<std::chrono::steady_clock::time_point> inputTime;
+
+    // Per-frame data, bound with dynamic offsets into the ring
+    UploadRing uploadRing;
+
     MyUniforms uniforms;
-    wgpu::Buffer uniformBuffer;
+    uint32_t myUniformsOffset = 0;
+    bool myUniformsChanged = false;
 
     bool lightingUniformsChanged = false;
     LightingUniforms lightingUniforms;
+    uint32_t lightingUniformsOffset = 0;
     wgpu::Buffer lightingUniformBuffer;
 
+    // Point and spot lights shaded through clusters of the view frustum
+    ClusteredLights clusteredLights;
+    bool clusteredLightsAvailable = false;
+    std::vector<LightOrbit> lightOrbits;
+    std::vector<LocalLight> localLights;
+    int localLightCount = 0;
+    // See config::animateLights
+    bool animateLights = false;
+    float lightsTime = 0.0f;
+    // Span of the orbits, lights reach farther the fewer they are
+    float lightAreaRadius = 1.0f;
+    std::chrono::steady_clock::time_point lightsStart;
+
     wgpu::Buffer vertexBuffer;
     uint32_t vertexCount;
 
+    wgpu::Buffer indexBuffer;
+    uint32_t indexCount;
+
+    // Objects placing the mesh, drawn with one instanced draw per mesh
+    SceneInstances sceneInstances;
+    uint32_t sceneMesh = 0;
+    Bounds meshBounds;
+    int instanceGridSize = 1;
+    CullingMode cullingMode = CullingMode::Cpu;
+    // Levels of detail picked by the CPU culling, so that their error
+    // stays under lodPixelError pixels on screen. Turning them on moves
+    // GPU culling back to the CPU.
+    bool levelsOfDetail = true;
+    float lodPixelError = 1.0f;
+
+    // Frustum and occlusion culling with indirect draws, used once the
+    // scene pipeline of the GPU_CULLING permutation is in place
+    GpuCuller gpuCuller;
+    bool gpuCullingAvailable = false;
+    bool pipelineGpuCulled = false;
+    bool showHiZ = false;
+    int hiZLevel = 0;
+
     wgpu::Texture texture;
     wgpu::Sampler sampler;
+    MipMapGenerator mipMapGenerator;
 
     wgpu::Texture depthTexture;
 
@@ -150,7 +344,53 @@ private:
 
     wgpu::BindGroup bindGroup;
 
+    // Owned by the cache, which keeps every permutation built so far
     wgpu::RenderPipeline pipeline;
+    PipelineCache pipelineCache;
+#if defined(WEBGPU_BACKEND_DAWN)
+    PipelineBlobStore pipelineBlobStore;
+#endif
+    ShadingSettings shading;
+    std::string sceneShaderSource;
+
+    // The scene draws, recorded once and replayed until they change, and
+    // the CPU time encoding them took in the last frame
+    RenderBundleCache sceneBundles;
+    bool renderBundles = true;
+    uint32_t bundledDrawList = 0;
+    double sceneEncodeMilliseconds = 0.0;
+    uint32_t scenePipelineRequest = 0;
+    bool scenePipelinePending = false;
+
+    // Headless render target and its readback
+    wgpu::Texture offscreenTexture;
+    FrameReadback frameReadback;
+    uint32_t frameIndex = 0;
+    std::chrono::steady_clock::time_point headlessStart;
+
+    // Progressive path traced alternative to the raster pipeline
+    PathTracer pathTracer;
+    bool pathTracerAvailable = false;
+    int pathTracerBounces = 0;
+    RenderMode renderMode = RenderMode::Raster;
+
+    // Frame timing, GPU passes are "Scene" then "GUI"
+    GpuTimer gpuTimer;
+    FrameStats frameStats{{"Scene", "GUI"}};
+    std::chrono::steady_clock::time_point lastFrameStart;
+
+    // Startup, the scene is drawn once `startupComplete` is set
+    StartupTimeline startupTimeline;
+    std::unique_ptr<StartupAssets> startupAssets;
+    std::future<bool> shaderTask;
+    std::future<bool> meshTask;
+    std::future<bool> textureTask;
+    size_t pipelineStage = 0;
+    std::optional<size_t> firstFrameStage;
+    bool pipelineRequested = false;
+    bool buffersReady = false;
+    bool texturesReady = false;
+    bool startupComplete = false;
 
     wgpu::TextureFormat surfaceFormat = wgpu::TextureFormat::Undefined;
     wgpu::TextureFormat textureFormat = wgpu::TextureFormat::Undefined;
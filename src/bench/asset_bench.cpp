@@ -0,0 +1,483 @@
+// Times the CPU side of the asset pipeline: OBJ and text geometry loading,
+// shader file reads, image decoding, mip chain generation, block
+// compression and frustum culling. Runs against
+// the shipped resources and against synthetic meshes and images that scale
+// past them. No window or GPU is needed. Results are written as JSON, one
+// entry per benchmark, so that runs from different commits can be compared.
+//
+// usage: AssetBench [output.json] [--quick] [--label name]
+
+#include "block_compression.hpp"
+#include "config.hpp"
+#include "frustum_culler.hpp"
+#include "mip_chain.hpp"
+#include "resource_manager.hpp"
+#include "scene.hpp"
+#include "thread_pool.hpp"
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct BenchResult {
+    std::string name;
+    std::string category;
+    size_t iterations = 0;
+    double minMs = 0.0;
+    double medianMs = 0.0;
+    double meanMs = 0.0;
+    // Input size, for throughput
+    uint64_t bytes = 0;
+    // Triangles, points or pixels processed per iteration
+    uint64_t items = 0;
+    std::string itemUnit;
+};
+
+struct BenchSettings {
+    size_t minIterations = 3;
+    size_t maxIterations = 50;
+    double budgetMs = 1000.0;
+};
+
+class Bench {
+public:
+    explicit Bench(BenchSettings settings) : settings(settings) {}
+
+    /**
+     * Time `body` after one warm-up run, until both the minimum iteration
+     * count and the time budget are reached. A body returning false fails
+     * the benchmark and the whole run.
+     */
+    template <typename F>
+    void run(const std::string& category, const std::string& name, uint64_t bytes, uint64_t items, const char* itemUnit, F&& body) {
+        if (!body()) {
+            std::cerr << category << "/" << name << " failed" << std::endl;
+            failed = true;
+            return;
+        }
+
+        std::vector<double> times;
+        double totalMs = 0.0;
+        while (times.size() < settings.maxIterations && (times.size() < settings.minIterations || totalMs < settings.budgetMs)) {
+            auto start = std::chrono::steady_clock::now();
+            body();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            times.push_back(ms);
+            totalMs += ms;
+        }
+        std::sort(times.begin(), times.end());
+
+        BenchResult result;
+        result.name = name;
+        result.category = category;
+        result.iterations = times.size();
+        result.minMs = times.front();
+        result.medianMs = times[times.size() / 2];
+        result.meanMs = totalMs / static_cast<double>(times.size());
+        result.bytes = bytes;
+        result.items = items;
+        result.itemUnit = itemUnit;
+        results.push_back(result);
+
+        std::cout << std::left << std::setw(36) << (category + "/" + name) << std::right
+                  << std::fixed << std::setprecision(2) << std::setw(10) << result.medianMs << " ms"
+                  << std::setw(10) << megabytesPerSecond(result) << " MB/s"
+                  << std::setw(6) << result.iterations << " runs" << std::endl;
+    }
+
+    bool succeeded() const { return !failed; }
+
+    bool writeJson(const std::filesystem::path& path, const std::string& label) const {
+        std::ofstream file(path);
+        if (!file.is_open()) return false;
+
+        std::time_t now = std::time(nullptr);
+        char timestamp[32];
+        std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+        file << std::setprecision(6) << std::fixed;
+        file << "{\n";
+        file << "  \"benchmark\": \"AssetBench\",\n";
+        file << "  \"label\": " << quoted(label) << ",\n";
+        file << "  \"timestamp\": " << quoted(timestamp) << ",\n";
+        file << "  \"threads\": " << ThreadPool::shared().size() + 1 << ",\n";
+        file << "  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            const BenchResult& r = results[i];
+            file << "    {"
+                 << "\"category\": " << quoted(r.category)
+                 << ", \"name\": " << quoted(r.name)
+                 << ", \"iterations\": " << r.iterations
+                 << ", \"min_ms\": " << r.minMs
+                 << ", \"median_ms\": " << r.medianMs
+                 << ", \"mean_ms\": " << r.meanMs
+                 << ", \"bytes\": " << r.bytes
+                 << ", \"mb_per_s\": " << megabytesPerSecond(r)
+                 << ", \"items\": " << r.items
+                 << ", \"item_unit\": " << quoted(r.itemUnit)
+                 << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        file << "  ]\n";
+        file << "}\n";
+        return file.good();
+    }
+
+private:
+    static double megabytesPerSecond(const BenchResult& result) {
+        return result.medianMs > 0.0 ? static_cast<double>(result.bytes) / 1e6 / (result.medianMs / 1000.0) : 0.0;
+    }
+
+    static std::string quoted(const std::string& text) {
+        std::string out = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') out += '\\';
+            if (static_cast<unsigned char>(c) < 0x20) continue;
+            out += c;
+        }
+        return out + "\"";
+    }
+
+private:
+    BenchSettings settings;
+    std::vector<BenchResult> results;
+    bool failed = false;
+};
+
+uint64_t fileSize(const std::filesystem::path& path) {
+    std::error_code error;
+    uint64_t size = std::filesystem::file_size(path, error);
+    return error ? 0 : size;
+}
+
+bool readFile(const std::filesystem::path& path, std::vector<unsigned char>& bytes) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+    bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// A wavy grid of `size` x `size` vertices with normals and uvs, in OBJ
+void writeSyntheticObj(const std::filesystem::path& path, uint32_t size) {
+    std::ofstream file(path);
+    file << std::fixed << std::setprecision(6);
+    for (uint32_t y = 0; y < size; y++) {
+        for (uint32_t x = 0; x < size; x++) {
+            float u = static_cast<float>(x) / static_cast<float>(size - 1);
+            float v = static_cast<float>(y) / static_cast<float>(size - 1);
+            float height = 0.05f * std::sin(20.0f * u) * std::cos(20.0f * v);
+            file << "v " << u - 0.5f << " " << height << " " << v - 0.5f << "\n";
+            file << "vn " << 0.0f << " " << 1.0f << " " << 0.0f << "\n";
+            file << "vt " << u << " " << v << "\n";
+        }
+    }
+    for (uint32_t y = 0; y + 1 < size; y++) {
+        for (uint32_t x = 0; x + 1 < size; x++) {
+            // OBJ indices start at 1
+            uint32_t i = y * size + x + 1;
+            uint32_t corners[4] = { i, i + 1, i + size + 1, i + size };
+            auto corner = [&](uint32_t c) { file << " " << c << "/" << c << "/" << c; };
+            file << "f";
+            corner(corners[0]); corner(corners[1]); corner(corners[2]);
+            file << "\nf";
+            corner(corners[0]); corner(corners[2]); corner(corners[3]);
+            file << "\n";
+        }
+    }
+}
+
+// The same kind of grid in the [points]/[indices] format of loadGeometry,
+// with 3D positions, normals and colors. Indices are 16 bit, so `size` is
+// at most 256.
+void writeSyntheticGeometry(const std::filesystem::path& path, uint32_t size) {
+    std::ofstream file(path);
+    file << std::fixed << std::setprecision(4);
+    file << "[points]\n";
+    for (uint32_t y = 0; y < size; y++) {
+        for (uint32_t x = 0; x < size; x++) {
+            float u = static_cast<float>(x) / static_cast<float>(size - 1);
+            float v = static_cast<float>(y) / static_cast<float>(size - 1);
+            file << u - 0.5f << " " << v - 0.5f << " 0.0  0.0 0.0 1.0  " << u << " " << v << " 0.5\n";
+        }
+    }
+    file << "[indices]\n";
+    for (uint32_t y = 0; y + 1 < size; y++) {
+        for (uint32_t x = 0; x + 1 < size; x++) {
+            uint32_t i = y * size + x;
+            file << i << " " << i + 1 << " " << i + size + 1 << "\n";
+            file << i << " " << i + size + 1 << " " << i + size << "\n";
+        }
+    }
+}
+
+// Smooth gradients with some noise, so that neither the decoder nor the
+// filters see a constant image
+std::vector<unsigned char> syntheticPixels(uint32_t width, uint32_t height, uint32_t channels) {
+    std::vector<unsigned char> pixels(static_cast<size_t>(width) * height * channels);
+    std::mt19937 rng(width * 31 + height);
+    std::uniform_int_distribution<int> noise(-8, 8);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            unsigned char* p = &pixels[(static_cast<size_t>(y) * width + x) * channels];
+            int base[4] = { static_cast<int>(255 * x / width), static_cast<int>(255 * y / height), static_cast<int>(255 * (x ^ y) / std::max(width, height)), 255 };
+            for (uint32_t c = 0; c < channels; c++) {
+                p[c] = static_cast<unsigned char>(std::clamp(base[c] + (c < 3 ? noise(rng) : 0), 0, 255));
+            }
+        }
+    }
+    return pixels;
+}
+
+// A binary PPM in memory; stb_image has no encoder here, and PNM is the one
+// format it decodes that is trivial to write
+std::vector<unsigned char> encodePpm(uint32_t width, uint32_t height, const std::vector<unsigned char>& rgb) {
+    std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    std::vector<unsigned char> bytes(header.begin(), header.end());
+    bytes.insert(bytes.end(), rgb.begin(), rgb.end());
+    return bytes;
+}
+
+bool decode(const std::vector<unsigned char>& encoded) {
+    int width, height, channels;
+    unsigned char* pixels = stbi_load_from_memory(encoded.data(), static_cast<int>(encoded.size()), &width, &height, &channels, 4);
+    if (!pixels) return false;
+    stbi_image_free(pixels);
+    return true;
+}
+
+void benchMips(Bench& bench, const std::string& name, const unsigned char* rgba, uint32_t width, uint32_t height) {
+    uint32_t levelCount = MipChainBuilder::levelCount(width, height);
+    uint64_t bytes = 4 * static_cast<uint64_t>(width) * height;
+    uint64_t pixels = static_cast<uint64_t>(width) * height;
+    // The chain is reused across iterations like the storage of a loader would be
+    MipChain chain;
+    bench.run("mips", name + "/box", bytes, pixels, "pixels", [&]() {
+        MipChainBuilder::build(rgba, width, height, levelCount, MipFilter::Box, chain);
+        return true;
+    });
+    bench.run("mips", name + "/box_srgb", bytes, pixels, "pixels", [&]() {
+        MipChainBuilder::build(rgba, width, height, levelCount, MipFilter::BoxSRGB, chain);
+        return true;
+    });
+}
+
+void benchCompression(Bench& bench, const std::string& name, const unsigned char* rgba, uint32_t width, uint32_t height) {
+    uint64_t bytes = 4 * static_cast<uint64_t>(width) * height;
+    uint64_t pixels = static_cast<uint64_t>(width) * height;
+    std::vector<unsigned char> decoded(bytes);
+    for (BlockFormat format : { BlockFormat::BC1, BlockFormat::BC7 }) {
+        const char* formatName = format == BlockFormat::BC1 ? "bc1" : "bc7";
+        std::vector<unsigned char> compressed(BlockCompressor::compressedSize(width, height, format));
+        bench.run("compress", name + "/" + formatName, bytes, pixels, "pixels", [&]() {
+            BlockCompressor::compress(rgba, width, height, format, compressed.data());
+            return true;
+        });
+
+        // Quality next to speed, BC1 drops alpha so it is left out of both
+        BlockCompressor::decompress(compressed.data(), width, height, format, decoded.data());
+        int channels = format == BlockFormat::BC1 ? 3 : 4;
+        double squaredError = 0.0;
+        for (size_t i = 0; i < bytes; i++) {
+            if (static_cast<int>(i % 4) >= channels) continue;
+            double difference = static_cast<double>(rgba[i]) - decoded[i];
+            squaredError += difference * difference;
+        }
+        double meanSquaredError = squaredError / (static_cast<double>(pixels) * channels);
+        double psnr = meanSquaredError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanSquaredError) : INFINITY;
+        std::cout << "  " << name << "/" << formatName << ": " << std::fixed << std::setprecision(2) << psnr << " dB PSNR, "
+                  << static_cast<double>(bytes) / compressed.size() << "x smaller" << std::endl;
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::filesystem::path outputPath = "asset_bench.json";
+    std::string label;
+    bool quick = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--quick") == 0) quick = true;
+        else if (std::strcmp(argv[i], "--label") == 0 && i + 1 < argc) label = argv[++i];
+        else outputPath = argv[i];
+    }
+
+    BenchSettings settings;
+    if (quick) {
+        settings.minIterations = 1;
+        settings.maxIterations = 5;
+        settings.budgetMs = 200.0;
+    }
+    Bench bench(settings);
+
+    std::filesystem::path resourceDir = std::filesystem::path(config::shapeModelFile).parent_path();
+    std::filesystem::path shaderDir = std::filesystem::path(config::shaderSrcFile).parent_path();
+    std::filesystem::path syntheticDir = std::filesystem::temp_directory_path() / "asset_bench";
+    std::filesystem::create_directories(syntheticDir);
+
+    // === Shipped assets
+    std::vector<std::filesystem::path> objFiles;
+    std::vector<std::filesystem::path> imageFiles;
+    for (const auto& entry : std::filesystem::directory_iterator(resourceDir)) {
+        if (entry.path().extension() == ".obj") objFiles.push_back(entry.path());
+        if (entry.path().extension() == ".jpg" || entry.path().extension() == ".png") imageFiles.push_back(entry.path());
+    }
+    std::sort(objFiles.begin(), objFiles.end());
+    std::sort(imageFiles.begin(), imageFiles.end());
+
+    // === Synthetic assets
+    std::vector<uint32_t> objSizes = quick ? std::vector<uint32_t>{ 128 } : std::vector<uint32_t>{ 128, 512, 1024 };
+    for (uint32_t size : objSizes) {
+        std::filesystem::path path = syntheticDir / ("grid_" + std::to_string(size) + ".obj");
+        writeSyntheticObj(path, size);
+        objFiles.push_back(path);
+    }
+
+    for (const std::filesystem::path& path : objFiles) {
+        Mesh mesh;
+        ResourceManager::loadGeometryFromObj(path, mesh);
+        bench.run("obj", path.filename().string(), fileSize(path), mesh.indices.size() / 3, "triangles", [&]() {
+            Mesh result;
+            return ResourceManager::loadGeometryFromObj(path, result);
+        });
+    }
+
+    // loadGeometry's text format, 2D for webgpu.txt and 3D with normals otherwise
+    std::filesystem::path syntheticGeometry = syntheticDir / "grid_256.txt";
+    writeSyntheticGeometry(syntheticGeometry, 256);
+    std::vector<std::pair<std::filesystem::path, size_t>> geometryFiles = {
+        { resourceDir / "webgpu.txt", 2 },
+        { resourceDir / "pyramid.txt", 6 },
+        { syntheticGeometry, 6 },
+    };
+    for (const auto& [path, dimensions] : geometryFiles) {
+        std::vector<float> points;
+        std::vector<uint16_t> indices;
+        ResourceManager::loadGeometry(path, points, indices, dimensions);
+        bench.run("geometry", path.filename().string(), fileSize(path), points.size() / (dimensions + 3), "points", [&]() {
+            return ResourceManager::loadGeometry(path, points, indices, dimensions);
+        });
+    }
+
+    // Shader sources, plus one far larger than any of them
+    std::vector<std::filesystem::path> shaderFiles;
+    for (const auto& entry : std::filesystem::directory_iterator(shaderDir)) {
+        if (entry.path().extension() == ".wgsl") shaderFiles.push_back(entry.path());
+    }
+    std::sort(shaderFiles.begin(), shaderFiles.end());
+    {
+        std::filesystem::path path = syntheticDir / "large.wgsl";
+        std::string source;
+        ResourceManager::readShaderFile(config::shaderSrcFile, source);
+        std::ofstream file(path, std::ios::binary);
+        for (size_t written = 0; !source.empty() && written < (quick ? 1u : 16u) << 20; written += source.size()) {
+            file << source;
+        }
+        shaderFiles.push_back(path);
+    }
+    for (const std::filesystem::path& path : shaderFiles) {
+        std::string contents;
+        bench.run("shader", path.filename().string(), fileSize(path), 0, "", [&]() {
+            return ResourceManager::readShaderFile(path, contents);
+        });
+    }
+
+    // Image decoding from memory, so the file system stays out of it
+    for (const std::filesystem::path& path : imageFiles) {
+        std::vector<unsigned char> encoded;
+        int width = 0, height = 0, channels = 0;
+        if (!readFile(path, encoded) || !stbi_info_from_memory(encoded.data(), static_cast<int>(encoded.size()), &width, &height, &channels)) {
+            std::cerr << "Could not read image " << path << std::endl;
+            continue;
+        }
+        bench.run("decode", path.filename().string(), encoded.size(), static_cast<uint64_t>(width) * height, "pixels", [&]() {
+            return decode(encoded);
+        });
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> imageSizes = quick
+        ? std::vector<std::pair<uint32_t, uint32_t>>{ { 1024, 1024 } }
+        : std::vector<std::pair<uint32_t, uint32_t>>{ { 1024, 1024 }, { 4096, 4096 }, { 3001, 1999 } };
+    for (auto [width, height] : imageSizes) {
+        std::string name = "synthetic_" + std::to_string(width) + "x" + std::to_string(height);
+        std::vector<unsigned char> encoded = encodePpm(width, height, syntheticPixels(width, height, 3));
+        bench.run("decode", name + ".ppm", encoded.size(), static_cast<uint64_t>(width) * height, "pixels", [&]() {
+            return decode(encoded);
+        });
+    }
+
+    // Mip chains of the shipped images and of larger and odd sized ones
+    for (const std::filesystem::path& path : imageFiles) {
+        int width, height, channels;
+        unsigned char* pixels = stbi_load(path.string().c_str(), &width, &height, &channels, 4);
+        if (!pixels) continue;
+        benchMips(bench, path.filename().string(), pixels, static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+        stbi_image_free(pixels);
+    }
+    for (auto [width, height] : imageSizes) {
+        std::vector<unsigned char> pixels = syntheticPixels(width, height, 4);
+        benchMips(bench, "synthetic_" + std::to_string(width) + "x" + std::to_string(height), pixels.data(), width, height);
+    }
+
+    // Block compression of the shipped images and of the smallest synthetic one
+    for (const std::filesystem::path& path : imageFiles) {
+        int width, height, channels;
+        unsigned char* pixels = stbi_load(path.string().c_str(), &width, &height, &channels, 4);
+        if (!pixels) continue;
+        benchCompression(bench, path.filename().string(), pixels, static_cast<uint32_t>(width), static_cast<uint32_t>(height));
+        stbi_image_free(pixels);
+    }
+    {
+        auto [width, height] = imageSizes.front();
+        std::vector<unsigned char> pixels = syntheticPixels(width, height, 4);
+        benchCompression(bench, "synthetic_" + std::to_string(width) + "x" + std::to_string(height), pixels.data(), width, height);
+    }
+
+    // Frustum culling of random boxes around the default view, the way the
+    // app culls its objects
+    std::vector<size_t> boxCounts = quick ? std::vector<size_t>{ 65536 } : std::vector<size_t>{ 1024, 65536, 1 << 20 };
+    Frustum frustum = Frustum::fromMatrix(Scene::projectionMatrix(Scene::defaultAspectRatio) * Scene::viewMatrix(CameraState()));
+    for (size_t count : boxCounts) {
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<float> position(-4.0f, 4.0f);
+        std::uniform_real_distribution<float> size(0.01f, 0.2f);
+        BoundsList boxes;
+        boxes.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            glm::vec3 center(position(rng), position(rng), position(rng));
+            glm::vec3 extent(size(rng), size(rng), size(rng));
+            Bounds bounds;
+            bounds.extend(center - extent);
+            bounds.extend(center + extent);
+            boxes.set(i, bounds);
+        }
+        std::vector<uint32_t> inside, intersecting;
+        std::string name = std::string(FrustumCuller::instructionSet()) + "_" + std::to_string(count);
+        bench.run("cull", name, count * 6 * sizeof(float), count, "boxes", [&]() {
+            FrustumCuller::classify(frustum, boxes, inside, intersecting);
+            return true;
+        });
+    }
+
+    std::error_code error;
+    std::filesystem::remove_all(syntheticDir, error);
+
+    if (!bench.writeJson(outputPath, label)) {
+        std::cerr << "Could not write " << outputPath << std::endl;
+        return 1;
+    }
+    std::cout << "Wrote " << outputPath.string() << std::endl;
+    return bench.succeeded() ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+// Builds a BVH over an OBJ with increasing thread counts, reports build time,
+// node count and SAH cost, and checks the tree and its ray queries against
+// brute force.
+//
+// usage: BvhBench [file.obj] [repeats]
+
+#include "bvh.hpp"
+#include "config.hpp"
+#include "obj_parser.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+bool contains(const BvhNode& outer, const glm::vec3& min, const glm::vec3& max) {
+    for (int axis = 0; axis < 3; axis++) {
+        if (min[axis] < outer.boundsMin[axis] || max[axis] > outer.boundsMax[axis]) return false;
+    }
+    return true;
+}
+
+// Every triangle in exactly one leaf, every child inside its parent and
+// every leaf triangle inside its leaf
+bool validateStructure(const Bvh& bvh, size_t triangleCount) {
+    if (bvh.triangles.size() != triangleCount) return false;
+    if (triangleCount == 0) return bvh.nodes.empty();
+
+    std::vector<uint32_t> seen(triangleCount, 0);
+    std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0u, 0u } };
+    while (!stack.empty()) {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        if (index >= bvh.nodes.size() || depth >= bvhMaxDepth) return false;
+        const BvhNode& node = bvh.nodes[index];
+
+        if (node.isLeaf()) {
+            if (node.leftFirst + node.triangleCount > triangleCount) return false;
+            for (uint32_t i = node.leftFirst; i < node.leftFirst + node.triangleCount; i++) {
+                const BvhTriangle& t = bvh.triangles[i];
+                if (!contains(node, glm::min(t.v0, glm::min(t.v1, t.v2)), glm::max(t.v0, glm::max(t.v1, t.v2)))) return false;
+                seen[t.primitive]++;
+            }
+            continue;
+        }
+        for (uint32_t child = node.leftFirst; child < node.leftFirst + 2; child++) {
+            if (child >= bvh.nodes.size()) return false;
+            if (!contains(node, bvh.nodes[child].boundsMin, bvh.nodes[child].boundsMax)) return false;
+            stack.push_back({ child, depth + 1 });
+        }
+    }
+    return std::all_of(seen.begin(), seen.end(), [](uint32_t count) { return count == 1; });
+}
+
+// Closest hit distances must match a test of every triangle
+bool validateRays(const Bvh& bvh, size_t rayCount) {
+    if (bvh.nodes.empty()) return true;
+    const BvhNode& root = bvh.nodes[0];
+    glm::vec3 center = 0.5f * (root.boundsMin + root.boundsMax);
+    float radius = glm::length(root.boundsMax - root.boundsMin);
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::normal_distribution<float> normal;
+    size_t hits = 0;
+    for (size_t r = 0; r < rayCount; r++) {
+        // From a sphere around the mesh towards a point inside its bounds
+        glm::vec3 direction = glm::normalize(glm::vec3(normal(rng), normal(rng), normal(rng)));
+        glm::vec3 target = root.boundsMin + (root.boundsMax - root.boundsMin) * glm::vec3(unit(rng), unit(rng), unit(rng));
+        BvhRay ray;
+        ray.origin = center + direction * radius;
+        ray.direction = glm::normalize(target - ray.origin);
+
+        BvhHit hit;
+        bool found = bvh.intersect(ray, hit);
+
+        Bvh single;
+        single.nodes.push_back(root);
+        single.nodes[0].leftFirst = 0;
+        single.nodes[0].triangleCount = 1;
+        float closest = std::numeric_limits<float>::max();
+        for (const BvhTriangle& triangle : bvh.triangles) {
+            single.triangles = { triangle };
+            BvhHit candidate;
+            if (single.intersect(ray, candidate)) closest = std::min(closest, candidate.t);
+        }
+
+        if (found != (closest < std::numeric_limits<float>::max()) || (found && hit.t != closest)) {
+            std::cerr << "Ray " << r << ": BVH hit " << (found ? hit.t : -1.0f) << ", brute force " << closest << std::endl;
+            return false;
+        }
+        if (found != bvh.occluded(ray)) {
+            std::cerr << "Ray " << r << ": occlusion query disagrees" << std::endl;
+            return false;
+        }
+        hits += found ? 1 : 0;
+    }
+    std::cout << "Checked " << rayCount << " rays against brute force, " << hits << " hits" << std::endl;
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::filesystem::path path = argc > 1 ? argv[1] : config::shapeModelFile;
+    int repeats = argc > 2 ? std::max(1, std::atoi(argv[2])) : 5;
+
+    ObjGeometry obj;
+    if (!ObjParser::parse(path, obj, &ThreadPool::shared())) {
+        return 1;
+    }
+
+    // Positions only, with the same axis swap as ResourceManager
+    std::vector<VertexAttributes> vertices(obj.positions.size() / 3);
+    for (size_t i = 0; i < vertices.size(); i++) {
+        vertices[i] = {};
+        vertices[i].position = { obj.positions[3 * i + 0], -obj.positions[3 * i + 2], obj.positions[3 * i + 1] };
+    }
+    std::vector<uint32_t> indices(obj.corners.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+        indices[i] = static_cast<uint32_t>(obj.corners[i].position);
+    }
+    size_t triangleCount = indices.size() / 3;
+    std::cout << path.filename().string() << ": " << triangleCount << " triangles" << std::endl;
+
+    size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> threadCounts;
+    for (size_t threads = 1; threads < hardwareThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(hardwareThreads);
+
+    Bvh bvh;
+    BvhBuildStats stats;
+    double singleThreadMs = 0.0;
+    bool deterministic = true;
+    for (size_t threads : threadCounts) {
+        // The calling thread takes tasks too
+        std::unique_ptr<ThreadPool> pool;
+        if (threads > 1) pool = std::make_unique<ThreadPool>(threads - 1);
+
+        double bestMs = std::numeric_limits<double>::max();
+        for (int i = 0; i < repeats; i++) {
+            Bvh result;
+            if (!BvhBuilder::build(vertices, indices, result, pool.get(), {}, &stats)) return 1;
+            bestMs = std::min(bestMs, stats.buildMilliseconds);
+
+            if (bvh.nodes.empty() && bvh.triangles.empty()) {
+                bvh = std::move(result);
+            }
+            else {
+                deterministic = deterministic
+                    && result.nodes.size() == bvh.nodes.size()
+                    && std::equal(result.triangles.begin(), result.triangles.end(), bvh.triangles.begin(), [](const BvhTriangle& a, const BvhTriangle& b) {
+                        return a.primitive == b.primitive;
+                    });
+            }
+        }
+        if (threads == 1) singleThreadMs = bestMs;
+
+        std::cout << std::setw(2) << threads << " thread" << (threads > 1 ? "s" : " ")
+                  << std::fixed << std::setprecision(1) << std::setw(9) << bestMs << " ms "
+                  << std::setw(9) << static_cast<double>(triangleCount) / (bestMs * 1000.0) << " Mtri/s "
+                  << std::setw(6) << std::setprecision(2) << singleThreadMs / bestMs << "x" << std::endl;
+    }
+
+    std::cout << stats.nodeCount << " nodes, " << stats.leafCount << " leaves, depth " << stats.maxDepth
+              << ", " << std::setprecision(2) << static_cast<double>(triangleCount) / std::max<size_t>(stats.leafCount, 1)
+              << " triangles per leaf, SAH cost " << stats.sahCost << std::endl;
+
+    bool valid = true;
+    if (!deterministic) {
+        std::cerr << "BVH differs between thread counts" << std::endl;
+        valid = false;
+    }
+    if (!validateStructure(bvh, triangleCount)) {
+        std::cerr << "Invalid BVH structure" << std::endl;
+        valid = false;
+    }
+    // Keep the brute force reference under a few seconds
+    size_t rayCount = std::clamp<size_t>(200'000'000 / std::max<size_t>(triangleCount, 1), 16, 4096);
+    if (!validateRays(bvh, rayCount)) {
+        valid = false;
+    }
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,287 @@
+// Builds the levels of detail of an OBJ and reports, per level, its
+// triangle count, the error the simplifier recorded and the Hausdorff
+// distance to the full mesh, measured by sampling both surfaces. Fails when
+// a level is malformed or does not shrink.
+//
+// usage: LodBench [file.obj] [levels] [samples]
+
+#include "config.hpp"
+#include "mesh_simplifier.hpp"
+#include "resource_manager.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <span>
+#include <vector>
+
+namespace {
+
+// Closest point to `p` on triangle abc (Ericson, "Real-Time Collision
+// Detection", 5.1.5)
+glm::vec3 closestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    glm::vec3 ab = b - a;
+    glm::vec3 ac = c - a;
+    glm::vec3 ap = p - a;
+    float d1 = glm::dot(ab, ap);
+    float d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) return a;
+
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp);
+    float d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) return b;
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp);
+    float d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) return c;
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+    float denominator = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+/**
+ * Uniform grid of the triangles of a surface, for distance queries. Cells
+ * are searched in growing shells around the query point until no closer
+ * triangle can be left.
+ */
+class TriangleGrid {
+public:
+    TriangleGrid(std::span<const VertexAttributes> vertices, std::span<const uint32_t> indices)
+        : vertices(vertices)
+        , indices(indices)
+    {
+        for (uint32_t index : indices) bounds.extend(vertices[index].position);
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0) return;
+
+        // A surface fills about resolution^2 of the cells
+        glm::vec3 size = bounds.max - bounds.min;
+        float extent = std::max(std::max(size.x, size.y), std::max(size.z, 1e-6f));
+        float longest = std::clamp(std::sqrt(static_cast<float>(triangleCount)), 1.0f, 128.0f);
+        cellSize = extent / longest;
+        for (int axis = 0; axis < 3; axis++) {
+            resolution[axis] = std::max(1, static_cast<int>(std::ceil(size[axis] / cellSize)));
+        }
+
+        std::vector<std::vector<uint32_t>> cells(cellCount());
+        for (uint32_t t = 0; t < triangleCount; t++) {
+            Bounds box;
+            for (int k = 0; k < 3; k++) box.extend(vertices[indices[3 * t + k]].position);
+            int low[3];
+            int high[3];
+            cellOf(box.min, low);
+            cellOf(box.max, high);
+            for (int z = low[2]; z <= high[2]; z++) {
+                for (int y = low[1]; y <= high[1]; y++) {
+                    for (int x = low[0]; x <= high[0]; x++) {
+                        cells[cellIndex(x, y, z)].push_back(t);
+                    }
+                }
+            }
+        }
+
+        cellStarts.push_back(0);
+        for (const std::vector<uint32_t>& cell : cells) {
+            cellTriangles.insert(cellTriangles.end(), cell.begin(), cell.end());
+            cellStarts.push_back(static_cast<uint32_t>(cellTriangles.size()));
+        }
+        visited.assign(triangleCount, 0);
+    }
+
+    // Distance from `point` to the closest triangle
+    float distance(const glm::vec3& point) {
+        float best = std::numeric_limits<float>::max();
+        if (cellStarts.empty()) return best;
+        stamp++;
+
+        int center[3];
+        cellOf(point, center);
+        int maxRadius = std::max(resolution[0], std::max(resolution[1], resolution[2]));
+        for (int radius = 0; radius <= maxRadius; radius++) {
+            // Cells of the shell, at Chebyshev distance `radius`
+            for (int z = center[2] - radius; z <= center[2] + radius; z++) {
+                for (int y = center[1] - radius; y <= center[1] + radius; y++) {
+                    for (int x = center[0] - radius; x <= center[0] + radius; x++) {
+                        bool onShell = std::abs(x - center[0]) == radius || std::abs(y - center[1]) == radius || std::abs(z - center[2]) == radius;
+                        if (!onShell || x < 0 || y < 0 || z < 0 || x >= resolution[0] || y >= resolution[1] || z >= resolution[2]) continue;
+                        size_t cell = cellIndex(x, y, z);
+                        for (uint32_t i = cellStarts[cell]; i < cellStarts[cell + 1]; i++) {
+                            best = std::min(best, triangleDistance(point, cellTriangles[i]));
+                        }
+                    }
+                }
+            }
+            // Cells past the next shell are at least this far
+            if (best <= static_cast<float>(radius) * cellSize) break;
+        }
+        return best;
+    }
+
+private:
+    size_t cellCount() const {
+        return static_cast<size_t>(resolution[0]) * static_cast<size_t>(resolution[1]) * static_cast<size_t>(resolution[2]);
+    }
+
+    size_t cellIndex(int x, int y, int z) const {
+        return (static_cast<size_t>(z) * static_cast<size_t>(resolution[1]) + static_cast<size_t>(y)) * static_cast<size_t>(resolution[0]) + static_cast<size_t>(x);
+    }
+
+    void cellOf(const glm::vec3& point, int cell[3]) const {
+        for (int axis = 0; axis < 3; axis++) {
+            int c = static_cast<int>(std::floor((point[axis] - bounds.min[axis]) / cellSize));
+            cell[axis] = std::clamp(c, 0, resolution[axis] - 1);
+        }
+    }
+
+    float triangleDistance(const glm::vec3& point, uint32_t t) {
+        if (visited[t] == stamp) return std::numeric_limits<float>::max();
+        visited[t] = stamp;
+        const glm::vec3& a = vertices[indices[3 * t + 0]].position;
+        const glm::vec3& b = vertices[indices[3 * t + 1]].position;
+        const glm::vec3& c = vertices[indices[3 * t + 2]].position;
+        return glm::length(point - closestPointOnTriangle(point, a, b, c));
+    }
+
+private:
+    std::span<const VertexAttributes> vertices;
+    std::span<const uint32_t> indices;
+    Bounds bounds;
+    float cellSize = 1.0f;
+    int resolution[3] = { 1, 1, 1 };
+    std::vector<uint32_t> cellStarts;
+    std::vector<uint32_t> cellTriangles;
+    // Triangles already tested by the current query
+    std::vector<uint32_t> visited;
+    uint32_t stamp = 0;
+};
+
+struct SurfaceDistance {
+    float max = 0.0f;
+    double mean = 0.0;
+};
+
+// Distances from every vertex of `from` and from `sampleCount` points spread
+// over it by area to the surface of `to`
+SurfaceDistance measureDistance(
+    std::span<const VertexAttributes> vertices,
+    std::span<const uint32_t> from, std::span<const uint32_t> to,
+    size_t sampleCount
+) {
+    SurfaceDistance result;
+    size_t triangleCount = from.size() / 3;
+    if (triangleCount == 0 || to.empty()) return result;
+
+    std::vector<double> cumulativeArea(triangleCount);
+    double area = 0.0;
+    for (size_t t = 0; t < triangleCount; t++) {
+        const glm::vec3& a = vertices[from[3 * t + 0]].position;
+        area += 0.5 * glm::length(glm::cross(vertices[from[3 * t + 1]].position - a, vertices[from[3 * t + 2]].position - a));
+        cumulativeArea[t] = area;
+    }
+
+    TriangleGrid grid(vertices, to);
+    double sum = 0.0;
+    auto add = [&](const glm::vec3& point) {
+        float distance = grid.distance(point);
+        result.max = std::max(result.max, distance);
+        sum += distance;
+    };
+    for (uint32_t index : from) add(vertices[index].position);
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    for (size_t i = 0; i < sampleCount && area > 0.0; i++) {
+        size_t t = std::lower_bound(cumulativeArea.begin(), cumulativeArea.end(), unit(rng) * area) - cumulativeArea.begin();
+        t = std::min(t, triangleCount - 1);
+        float r1 = static_cast<float>(std::sqrt(unit(rng)));
+        float r2 = static_cast<float>(unit(rng));
+        const glm::vec3& a = vertices[from[3 * t + 0]].position;
+        const glm::vec3& b = vertices[from[3 * t + 1]].position;
+        const glm::vec3& c = vertices[from[3 * t + 2]].position;
+        add((1.0f - r1) * a + r1 * (1.0f - r2) * b + r1 * r2 * c);
+    }
+    result.mean = sum / static_cast<double>(from.size() + (area > 0.0 ? sampleCount : 0));
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::filesystem::path path = argc > 1 ? argv[1] : config::shapeModelFile;
+    uint32_t levelCount = argc > 2 ? static_cast<uint32_t>(std::max(1, std::atoi(argv[2]))) : config::meshLodCount;
+    size_t sampleCount = argc > 3 ? static_cast<size_t>(std::max(0, std::atoi(argv[3]))) : 100000;
+
+    // The full mesh as the app loads it, levels of detail built below
+    Mesh mesh;
+    MeshOptimizerOptions optimizerOptions;
+    optimizerOptions.reduceOverdraw = config::reduceMeshOverdraw;
+    optimizerOptions.chunkTriangleCount = config::meshChunkTriangleCount;
+    if (!ResourceManager::loadGeometryFromObj(path, mesh, optimizerOptions)) {
+        std::cerr << "Could not load geometry file at: " << path << std::endl;
+        return 1;
+    }
+    size_t baseIndexCount = mesh.indices.size();
+    std::cout << path.filename().string() << ": " << baseIndexCount / 3 << " triangles, "
+              << mesh.vertices.size() << " vertices" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    MeshSimplifier::buildLods(mesh, levelCount, config::meshLodTriangleRatio);
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << mesh.lods.size() << " levels built in " << std::fixed << std::setprecision(1) << buildMs << " ms" << std::endl;
+
+    glm::vec3 size = mesh.bounds.max - mesh.bounds.min;
+    float diagonal = glm::length(size);
+    std::span<const uint32_t> base(mesh.indices.data(), baseIndexCount);
+
+    std::cout << "level  triangles      ratio  recorded error  Hausdorff    (% diag)  mean distance" << std::endl;
+    bool valid = !mesh.lods.empty() && mesh.lods[0].firstIndex == 0 && mesh.lods[0].indexCount == baseIndexCount;
+    for (size_t level = 0; level < mesh.lods.size(); level++) {
+        const MeshLod& lod = mesh.lods[level];
+        if (lod.indexCount % 3 != 0 || static_cast<size_t>(lod.firstIndex) + lod.indexCount > mesh.indices.size()) {
+            std::cerr << "Level " << level << " lies outside the index buffer" << std::endl;
+            valid = false;
+            continue;
+        }
+        std::span<const uint32_t> indices(mesh.indices.data() + lod.firstIndex, lod.indexCount);
+        if (std::any_of(indices.begin(), indices.end(), [&](uint32_t index) { return index >= mesh.vertices.size(); })) {
+            std::cerr << "Level " << level << " indexes past the vertices" << std::endl;
+            valid = false;
+            continue;
+        }
+        if (level > 0 && (lod.indexCount >= mesh.lods[level - 1].indexCount || lod.error < mesh.lods[level - 1].error)) {
+            std::cerr << "Level " << level << " is not coarser than the previous one" << std::endl;
+            valid = false;
+        }
+
+        // Two-sided: points of the level far from the full mesh, and parts
+        // of the full mesh the level no longer covers
+        SurfaceDistance toBase = measureDistance(mesh.vertices, indices, base, sampleCount);
+        SurfaceDistance fromBase = measureDistance(mesh.vertices, base, indices, sampleCount);
+        float hausdorff = std::max(toBase.max, fromBase.max);
+
+        std::cout << std::setw(5) << level << std::setw(11) << lod.indexCount / 3
+                  << std::setw(10) << std::setprecision(3) << static_cast<double>(lod.indexCount) / static_cast<double>(std::max<size_t>(baseIndexCount, 1))
+                  << std::setw(16) << std::setprecision(6) << lod.error
+                  << std::setw(11) << hausdorff
+                  << std::setw(11) << std::setprecision(3) << 100.0f * hausdorff / std::max(diagonal, 1e-12f)
+                  << std::setw(15) << std::setprecision(6) << 0.5 * (toBase.mean + fromBase.mean) << std::endl;
+    }
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,329 @@
+// Checks the compute shader mip chain against the CPU one. Requests the
+// fallback (software) adapter, so it runs without a GPU, fills the mip
+// chains of power of two, odd and one texel wide images with
+// MipMapGenerator, reads every level back and compares it texel by texel
+// with MipChainBuilder, for both filters. Fails when a channel differs by
+// more than the tolerance, or when the device reports an error.
+//
+// usage: MipCheck [--hardware]
+
+#include "config.hpp"
+#include "mip_chain.hpp"
+#include "mipmap_generator.hpp"
+#include "webgpu_utils.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Both sides build each level from the previous 8 bit one, round to
+// nearest and filter odd sizes with the same weights. They still differ by
+// the float operation order and the table based sRGB encoding of the CPU,
+// which can move a value across a rounding boundary, by one step at a time
+constexpr int tolerance = 2;
+
+struct ImageSize {
+    uint32_t width;
+    uint32_t height;
+};
+
+const ImageSize imageSizes[] = {
+    { 256, 256 },
+    { 64, 16 },
+    { 1, 1 },
+    { 2, 1 },
+    { 13, 7 },
+    { 255, 129 },
+    { 100, 37 },
+    { 1, 33 },
+    { 47, 1 },
+};
+
+struct LevelDifference {
+    int maxDifference = 0;
+    double meanDifference = 0.0;
+};
+
+// Noise with a gradient underneath, so that both flat and busy areas are
+// filtered
+std::vector<unsigned char> makeImage(uint32_t width, uint32_t height, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> noise(-48, 48);
+    std::vector<unsigned char> pixels(4 * static_cast<size_t>(width) * height);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            unsigned char* pixel = &pixels[4 * (static_cast<size_t>(y) * width + x)];
+            int gradient[4] = {
+                static_cast<int>(255 * x / std::max(width, 1u)),
+                static_cast<int>(255 * y / std::max(height, 1u)),
+                128,
+                255 - static_cast<int>(255 * x / std::max(width, 1u)),
+            };
+            for (int c = 0; c < 4; c++) {
+                pixel[c] = static_cast<unsigned char>(std::clamp(gradient[c] + noise(rng), 0, 255));
+            }
+        }
+    }
+    return pixels;
+}
+
+void waitForMapping(wgpu::Device device, const bool& mapped) {
+    while (!mapped) {
+#if defined(WEBGPU_BACKEND_DAWN)
+        device.tick();
+        std::this_thread::yield();
+#elif defined(WEBGPU_BACKEND_WGPU)
+        device.poll(true, nullptr);
+#endif
+    }
+}
+
+/**
+ * Fill the chain of a `width` x `height` texture on the GPU and read back
+ * levels 1 and up, tightly packed one after the other. Returns false when
+ * the readback could not be mapped.
+ */
+bool generateOnGpu(
+    wgpu::Device device,
+    MipMapGenerator& generator,
+    const std::vector<unsigned char>& pixels,
+    uint32_t width, uint32_t height,
+    uint32_t levelCount,
+    MipFilter filter,
+    std::vector<std::vector<unsigned char>>& levels
+) {
+    wgpu::Queue queue = device.getQueue();
+
+    wgpu::TextureDescriptor textureDesc;
+    textureDesc.label = "Mip check texture"_wgpu;
+    textureDesc.dimension = wgpu::TextureDimension::_2D;
+    textureDesc.format = wgpu::TextureFormat::RGBA8Unorm;
+    textureDesc.sampleCount = 1;
+    textureDesc.size = { width, height, 1 };
+    textureDesc.mipLevelCount = levelCount;
+    textureDesc.usage = wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::StorageBinding
+        | wgpu::TextureUsage::CopyDst | wgpu::TextureUsage::CopySrc;
+    textureDesc.viewFormatCount = 0;
+    textureDesc.viewFormats = nullptr;
+    wgpu::Texture texture = device.createTexture(textureDesc);
+
+    wgpu::TexelCopyTextureInfo baseDestination;
+    baseDestination.texture = texture;
+    baseDestination.mipLevel = 0;
+    baseDestination.origin = { 0, 0, 0 };
+    baseDestination.aspect = wgpu::TextureAspect::All;
+
+    wgpu::TexelCopyBufferLayout baseLayout;
+    baseLayout.offset = 0;
+    baseLayout.bytesPerRow = 4 * width;
+    baseLayout.rowsPerImage = height;
+    queue.writeTexture(baseDestination, pixels.data(), pixels.size(), baseLayout, textureDesc.size);
+
+    generator.generate(texture, textureDesc.size, levelCount, filter);
+
+    // Every level at its own offset in one buffer, rows padded for the copy
+    std::vector<uint32_t> levelWidths(levelCount);
+    std::vector<uint32_t> levelHeights(levelCount);
+    std::vector<uint32_t> paddedBytesPerRow(levelCount);
+    std::vector<uint64_t> levelOffsets(levelCount);
+    uint64_t bufferSize = 0;
+    for (uint32_t level = 1; level < levelCount; level++) {
+        levelWidths[level] = std::max(1u, width >> level);
+        levelHeights[level] = std::max(1u, height >> level);
+        paddedBytesPerRow[level] = (4 * levelWidths[level] + 255) & ~255u;
+        levelOffsets[level] = bufferSize;
+        bufferSize += static_cast<uint64_t>(paddedBytesPerRow[level]) * levelHeights[level];
+    }
+
+    wgpu::BufferDescriptor bufferDesc;
+    bufferDesc.label = "Mip check readback"_wgpu;
+    bufferDesc.size = bufferSize;
+    bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
+    bufferDesc.mappedAtCreation = false;
+    wgpu::Buffer readback = device.createBuffer(bufferDesc);
+
+    wgpu::CommandEncoderDescriptor encoderDesc = {};
+    encoderDesc.label = "Mip check encoder"_wgpu;
+    wgpu::CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+    for (uint32_t level = 1; level < levelCount; level++) {
+        wgpu::TexelCopyTextureInfo source;
+        source.texture = texture;
+        source.mipLevel = level;
+        source.origin = { 0, 0, 0 };
+        source.aspect = wgpu::TextureAspect::All;
+
+        wgpu::TexelCopyBufferInfo destination;
+        destination.buffer = readback;
+        destination.layout.offset = levelOffsets[level];
+        destination.layout.bytesPerRow = paddedBytesPerRow[level];
+        destination.layout.rowsPerImage = levelHeights[level];
+
+        encoder.copyTextureToBuffer(source, destination, { levelWidths[level], levelHeights[level], 1 });
+    }
+    wgpu::CommandBufferDescriptor cmdBufferDesc = {};
+    cmdBufferDesc.label = "Mip check command buffer"_wgpu;
+    wgpu::CommandBuffer command = encoder.finish(cmdBufferDesc);
+    encoder.release();
+    queue.submit(command);
+    command.release();
+
+    struct MapResult {
+        bool mapped = false;
+        bool succeeded = false;
+    } result;
+    wgpu::BufferMapCallbackInfo callbackInfo;
+    callbackInfo.nextInChain = nullptr;
+    callbackInfo.mode = wgpu::CallbackMode::AllowProcessEvents;
+    callbackInfo.callback = [](WGPUMapAsyncStatus status, [[maybe_unused]] WGPUStringView message, void* userdata1, [[maybe_unused]] void* userdata2) {
+        MapResult& result = *reinterpret_cast<MapResult*>(userdata1);
+        result.succeeded = status == WGPUMapAsyncStatus_Success;
+        result.mapped = true;
+    };
+    callbackInfo.userdata1 = &result;
+    callbackInfo.userdata2 = nullptr;
+    readback.mapAsync(wgpu::MapMode::Read, 0, bufferSize, callbackInfo);
+    waitForMapping(device, result.mapped);
+
+    if (result.succeeded) {
+        const unsigned char* data = static_cast<const unsigned char*>(readback.getConstMappedRange(0, bufferSize));
+        levels.assign(levelCount, {});
+        for (uint32_t level = 1; level < levelCount; level++) {
+            size_t rowSize = 4 * static_cast<size_t>(levelWidths[level]);
+            levels[level].resize(rowSize * levelHeights[level]);
+            for (uint32_t y = 0; y < levelHeights[level]; y++) {
+                std::memcpy(levels[level].data() + y * rowSize, data + levelOffsets[level] + static_cast<size_t>(y) * paddedBytesPerRow[level], rowSize);
+            }
+        }
+        readback.unmap();
+    }
+
+    readback.destroy();
+    readback.release();
+    texture.destroy();
+    texture.release();
+    queue.release();
+    return result.succeeded;
+}
+
+LevelDifference compareLevel(const unsigned char* expected, const unsigned char* actual, size_t size) {
+    LevelDifference difference;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size; i++) {
+        int delta = std::abs(static_cast<int>(expected[i]) - static_cast<int>(actual[i]));
+        difference.maxDifference = std::max(difference.maxDifference, delta);
+        sum += static_cast<uint64_t>(delta);
+    }
+    difference.meanDifference = size > 0 ? static_cast<double>(sum) / static_cast<double>(size) : 0.0;
+    return difference;
+}
+
+const char* filterName(MipFilter filter) {
+    return filter == MipFilter::BoxSRGB ? "sRGB" : "box";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    bool hardware = argc > 1 && std::string_view(argv[1]) == "--hardware";
+
+    wgpu::InstanceDescriptor instanceDesc = {};
+    wgpu::Instance instance = wgpu::createInstance(instanceDesc);
+    if (!instance) {
+        std::cerr << "Could not create a WebGPU instance" << std::endl;
+        return 1;
+    }
+
+    wgpu::RequestAdapterOptions adapterOpts = wgpu::Default;
+    adapterOpts.forceFallbackAdapter = !hardware;
+    wgpu::Adapter adapter = instance.requestAdapter(adapterOpts);
+    if (!adapter) {
+        std::cerr << "Could not get a" << (hardware ? "n" : " fallback") << " adapter" << std::endl;
+        instance.release();
+        return 1;
+    }
+
+    // Any validation error fails the check, even when the readback matches
+    uint32_t deviceErrors = 0;
+    wgpu::DeviceDescriptor deviceDesc = {};
+    deviceDesc.label = "Mip check device"_wgpu;
+    deviceDesc.deviceLostCallbackInfo.callback = onDeviceLost;
+    deviceDesc.uncapturedErrorCallbackInfo.callback = [](WGPUDevice const* device, WGPUErrorType type, WGPUStringView message, void* userdata1, void* userdata2) {
+        onDeviceError(device, type, message, userdata1, userdata2);
+        (*reinterpret_cast<uint32_t*>(userdata1))++;
+    };
+    deviceDesc.uncapturedErrorCallbackInfo.userdata1 = &deviceErrors;
+    wgpu::Device device = adapter.requestDevice(deviceDesc);
+    adapter.release();
+    if (!device) {
+        std::cerr << "Could not get a device" << std::endl;
+        instance.release();
+        return 1;
+    }
+
+    MipMapGenerator generator;
+    if (!generator.initialize(device, config::mipMapShaderFile)) {
+        std::cerr << "Could not load the mipmap shader at: " << config::mipMapShaderFile << std::endl;
+        device.release();
+        instance.release();
+        return 1;
+    }
+
+    std::cout << "Tolerance: " << tolerance << " per channel" << std::endl;
+    std::cout << "   size      filter  levels  max diff  mean diff" << std::endl;
+    bool valid = true;
+    uint32_t seed = 1;
+    for (const ImageSize& size : imageSizes) {
+        std::vector<unsigned char> pixels = makeImage(size.width, size.height, seed++);
+        uint32_t levelCount = MipChainBuilder::levelCount(size.width, size.height);
+
+        for (MipFilter filter : { MipFilter::Box, MipFilter::BoxSRGB }) {
+            MipChain expected;
+            MipChainBuilder::build(pixels.data(), size.width, size.height, levelCount, filter, expected);
+
+            std::vector<std::vector<unsigned char>> actual;
+            if (!generateOnGpu(device, generator, pixels, size.width, size.height, levelCount, filter, actual)) {
+                std::cerr << size.width << "x" << size.height << " " << filterName(filter) << ": could not read the levels back" << std::endl;
+                valid = false;
+                continue;
+            }
+
+            int maxDifference = 0;
+            double meanDifference = 0.0;
+            for (uint32_t level = 1; level < levelCount; level++) {
+                LevelDifference difference = compareLevel(expected.levelData(level), actual[level].data(), expected.levelSize(level));
+                if (difference.maxDifference > tolerance) {
+                    std::cerr << size.width << "x" << size.height << " " << filterName(filter)
+                              << ": level " << level << " differs by " << difference.maxDifference << std::endl;
+                    valid = false;
+                }
+                maxDifference = std::max(maxDifference, difference.maxDifference);
+                meanDifference = std::max(meanDifference, difference.meanDifference);
+            }
+
+            std::cout << std::setw(4) << size.width << "x" << std::left << std::setw(4) << size.height << std::right
+                      << std::setw(10) << filterName(filter) << std::setw(8) << levelCount
+                      << std::setw(10) << maxDifference
+                      << std::setw(11) << std::fixed << std::setprecision(4) << meanDifference << std::endl;
+        }
+    }
+
+    generator.terminate();
+    device.release();
+    instance.release();
+
+    if (deviceErrors > 0) {
+        std::cerr << deviceErrors << " device error" << (deviceErrors > 1 ? "s" : "") << std::endl;
+        valid = false;
+    }
+    std::cout << (valid ? "GPU mip chains match the CPU ones" : "GPU mip chains differ from the CPU ones") << std::endl;
+    return valid ? 0 : 1;
+}
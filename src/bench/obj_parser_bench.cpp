@@ -0,0 +1,130 @@
+// Measures ObjParser throughput against the thread count and checks that it
+// reads the same geometry as tinyobj.
+//
+// usage: ObjParserBench [file.obj] [repeats]
+
+#include "config.hpp"
+#include "obj_parser.hpp"
+#include "thread_pool.hpp"
+
+#include "tiny_obj_loader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+
+template <typename T>
+bool sameBits(const std::vector<T>& a, const std::vector<T>& b) {
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+}
+
+// Compare with what tinyobj::LoadObj returns for the same file
+bool matchesTinyObj(const std::filesystem::path& path, const ObjGeometry& geometry, double& tinyObjMs) {
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warn;
+    std::string err;
+
+    auto start = std::chrono::steady_clock::now();
+    bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.string().c_str());
+    tinyObjMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (!ret) {
+        std::cerr << "tinyobj failed: " << err << std::endl;
+        return false;
+    }
+
+    std::vector<ObjCorner> corners;
+    std::vector<SubMesh> shapeRanges;
+    for (const auto& shape : shapes) {
+        if (shape.mesh.indices.empty()) continue;
+        shapeRanges.push_back({ static_cast<uint32_t>(corners.size()), static_cast<uint32_t>(shape.mesh.indices.size()) });
+        for (const tinyobj::index_t& idx : shape.mesh.indices) {
+            corners.push_back({ idx.vertex_index, idx.texcoord_index, idx.normal_index });
+        }
+    }
+
+    bool same = true;
+    auto check = [&](bool ok, const char* what) {
+        if (!ok) std::cerr << "Mismatch with tinyobj: " << what << std::endl;
+        same = same && ok;
+    };
+    check(sameBits(attrib.vertices, geometry.positions), "positions");
+    check(sameBits(attrib.colors, geometry.colors), "colors");
+    check(sameBits(attrib.normals, geometry.normals), "normals");
+    check(sameBits(attrib.texcoords, geometry.texcoords), "texture coordinates");
+    check(sameBits(corners, geometry.corners), "triangles");
+    check(sameBits(shapeRanges, geometry.shapes), "shapes");
+    return same;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::filesystem::path path = argc > 1 ? argv[1] : config::shapeModelFile;
+    int repeats = argc > 2 ? std::max(1, std::atoi(argv[2])) : 5;
+
+    std::error_code error;
+    double megabytes = static_cast<double>(std::filesystem::file_size(path, error)) / 1e6;
+    if (error) {
+        std::cerr << "Could not read " << path << std::endl;
+        return 1;
+    }
+
+    ObjGeometry geometry;
+    if (!ObjParser::parse(path, geometry, nullptr)) {
+        return 1;
+    }
+
+    double tinyObjMs = 0.0;
+    bool same = matchesTinyObj(path, geometry, tinyObjMs);
+
+    std::cout << path.filename().string() << ": " << std::fixed << std::setprecision(1) << megabytes << " MB, "
+              << geometry.positions.size() / 3 << " vertices, " << geometry.corners.size() / 3 << " triangles" << std::endl;
+    std::cout << "tinyobj  " << std::setw(9) << tinyObjMs << " ms " << std::setw(9) << megabytes / (tinyObjMs / 1000.0) << " MB/s" << std::endl;
+
+    // 1, 2, 4, ... threads up to the number of hardware threads
+    size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> threadCounts;
+    for (size_t threads = 1; threads < hardwareThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(hardwareThreads);
+
+    double singleThreadMs = 0.0;
+    for (size_t threads : threadCounts) {
+        // The calling thread takes chunks too
+        std::unique_ptr<ThreadPool> pool;
+        if (threads > 1) pool = std::make_unique<ThreadPool>(threads - 1);
+
+        double bestMs = std::numeric_limits<double>::max();
+        for (int i = 0; i < repeats; i++) {
+            ObjGeometry result;
+            auto start = std::chrono::steady_clock::now();
+            ObjParser::parse(path, result, pool.get());
+            bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+        if (threads == 1) singleThreadMs = bestMs;
+
+        std::cout << std::setw(2) << threads << " thread" << (threads > 1 ? "s" : " ")
+                  << std::setw(9) << bestMs << " ms "
+                  << std::setw(9) << megabytes / (bestMs / 1000.0) << " MB/s "
+                  << std::setw(6) << std::setprecision(2) << singleThreadMs / bestMs << "x" << std::setprecision(1) << std::endl;
+    }
+
+    if (!same) {
+        std::cerr << "ObjParser output differs from tinyobj" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+// Renders the app's default view of an OBJ with the CPU path tracer, without
+// a window or a GPU, and writes it as a PPM. Reports rays per second, and
+// with --scaling renders again at increasing thread counts to show the
+// speedup over one thread.
+//
+// usage: ReferenceRender [file.obj] [output.ppm] [samples per pixel] [--scaling]
+
+#include "bvh.hpp"
+#include "config.hpp"
+#include "cpu_path_tracer.hpp"
+#include "resource_manager.hpp"
+#include "scene.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+void printStats(size_t threads, const CpuRenderStats& stats, double singleThreadMs) {
+    std::cout << std::setw(2) << threads << " thread" << (threads > 1 ? "s" : " ")
+              << std::fixed << std::setprecision(1) << std::setw(10) << stats.renderMilliseconds << " ms "
+              << std::setw(8) << stats.raysPerSecond * 1e-6 << " Mrays/s ";
+    if (singleThreadMs > 0.0) {
+        std::cout << std::setw(6) << std::setprecision(2) << singleThreadMs / stats.renderMilliseconds << "x ";
+    }
+    std::cout << stats.stolenTiles << "/" << stats.tileCount << " tiles stolen" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<std::string> arguments;
+    bool scaling = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--scaling") == 0) scaling = true;
+        else arguments.push_back(argv[i]);
+    }
+    std::filesystem::path path = arguments.size() > 0 ? arguments[0] : config::shapeModelFile;
+    std::filesystem::path output = arguments.size() > 1 ? arguments[1] : "reference.ppm";
+
+    CpuRenderOptions options;
+    if (arguments.size() > 2) options.samplesPerPixel = static_cast<uint32_t>(std::max(1, std::atoi(arguments[2].c_str())));
+    options.maxBounces = static_cast<uint32_t>(config::pathTracerMaxBounces);
+    options.width = 640;
+    options.height = 480;
+
+    // Same mesh, texture and view as the app starts with, built with the
+    // same options so that both share the mesh cache
+    Mesh mesh;
+    MappedFile meshCacheFile;
+    MeshView meshData;
+    MeshOptimizerOptions optimizerOptions;
+    optimizerOptions.reduceOverdraw = config::reduceMeshOverdraw;
+    optimizerOptions.chunkTriangleCount = config::meshChunkTriangleCount;
+    optimizerOptions.lodCount = config::meshLodCount;
+    optimizerOptions.lodTriangleRatio = config::meshLodTriangleRatio;
+    if (!ResourceManager::loadMesh(path, mesh, meshCacheFile, meshData, optimizerOptions)) {
+        std::cerr << "Could not load geometry file at: " << path << std::endl;
+        return 1;
+    }
+
+    CpuTexture baseColor;
+    if (!CpuTexture::load(config::textureFile, baseColor)) {
+        std::cerr << "Could not load texture at: " << config::textureFile << std::endl;
+        return 1;
+    }
+
+    Bvh bvh;
+    BvhBuildStats buildStats;
+    if (!BvhBuilder::build(meshData.vertices, meshData.baseIndices(), bvh, &ThreadPool::shared(), {}, &buildStats)) {
+        return 1;
+    }
+    std::cout << path.filename().string() << ": " << meshData.baseIndices().size() / 3 << " triangles, BVH built in "
+              << std::fixed << std::setprecision(1) << buildStats.buildMilliseconds << " ms" << std::endl;
+
+    CameraState camera;
+    CpuScene scene;
+    scene.bvh = &bvh;
+    scene.mesh = meshData;
+    scene.baseColor = &baseColor;
+    scene.lights = Scene::defaultLights();
+    scene.projectionMatrix = Scene::projectionMatrix(static_cast<float>(options.width) / static_cast<float>(options.height));
+    scene.viewMatrix = Scene::viewMatrix(camera);
+    scene.modelMatrix = glm::mat4x4(1.0f);
+    scene.cameraWorldPosition = Scene::cameraWorldPosition(camera);
+
+    std::cout << options.width << "x" << options.height << ", " << options.samplesPerPixel << " spp, "
+              << options.maxBounces << " bounces" << std::endl;
+
+    size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> threadCounts;
+    if (scaling) {
+        for (size_t threads = 1; threads < hardwareThreads; threads *= 2) {
+            threadCounts.push_back(threads);
+        }
+    }
+    threadCounts.push_back(hardwareThreads);
+
+    std::vector<glm::vec3> image;
+    double singleThreadMs = 0.0;
+    for (size_t threads : threadCounts) {
+        // The calling thread renders too
+        std::unique_ptr<ThreadPool> pool;
+        if (threads > 1) pool = std::make_unique<ThreadPool>(threads - 1);
+
+        CpuRenderStats stats;
+        if (!CpuPathTracer::render(scene, options, pool.get(), image, &stats)) return 1;
+        if (threads == 1) singleThreadMs = stats.renderMilliseconds;
+        printStats(threads, stats, singleThreadMs);
+    }
+
+    if (!CpuPathTracer::writeImage(output, options.width, options.height, image)) {
+        std::cerr << "Could not write image at: " << output << std::endl;
+        return 1;
+    }
+    std::cout << "Wrote " << output.string() << std::endl;
+    return 0;
+}
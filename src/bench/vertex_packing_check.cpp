@@ -0,0 +1,165 @@
+// Checks that packing vertices stays within the error bounds the packer
+// states. Packs the shipped mesh and synthetic meshes covering the edge
+// cases (degenerate bounds, a plane far from the origin, axis aligned and
+// octahedron edge normals, texture coordinates outside [0, 1]) with both
+// position encodings, and fails when any attribute drifts past
+// VertexPacker::errorBound().
+//
+// usage: VertexPackingCheck [file.obj]
+
+#include "config.hpp"
+#include "resource_manager.hpp"
+#include "vertex_packing.hpp"
+
+#include <cmath>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct TestMesh {
+    std::string name;
+    std::vector<VertexAttributes> vertices;
+};
+
+VertexAttributes makeVertex(glm::vec3 position, glm::vec3 normal, glm::vec2 uv) {
+    return { position, normal, glm::vec3(0.25f, 0.5f, 1.0f), uv };
+}
+
+Bounds boundsOf(const std::vector<VertexAttributes>& vertices) {
+    Bounds bounds;
+    for (const VertexAttributes& v : vertices) bounds.extend(v.position);
+    return bounds;
+}
+
+// Every vertex at the same point, the bounds have no extent at all
+TestMesh singlePoint() {
+    TestMesh mesh{ "single point", {} };
+    for (int i = 0; i < 16; i++) {
+        mesh.vertices.push_back(makeVertex(glm::vec3(3.5f, -2.0f, 0.125f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec2(0.5f)));
+    }
+    return mesh;
+}
+
+// Flat along z and far from the origin, where float rounding is coarse
+TestMesh offsetPlane() {
+    TestMesh mesh{ "offset plane", {} };
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coordinate(-50.0f, 50.0f);
+    for (int i = 0; i < 4096; i++) {
+        glm::vec3 position(1000.0f + coordinate(rng), -2000.0f + coordinate(rng), 4096.0f);
+        mesh.vertices.push_back(makeVertex(position, glm::vec3(0.0f, 0.0f, -1.0f), glm::vec2(0.0f)));
+    }
+    return mesh;
+}
+
+// Normals on the axes, on the edges of the octahedron where its lower half
+// unfolds, and zero
+TestMesh edgeNormals() {
+    TestMesh mesh{ "edge normals", {} };
+    const glm::vec3 normals[] = {
+        { 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f },
+        { 0.0f, 1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+        { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f },
+        { 1.0f, 1.0f, 0.0f }, { -1.0f, 1.0f, 0.0f }, { 1.0f, -1.0f, 0.0f }, { -1.0f, -1.0f, 0.0f },
+        { 1.0f, 0.0f, -1.0f }, { 0.0f, -1.0f, -1.0f }, { -1.0f, 0.0f, -1.0f }, { 0.0f, 1.0f, -1.0f },
+        { 1.0f, 1.0f, -1.0f }, { -1.0f, -1.0f, -1.0f }, { 1e-7f, 0.0f, -1.0f }, { 0.0f, -1e-7f, -1.0f },
+        { 0.0f, 0.0f, 0.0f },
+    };
+    float x = 0.0f;
+    for (const glm::vec3& normal : normals) {
+        mesh.vertices.push_back(makeVertex(glm::vec3(x, 0.0f, 0.0f), normal, glm::vec2(0.5f)));
+        x += 1.0f;
+    }
+    return mesh;
+}
+
+// Tiled, mirrored and subnormal texture coordinates
+TestMesh wrappedUvs() {
+    TestMesh mesh{ "uv outside [0, 1]", {} };
+    const float values[] = { -3.75f, -1.0f, -1e-3f, -1e-6f, 0.0f, 1e-6f, 1.0001f, 2.5f, 17.3f, 255.9f, 2048.5f };
+    float x = 0.0f;
+    for (float u : values) {
+        for (float v : values) {
+            mesh.vertices.push_back(makeVertex(glm::vec3(x, 1.0f, -1.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(u, v)));
+            x += 0.5f;
+        }
+    }
+    return mesh;
+}
+
+// Random points, normals and colors in a large box
+TestMesh randomCloud() {
+    TestMesh mesh{ "random cloud", {} };
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> coordinate(-500.0f, 500.0f);
+    std::normal_distribution<float> direction(0.0f, 1.0f);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int i = 0; i < 65536; i++) {
+        VertexAttributes v;
+        v.position = glm::vec3(coordinate(rng), coordinate(rng), 0.01f * coordinate(rng));
+        v.normal = glm::vec3(direction(rng), direction(rng), direction(rng));
+        v.color = glm::vec3(unit(rng), unit(rng), unit(rng));
+        v.uv = glm::vec2(unit(rng), 4.0f * unit(rng) - 2.0f);
+        mesh.vertices.push_back(v);
+    }
+    return mesh;
+}
+
+const char* encodingName(PositionEncoding encoding) {
+    return encoding == PositionEncoding::Float16 ? "float16" : "unorm16";
+}
+
+bool exceeds(const PackingError& error, const PackingError& bound) {
+    return error.position > bound.position || error.normalDegrees > bound.normalDegrees
+        || error.color > bound.color || error.uv > bound.uv;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::filesystem::path path = argc > 1 ? argv[1] : config::shapeModelFile;
+
+    std::vector<TestMesh> meshes;
+    Mesh shipped;
+    if (!ResourceManager::loadGeometryFromObj(path, shipped)) {
+        std::cerr << "Could not load geometry file at: " << path << std::endl;
+        return 1;
+    }
+    meshes.push_back({ path.filename().string(), std::move(shipped.vertices) });
+    meshes.push_back(singlePoint());
+    meshes.push_back(offsetPlane());
+    meshes.push_back(edgeNormals());
+    meshes.push_back(wrappedUvs());
+    meshes.push_back(randomCloud());
+
+    std::cout << "mesh                 encoding   position (bound)         normal deg (bound)     color (bound)          uv (bound)" << std::endl;
+    bool valid = true;
+    for (const TestMesh& mesh : meshes) {
+        for (PositionEncoding encoding : { PositionEncoding::Unorm16, PositionEncoding::Float16 }) {
+            VertexQuantization quantization = VertexPacker::quantization(boundsOf(mesh.vertices), encoding);
+            std::vector<PackedVertex> packed;
+            VertexPacker::pack(mesh.vertices, quantization, encoding, packed);
+
+            PackingError error = VertexPacker::measureError(mesh.vertices, packed, quantization, encoding);
+            PackingError bound = VertexPacker::errorBound(mesh.vertices, quantization, encoding);
+            bool failed = exceeds(error, bound);
+            valid = valid && !failed;
+
+            std::cout << std::left << std::setw(21) << mesh.name << std::setw(9) << encodingName(encoding) << std::right
+                      << std::scientific << std::setprecision(3)
+                      << std::setw(12) << error.position << " (" << bound.position << ")"
+                      << std::setw(12) << error.normalDegrees << " (" << bound.normalDegrees << ")"
+                      << std::setw(12) << error.color << " (" << bound.color << ")"
+                      << std::setw(12) << error.uv << " (" << bound.uv << ")"
+                      << (failed ? "  EXCEEDED" : "") << std::endl;
+        }
+    }
+
+    std::cout << (valid ? "Packed vertices stay within their error bounds" : "Packed vertices exceed their error bounds") << std::endl;
+    return valid ? 0 : 1;
+}
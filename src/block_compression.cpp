@@ -0,0 +1,509 @@
+#include "block_compression.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+constexpr uint32_t texelsPerBlock = 16;
+
+// Below this many blocks a task is not worth scheduling
+constexpr size_t minBlocksPerTask = 256;
+
+// Least squares refinements of the endpoints after the first fit
+constexpr int refinementCount = 2;
+
+// Interpolation weights of 4 bit BC7 indices, out of 64
+constexpr int bc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+/**
+ * Mean and principal axis of the 16 points of a block over `channels`, by
+ * power iteration on their covariance. The axis is zero when all points
+ * are equal.
+ */
+void principalAxis(const float (*points)[4], int channels, float mean[4], float axis[4]) {
+    for (int c = 0; c < 4; c++) {
+        mean[c] = 0.0f;
+        axis[c] = 0.0f;
+    }
+    for (uint32_t i = 0; i < texelsPerBlock; i++) {
+        for (int c = 0; c < channels; c++) mean[c] += points[i][c];
+    }
+    for (int c = 0; c < channels; c++) mean[c] /= texelsPerBlock;
+
+    float covariance[4][4] = {};
+    for (uint32_t i = 0; i < texelsPerBlock; i++) {
+        for (int a = 0; a < channels; a++) {
+            float da = points[i][a] - mean[a];
+            for (int b = a; b < channels; b++) {
+                covariance[a][b] += da * (points[i][b] - mean[b]);
+            }
+        }
+    }
+    for (int a = 0; a < channels; a++) {
+        for (int b = 0; b < a; b++) covariance[a][b] = covariance[b][a];
+    }
+
+    // Start from the channel of largest variance, which is never orthogonal
+    // to the principal axis unless the block is flat
+    int start = 0;
+    for (int c = 1; c < channels; c++) {
+        if (covariance[c][c] > covariance[start][start]) start = c;
+    }
+    if (covariance[start][start] <= 0.0f) return;
+
+    float v[4] = {};
+    v[start] = 1.0f;
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[4] = {};
+        for (int a = 0; a < channels; a++) {
+            for (int b = 0; b < channels; b++) next[a] += covariance[a][b] * v[b];
+        }
+        float length = 0.0f;
+        for (int c = 0; c < channels; c++) length += next[c] * next[c];
+        length = std::sqrt(length);
+        if (length <= 0.0f) return;
+        for (int c = 0; c < channels; c++) v[c] = next[c] / length;
+    }
+    for (int c = 0; c < channels; c++) axis[c] = v[c];
+}
+
+// Ends of the projection of the points on the axis through their mean
+void fitEndpoints(const float (*points)[4], int channels, float inset, float low[4], float high[4]) {
+    float mean[4], axis[4];
+    principalAxis(points, channels, mean, axis);
+
+    float minT = 0.0f, maxT = 0.0f;
+    for (uint32_t i = 0; i < texelsPerBlock; i++) {
+        float t = 0.0f;
+        for (int c = 0; c < channels; c++) t += (points[i][c] - mean[c]) * axis[c];
+        minT = std::min(minT, t);
+        maxT = std::max(maxT, t);
+    }
+
+    // Pull the ends in, the extreme texels are rarely worth a palette entry
+    float shrink = (maxT - minT) * inset;
+    minT += shrink;
+    maxT -= shrink;
+    for (int c = 0; c < channels; c++) {
+        low[c] = std::clamp(mean[c] + axis[c] * minT, 0.0f, 255.0f);
+        high[c] = std::clamp(mean[c] + axis[c] * maxT, 0.0f, 255.0f);
+    }
+}
+
+/**
+ * Endpoints minimizing the squared error of `points` for the given
+ * interpolation weights of the high endpoint. Returns false when the
+ * weights do not constrain both endpoints.
+ */
+bool solveEndpoints(const float (*points)[4], int channels, const float* weights, float low[4], float high[4]) {
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[4] = {}, bx[4] = {};
+    for (uint32_t i = 0; i < texelsPerBlock; i++) {
+        float b = weights[i];
+        float a = 1.0f - b;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = 0; c < channels; c++) {
+            ax[c] += a * points[i][c];
+            bx[c] += b * points[i][c];
+        }
+    }
+
+    float determinant = aa * bb - ab * ab;
+    if (std::abs(determinant) < 1e-6f) return false;
+    for (int c = 0; c < channels; c++) {
+        low[c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+        high[c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+    }
+    return true;
+}
+
+void loadTexels(const unsigned char* texels, int channels, float points[16][4]) {
+    for (uint32_t i = 0; i < texelsPerBlock; i++) {
+        for (int c = 0; c < 4; c++) points[i][c] = c < channels ? texels[4 * i + c] : 255.0f;
+    }
+}
+
+// BC1
+
+uint16_t packRgb565(const float color[4]) {
+    auto quantize = [](float value, int maxValue) {
+        return static_cast<uint16_t>(std::clamp(static_cast<int>(std::lround(value * maxValue / 255.0f)), 0, maxValue));
+    };
+    return static_cast<uint16_t>((quantize(color[0], 31) << 11) | (quantize(color[1], 63) << 5) | quantize(color[2], 31));
+}
+
+void unpackRgb565(uint16_t packed, int color[3]) {
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// Palette of the four color mode, whichever endpoint is larger
+void bc1Palette(uint16_t color0, uint16_t color1, int palette[4][3]) {
+    unpackRgb565(color0, palette[0]);
+    unpackRgb565(color1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+}
+
+// Pick the closest palette entry of every texel, return the total error
+float bc1Indices(const float points[16][4], uint16_t color0, uint16_t color1, uint8_t indices[16]) {
+    int palette[4][3];
+    bc1Palette(color0, color1, palette);
+
+    float total = 0.0f;
+    for (uint32_t i = 0; i < texelsPerBlock; i++) {
+        float best = INFINITY;
+        for (uint8_t entry = 0; entry < 4; entry++) {
+            float error = 0.0f;
+            for (int c = 0; c < 3; c++) {
+                float d = points[i][c] - static_cast<float>(palette[entry][c]);
+                error += d * d;
+            }
+            if (error < best) {
+                best = error;
+                indices[i] = entry;
+            }
+        }
+        total += best;
+    }
+    return total;
+}
+
+// Weight of color1 for indices 0 to 3
+constexpr float bc1Weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+// BC7 mode 6
+
+struct Bc7Endpoint {
+    // 7 bit channel values and the shared low bit
+    int values[4];
+    int pBit;
+};
+
+// Closest endpoint to `color`, trying both low bits
+Bc7Endpoint quantizeBc7Endpoint(const float color[4]) {
+    Bc7Endpoint best{};
+    float bestError = INFINITY;
+    for (int pBit = 0; pBit < 2; pBit++) {
+        Bc7Endpoint candidate{};
+        candidate.pBit = pBit;
+        float error = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            int value = std::clamp(static_cast<int>(std::lround((color[c] - pBit) / 2.0f)), 0, 127);
+            candidate.values[c] = value;
+            float d = color[c] - static_cast<float>(2 * value + pBit);
+            error += d * d;
+        }
+        if (error < bestError) {
+            bestError = error;
+            best = candidate;
+        }
+    }
+    return best;
+}
+
+void bc7Palette(const Bc7Endpoint& low, const Bc7Endpoint& high, int palette[16][4]) {
+    for (int c = 0; c < 4; c++) {
+        int e0 = 2 * low.values[c] + low.pBit;
+        int e1 = 2 * high.values[c] + high.pBit;
+        for (int index = 0; index < 16; index++) {
+            palette[index][c] = ((64 - bc7Weights[index]) * e0 + bc7Weights[index] * e1 + 32) >> 6;
+        }
+    }
+}
+
+float bc7Indices(const float points[16][4], const Bc7Endpoint& low, const Bc7Endpoint& high, uint8_t indices[16]) {
+    int palette[16][4];
+    bc7Palette(low, high, palette);
+
+    float total = 0.0f;
+    for (uint32_t i = 0; i < texelsPerBlock; i++) {
+        float best = INFINITY;
+        for (uint8_t entry = 0; entry < 16; entry++) {
+            float error = 0.0f;
+            for (int c = 0; c < 4; c++) {
+                float d = points[i][c] - static_cast<float>(palette[entry][c]);
+                error += d * d;
+            }
+            if (error < best) {
+                best = error;
+                indices[i] = entry;
+            }
+        }
+        total += best;
+    }
+    return total;
+}
+
+// Little endian bit stream of a 128 bit BC7 block
+class BlockBits {
+public:
+    explicit BlockBits(unsigned char* data) : data(data) {}
+
+    void write(uint32_t value, int bitCount) {
+        for (int bit = 0; bit < bitCount; bit++, position++) {
+            if ((value >> bit) & 1) data[position >> 3] |= static_cast<unsigned char>(1 << (position & 7));
+        }
+    }
+
+    uint32_t read(int bitCount) {
+        uint32_t value = 0;
+        for (int bit = 0; bit < bitCount; bit++, position++) {
+            value |= static_cast<uint32_t>((data[position >> 3] >> (position & 7)) & 1) << bit;
+        }
+        return value;
+    }
+
+private:
+    unsigned char* data;
+    int position = 0;
+};
+
+// Calls `body(texels, block)` for every block of the image, split across the pool
+template <typename Body>
+void forEachBlock(uint32_t width, uint32_t height, Body body) {
+    size_t blocksX = (width + BlockCompressor::blockSize - 1) / BlockCompressor::blockSize;
+    size_t blocksY = (height + BlockCompressor::blockSize - 1) / BlockCompressor::blockSize;
+    size_t rowsPerTask = std::max<size_t>(1, minBlocksPerTask / blocksX);
+    ThreadPool::shared().parallelFor(blocksY, rowsPerTask, [&](size_t begin, size_t end) {
+        for (size_t by = begin; by < end; by++) {
+            for (size_t bx = 0; bx < blocksX; bx++) {
+                body(static_cast<uint32_t>(bx), static_cast<uint32_t>(by), by * blocksX + bx);
+            }
+        }
+    });
+}
+
+} // namespace
+
+uint32_t BlockCompressor::blockBytes(BlockFormat format) {
+    return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+size_t BlockCompressor::compressedSize(uint32_t width, uint32_t height, BlockFormat format) {
+    size_t blocksX = (width + blockSize - 1) / blockSize;
+    size_t blocksY = (height + blockSize - 1) / blockSize;
+    return blocksX * blocksY * blockBytes(format);
+}
+
+void BlockCompressor::compress(
+    const unsigned char* pixelData,
+    uint32_t width, uint32_t height,
+    BlockFormat format,
+    unsigned char* compressedData
+) {
+    uint32_t bytes = blockBytes(format);
+    forEachBlock(width, height, [&](uint32_t bx, uint32_t by, size_t blockIndex) {
+        unsigned char texels[4 * texelsPerBlock];
+        for (uint32_t y = 0; y < blockSize; y++) {
+            uint32_t sy = std::min(by * blockSize + y, height - 1);
+            for (uint32_t x = 0; x < blockSize; x++) {
+                uint32_t sx = std::min(bx * blockSize + x, width - 1);
+                std::memcpy(&texels[4 * (y * blockSize + x)], &pixelData[4 * (static_cast<size_t>(sy) * width + sx)], 4);
+            }
+        }
+
+        unsigned char* block = compressedData + blockIndex * bytes;
+        if (format == BlockFormat::BC1) {
+            encodeBC1(texels, block);
+        }
+        else {
+            encodeBC7(texels, block);
+        }
+    });
+}
+
+void BlockCompressor::decompress(
+    const unsigned char* compressedData,
+    uint32_t width, uint32_t height,
+    BlockFormat format,
+    unsigned char* pixelData
+) {
+    uint32_t bytes = blockBytes(format);
+    forEachBlock(width, height, [&](uint32_t bx, uint32_t by, size_t blockIndex) {
+        unsigned char texels[4 * texelsPerBlock];
+        const unsigned char* block = compressedData + blockIndex * bytes;
+        if (format == BlockFormat::BC1) {
+            decodeBC1(block, texels);
+        }
+        else {
+            decodeBC7(block, texels);
+        }
+
+        for (uint32_t y = 0; y < blockSize && by * blockSize + y < height; y++) {
+            for (uint32_t x = 0; x < blockSize && bx * blockSize + x < width; x++) {
+                size_t target = static_cast<size_t>(by * blockSize + y) * width + bx * blockSize + x;
+                std::memcpy(&pixelData[4 * target], &texels[4 * (y * blockSize + x)], 4);
+            }
+        }
+    });
+}
+
+bool BlockCompressor::isOpaque(const unsigned char* pixelData, uint32_t width, uint32_t height) {
+    size_t count = static_cast<size_t>(width) * height;
+    for (size_t i = 0; i < count; i++) {
+        if (pixelData[4 * i + 3] != 255) return false;
+    }
+    return true;
+}
+
+void BlockCompressor::encodeBC1(const unsigned char* texels, unsigned char* block) {
+    float points[16][4];
+    loadTexels(texels, 3, points);
+
+    float low[4], high[4];
+    fitEndpoints(points, 3, 1.0f / 16.0f, low, high);
+    uint16_t color0 = packRgb565(high);
+    uint16_t color1 = packRgb565(low);
+    uint8_t indices[16];
+    float error = bc1Indices(points, color0, color1, indices);
+
+    for (int iteration = 0; iteration < refinementCount && error > 0.0f; iteration++) {
+        float weights[16];
+        for (uint32_t i = 0; i < texelsPerBlock; i++) weights[i] = bc1Weights[indices[i]];
+        if (!solveEndpoints(points, 3, weights, high, low)) break;
+
+        uint16_t candidate0 = packRgb565(high);
+        uint16_t candidate1 = packRgb565(low);
+        uint8_t candidateIndices[16];
+        float candidateError = bc1Indices(points, candidate0, candidate1, candidateIndices);
+        if (candidateError >= error) break;
+        color0 = candidate0;
+        color1 = candidate1;
+        error = candidateError;
+        std::memcpy(indices, candidateIndices, sizeof(indices));
+    }
+
+    // The four color mode needs color0 > color1, swapping the endpoints
+    // swaps indices 0 and 1, and 2 and 3
+    if (color0 < color1) {
+        std::swap(color0, color1);
+        for (uint8_t& index : indices) index ^= 1;
+    }
+    else if (color0 == color1) {
+        std::memset(indices, 0, sizeof(indices));
+    }
+
+    uint32_t packedIndices = 0;
+    for (uint32_t i = 0; i < texelsPerBlock; i++) packedIndices |= static_cast<uint32_t>(indices[i]) << (2 * i);
+
+    block[0] = static_cast<unsigned char>(color0 & 0xff);
+    block[1] = static_cast<unsigned char>(color0 >> 8);
+    block[2] = static_cast<unsigned char>(color1 & 0xff);
+    block[3] = static_cast<unsigned char>(color1 >> 8);
+    for (int i = 0; i < 4; i++) block[4 + i] = static_cast<unsigned char>(packedIndices >> (8 * i));
+}
+
+void BlockCompressor::encodeBC7(const unsigned char* texels, unsigned char* block) {
+    float points[16][4];
+    loadTexels(texels, 4, points);
+
+    float low[4], high[4];
+    fitEndpoints(points, 4, 0.0f, low, high);
+    Bc7Endpoint endpoint0 = quantizeBc7Endpoint(low);
+    Bc7Endpoint endpoint1 = quantizeBc7Endpoint(high);
+    uint8_t indices[16];
+    float error = bc7Indices(points, endpoint0, endpoint1, indices);
+
+    for (int iteration = 0; iteration < refinementCount && error > 0.0f; iteration++) {
+        float weights[16];
+        for (uint32_t i = 0; i < texelsPerBlock; i++) weights[i] = bc7Weights[indices[i]] / 64.0f;
+        if (!solveEndpoints(points, 4, weights, low, high)) break;
+
+        Bc7Endpoint candidate0 = quantizeBc7Endpoint(low);
+        Bc7Endpoint candidate1 = quantizeBc7Endpoint(high);
+        uint8_t candidateIndices[16];
+        float candidateError = bc7Indices(points, candidate0, candidate1, candidateIndices);
+        if (candidateError >= error) break;
+        endpoint0 = candidate0;
+        endpoint1 = candidate1;
+        error = candidateError;
+        std::memcpy(indices, candidateIndices, sizeof(indices));
+    }
+
+    // The top bit of the first index is implied zero, swap the endpoints
+    // to make it so
+    if (indices[0] >= 8) {
+        std::swap(endpoint0, endpoint1);
+        for (uint8_t& index : indices) index = static_cast<uint8_t>(15 - index);
+    }
+
+    std::memset(block, 0, 16);
+    BlockBits bits(block);
+    bits.write(1 << 6, 7);
+    for (int c = 0; c < 4; c++) {
+        bits.write(static_cast<uint32_t>(endpoint0.values[c]), 7);
+        bits.write(static_cast<uint32_t>(endpoint1.values[c]), 7);
+    }
+    bits.write(static_cast<uint32_t>(endpoint0.pBit), 1);
+    bits.write(static_cast<uint32_t>(endpoint1.pBit), 1);
+    bits.write(indices[0], 3);
+    for (uint32_t i = 1; i < texelsPerBlock; i++) bits.write(indices[i], 4);
+}
+
+void BlockCompressor::decodeBC1(const unsigned char* block, unsigned char* texels) {
+    uint16_t color0 = static_cast<uint16_t>(block[0] | (block[1] << 8));
+    uint16_t color1 = static_cast<uint16_t>(block[2] | (block[3] << 8));
+    uint32_t packedIndices = static_cast<uint32_t>(block[4]) | (static_cast<uint32_t>(block[5]) << 8)
+        | (static_cast<uint32_t>(block[6]) << 16) | (static_cast<uint32_t>(block[7]) << 24);
+
+    int palette[4][4];
+    unpackRgb565(color0, palette[0]);
+    unpackRgb565(color1, palette[1]);
+    palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+    for (int c = 0; c < 3; c++) {
+        if (color0 > color1) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        else {
+            // Three colors and transparent black
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+    if (color0 <= color1) palette[3][3] = 0;
+
+    for (uint32_t i = 0; i < texelsPerBlock; i++) {
+        const int* color = palette[(packedIndices >> (2 * i)) & 3];
+        for (int c = 0; c < 4; c++) texels[4 * i + c] = static_cast<unsigned char>(color[c]);
+    }
+}
+
+void BlockCompressor::decodeBC7(const unsigned char* block, unsigned char* texels) {
+    // Mode 6 is six zero bits then a one
+    if ((block[0] & 0x7f) != 1 << 6) {
+        std::memset(texels, 0, 4 * texelsPerBlock);
+        return;
+    }
+
+    unsigned char data[16];
+    std::memcpy(data, block, sizeof(data));
+    BlockBits bits(data);
+    bits.read(7);
+    Bc7Endpoint endpoint0{}, endpoint1{};
+    for (int c = 0; c < 4; c++) {
+        endpoint0.values[c] = static_cast<int>(bits.read(7));
+        endpoint1.values[c] = static_cast<int>(bits.read(7));
+    }
+    endpoint0.pBit = static_cast<int>(bits.read(1));
+    endpoint1.pBit = static_cast<int>(bits.read(1));
+
+    int palette[16][4];
+    bc7Palette(endpoint0, endpoint1, palette);
+    for (uint32_t i = 0; i < texelsPerBlock; i++) {
+        uint32_t index = bits.read(i == 0 ? 3 : 4);
+        for (int c = 0; c < 4; c++) texels[4 * i + c] = static_cast<unsigned char>(palette[index][c]);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef _BLOCK_COMPRESSION_H
+#define _BLOCK_COMPRESSION_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Block compressed formats produced by BlockCompressor. Both encode 4x4
+ * texel blocks.
+ */
+enum class BlockFormat {
+    // 8 bytes per block, two RGB565 endpoints and 2 bit indices, opaque only
+    BC1,
+    // 16 bytes per block, RGBA endpoints and 4 bit indices (mode 6 only)
+    BC7,
+};
+
+/**
+ * CPU encoder for BC1 and BC7. Endpoints come from the principal axis of
+ * the block's colors and are refined by least squares against the chosen
+ * indices. Rows of blocks are split across ThreadPool::shared().
+ */
+class BlockCompressor {
+public:
+    static constexpr uint32_t blockSize = 4;
+
+    static uint32_t blockBytes(BlockFormat format);
+
+    /**
+     * Bytes taken by a `width` x `height` image, partial blocks included
+     */
+    static size_t compressedSize(uint32_t width, uint32_t height, BlockFormat format);
+
+    /**
+     * Compress the RGBA8 image in `pixelData` into `compressedData`, which
+     * must hold compressedSize() bytes. Blocks overhanging the image repeat
+     * its last row and column.
+     */
+    static void compress(
+        const unsigned char* pixelData,
+        uint32_t width, uint32_t height,
+        BlockFormat format,
+        unsigned char* compressedData
+    );
+
+    /**
+     * Expand `compressedData` back to RGBA8, to measure the encoding error.
+     * BC7 blocks other than mode 6 decode to black.
+     */
+    static void decompress(
+        const unsigned char* compressedData,
+        uint32_t width, uint32_t height,
+        BlockFormat format,
+        unsigned char* pixelData
+    );
+
+    /**
+     * Whether every texel has an alpha of 255, so that BC1 loses nothing
+     * on the alpha channel
+     */
+    static bool isOpaque(const unsigned char* pixelData, uint32_t width, uint32_t height);
+
+    // Single block encoders, `texels` holds 16 RGBA8 texels in row order
+    static void encodeBC1(const unsigned char* texels, unsigned char* block);
+    static void encodeBC7(const unsigned char* texels, unsigned char* block);
+
+    static void decodeBC1(const unsigned char* block, unsigned char* texels);
+    static void decodeBC7(const unsigned char* block, unsigned char* texels);
+};
+
+#endif // _BLOCK_COMPRESSION_H
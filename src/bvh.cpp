@@ -0,0 +1,483 @@
+#include "bvh.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+
+namespace {
+
+// Triangles per pool task when binning a large node
+constexpr size_t binningGrainSize = 16 * 1024;
+constexpr uint32_t maxBinCount = 64;
+// Below this depth nodes are cut at their median instead, which reaches
+// single triangles within 31 more levels
+constexpr uint32_t medianSplitDepth = bvhMaxDepth - 32;
+constexpr int traversalStackSize = bvhMaxDepth;
+
+void grow(Bounds& bounds, const Bounds& other) {
+    bounds.min = glm::min(bounds.min, other.min);
+    bounds.max = glm::max(bounds.max, other.max);
+}
+
+float surfaceArea(const Bounds& bounds) {
+    if (bounds.isEmpty()) return 0.0f;
+    glm::vec3 extent = bounds.max - bounds.min;
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+// Left uninitialized by default, BinSet only resets the bins in use
+struct Bin {
+    glm::vec3 min;
+    glm::vec3 max;
+    uint32_t count;
+};
+
+// Bins of the three axes, reduced over a range of triangles
+struct BinSet {
+    explicit BinSet(uint32_t binCount) {
+        Bin empty = { Bounds().min, Bounds().max, 0 };
+        for (int axis = 0; axis < 3; axis++) {
+            std::fill_n(bins[axis], binCount, empty);
+        }
+    }
+
+    Bin bins[3][maxBinCount];
+};
+
+// Bounds of a triangle, partitioned along with its id so that every pass
+// over a node reads memory sequentially
+struct TriangleRef {
+    glm::vec3 min;
+    uint32_t id;
+    glm::vec3 max;
+
+    glm::vec3 centroid() const { return 0.5f * (min + max); }
+};
+
+// Bounds of the triangles and of their centroids
+struct RangeBounds {
+    Bounds bounds;
+    Bounds centroids;
+};
+
+struct BuildContext {
+    BuildContext(const BvhBuildOptions& options, ThreadPool* pool)
+        : options(options)
+        , pool(pool)
+    {}
+
+    const BvhBuildOptions& options;
+    ThreadPool* pool;
+
+    // Partitioned in place as nodes are split
+    std::vector<TriangleRef> refs;
+
+    std::vector<BvhNode> nodes;
+    std::atomic<uint32_t> nodeCount{ 0 };
+    std::atomic<uint32_t> leafCount{ 0 };
+    std::atomic<uint32_t> maxDepth{ 0 };
+};
+
+/**
+ * Run `body(begin, end, partial)` over chunks of [first, first + count) and
+ * merge the partial results into `result`, in parallel when the range is
+ * large enough. Partial results start as copies of the initial `result`.
+ */
+template <typename T, typename Body, typename Merge>
+void reduceRange(BuildContext& ctx, uint32_t first, uint32_t count, T& result, Body body, Merge merge) {
+    if (!ctx.pool || count < 2 * binningGrainSize) {
+        body(first, first + count, result);
+        return;
+    }
+
+    const T empty = result;
+    std::mutex mutex;
+    ctx.pool->parallelFor(count, binningGrainSize, [&](size_t begin, size_t end) {
+        T partial = empty;
+        body(first + static_cast<uint32_t>(begin), first + static_cast<uint32_t>(end), partial);
+        std::lock_guard<std::mutex> lock(mutex);
+        merge(result, partial);
+    });
+}
+
+void makeLeaf(BuildContext& ctx, BvhNode& node, uint32_t first, uint32_t count, uint32_t depth) {
+    node.leftFirst = first;
+    node.triangleCount = count;
+    ctx.leafCount.fetch_add(1);
+
+    uint32_t deepest = ctx.maxDepth.load();
+    while (depth > deepest && !ctx.maxDepth.compare_exchange_weak(deepest, depth)) {}
+}
+
+void buildNode(BuildContext& ctx, uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth) {
+    const BvhBuildOptions& options = ctx.options;
+    BvhNode& node = ctx.nodes[nodeIndex];
+
+    RangeBounds range;
+    reduceRange(ctx, first, count, range,
+        [&](uint32_t begin, uint32_t end, RangeBounds& partial) {
+            for (uint32_t i = begin; i < end; i++) {
+                const TriangleRef& ref = ctx.refs[i];
+                partial.bounds.min = glm::min(partial.bounds.min, ref.min);
+                partial.bounds.max = glm::max(partial.bounds.max, ref.max);
+                partial.centroids.extend(ref.centroid());
+            }
+        },
+        [](RangeBounds& result, const RangeBounds& partial) {
+            grow(result.bounds, partial.bounds);
+            grow(result.centroids, partial.centroids);
+        }
+    );
+    node.boundsMin = range.bounds.min;
+    node.boundsMax = range.bounds.max;
+
+    glm::vec3 centroidExtent = range.centroids.max - range.centroids.min;
+    bool splittable = centroidExtent.x > 0.0f || centroidExtent.y > 0.0f || centroidExtent.z > 0.0f;
+    if (count == 1 || (!splittable && count <= options.maxLeafSize)) {
+        makeLeaf(ctx, node, first, count, depth);
+        return;
+    }
+
+    uint32_t split = first + count / 2;
+    if (splittable && depth >= medianSplitDepth) {
+        if (count <= options.maxLeafSize) {
+            makeLeaf(ctx, node, first, count, depth);
+            return;
+        }
+        int axis = centroidExtent.x >= centroidExtent.y && centroidExtent.x >= centroidExtent.z ? 0
+            : centroidExtent.y >= centroidExtent.z ? 1 : 2;
+        std::nth_element(ctx.refs.begin() + first, ctx.refs.begin() + split, ctx.refs.begin() + first + count, [axis](const TriangleRef& a, const TriangleRef& b) {
+            return a.min[axis] + a.max[axis] < b.min[axis] + b.max[axis];
+        });
+    }
+    else if (splittable) {
+        // === Bin centroids along every axis
+        uint32_t binCount = std::clamp(options.binCount, 2u, maxBinCount);
+        glm::vec3 binScale(0.0f);
+        for (int axis = 0; axis < 3; axis++) {
+            if (centroidExtent[axis] > 0.0f) {
+                binScale[axis] = static_cast<float>(binCount) / centroidExtent[axis];
+            }
+        }
+        auto binIndex = [&](const glm::vec3& centroid, int axis) {
+            float position = (centroid[axis] - range.centroids.min[axis]) * binScale[axis];
+            return std::min(static_cast<uint32_t>(std::max(position, 0.0f)), binCount - 1);
+        };
+
+        BinSet binned(binCount);
+        reduceRange(ctx, first, count, binned,
+            [&](uint32_t begin, uint32_t end, BinSet& partial) {
+                for (uint32_t i = begin; i < end; i++) {
+                    const TriangleRef& ref = ctx.refs[i];
+                    glm::vec3 centroid = ref.centroid();
+                    for (int axis = 0; axis < 3; axis++) {
+                        Bin& bin = partial.bins[axis][binIndex(centroid, axis)];
+                        bin.min = glm::min(bin.min, ref.min);
+                        bin.max = glm::max(bin.max, ref.max);
+                        bin.count++;
+                    }
+                }
+            },
+            [binCount](BinSet& result, const BinSet& partial) {
+                for (int axis = 0; axis < 3; axis++) {
+                    for (uint32_t b = 0; b < binCount; b++) {
+                        Bin& bin = result.bins[axis][b];
+                        bin.min = glm::min(bin.min, partial.bins[axis][b].min);
+                        bin.max = glm::max(bin.max, partial.bins[axis][b].max);
+                        bin.count += partial.bins[axis][b].count;
+                    }
+                }
+            }
+        );
+
+        // === Sweep the split planes between bins
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1;
+        uint32_t bestBin = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            if (centroidExtent[axis] <= 0.0f) continue;
+            const Bin* bins = binned.bins[axis];
+
+            // Cost of the right side of every plane
+            float rightCosts[maxBinCount];
+            Bounds right;
+            uint32_t rightCount = 0;
+            for (uint32_t b = binCount - 1; b > 0; b--) {
+                if (bins[b].count > 0) {
+                    right.extend(bins[b].min);
+                    right.extend(bins[b].max);
+                }
+                rightCount += bins[b].count;
+                rightCosts[b] = surfaceArea(right) * static_cast<float>(rightCount);
+            }
+
+            Bounds left;
+            uint32_t leftCount = 0;
+            for (uint32_t b = 1; b < binCount; b++) {
+                if (bins[b - 1].count > 0) {
+                    left.extend(bins[b - 1].min);
+                    left.extend(bins[b - 1].max);
+                }
+                leftCount += bins[b - 1].count;
+                if (leftCount == 0 || leftCount == count) continue;
+                float cost = surfaceArea(left) * static_cast<float>(leftCount) + rightCosts[b];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        float area = surfaceArea(range.bounds);
+        float splitCost = options.traversalCost + options.intersectionCost * (area > 0.0f ? bestCost / area : 0.0f);
+        float leafCost = options.intersectionCost * static_cast<float>(count);
+        if (bestAxis < 0 || (splitCost >= leafCost && count <= options.maxLeafSize)) {
+            makeLeaf(ctx, node, first, count, depth);
+            return;
+        }
+
+        // The extreme centroids land in the first and last bin, so both
+        // sides of the best plane are non-empty
+        auto middle = std::partition(ctx.refs.begin() + first, ctx.refs.begin() + first + count, [&](const TriangleRef& ref) {
+            return binIndex(ref.centroid(), bestAxis) < bestBin;
+        });
+        split = static_cast<uint32_t>(middle - ctx.refs.begin());
+    }
+    // When every centroid is the same point the range is simply cut in half
+
+    uint32_t left = ctx.nodeCount.fetch_add(2);
+    node.leftFirst = left;
+    node.triangleCount = 0;
+
+    uint32_t childFirst[2] = { first, split };
+    uint32_t childCount[2] = { split - first, first + count - split };
+    auto buildChildren = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            buildNode(ctx, left + static_cast<uint32_t>(i), childFirst[i], childCount[i], depth + 1);
+        }
+    };
+    if (ctx.pool && count >= options.parallelThreshold) {
+        ctx.pool->parallelFor(2, 1, buildChildren);
+    }
+    else {
+        buildChildren(0, 2);
+    }
+}
+
+// Lay out the nodes depth first (the order children were allocated in
+// depends on thread timing), keeping siblings next to each other
+std::vector<BvhNode> renumberNodes(const std::vector<BvhNode>& nodes, uint32_t nodeCount) {
+    std::vector<BvhNode> renumbered;
+    renumbered.reserve(nodeCount);
+    renumbered.push_back(nodes[0]);
+
+    // Pairs of (old index, new index) whose children are still to place
+    std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0u, 0u } };
+    while (!stack.empty()) {
+        auto [oldIndex, newIndex] = stack.back();
+        stack.pop_back();
+        const BvhNode& node = nodes[oldIndex];
+        if (node.isLeaf()) continue;
+
+        uint32_t left = static_cast<uint32_t>(renumbered.size());
+        renumbered[newIndex].leftFirst = left;
+        renumbered.push_back(nodes[node.leftFirst]);
+        renumbered.push_back(nodes[node.leftFirst + 1]);
+        stack.push_back({ node.leftFirst + 1, left + 1 });
+        stack.push_back({ node.leftFirst, left });
+    }
+    return renumbered;
+}
+
+bool intersectBounds(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inverseDirection, float tMin, float tMax, float& tEntry) {
+    glm::vec3 t0 = (node.boundsMin - origin) * inverseDirection;
+    glm::vec3 t1 = (node.boundsMax - origin) * inverseDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    tEntry = std::max({ tMin, tNear.x, tNear.y, tNear.z });
+    float tExit = std::min({ tMax, tFar.x, tFar.y, tFar.z });
+    return tEntry <= tExit;
+}
+
+// Möller-Trumbore, `hit` is only written when the hit is closer
+bool intersectTriangle(const BvhTriangle& triangle, const BvhRay& ray, float tMax, BvhHit& hit) {
+    glm::vec3 edge1 = triangle.v1 - triangle.v0;
+    glm::vec3 edge2 = triangle.v2 - triangle.v0;
+    glm::vec3 p = glm::cross(ray.direction, edge2);
+    float determinant = glm::dot(edge1, p);
+    if (determinant == 0.0f) return false;
+
+    float inverseDeterminant = 1.0f / determinant;
+    glm::vec3 s = ray.origin - triangle.v0;
+    float u = glm::dot(s, p) * inverseDeterminant;
+    if (u < 0.0f || u > 1.0f) return false;
+
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = glm::dot(ray.direction, q) * inverseDeterminant;
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    float t = glm::dot(edge2, q) * inverseDeterminant;
+    if (t < ray.tMin || t >= tMax) return false;
+
+    hit.t = t;
+    hit.u = u;
+    hit.v = v;
+    return true;
+}
+
+template <bool anyHit>
+bool traverse(const Bvh& bvh, const BvhRay& ray, BvhHit& hit) {
+    if (bvh.nodes.empty()) return false;
+
+    // Infinite components are fine, the slab test then yields +-inf
+    glm::vec3 inverseDirection = 1.0f / ray.direction;
+    float tMax = ray.tMax;
+    bool found = false;
+
+    // Holds at most one sibling per level besides the current node
+    uint32_t stack[traversalStackSize];
+    int stackSize = 0;
+    float tEntry;
+    if (!intersectBounds(bvh.nodes[0], ray.origin, inverseDirection, ray.tMin, tMax, tEntry)) return false;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        const BvhNode& node = bvh.nodes[stack[--stackSize]];
+        if (node.isLeaf()) {
+            for (uint32_t i = node.leftFirst; i < node.leftFirst + node.triangleCount; i++) {
+                if (intersectTriangle(bvh.triangles[i], ray, tMax, hit)) {
+                    hit.triangle = i;
+                    tMax = hit.t;
+                    found = true;
+                    if constexpr (anyHit) return true;
+                }
+            }
+            continue;
+        }
+
+        // Visit the nearer child first
+        float tLeft, tRight;
+        bool hitLeft = intersectBounds(bvh.nodes[node.leftFirst], ray.origin, inverseDirection, ray.tMin, tMax, tLeft);
+        bool hitRight = intersectBounds(bvh.nodes[node.leftFirst + 1], ray.origin, inverseDirection, ray.tMin, tMax, tRight);
+        if (hitLeft && hitRight) {
+            bool leftFirst = tLeft <= tRight;
+            stack[stackSize++] = node.leftFirst + (leftFirst ? 1 : 0);
+            stack[stackSize++] = node.leftFirst + (leftFirst ? 0 : 1);
+        }
+        else if (hitLeft || hitRight) {
+            stack[stackSize++] = node.leftFirst + (hitLeft ? 0 : 1);
+        }
+    }
+    return found;
+}
+
+} // namespace
+
+bool Bvh::intersect(const BvhRay& ray, BvhHit& hit) const {
+    return traverse<false>(*this, ray, hit);
+}
+
+bool Bvh::occluded(const BvhRay& ray) const {
+    BvhHit hit;
+    return traverse<true>(*this, ray, hit);
+}
+
+bool BvhBuilder::build(
+    std::span<const VertexAttributes> vertices,
+    std::span<const uint32_t> indices,
+    Bvh& bvh,
+    ThreadPool* pool,
+    const BvhBuildOptions& options,
+    BvhBuildStats* stats
+) {
+    auto start = std::chrono::steady_clock::now();
+    bvh.nodes.clear();
+    bvh.triangles.clear();
+
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount >= (size_t(1) << 31)) {
+        std::cerr << "Too many triangles for a BVH: " << triangleCount << std::endl;
+        return false;
+    }
+    for (uint32_t index : indices) {
+        if (index >= vertices.size()) {
+            std::cerr << "BVH triangle references missing vertex " << index << std::endl;
+            return false;
+        }
+    }
+
+    if (triangleCount > 0) {
+        BuildContext ctx(options, pool);
+        ctx.refs.resize(triangleCount);
+        for (size_t t = 0; t < triangleCount; t++) {
+            Bounds bounds;
+            for (int j = 0; j < 3; j++) {
+                bounds.extend(vertices[indices[3 * t + j]].position);
+            }
+            ctx.refs[t] = { bounds.min, static_cast<uint32_t>(t), bounds.max };
+        }
+
+        // A binary tree with one triangle per leaf at most has 2n - 1 nodes
+        ctx.nodes.resize(2 * triangleCount);
+        ctx.nodeCount = 1;
+        buildNode(ctx, 0, 0, static_cast<uint32_t>(triangleCount), 0);
+
+        bvh.nodes = renumberNodes(ctx.nodes, ctx.nodeCount.load());
+
+        bvh.triangles.resize(triangleCount);
+        for (size_t i = 0; i < triangleCount; i++) {
+            uint32_t t = ctx.refs[i].id;
+            BvhTriangle& triangle = bvh.triangles[i];
+            triangle.v0 = vertices[indices[3 * t + 0]].position;
+            triangle.v1 = vertices[indices[3 * t + 1]].position;
+            triangle.v2 = vertices[indices[3 * t + 2]].position;
+            triangle.primitive = t;
+            triangle.padding0 = 0;
+            triangle.padding1 = 0;
+        }
+
+        if (stats) {
+            stats->leafCount = ctx.leafCount.load();
+            stats->maxDepth = ctx.maxDepth.load();
+        }
+    }
+
+    if (stats) {
+        stats->buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        stats->nodeCount = bvh.nodes.size();
+        if (bvh.nodes.empty()) {
+            stats->leafCount = 0;
+            stats->maxDepth = 0;
+        }
+        stats->sahCost = sahCost(bvh, options);
+    }
+    return true;
+}
+
+float BvhBuilder::sahCost(const Bvh& bvh, const BvhBuildOptions& options) {
+    if (bvh.nodes.empty()) return 0.0f;
+
+    auto nodeArea = [](const BvhNode& node) {
+        Bounds bounds;
+        bounds.min = node.boundsMin;
+        bounds.max = node.boundsMax;
+        return surfaceArea(bounds);
+    };
+    float rootArea = nodeArea(bvh.nodes[0]);
+    if (rootArea <= 0.0f) {
+        return options.intersectionCost * static_cast<float>(bvh.triangles.size());
+    }
+
+    double cost = 0.0;
+    for (const BvhNode& node : bvh.nodes) {
+        double weight = nodeArea(node) / rootArea;
+        cost += node.isLeaf()
+            ? weight * options.intersectionCost * node.triangleCount
+            : weight * options.traversalCost;
+    }
+    return static_cast<float>(cost);
+}
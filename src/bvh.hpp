@@ -0,0 +1,136 @@
+#ifndef _BVH_H
+#define _BVH_H
+
+#include "mesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+class ThreadPool;
+
+/**
+ * No leaf is deeper than this, which bounds traversal stacks
+ */
+constexpr uint32_t bvhMaxDepth = 64;
+
+/**
+ * 32 byte BVH node. The children of an inner node are stored next to each
+ * other at `leftFirst` and `leftFirst + 1`; a leaf covers `triangleCount`
+ * entries of Bvh::triangles starting at `leftFirst`.
+ */
+struct alignas(32) BvhNode {
+    glm::vec3 boundsMin;
+    uint32_t leftFirst;
+    glm::vec3 boundsMax;
+    uint32_t triangleCount;
+
+    bool isLeaf() const { return triangleCount > 0; }
+};
+static_assert(sizeof(BvhNode) == 32);
+
+/**
+ * Triangle in leaf order, laid out as three vec4 so that it can be read
+ * from a storage buffer as is
+ */
+struct BvhTriangle {
+    glm::vec3 v0;
+    // Index of the triangle in the source index buffer (first index / 3)
+    uint32_t primitive;
+    glm::vec3 v1;
+    uint32_t padding0;
+    glm::vec3 v2;
+    uint32_t padding1;
+};
+static_assert(sizeof(BvhTriangle) == 48);
+
+struct BvhRay {
+    glm::vec3 origin;
+    glm::vec3 direction;
+    float tMin = 0.0f;
+    float tMax = std::numeric_limits<float>::max();
+};
+
+struct BvhHit {
+    float t = std::numeric_limits<float>::max();
+    // Barycentric coordinates of the hit relative to v1 and v2
+    float u = 0.0f;
+    float v = 0.0f;
+    // Index into Bvh::triangles
+    uint32_t triangle = 0;
+};
+
+/**
+ * Bounding volume hierarchy over the triangles of a mesh, node 0 is the
+ * root. Empty when the mesh has no triangles.
+ */
+struct Bvh {
+    std::vector<BvhNode> nodes;
+    std::vector<BvhTriangle> triangles;
+
+    /**
+     * Closest hit of `ray` within [tMin, tMax], false on a miss
+     */
+    bool intersect(const BvhRay& ray, BvhHit& hit) const;
+
+    /**
+     * Whether `ray` hits anything within [tMin, tMax], stops at the first hit
+     */
+    bool occluded(const BvhRay& ray) const;
+};
+
+struct BvhBuildOptions {
+    // SAH split candidates per axis
+    uint32_t binCount = 16;
+    // Larger leaves are always split, smaller ones when the SAH says so
+    uint32_t maxLeafSize = 8;
+    // Relative SAH costs of visiting a node and of testing a triangle
+    float traversalCost = 1.0f;
+    float intersectionCost = 1.0f;
+    // Nodes with at least this many triangles build their children as
+    // separate pool tasks
+    uint32_t parallelThreshold = 4096;
+};
+
+struct BvhBuildStats {
+    double buildMilliseconds = 0.0;
+    size_t nodeCount = 0;
+    size_t leafCount = 0;
+    uint32_t maxDepth = 0;
+    float sahCost = 0.0f;
+};
+
+/**
+ * Top-down binned SAH builder (Wald, "On fast Construction of SAH-based
+ * Bounding Volume Hierarchies"). Large nodes bin their triangles in
+ * parallel, and subtrees above `parallelThreshold` triangles are built as
+ * separate tasks. Nodes are renumbered depth first afterwards, so the result
+ * does not depend on the thread count.
+ */
+class BvhBuilder {
+public:
+    /**
+     * Build `bvh` over the triangle list `indices` into `vertices`. Runs on
+     * `pool`, or on the calling thread alone when it is null.
+     */
+    static bool build(
+        std::span<const VertexAttributes> vertices,
+        std::span<const uint32_t> indices,
+        Bvh& bvh,
+        ThreadPool* pool,
+        const BvhBuildOptions& options = {},
+        BvhBuildStats* stats = nullptr
+    );
+
+    /**
+     * Expected cost of a ray query, relative to the root: the traversal
+     * cost of every inner node and the intersection cost of every leaf
+     * triangle, weighted by node surface area
+     */
+    static float sahCost(const Bvh& bvh, const BvhBuildOptions& options = {});
+};
+
+#endif // _BVH_H
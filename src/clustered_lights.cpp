@@ -0,0 +1,176 @@
+#include "clustered_lights.hpp"
+#include "resource_manager.hpp"
+#include "webgpu_utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Workgroups of cs_assign, one thread per cluster, as in light_clustering.wgsl
+constexpr uint32_t assignWorkgroupSize = 64;
+
+wgpu::BindGroupLayoutEntry bufferLayout(uint32_t binding, wgpu::BufferBindingType type, uint64_t minBindingSize = 0, bool dynamicOffset = false) {
+    wgpu::BindGroupLayoutEntry entry;
+    entry.binding = binding;
+    entry.visibility = wgpu::ShaderStage::Compute;
+    entry.buffer.type = type;
+    entry.buffer.hasDynamicOffset = dynamicOffset;
+    entry.buffer.minBindingSize = minBindingSize;
+    return entry;
+}
+
+wgpu::BindGroupEntry bufferBinding(uint32_t binding, wgpu::Buffer buffer, uint64_t size) {
+    wgpu::BindGroupEntry entry;
+    entry.binding = binding;
+    entry.buffer = buffer;
+    entry.offset = 0;
+    entry.size = size;
+    return entry;
+}
+
+} // namespace
+
+LocalLight LocalLight::point(const glm::vec3& position, float range, const glm::vec3& color) {
+    return { position, range, color, 0.0f, glm::vec3(0.0f, 0.0f, -1.0f), 1.0f };
+}
+
+LocalLight LocalLight::spot(
+    const glm::vec3& position, const glm::vec3& direction, float range, const glm::vec3& color,
+    float innerAngle, float outerAngle
+) {
+    // As recommended by KHR_lights_punctual, the smoothing folds into a
+    // single multiply-add per fragment
+    float cosOuter = std::cos(outerAngle);
+    float cosInner = std::cos(std::min(innerAngle, outerAngle));
+    float spotScale = 1.0f / std::max(cosInner - cosOuter, 1e-4f);
+    return { position, range, color, spotScale, glm::normalize(direction), -cosOuter * spotScale };
+}
+
+bool ClusteredLights::initialize(wgpu::Device device, const std::filesystem::path& shaderPath, uint32_t capacity, const glm::uvec3& gridSize, wgpu::Buffer ringBuffer) {
+    this->device = device;
+
+    wgpu::ShaderModule shaderModule = ResourceManager::loadShaderModule(shaderPath, device);
+    if (!shaderModule) return false;
+
+    // Uniforms and lights from the ring, then the lists it writes
+    std::vector<wgpu::BindGroupLayoutEntry> entries = {
+        bufferLayout(0, wgpu::BufferBindingType::Uniform, sizeof(Uniforms), true),
+        bufferLayout(1, wgpu::BufferBindingType::ReadOnlyStorage, sizeof(LocalLight), true),
+        bufferLayout(2, wgpu::BufferBindingType::Storage),
+    };
+    wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+    bindGroupLayoutDesc.label = "Light clustering bind group layout"_wgpu;
+    bindGroupLayoutDesc.entryCount = (uint32_t)entries.size();
+    bindGroupLayoutDesc.entries = entries.data();
+    bindGroupLayout = device.createBindGroupLayout(bindGroupLayoutDesc);
+
+    wgpu::PipelineLayoutDescriptor pipelineLayoutDesc;
+    pipelineLayoutDesc.label = "Light clustering pipeline layout"_wgpu;
+    pipelineLayoutDesc.bindGroupLayoutCount = 1;
+    pipelineLayoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
+    wgpu::PipelineLayout pipelineLayout = device.createPipelineLayout(pipelineLayoutDesc);
+
+    wgpu::ComputePipelineDescriptor pipelineDesc;
+    pipelineDesc.label = "Light clustering pipeline"_wgpu;
+    pipelineDesc.layout = pipelineLayout;
+    pipelineDesc.compute.module = shaderModule;
+    pipelineDesc.compute.entryPoint = "cs_assign"_wgpu;
+    pipelineDesc.compute.constantCount = 0;
+    pipelineDesc.compute.constants = nullptr;
+    pipeline = device.createComputePipeline(pipelineDesc);
+    pipelineLayout.release();
+    shaderModule.release();
+
+    // Storage bindings must not be empty
+    lightCapacity = std::max(capacity, 1u);
+    uniforms.gridSize = glm::max(gridSize, glm::uvec3(1));
+    uint64_t clusterCount = static_cast<uint64_t>(uniforms.gridSize.x) * uniforms.gridSize.y * uniforms.gridSize.z;
+    lightBytes = lightBindingSize(lightCapacity);
+    clusterBytes = clusterCount * (maxLightsPerCluster + 1) * sizeof(uint32_t);
+    clusters = createBuffer("Light clusters", clusterBytes, wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Storage);
+
+    wgpu::BindGroupEntry bindings[] = {
+        bufferBinding(0, ringBuffer, sizeof(Uniforms)),
+        bufferBinding(1, ringBuffer, lightBytes),
+        bufferBinding(2, clusters, clusterBytes),
+    };
+    wgpu::BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.label = "Light clustering bind group"_wgpu;
+    bindGroupDesc.layout = bindGroupLayout;
+    bindGroupDesc.entryCount = 3;
+    bindGroupDesc.entries = bindings;
+    bindGroup = device.createBindGroup(bindGroupDesc);
+    return pipeline != nullptr;
+}
+
+void ClusteredLights::terminate() {
+    if (clusters) clusters.release();
+    if (bindGroup) bindGroup.release();
+    if (pipeline) pipeline.release();
+    if (bindGroupLayout) bindGroupLayout.release();
+    clusters = nullptr;
+    bindGroup = nullptr;
+    pipeline = nullptr;
+    bindGroupLayout = nullptr;
+    uniforms.lightCount = 0;
+}
+
+wgpu::Buffer ClusteredLights::createBuffer(const char* label, uint64_t size, wgpu::BufferUsage usage) {
+    wgpu::BufferDescriptor bufferDesc;
+    bufferDesc.label = chars_to_wgpu(label);
+    bufferDesc.size = size;
+    bufferDesc.usage = usage;
+    bufferDesc.mappedAtCreation = false;
+    return device.createBuffer(bufferDesc);
+}
+
+void ClusteredLights::update(
+    UploadRing& ring, std::span<const LocalLight> lights,
+    const glm::mat4x4& viewMatrix, const glm::mat4x4& projection, uint32_t width, uint32_t height
+) {
+    // The binding spans the whole capacity, only the lights of this frame
+    // are copied. Without room for them the frame goes without lights.
+    uint32_t count = static_cast<uint32_t>(std::min<size_t>(lights.size(), lightCapacity));
+    UploadRing::Allocation allocation = ring.allocate(count * sizeof(LocalLight), lightBytes);
+    if (allocation.data && count > 0) {
+        std::memcpy(allocation.data, lights.data(), count * sizeof(LocalLight));
+    }
+    uniforms.lightCount = allocation.data ? count : 0;
+    lightsOffset = static_cast<uint32_t>(allocation.offset);
+
+    // depth = a + b / distance with a and b from the third row of the
+    // projection, depth 0 and 1 give the planes
+    float a = projection[2][2];
+    float b = projection[3][2];
+    float near = -b / a;
+    float far = b / (1.0f - a);
+    float logRatio = std::log(far / near);
+
+    uniforms.viewMatrix = viewMatrix;
+    uniforms.inverseProjection = glm::inverse(projection);
+    uniforms.screenSize = glm::vec2(std::max(width, 1u), std::max(height, 1u));
+    uniforms.sliceScale = static_cast<float>(uniforms.gridSize.z) / logRatio;
+    uniforms.sliceBias = -uniforms.sliceScale * std::log(near);
+    uniforms.near = near;
+    uniforms.far = far;
+    uniformsOffset = static_cast<uint32_t>(ring.push(uniforms));
+}
+
+void ClusteredLights::assign(wgpu::CommandEncoder encoder) {
+    if (!pipeline) return;
+
+    uint32_t clusterCount = uniforms.gridSize.x * uniforms.gridSize.y * uniforms.gridSize.z;
+    wgpu::ComputePassDescriptor computePassDesc;
+    computePassDesc.timestampWrites = nullptr;
+    wgpu::ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+    computePass.setPipeline(pipeline);
+    // In binding order, uniforms then lights
+    uint32_t dynamicOffsets[] = { uniformsOffset, lightsOffset };
+    computePass.setBindGroup(0, bindGroup, 2, dynamicOffsets);
+    computePass.dispatchWorkgroups((clusterCount + assignWorkgroupSize - 1) / assignWorkgroupSize, 1, 1);
+    computePass.end();
+    computePass.release();
+}
@@ -0,0 +1,149 @@
+#ifndef _CLUSTERED_LIGHTS_H
+#define _CLUSTERED_LIGHTS_H
+
+#include "upload_ring.hpp"
+
+#include <webgpu/webgpu.hpp>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+/**
+ * A point light, or a spot light when its cone is narrower than the whole
+ * sphere, in world space. The layout of Light in shader.wgsl and
+ * light_clustering.wgsl.
+ */
+struct LocalLight {
+    glm::vec3 position;
+    // Distance at which the light has faded out entirely
+    float range;
+    glm::vec3 color;
+    // The cone fades as saturate(cos(angle to direction) * spotScale +
+    // spotOffset), 0 and 1 for a point light
+    float spotScale;
+    glm::vec3 direction;
+    float spotOffset;
+
+    static LocalLight point(const glm::vec3& position, float range, const glm::vec3& color);
+
+    // Full intensity up to `innerAngle` off `direction`, none past `outerAngle`
+    static LocalLight spot(
+        const glm::vec3& position, const glm::vec3& direction, float range, const glm::vec3& color,
+        float innerAngle, float outerAngle
+    );
+};
+static_assert(sizeof(LocalLight) == 48);
+
+/**
+ * Clustered forward shading (Olsson et al., "Clustered Deferred and Forward
+ * Shading"): the view frustum is split into a grid of clusters, tiles of
+ * the screen cut into slices growing exponentially with depth, and a compute
+ * pass lists the lights reaching each cluster. The fragment shader (the
+ * CLUSTERED_LIGHTS permutation of shader.wgsl) then shades with the list of
+ * its cluster only, so that its cost follows how many lights overlap
+ * locally rather than how many there are.
+ *
+ * Lights are tested against the bounds of a cluster, and spot lights also
+ * against its bounding sphere by their cone. A cluster lists
+ * maxLightsPerCluster lights at most, further ones are dropped.
+ *
+ * The lights and the uniforms are written every frame into the upload ring
+ * and bound with dynamic offsets, only the cluster lists have a buffer of
+ * their own.
+ */
+class ClusteredLights {
+public:
+    // Lights a cluster lists at most, as in light_clustering.wgsl
+    static constexpr uint32_t maxLightsPerCluster = 127;
+
+    /**
+     * Load the shader, create the pipeline and the cluster lists for
+     * `capacity` lights and a grid of `gridSize` clusters. Lights and
+     * uniforms are read from `ringBuffer`, the buffer of the upload ring.
+     */
+    bool initialize(wgpu::Device device, const std::filesystem::path& shaderPath, uint32_t capacity, const glm::uvec3& gridSize, wgpu::Buffer ringBuffer);
+
+    // Release every object created so far
+    void terminate();
+
+    /**
+     * Write the lights, those past the capacity are ignored, and the
+     * uniforms for a camera of `viewMatrix` and `projection` rendering
+     * `width` x `height` pixels into the frame of `ring`. Depth slices span
+     * the near and far planes of the projection.
+     */
+    void update(
+        UploadRing& ring, std::span<const LocalLight> lights,
+        const glm::mat4x4& viewMatrix, const glm::mat4x4& projection, uint32_t width, uint32_t height
+    );
+
+    /**
+     * Record the pass listing the lights of each cluster from the data of
+     * the last update(), after the copy of the ring
+     */
+    void assign(wgpu::CommandEncoder encoder);
+
+    uint32_t lightCount() const { return uniforms.lightCount; }
+    uint32_t capacity() const { return lightCapacity; }
+    const glm::uvec3& gridSize() const { return uniforms.gridSize; }
+
+    /**
+     * Bytes the lights take in the ring at most, which each frame must
+     * have room for
+     */
+    static constexpr uint64_t lightBindingSize(uint32_t capacity) { return std::max(capacity, 1u) * sizeof(LocalLight); }
+
+    // Bindings of the fragment shader: lights and uniforms in the ring at
+    // the offsets of the last update(), and the cluster lists
+    uint64_t lightBindingSize() const { return lightBytes; }
+    uint32_t lightOffset() const { return lightsOffset; }
+    static constexpr uint64_t uniformBindingSize() { return sizeof(Uniforms); }
+    uint32_t uniformOffset() const { return uniformsOffset; }
+    wgpu::Buffer clusterBuffer() const { return clusters; }
+    uint64_t clusterBindingSize() const { return clusterBytes; }
+
+private:
+    // Layout of ClusterUniforms in shader.wgsl and light_clustering.wgsl
+    struct Uniforms {
+        // World space to view space
+        glm::mat4x4 viewMatrix;
+        // Clip space to view space
+        glm::mat4x4 inverseProjection;
+        glm::uvec3 gridSize;
+        uint32_t lightCount;
+        glm::vec2 screenSize;
+        // Slice of view depth z is log(z) * sliceScale + sliceBias
+        float sliceScale;
+        float sliceBias;
+        float near;
+        float far;
+        uint32_t _pad[2];
+    };
+    static_assert(sizeof(Uniforms) % 16 == 0);
+    static_assert(sizeof(Uniforms) <= 256, "maxUniformBufferBindingSize");
+
+    wgpu::Buffer createBuffer(const char* label, uint64_t size, wgpu::BufferUsage usage);
+
+private:
+    wgpu::Device device;
+
+    wgpu::BindGroupLayout bindGroupLayout;
+    wgpu::ComputePipeline pipeline;
+    wgpu::BindGroup bindGroup;
+
+    // Per cluster, a count followed by maxLightsPerCluster light indices
+    wgpu::Buffer clusters;
+    uint64_t lightBytes = 0;
+    uint64_t clusterBytes = 0;
+    // Into the ring, of this frame's uniforms and lights
+    uint32_t uniformsOffset = 0;
+    uint32_t lightsOffset = 0;
+
+    Uniforms uniforms{};
+    uint32_t lightCapacity = 0;
+};
+
+#endif // _CLUSTERED_LIGHTS_H
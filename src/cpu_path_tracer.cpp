@@ -0,0 +1,387 @@
+#include "cpu_path_tracer.hpp"
+#include "thread_pool.hpp"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+namespace {
+
+constexpr float pi = 3.14159265358979323846f;
+
+// Radiance of rays that leave the scene, the raster clear color
+const glm::vec3 environment = glm::vec3(0.05f);
+
+// === Random numbers, the same sequence as path_tracer.wgsl
+
+uint32_t pcgHash(uint32_t value) {
+    uint32_t state = value * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float random(uint32_t& state) {
+    state = pcgHash(state);
+    return static_cast<float>(state >> 8) / 16777216.0f;
+}
+
+// Cosine weighted direction around `normal`
+glm::vec3 sampleHemisphere(const glm::vec3& normal, uint32_t& state) {
+    float r1 = random(state);
+    float r2 = random(state);
+    float phi = 2.0f * pi * r1;
+    float radius = std::sqrt(r2);
+    glm::vec3 local = { radius * std::cos(phi), radius * std::sin(phi), std::sqrt(std::max(0.0f, 1.0f - r2)) };
+
+    // Orthonormal basis (Duff et al., "Building an Orthonormal Basis, Revisited")
+    float s = normal.z >= 0.0f ? 1.0f : -1.0f;
+    float a = -1.0f / (s + normal.z);
+    float b = normal.x * normal.y * a;
+    glm::vec3 tangent = { 1.0f + s * normal.x * normal.x * a, s * b, -s * normal.x };
+    glm::vec3 bitangent = { b, s + normal.y * normal.y * a, -normal.y };
+    return glm::normalize(local.x * tangent + local.y * bitangent + local.z * normal);
+}
+
+// === Work stealing tile queues
+
+/**
+ * One deque of tile indices per worker. The owner takes tiles from the
+ * front; a worker whose deque is empty moves the back half of another
+ * deque into its own. Tiles are never added after construction, so a
+ * worker that finds every deque empty is done.
+ */
+class TileQueues {
+public:
+    TileQueues(size_t workerCount, uint32_t tileCount)
+        : queues(workerCount)
+    {
+        // Contiguous runs of tiles, so that neighbouring tiles share a
+        // worker until stealing breaks the runs up
+        for (size_t worker = 0; worker < workerCount; worker++) {
+            uint32_t begin = static_cast<uint32_t>(tileCount * worker / workerCount);
+            uint32_t end = static_cast<uint32_t>(tileCount * (worker + 1) / workerCount);
+            for (uint32_t tile = begin; tile < end; tile++) {
+                queues[worker].tiles.push_back(tile);
+            }
+        }
+    }
+
+    /**
+     * Next tile of `worker`, false once every queue is empty
+     */
+    bool pop(size_t worker, uint32_t& tile, size_t& stolenTiles) {
+        if (popFront(worker, tile)) return true;
+
+        std::vector<uint32_t> loot;
+        for (size_t offset = 1; offset < queues.size(); offset++) {
+            Queue& victim = queues[(worker + offset) % queues.size()];
+            {
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                size_t count = (victim.tiles.size() + 1) / 2;
+                loot.assign(victim.tiles.end() - count, victim.tiles.end());
+                victim.tiles.erase(victim.tiles.end() - count, victim.tiles.end());
+            }
+            if (loot.empty()) continue;
+
+            stolenTiles += loot.size();
+            tile = loot.front();
+            std::lock_guard<std::mutex> lock(queues[worker].mutex);
+            queues[worker].tiles.insert(queues[worker].tiles.end(), loot.begin() + 1, loot.end());
+            return true;
+        }
+        return false;
+    }
+
+private:
+    bool popFront(size_t worker, uint32_t& tile) {
+        std::lock_guard<std::mutex> lock(queues[worker].mutex);
+        if (queues[worker].tiles.empty()) return false;
+        tile = queues[worker].tiles.front();
+        queues[worker].tiles.pop_front();
+        return true;
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<uint32_t> tiles;
+    };
+    std::vector<Queue> queues;
+};
+
+// === Path tracing
+
+struct TraceContext {
+    const CpuScene& scene;
+    const CpuRenderOptions& options;
+    glm::mat4x4 inverseViewProjection;
+    glm::mat4x4 inverseModelMatrix;
+    glm::vec3 cameraModelPosition;
+    glm::vec3 lightDirections[2];
+    glm::vec3 lightModelDirections[2];
+
+    TraceContext(const CpuScene& scene, const CpuRenderOptions& options)
+        : scene(scene)
+        , options(options)
+        , inverseViewProjection(glm::inverse(scene.projectionMatrix * scene.viewMatrix))
+        , inverseModelMatrix(glm::inverse(scene.modelMatrix))
+    {
+        cameraModelPosition = glm::vec3(inverseModelMatrix * glm::vec4(scene.cameraWorldPosition, 1.0f));
+        for (int i = 0; i < 2; i++) {
+            lightDirections[i] = glm::normalize(glm::vec3(scene.lights.directions[i]));
+            lightModelDirections[i] = toModel(lightDirections[i]);
+        }
+    }
+
+    glm::vec3 toModel(const glm::vec3& direction) const {
+        return glm::vec3(inverseModelMatrix * glm::vec4(direction, 0.0f));
+    }
+
+    glm::vec3 toWorld(const glm::vec3& direction) const {
+        return glm::normalize(glm::vec3(scene.modelMatrix * glm::vec4(direction, 0.0f)));
+    }
+};
+
+struct SurfacePoint {
+    // Model space, for the next rays
+    glm::vec3 position;
+    glm::vec3 geometricNormal;
+    // World space, for lighting
+    glm::vec3 normal;
+    glm::vec3 albedo;
+};
+
+SurfacePoint surfacePoint(const TraceContext& context, const BvhRay& ray, const BvhHit& hit) {
+    const BvhTriangle& triangle = context.scene.bvh->triangles[hit.triangle];
+    const uint32_t* corners = &context.scene.mesh.indices[3 * static_cast<size_t>(triangle.primitive)];
+    const VertexAttributes& a = context.scene.mesh.vertices[corners[0]];
+    const VertexAttributes& b = context.scene.mesh.vertices[corners[1]];
+    const VertexAttributes& c = context.scene.mesh.vertices[corners[2]];
+    float w = 1.0f - hit.u - hit.v;
+
+    SurfacePoint point;
+    point.position = ray.origin + hit.t * ray.direction;
+
+    // Both normals face the incoming ray
+    glm::vec3 geometricNormal = glm::normalize(glm::cross(triangle.v1 - triangle.v0, triangle.v2 - triangle.v0));
+    point.geometricNormal = glm::dot(geometricNormal, ray.direction) > 0.0f ? -geometricNormal : geometricNormal;
+
+    glm::vec3 normal = w * a.normal + hit.u * b.normal + hit.v * c.normal;
+    if (glm::dot(normal, normal) == 0.0f) {
+        normal = point.geometricNormal;
+    }
+    normal = glm::dot(normal, point.geometricNormal) < 0.0f ? -normal : normal;
+    point.normal = context.toWorld(normal);
+
+    glm::vec2 uv = w * a.uv + hit.u * b.uv + hit.v * c.uv;
+    point.albedo = context.scene.baseColor->sample(uv);
+    return point;
+}
+
+// Start point of rays leaving `point`, off the surface
+glm::vec3 offsetOrigin(const SurfacePoint& point) {
+    float scale = std::max(std::max(std::abs(point.position.x), std::abs(point.position.y)), std::abs(point.position.z));
+    return point.position + point.geometricNormal * (1e-4f + scale * 1e-5f);
+}
+
+glm::vec3 tracePath(const TraceContext& context, BvhRay ray, uint32_t& state, uint64_t& rayCount) {
+    const Bvh& bvh = *context.scene.bvh;
+    glm::vec3 radiance(0.0f);
+    glm::vec3 throughput(1.0f);
+
+    for (uint32_t bounce = 0; bounce <= context.options.maxBounces; bounce++) {
+        BvhHit hit;
+        rayCount++;
+        if (!bvh.intersect(ray, hit)) {
+            radiance += throughput * environment;
+            break;
+        }
+
+        SurfacePoint point = surfacePoint(context, ray, hit);
+        glm::vec3 origin = offsetOrigin(point);
+
+        // Direct light, with the same intensity convention as fs_main
+        for (int i = 0; i < 2; i++) {
+            float cosine = glm::dot(context.lightDirections[i], point.normal);
+            if (cosine <= 0.0f) continue;
+
+            BvhRay shadowRay;
+            shadowRay.origin = origin;
+            shadowRay.direction = context.lightModelDirections[i];
+            rayCount++;
+            if (!bvh.occluded(shadowRay)) {
+                radiance += throughput * point.albedo * glm::vec3(context.scene.lights.colors[i]) * cosine;
+            }
+        }
+
+        // Continue along a cosine weighted direction, whose pdf cancels the
+        // cosine and 1/pi of the Lambertian BRDF
+        throughput *= point.albedo;
+        if (bounce >= 2) {
+            // Russian roulette
+            float survival = std::clamp(std::max(throughput.x, std::max(throughput.y, throughput.z)), 0.05f, 1.0f);
+            if (random(state) >= survival) break;
+            throughput /= survival;
+        }
+        ray.origin = origin;
+        ray.direction = context.toModel(sampleHemisphere(point.normal, state));
+    }
+    return radiance;
+}
+
+void renderTile(const TraceContext& context, uint32_t tile, std::vector<glm::vec3>& image, uint64_t& rayCount) {
+    const CpuRenderOptions& options = context.options;
+    uint32_t tilesPerRow = (options.width + options.tileSize - 1) / options.tileSize;
+    uint32_t x0 = (tile % tilesPerRow) * options.tileSize;
+    uint32_t y0 = (tile / tilesPerRow) * options.tileSize;
+    uint32_t x1 = std::min(x0 + options.tileSize, options.width);
+    uint32_t y1 = std::min(y0 + options.tileSize, options.height);
+    glm::vec2 size(static_cast<float>(options.width), static_cast<float>(options.height));
+
+    for (uint32_t y = y0; y < y1; y++) {
+        for (uint32_t x = x0; x < x1; x++) {
+            uint32_t pixelIndex = y * options.width + x;
+            glm::vec3 sum(0.0f);
+            for (uint32_t sample = 0; sample < options.samplesPerPixel; sample++) {
+                uint32_t state = pcgHash(pixelIndex ^ pcgHash(sample));
+
+                // Jittered camera ray through the pixel, y down in pixels and
+                // up in NDC
+                glm::vec2 pixel = glm::vec2(static_cast<float>(x), static_cast<float>(y));
+                pixel.x += random(state);
+                pixel.y += random(state);
+                glm::vec4 farPoint = context.inverseViewProjection
+                    * glm::vec4(2.0f * pixel.x / size.x - 1.0f, 1.0f - 2.0f * pixel.y / size.y, 1.0f, 1.0f);
+                glm::vec3 worldDirection = glm::normalize(glm::vec3(farPoint) / farPoint.w - context.scene.cameraWorldPosition);
+
+                BvhRay ray;
+                ray.origin = context.cameraModelPosition;
+                ray.direction = context.toModel(worldDirection);
+                sum += tracePath(context, ray, state, rayCount);
+            }
+            image[pixelIndex] = sum / static_cast<float>(options.samplesPerPixel);
+        }
+    }
+}
+
+float encodeSrgb(float linear) {
+    linear = std::clamp(linear, 0.0f, 1.0f);
+    return linear <= 0.0031308f ? 12.92f * linear : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+}
+
+} // namespace
+
+bool CpuTexture::load(const std::filesystem::path& path, CpuTexture& texture) {
+    int width, height, channels;
+    unsigned char* pixelData = stbi_load(path.string().c_str(), &width, &height, &channels, 4 /* force 4 channels */);
+    if (nullptr == pixelData) return false;
+
+    texture.width = static_cast<uint32_t>(width);
+    texture.height = static_cast<uint32_t>(height);
+    texture.pixels.assign(pixelData, pixelData + 4 * static_cast<size_t>(width) * static_cast<size_t>(height));
+    stbi_image_free(pixelData);
+    return true;
+}
+
+glm::vec3 CpuTexture::sample(glm::vec2 uv) const {
+    if (pixels.empty()) return glm::vec3(1.0f);
+
+    auto texel = [](float coordinate, uint32_t size) {
+        float wrapped = coordinate - std::floor(coordinate);
+        return std::min(static_cast<uint32_t>(wrapped * static_cast<float>(size)), size - 1);
+    };
+    const uint8_t* pixel = &pixels[4 * (static_cast<size_t>(texel(uv.y, height)) * width + texel(uv.x, width))];
+    return glm::vec3(pixel[0], pixel[1], pixel[2]) / 255.0f;
+}
+
+bool CpuPathTracer::render(
+    const CpuScene& scene,
+    const CpuRenderOptions& options,
+    ThreadPool* pool,
+    std::vector<glm::vec3>& image,
+    CpuRenderStats* stats
+) {
+    if (!scene.bvh || !scene.baseColor || options.width == 0 || options.height == 0
+        || options.samplesPerPixel == 0 || options.tileSize == 0) {
+        std::cerr << "Invalid reference render setup" << std::endl;
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    image.assign(static_cast<size_t>(options.width) * options.height, environment);
+    if (scene.bvh->nodes.empty()) {
+        if (stats) *stats = CpuRenderStats();
+        return true;
+    }
+
+    TraceContext context(scene, options);
+    uint32_t tilesPerRow = (options.width + options.tileSize - 1) / options.tileSize;
+    uint32_t tilesPerColumn = (options.height + options.tileSize - 1) / options.tileSize;
+    uint32_t tileCount = tilesPerRow * tilesPerColumn;
+    size_t workerCount = pool ? pool->size() + 1 : 1;
+    TileQueues queues(workerCount, tileCount);
+
+    std::atomic<uint64_t> rayCount = 0;
+    std::atomic<size_t> stolenTiles = 0;
+    auto work = [&](size_t begin, size_t end) {
+        for (size_t worker = begin; worker < end; worker++) {
+            uint64_t workerRays = 0;
+            size_t workerStolen = 0;
+            uint32_t tile;
+            while (queues.pop(worker, tile, workerStolen)) {
+                renderTile(context, tile, image, workerRays);
+            }
+            rayCount += workerRays;
+            stolenTiles += workerStolen;
+        }
+    };
+    if (pool) {
+        pool->parallelFor(workerCount, 1, work);
+    }
+    else {
+        work(0, 1);
+    }
+
+    if (stats) {
+        stats->renderMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        stats->rayCount = rayCount;
+        stats->raysPerSecond = static_cast<double>(stats->rayCount) / std::max(stats->renderMilliseconds * 1e-3, 1e-9);
+        stats->workerCount = workerCount;
+        stats->tileCount = tileCount;
+        stats->stolenTiles = stolenTiles;
+    }
+    return true;
+}
+
+bool CpuPathTracer::writeImage(
+    const std::filesystem::path& path,
+    uint32_t width,
+    uint32_t height,
+    const std::vector<glm::vec3>& image
+) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    file << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<uint8_t> row(3 * static_cast<size_t>(width));
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            // Same transform as fs_display, then the sRGB encoding of the
+            // surface
+            const glm::vec3& color = image[static_cast<size_t>(y) * width + x];
+            for (int channel = 0; channel < 3; channel++) {
+                float encoded = encodeSrgb(std::pow(std::max(color[channel], 0.0f), 2.2f));
+                row[3 * x + channel] = static_cast<uint8_t>(std::lround(encoded * 255.0f));
+            }
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size()));
+    }
+    return file.good();
+}
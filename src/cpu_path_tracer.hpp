@@ -0,0 +1,100 @@
+#ifndef _CPU_PATH_TRACER_H
+#define _CPU_PATH_TRACER_H
+
+#include "bvh.hpp"
+#include "mesh.hpp"
+#include "scene.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+class ThreadPool;
+
+/**
+ * RGBA8 image on the CPU, sampled like the base color texture at level 0:
+ * nearest filtering and repeat addressing
+ */
+struct CpuTexture {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::vector<uint8_t> pixels;
+
+    static bool load(const std::filesystem::path& path, CpuTexture& texture);
+
+    glm::vec3 sample(glm::vec2 uv) const;
+};
+
+/**
+ * Everything a reference image depends on. The BVH must be built over
+ * `mesh`, which it indexes through BvhTriangle::primitive.
+ */
+struct CpuScene {
+    const Bvh* bvh = nullptr;
+    MeshView mesh;
+    const CpuTexture* baseColor = nullptr;
+    SceneLights lights;
+
+    glm::mat4x4 projectionMatrix;
+    glm::mat4x4 viewMatrix;
+    glm::mat4x4 modelMatrix;
+    glm::vec3 cameraWorldPosition;
+};
+
+struct CpuRenderOptions {
+    uint32_t width = 640;
+    uint32_t height = 480;
+    uint32_t samplesPerPixel = 64;
+    // Indirect bounces per path, after the camera ray
+    uint32_t maxBounces = 4;
+    // Side of the square tiles workers take and steal
+    uint32_t tileSize = 16;
+};
+
+struct CpuRenderStats {
+    double renderMilliseconds = 0.0;
+    // Camera, bounce and shadow rays
+    uint64_t rayCount = 0;
+    double raysPerSecond = 0.0;
+    size_t workerCount = 0;
+    size_t tileCount = 0;
+    size_t stolenTiles = 0;
+};
+
+/**
+ * Reference path tracer computing the same estimate as path_tracer.wgsl:
+ * Lambertian surfaces, the two directional lights sampled with shadow rays,
+ * cosine weighted bounces and a uniform environment. Pixels are seeded the
+ * same way on every run, so images do not depend on the thread count.
+ */
+class CpuPathTracer {
+public:
+    /**
+     * Render `scene` into `image`, row-major linear radiance. The image is
+     * cut into tiles dealt out evenly to one worker per pool thread plus the
+     * calling thread; a worker that runs out steals half of another one's
+     * remaining tiles. Runs on the calling thread alone when `pool` is null.
+     */
+    static bool render(
+        const CpuScene& scene,
+        const CpuRenderOptions& options,
+        ThreadPool* pool,
+        std::vector<glm::vec3>& image,
+        CpuRenderStats* stats = nullptr
+    );
+
+    /**
+     * Write `image` as a binary PPM, with the display transform of the
+     * GPU renderers
+     */
+    static bool writeImage(
+        const std::filesystem::path& path,
+        uint32_t width,
+        uint32_t height,
+        const std::vector<glm::vec3>& image
+    );
+};
+
+#endif // _CPU_PATH_TRACER_H
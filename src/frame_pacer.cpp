@@ -0,0 +1,68 @@
+#include "frame_pacer.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+using namespace std::chrono_literals;
+
+// Bounds of the spin margin, over the latest wake up seen
+constexpr FramePacer::Clock::duration minSpinMargin = 250us;
+constexpr FramePacer::Clock::duration maxSpinMargin = 4ms;
+
+// Estimates step down by this fraction of the gap each frame, and jump up
+// right away, since waking up late costs a frame and early only spins
+constexpr int decayDivisor = 16;
+
+FramePacer::Clock::duration decayTowards(FramePacer::Clock::duration value, FramePacer::Clock::duration sample) {
+    if (sample >= value) return sample;
+    return value - (value - sample) / decayDivisor;
+}
+
+} // namespace
+
+void FramePacer::setFrameRateLimit(double framesPerSecond) {
+    frameRate = std::max(framesPerSecond, 0.0);
+    period = frameRate > 0.0
+        ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / frameRate))
+        : Clock::duration{};
+    deadline = {};
+}
+
+void FramePacer::wait() {
+    Clock::time_point start = Clock::now();
+    if (frameRate <= 0.0) {
+        lastWait = {};
+        return;
+    }
+
+    // Wake up early enough for the work to end at the deadline
+    Clock::duration lead = justInTime ? std::min(workEstimate, period) : Clock::duration{};
+    if (deadline == Clock::time_point{} || start - (deadline - lead) > period) {
+        deadline = start + lead;
+    }
+    Clock::time_point target = deadline - lead;
+    deadline += period;
+
+    Clock::time_point sleepEnd = target - spinMargin;
+    if (sleepEnd > start) {
+        std::this_thread::sleep_until(sleepEnd);
+        Clock::duration late = Clock::now() - sleepEnd;
+        spinMargin = std::clamp(decayTowards(spinMargin, late + minSpinMargin), minSpinMargin, maxSpinMargin);
+    }
+    while (Clock::now() < target) {
+        std::this_thread::yield();
+    }
+    lastWait = Clock::now() - start;
+}
+
+void FramePacer::beginWork() {
+    workStart = Clock::now();
+}
+
+void FramePacer::endWork() {
+    if (workStart == Clock::time_point{}) return;
+    workEstimate = decayTowards(workEstimate, Clock::now() - workStart);
+    workStart = {};
+}
@@ -0,0 +1,58 @@
+#ifndef _FRAME_PACER_H
+#define _FRAME_PACER_H
+
+#include <chrono>
+
+/**
+ * CPU frame limiter. Frames start one period apart, or as soon as possible
+ * once they fall more than a period behind, rather than rushing to catch
+ * up. Waits sleep until shortly before the deadline, since the scheduler
+ * wakes threads up late, and spin the rest of the way. The margin follows
+ * how late sleeps have woken up recently.
+ *
+ * In just-in-time mode the wait ends ahead of the deadline by the time the
+ * work of a frame takes, measured between beginWork() and endWork(), so
+ * that the input read after the wait is as fresh as possible when the
+ * frame is submitted.
+ */
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Frames per second at most, 0 for no limit
+    void setFrameRateLimit(double framesPerSecond);
+    double frameRateLimit() const { return frameRate; }
+
+    void setJustInTime(bool enabled) { justInTime = enabled; }
+    bool isJustInTime() const { return justInTime; }
+
+    /**
+     * Block until the next frame should start, right away without a limit
+     */
+    void wait();
+
+    // Bounds of the work wait() leaves time for in just-in-time mode
+    void beginWork();
+    void endWork();
+
+    // Of the last wait()
+    double waitMilliseconds() const { return lastWait.count(); }
+    double spinMarginMilliseconds() const { return std::chrono::duration<double, std::milli>(spinMargin).count(); }
+    double workEstimateMilliseconds() const { return std::chrono::duration<double, std::milli>(workEstimate).count(); }
+
+private:
+    double frameRate = 0.0;
+    bool justInTime = false;
+    Clock::duration period{};
+    // Start of the next frame, or its submission in just-in-time mode
+    Clock::time_point deadline{};
+
+    // Sleeps end this early, then spin
+    Clock::duration spinMargin = std::chrono::milliseconds(1);
+    // Upper estimate of how long the work takes
+    Clock::duration workEstimate{};
+    Clock::time_point workStart{};
+    std::chrono::duration<double, std::milli> lastWait{};
+};
+
+#endif // _FRAME_PACER_H
@@ -0,0 +1,238 @@
+#include "frame_readback.hpp"
+#include "thread_pool.hpp"
+#include "webgpu_utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string_view>
+#include <thread>
+
+namespace {
+
+// bytesPerRow of texture to buffer copies must be a multiple of this
+constexpr uint32_t copyBytesPerRowAlignment = 256;
+
+// Write the RGB channels of padded RGBA8 rows as a binary PPM
+bool writeFrame(
+    const std::filesystem::path& path,
+    uint32_t width,
+    uint32_t height,
+    uint32_t paddedBytesPerRow,
+    bool swapRedBlue,
+    const std::vector<uint8_t>& pixels
+) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Could not write frame at: " << path << std::endl;
+        return false;
+    }
+
+    file << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<uint8_t> row(3 * static_cast<size_t>(width));
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t* source = &pixels[static_cast<size_t>(y) * paddedBytesPerRow];
+        for (uint32_t x = 0; x < width; x++) {
+            row[3 * x + 0] = source[4 * x + (swapRedBlue ? 2 : 0)];
+            row[3 * x + 1] = source[4 * x + 1];
+            row[3 * x + 2] = source[4 * x + (swapRedBlue ? 0 : 2)];
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), static_cast<std::streamsize>(row.size()));
+    }
+    return file.good();
+}
+
+} // namespace
+
+bool FrameReadback::initialize(
+    wgpu::Device device,
+    uint32_t width,
+    uint32_t height,
+    wgpu::TextureFormat format,
+    uint32_t ringSize,
+    const std::filesystem::path& outputDirectory
+) {
+    switch (format) {
+    case wgpu::TextureFormat::RGBA8Unorm:
+    case wgpu::TextureFormat::RGBA8UnormSrgb:
+        swapRedBlue = false;
+        break;
+    case wgpu::TextureFormat::BGRA8Unorm:
+    case wgpu::TextureFormat::BGRA8UnormSrgb:
+        swapRedBlue = true;
+        break;
+    default:
+        std::cerr << "Frame readback only supports RGBA8 and BGRA8 formats" << std::endl;
+        return false;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(outputDirectory, error);
+    if (error) {
+        std::cerr << "Could not create output directory " << outputDirectory << ": " << error.message() << std::endl;
+        return false;
+    }
+
+    this->device = device;
+    this->width = width;
+    this->height = height;
+    this->outputDirectory = outputDirectory;
+    paddedBytesPerRow = (4 * width + copyBytesPerRowAlignment - 1) / copyBytesPerRowAlignment * copyBytesPerRowAlignment;
+
+    wgpu::BufferDescriptor bufferDesc;
+    bufferDesc.label = "Frame readback buffer"_wgpu;
+    bufferDesc.size = static_cast<uint64_t>(paddedBytesPerRow) * height;
+    bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
+    bufferDesc.mappedAtCreation = false;
+
+    slots.resize(std::max(ringSize, 1u));
+    for (Slot& slot : slots) {
+        slot.buffer = device.createBuffer(bufferDesc);
+    }
+    return true;
+}
+
+void FrameReadback::terminate() {
+    flush();
+    for (Slot& slot : slots) {
+        slot.buffer.release();
+    }
+    slots.clear();
+}
+
+void FrameReadback::capture(wgpu::CommandEncoder encoder, wgpu::Texture texture) {
+    Slot& slot = slots[nextSlot];
+
+    // The ring wrapped around, wait for the oldest frame
+    if (slot.state != SlotState::Free) {
+        auto start = std::chrono::steady_clock::now();
+        waitForSlot(slot);
+        retire(slot);
+        statistics.stallMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    wgpu::TexelCopyTextureInfo source;
+    source.texture = texture;
+    source.mipLevel = 0;
+    source.origin = { 0, 0, 0 };
+    source.aspect = wgpu::TextureAspect::All;
+
+    wgpu::TexelCopyBufferInfo destination;
+    destination.buffer = slot.buffer;
+    destination.layout.offset = 0;
+    destination.layout.bytesPerRow = paddedBytesPerRow;
+    destination.layout.rowsPerImage = height;
+
+    encoder.copyTextureToBuffer(source, destination, { width, height, 1 });
+    slot.state = SlotState::Recorded;
+    slot.frameIndex = frameCount++;
+}
+
+void FrameReadback::submit(wgpu::Queue queue, wgpu::CommandBuffer command) {
+    Slot& slot = slots[nextSlot];
+
+#if defined(WEBGPU_BACKEND_WGPU)
+    // Keep the index to wait for this frame alone rather than the whole queue
+    WGPUCommandBuffer commandBuffer = command;
+    slot.submissionIndex = wgpuQueueSubmitForIndex(queue, 1, &commandBuffer);
+#else
+    queue.submit(command);
+#endif
+
+    if (slot.state != SlotState::Recorded) return;
+
+    wgpu::BufferMapCallbackInfo callbackInfo;
+    callbackInfo.nextInChain = nullptr;
+    callbackInfo.mode = wgpu::CallbackMode::AllowProcessEvents;
+    callbackInfo.callback = onBufferMapped;
+    callbackInfo.userdata1 = &slot;
+    callbackInfo.userdata2 = nullptr;
+    slot.state = SlotState::Mapping;
+    slot.buffer.mapAsync(wgpu::MapMode::Read, 0, slot.buffer.getSize(), callbackInfo);
+
+    nextSlot = (nextSlot + 1) % slots.size();
+}
+
+void FrameReadback::collect() {
+    while (slots[oldestSlot].state == SlotState::Mapped) {
+        retire(slots[oldestSlot]);
+    }
+
+    // Forget about the writes that are done
+    while (!pendingWrites.empty() && pendingWrites.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        statistics.framesWritten += pendingWrites.front().get() ? 1 : 0;
+        pendingWrites.pop_front();
+    }
+}
+
+void FrameReadback::flush() {
+    // Waiting for one slot may map the ones after it as well, retire those
+    // too rather than stop at the first slot that is already mapped
+    while (!slots.empty() && slots[oldestSlot].state != SlotState::Free) {
+        if (slots[oldestSlot].state == SlotState::Mapping) {
+            waitForSlot(slots[oldestSlot]);
+        }
+        retire(slots[oldestSlot]);
+    }
+    while (!pendingWrites.empty()) {
+        statistics.framesWritten += pendingWrites.front().get() ? 1 : 0;
+        pendingWrites.pop_front();
+    }
+}
+
+void FrameReadback::onBufferMapped(WGPUMapAsyncStatus status, WGPUStringView message, void* userdata1, [[maybe_unused]] void* userdata2) {
+    Slot& slot = *reinterpret_cast<Slot*>(userdata1);
+    if (status != WGPUMapAsyncStatus_Success) {
+        std::cerr << "Could not map frame " << slot.frameIndex << " for readback";
+        if (message.data) std::cerr << ": " << std::string_view(message.data, message.length);
+        std::cerr << std::endl;
+    }
+    slot.mapSucceeded = status == WGPUMapAsyncStatus_Success;
+    slot.state = SlotState::Mapped;
+}
+
+void FrameReadback::waitForSlot(Slot& slot) {
+    while (slot.state == SlotState::Mapping) {
+#if defined(WEBGPU_BACKEND_DAWN)
+        device.tick();
+        std::this_thread::yield();
+#elif defined(WEBGPU_BACKEND_WGPU)
+        device.poll(true, &slot.submissionIndex);
+#endif
+    }
+}
+
+void FrameReadback::retire(Slot& slot) {
+    if (slot.mapSucceeded) {
+        // Copy out so that the buffer can be reused right away, the
+        // conversion and the disk write happen on the pool
+        size_t size = static_cast<size_t>(paddedBytesPerRow) * height;
+        auto pixels = std::make_shared<std::vector<uint8_t>>(size);
+        std::memcpy(pixels->data(), slot.buffer.getConstMappedRange(0, size), size);
+        slot.buffer.unmap();
+
+        std::ostringstream name;
+        name << "frame_" << std::setw(5) << std::setfill('0') << slot.frameIndex << ".ppm";
+        std::filesystem::path path = outputDirectory / name.str();
+        pendingWrites.push_back(ThreadPool::shared().submit(
+            [path, width = width, height = height, paddedBytesPerRow = paddedBytesPerRow, swapRedBlue = swapRedBlue, pixels]() {
+                return writeFrame(path, width, height, paddedBytesPerRow, swapRedBlue, *pixels);
+            }
+        ));
+
+        // Bound the frames waiting for the disk to the size of the ring
+        while (pendingWrites.size() > slots.size()) {
+            statistics.framesWritten += pendingWrites.front().get() ? 1 : 0;
+            pendingWrites.pop_front();
+        }
+    }
+
+    slot.state = SlotState::Free;
+    slot.mapSucceeded = false;
+    oldestSlot = (oldestSlot + 1) % slots.size();
+}
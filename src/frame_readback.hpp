@@ -0,0 +1,112 @@
+#ifndef _FRAME_READBACK_H
+#define _FRAME_READBACK_H
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <vector>
+
+/**
+ * Copies rendered frames into a ring of MapRead buffers and writes them to
+ * disk. Each frame is mapped asynchronously once its submission is queued,
+ * so the GPU keeps rendering the next frames while earlier ones are read
+ * back; the CPU only waits when it wraps around to a slot whose frame is
+ * still in flight. Mapped frames are written as PPM files by pool tasks.
+ */
+class FrameReadback {
+public:
+    struct Stats {
+        uint64_t framesWritten = 0;
+        // Time capture() spent waiting for a ring slot to be read back
+        double stallMilliseconds = 0.0;
+    };
+
+public:
+    /**
+     * Create `ringSize` buffers for `width` x `height` frames of an RGBA8 or
+     * BGRA8 `format`, written to `outputDirectory`
+     */
+    bool initialize(
+        wgpu::Device device,
+        uint32_t width,
+        uint32_t height,
+        wgpu::TextureFormat format,
+        uint32_t ringSize,
+        const std::filesystem::path& outputDirectory
+    );
+
+    // Write out every pending frame and release the buffers
+    void terminate();
+
+    /**
+     * Record the copy of `texture`, which needs the CopySrc usage, into the
+     * next ring slot. Waits until that slot's previous frame is mapped.
+     */
+    void capture(wgpu::CommandEncoder encoder, wgpu::Texture texture);
+
+    /**
+     * Submit `command`, which must contain the last capture(), and start
+     * mapping its slot
+     */
+    void submit(wgpu::Queue queue, wgpu::CommandBuffer command);
+
+    /**
+     * Hand the frames mapped so far to the writer tasks, without waiting.
+     * Map callbacks only run while the device is polled.
+     */
+    void collect();
+
+    // Wait until every submitted frame is on disk
+    void flush();
+
+    const Stats& stats() const { return statistics; }
+
+private:
+    enum class SlotState {
+        Free,
+        Recorded,
+        Mapping,
+        Mapped,
+    };
+
+    struct Slot {
+        wgpu::Buffer buffer;
+        SlotState state = SlotState::Free;
+        uint64_t frameIndex = 0;
+        bool mapSucceeded = false;
+#if defined(WEBGPU_BACKEND_WGPU)
+        WGPUSubmissionIndex submissionIndex = 0;
+#endif
+    };
+
+    static void onBufferMapped(WGPUMapAsyncStatus status, WGPUStringView message, void* userdata1, void* userdata2);
+
+    // Poll the device until `slot` has been mapped
+    void waitForSlot(Slot& slot);
+
+    // Copy out the mapped rows of `slot`, unmap it and queue the file write
+    void retire(Slot& slot);
+
+private:
+    wgpu::Device device;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // Rows are padded to the 256 byte copy alignment
+    uint32_t paddedBytesPerRow = 0;
+    bool swapRedBlue = false;
+    std::filesystem::path outputDirectory;
+
+    std::vector<Slot> slots;
+    // Next slot to record into, and oldest slot not yet retired
+    size_t nextSlot = 0;
+    size_t oldestSlot = 0;
+    uint64_t frameCount = 0;
+
+    std::deque<std::future<bool>> pendingWrites;
+    Stats statistics;
+};
+
+#endif // _FRAME_READBACK_H
@@ -0,0 +1,103 @@
+#include "frame_stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+
+FrameStats::FrameStats(std::vector<std::string> gpuPassNames, size_t historySize)
+    : passNames(std::move(gpuPassNames))
+    , historySize(std::max<size_t>(historySize, 1))
+{
+    passNames.resize(std::min(passNames.size(), maxGpuPasses));
+}
+
+void FrameStats::addCpuFrame(uint64_t frameIndex, double milliseconds, double inputLatencyMilliseconds) {
+    Frame frame;
+    frame.index = frameIndex;
+    frame.cpuMilliseconds = milliseconds;
+    frame.inputLatencyMilliseconds = inputLatencyMilliseconds;
+    frame.gpuMilliseconds.fill(std::numeric_limits<double>::quiet_NaN());
+    history.push_back(frame);
+    if (history.size() > historySize) history.pop_front();
+}
+
+void FrameStats::addGpuFrame(uint64_t frameIndex, std::span<const double> passMilliseconds) {
+    // Frames are added in order, so the index gives the position
+    if (history.empty() || frameIndex < history.front().index || frameIndex > history.back().index) return;
+    Frame& frame = history[frameIndex - history.front().index];
+    if (frame.index != frameIndex) return;
+
+    size_t count = std::min(passMilliseconds.size(), passNames.size());
+    std::copy_n(passMilliseconds.begin(), count, frame.gpuMilliseconds.begin());
+}
+
+FrameStats::Percentiles FrameStats::cpuPercentiles() const {
+    std::vector<double> values;
+    values.reserve(history.size());
+    for (const Frame& frame : history) {
+        values.push_back(frame.cpuMilliseconds);
+    }
+    return percentiles(values);
+}
+
+FrameStats::Percentiles FrameStats::gpuPercentiles(size_t pass) const {
+    std::vector<double> values;
+    values.reserve(history.size());
+    for (const Frame& frame : history) {
+        if (!std::isnan(frame.gpuMilliseconds[pass])) values.push_back(frame.gpuMilliseconds[pass]);
+    }
+    return percentiles(values);
+}
+
+FrameStats::Percentiles FrameStats::inputLatencyPercentiles() const {
+    std::vector<double> values;
+    values.reserve(history.size());
+    for (const Frame& frame : history) {
+        if (!std::isnan(frame.inputLatencyMilliseconds)) values.push_back(frame.inputLatencyMilliseconds);
+    }
+    return percentiles(values);
+}
+
+FrameStats::Percentiles FrameStats::percentiles(std::vector<double>& values) {
+    Percentiles result;
+    if (values.empty()) return result;
+
+    // Nearest rank, selecting in increasing order so that each call only
+    // partitions what is left above the previous rank
+    auto rank = [&](double fraction, size_t from) {
+        size_t index = std::min(static_cast<size_t>(std::ceil(fraction * static_cast<double>(values.size()))), values.size()) - 1;
+        index = std::max(index, from);
+        std::nth_element(values.begin() + static_cast<std::ptrdiff_t>(from), values.begin() + static_cast<std::ptrdiff_t>(index), values.end());
+        return index;
+    };
+    size_t p50 = rank(0.50, 0);
+    result.p50 = values[p50];
+    size_t p95 = rank(0.95, p50);
+    result.p95 = values[p95];
+    result.p99 = values[rank(0.99, p95)];
+    return result;
+}
+
+bool FrameStats::writeCsv(const std::filesystem::path& path) const {
+    std::ofstream file(path);
+    if (!file.is_open()) return false;
+
+    file << "frame,cpu_ms,input_latency_ms";
+    for (const std::string& name : passNames) {
+        file << ",gpu_" << name << "_ms";
+    }
+    file << "\n";
+
+    for (const Frame& frame : history) {
+        file << frame.index << "," << frame.cpuMilliseconds << ",";
+        if (!std::isnan(frame.inputLatencyMilliseconds)) file << frame.inputLatencyMilliseconds;
+        for (size_t pass = 0; pass < passNames.size(); pass++) {
+            // Empty cells for frames that were not timed on the GPU
+            file << ",";
+            if (!std::isnan(frame.gpuMilliseconds[pass])) file << frame.gpuMilliseconds[pass];
+        }
+        file << "\n";
+    }
+    return file.good();
+}
@@ -0,0 +1,70 @@
+#ifndef _FRAME_STATS_H
+#define _FRAME_STATS_H
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <limits>
+#include <span>
+#include <string>
+#include <vector>
+
+/**
+ * Rolling history of CPU frame times and GPU pass times. GPU times arrive
+ * a few frames late and are matched to their frame by index; frames whose
+ * GPU times never arrive keep them as NaN. Frames may also carry the time
+ * from their first input event to their submission, NaN without input.
+ */
+class FrameStats {
+public:
+    static constexpr size_t maxGpuPasses = 4;
+
+    struct Percentiles {
+        double p50 = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+    };
+
+    struct Frame {
+        uint64_t index;
+        double cpuMilliseconds;
+        double inputLatencyMilliseconds;
+        std::array<double, maxGpuPasses> gpuMilliseconds;
+    };
+
+public:
+    FrameStats(std::vector<std::string> gpuPassNames, size_t historySize = 1000);
+
+    void addCpuFrame(uint64_t frameIndex, double milliseconds, double inputLatencyMilliseconds = std::numeric_limits<double>::quiet_NaN());
+
+    void addGpuFrame(uint64_t frameIndex, std::span<const double> passMilliseconds);
+
+    const std::deque<Frame>& frames() const { return history; }
+
+    const std::vector<std::string>& gpuPassNames() const { return passNames; }
+
+    Percentiles cpuPercentiles() const;
+
+    // Over the frames whose GPU times arrived
+    Percentiles gpuPercentiles(size_t pass) const;
+
+    // Over the frames that had input
+    Percentiles inputLatencyPercentiles() const;
+
+    /**
+     * Write the history as CSV, one row per frame with the CPU frame time,
+     * the input latency and the time of each GPU pass in milliseconds
+     */
+    bool writeCsv(const std::filesystem::path& path) const;
+
+private:
+    static Percentiles percentiles(std::vector<double>& values);
+
+private:
+    std::vector<std::string> passNames;
+    size_t historySize;
+    std::deque<Frame> history;
+};
+
+#endif // _FRAME_STATS_H
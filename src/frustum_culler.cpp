@@ -0,0 +1,298 @@
+#include "frustum_culler.hpp"
+
+#include <bit>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define FRUSTUM_CULLER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FRUSTUM_CULLER_TARGET_AVX2
+#else
+#define FRUSTUM_CULLER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+
+constexpr size_t width = FrustumCuller::maxWidth;
+
+using Components = std::array<std::vector<float>, 6>;
+
+size_t paddedSize(size_t count) {
+    return (count + width - 1) / width * width;
+}
+
+// Sort the `lanes` boxes from `first` on by the lane masks a kernel
+// computed for them: those outside are dropped, those crossing a plane go to
+// `intersecting` and the rest to `inside`
+void appendLanes(
+    uint32_t outside, uint32_t crossing, size_t first, size_t lanes, size_t count,
+    std::vector<uint32_t>& inside, std::vector<uint32_t>* intersecting
+) {
+    // Lanes past the end are padding
+    uint32_t kept = ~outside & ((1u << lanes) - 1);
+    if (count - first < lanes) kept &= (1u << (count - first)) - 1;
+    while (kept != 0) {
+        uint32_t lane = static_cast<uint32_t>(std::countr_zero(kept));
+        kept &= kept - 1;
+        uint32_t index = static_cast<uint32_t>(first) + lane;
+        if ((crossing >> lane) & 1u) intersecting->push_back(index);
+        else inside.push_back(index);
+    }
+}
+
+#if defined(FRUSTUM_CULLER_X86)
+// 4 boxes per iteration
+void cullBoxesSSE(
+    const Frustum& frustum, const Components& components, size_t count,
+    std::vector<uint32_t>& inside, std::vector<uint32_t>* intersecting
+) {
+    // Splat every plane once rather than once per group of boxes
+    struct PlaneLanes {
+        __m128 x, y, z, w;
+        __m128 absX, absY, absZ;
+    };
+    std::array<PlaneLanes, 6> planes;
+    for (size_t p = 0; p < planes.size(); p++) {
+        const glm::vec4& plane = frustum.planes[p];
+        planes[p] = {
+            _mm_set1_ps(plane.x), _mm_set1_ps(plane.y), _mm_set1_ps(plane.z), _mm_set1_ps(plane.w),
+            _mm_set1_ps(glm::abs(plane.x)), _mm_set1_ps(glm::abs(plane.y)), _mm_set1_ps(glm::abs(plane.z))
+        };
+    }
+
+    const __m128 zero = _mm_setzero_ps();
+    for (size_t i = 0; i < count; i += 4) {
+        __m128 centerX = _mm_loadu_ps(&components[0][i]);
+        __m128 centerY = _mm_loadu_ps(&components[1][i]);
+        __m128 centerZ = _mm_loadu_ps(&components[2][i]);
+        __m128 extentX = _mm_loadu_ps(&components[3][i]);
+        __m128 extentY = _mm_loadu_ps(&components[4][i]);
+        __m128 extentZ = _mm_loadu_ps(&components[5][i]);
+
+        __m128 outside = zero;
+        __m128 crossing = zero;
+        for (const PlaneLanes& plane : planes) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(plane.x, centerX), _mm_mul_ps(plane.y, centerY)), _mm_mul_ps(plane.z, centerZ)), plane.w);
+            __m128 radius = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(plane.absX, extentX), _mm_mul_ps(plane.absY, extentY)), _mm_mul_ps(plane.absZ, extentZ));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+            if (intersecting) crossing = _mm_or_ps(crossing, _mm_cmplt_ps(_mm_sub_ps(distance, radius), zero));
+        }
+
+        appendLanes(
+            static_cast<uint32_t>(_mm_movemask_ps(outside)), static_cast<uint32_t>(_mm_movemask_ps(crossing)),
+            i, 4, count, inside, intersecting
+        );
+    }
+}
+
+// 8 boxes per iteration, the same operations as the SSE kernel so that both
+// keep the same boxes
+FRUSTUM_CULLER_TARGET_AVX2
+void cullBoxesAVX2(
+    const Frustum& frustum, const Components& components, size_t count,
+    std::vector<uint32_t>& inside, std::vector<uint32_t>* intersecting
+) {
+    struct PlaneLanes {
+        __m256 x, y, z, w;
+        __m256 absX, absY, absZ;
+    };
+    std::array<PlaneLanes, 6> planes;
+    for (size_t p = 0; p < planes.size(); p++) {
+        const glm::vec4& plane = frustum.planes[p];
+        planes[p] = {
+            _mm256_set1_ps(plane.x), _mm256_set1_ps(plane.y), _mm256_set1_ps(plane.z), _mm256_set1_ps(plane.w),
+            _mm256_set1_ps(glm::abs(plane.x)), _mm256_set1_ps(glm::abs(plane.y)), _mm256_set1_ps(glm::abs(plane.z))
+        };
+    }
+
+    const __m256 zero = _mm256_setzero_ps();
+    for (size_t i = 0; i < count; i += 8) {
+        __m256 centerX = _mm256_loadu_ps(&components[0][i]);
+        __m256 centerY = _mm256_loadu_ps(&components[1][i]);
+        __m256 centerZ = _mm256_loadu_ps(&components[2][i]);
+        __m256 extentX = _mm256_loadu_ps(&components[3][i]);
+        __m256 extentY = _mm256_loadu_ps(&components[4][i]);
+        __m256 extentZ = _mm256_loadu_ps(&components[5][i]);
+
+        __m256 outside = zero;
+        __m256 crossing = zero;
+        for (const PlaneLanes& plane : planes) {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+                _mm256_mul_ps(plane.x, centerX), _mm256_mul_ps(plane.y, centerY)), _mm256_mul_ps(plane.z, centerZ)), plane.w);
+            __m256 radius = _mm256_add_ps(_mm256_add_ps(
+                _mm256_mul_ps(plane.absX, extentX), _mm256_mul_ps(plane.absY, extentY)), _mm256_mul_ps(plane.absZ, extentZ));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_LT_OQ));
+            if (intersecting) crossing = _mm256_or_ps(crossing, _mm256_cmp_ps(_mm256_sub_ps(distance, radius), zero, _CMP_LT_OQ));
+        }
+
+        appendLanes(
+            static_cast<uint32_t>(_mm256_movemask_ps(outside)), static_cast<uint32_t>(_mm256_movemask_ps(crossing)),
+            i, 8, count, inside, intersecting
+        );
+    }
+}
+
+bool cpuHasAvx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool useAvx2() {
+    static const bool hasAvx2 = cpuHasAvx2();
+    return hasAvx2;
+}
+#else
+// One box per iteration
+void cullBoxesScalar(
+    const Frustum& frustum, const Components& components, size_t count,
+    std::vector<uint32_t>& inside, std::vector<uint32_t>* intersecting
+) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t outside = 0;
+        uint32_t crossing = 0;
+        for (const glm::vec4& plane : frustum.planes) {
+            float distance = plane.x * components[0][i] + plane.y * components[1][i] + plane.z * components[2][i] + plane.w;
+            float radius = glm::abs(plane.x) * components[3][i] + glm::abs(plane.y) * components[4][i] + glm::abs(plane.z) * components[5][i];
+            outside |= distance + radius < 0.0f ? 1u : 0u;
+            crossing |= distance - radius < 0.0f ? 1u : 0u;
+        }
+        appendLanes(outside, intersecting ? crossing : 0u, i, 1, count, inside, intersecting);
+    }
+}
+#endif
+
+/**
+ * A box is outside when even its corner furthest along a plane's normal is
+ * behind the plane, and crosses the plane when its nearest corner is
+ * behind it: with d the signed distance of the center and r the extent
+ * projected on the normal, d + r < 0 and d - r < 0 respectively.
+ * `intersecting` is null when only visibility matters.
+ */
+void cullBoxes(
+    const Frustum& frustum, const Components& components, size_t count,
+    std::vector<uint32_t>& inside, std::vector<uint32_t>* intersecting
+) {
+    inside.clear();
+    if (intersecting) intersecting->clear();
+#if defined(FRUSTUM_CULLER_X86)
+    if (useAvx2()) {
+        cullBoxesAVX2(frustum, components, count, inside, intersecting);
+    }
+    else {
+        cullBoxesSSE(frustum, components, count, inside, intersecting);
+    }
+#else
+    cullBoxesScalar(frustum, components, count, inside, intersecting);
+#endif
+}
+
+} // namespace
+
+Frustum Frustum::fromMatrix(const glm::mat4x4& viewProjection) {
+    // Rows of the matrix, GLM stores columns
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        rows[i] = { viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i] };
+    }
+
+    // -w <= x <= w, -w <= y <= w and 0 <= z <= w in clip space
+    Frustum frustum;
+    frustum.planes = {
+        rows[3] + rows[0],
+        rows[3] - rows[0],
+        rows[3] + rows[1],
+        rows[3] - rows[1],
+        rows[2],
+        rows[3] - rows[2],
+    };
+    return frustum;
+}
+
+Frustum Frustum::transformed(const glm::mat4x4& transform) const {
+    // dot(plane, M * p) = dot(transpose(M) * plane, p), and GLM's row
+    // vector product computes transpose(M) * plane
+    Frustum frustum;
+    for (size_t p = 0; p < planes.size(); p++) {
+        frustum.planes[p] = planes[p] * transform;
+    }
+    return frustum;
+}
+
+void BoundsList::clear() {
+    resize(0);
+}
+
+void BoundsList::resize(size_t count) {
+    this->count = count;
+    for (std::vector<float>& component : components) {
+        component.resize(paddedSize(count), 0.0f);
+    }
+}
+
+void BoundsList::set(size_t index, const Bounds& bounds) {
+    glm::vec3 center = 0.5f * (bounds.min + bounds.max);
+    glm::vec3 extent = 0.5f * (bounds.max - bounds.min);
+    for (int axis = 0; axis < 3; axis++) {
+        components[axis][index] = center[axis];
+        components[3 + axis][index] = extent[axis];
+    }
+}
+
+void BoundsList::set(size_t index, const Bounds& bounds, const glm::mat4x4& transform) {
+    // The extent along each world axis gathers the absolute contributions
+    // of the three local axes (Arvo, "Transforming Axis-Aligned Bounding
+    // Boxes")
+    glm::vec3 center = 0.5f * (bounds.min + bounds.max);
+    glm::vec3 extent = 0.5f * (bounds.max - bounds.min);
+    glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+    for (int axis = 0; axis < 3; axis++) {
+        float worldExtent = glm::abs(transform[0][axis]) * extent.x
+            + glm::abs(transform[1][axis]) * extent.y
+            + glm::abs(transform[2][axis]) * extent.z;
+        components[axis][index] = worldCenter[axis];
+        components[3 + axis][index] = worldExtent;
+    }
+}
+
+float BoundsList::distance(size_t index, const glm::vec3& point) const {
+    glm::vec3 outside(0.0f);
+    for (int axis = 0; axis < 3; axis++) {
+        float offset = glm::abs(point[axis] - components[axis][index]) - components[3 + axis][index];
+        outside[axis] = glm::max(offset, 0.0f);
+    }
+    return glm::length(outside);
+}
+
+const char* FrustumCuller::instructionSet() {
+#if defined(FRUSTUM_CULLER_X86)
+    return useAvx2() ? "AVX2" : "SSE";
+#else
+    return "scalar";
+#endif
+}
+
+void FrustumCuller::cull(const Frustum& frustum, const BoundsList& boxes, std::vector<uint32_t>& visible) {
+    cullBoxes(frustum, boxes.components, boxes.size(), visible, nullptr);
+}
+
+void FrustumCuller::classify(
+    const Frustum& frustum, const BoundsList& boxes,
+    std::vector<uint32_t>& inside, std::vector<uint32_t>& intersecting
+) {
+    cullBoxes(frustum, boxes.components, boxes.size(), inside, &intersecting);
+}
@@ -0,0 +1,94 @@
+#ifndef _FRUSTUM_CULLER_H
+#define _FRUSTUM_CULLER_H
+
+#include "mesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * The six planes bounding what a view projection matrix keeps, as
+ * (normal, distance) with normals pointing inward: a point p is inside when
+ * dot(plane.xyz, p) + plane.w >= 0 for every plane. Planes are not
+ * normalized, which the tests do not need.
+ */
+struct Frustum {
+    std::array<glm::vec4, 6> planes;
+
+    /**
+     * Planes of a projection with depth in [0, 1], as WebGPU expects
+     * (Gribb and Hartmann, "Fast Extraction of Viewing Frustum Planes from
+     * the World-View-Projection Matrix")
+     */
+    static Frustum fromMatrix(const glm::mat4x4& viewProjection);
+
+    /**
+     * The same frustum in the space that `transform` maps to this one's,
+     * e.g. in model space given the model matrix
+     */
+    Frustum transformed(const glm::mat4x4& transform) const;
+};
+
+/**
+ * Axis aligned boxes stored as arrays of centers and half extents, one per
+ * coordinate, so that the culler loads several boxes per instruction. The
+ * arrays are padded to a multiple of FrustumCuller::maxWidth.
+ */
+class BoundsList {
+public:
+    void clear();
+
+    // Resize to `count` boxes, new ones are empty
+    void resize(size_t count);
+
+    void set(size_t index, const Bounds& bounds);
+
+    // Set box `index` to the world bounds of `bounds` placed by `transform`
+    void set(size_t index, const Bounds& bounds, const glm::mat4x4& transform);
+
+    // Distance from `point` to box `index`, zero when inside it
+    float distance(size_t index, const glm::vec3& point) const;
+
+    size_t size() const { return count; }
+
+private:
+    friend class FrustumCuller;
+
+    size_t count = 0;
+    // Center x, y, z then half extent x, y, z
+    std::array<std::vector<float>, 6> components;
+};
+
+/**
+ * Tests boxes against a frustum several at a time on x86-64, with AVX2
+ * (8 boxes) when the CPU running it has it and SSE (4 boxes) otherwise, or
+ * one at a time elsewhere. A box is kept unless it lies entirely behind one
+ * of the planes, so a few boxes near the frustum corners are kept while
+ * invisible.
+ */
+class FrustumCuller {
+public:
+    // Most boxes tested at once, whichever instruction set is picked
+    static constexpr size_t maxWidth = 8;
+
+    // Name of the instruction set used, for display
+    static const char* instructionSet();
+
+    // Fill `visible` with the indices of the boxes in the frustum, ascending
+    static void cull(const Frustum& frustum, const BoundsList& boxes, std::vector<uint32_t>& visible);
+
+    /**
+     * Same split in two: `inside` receives the boxes entirely in the frustum,
+     * `intersecting` those crossing one of its planes
+     */
+    static void classify(
+        const Frustum& frustum, const BoundsList& boxes,
+        std::vector<uint32_t>& inside, std::vector<uint32_t>& intersecting
+    );
+};
+
+#endif // _FRUSTUM_CULLER_H
@@ -0,0 +1,578 @@
+#include "gpu_culler.hpp"
+#include "frustum_culler.hpp"
+#include "resource_manager.hpp"
+#include "webgpu_utils.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <iostream>
+#include <string_view>
+
+namespace {
+
+// Dynamic offsets of storage bindings must be a multiple of
+// minStorageBufferOffsetAlignment, which is at most this
+constexpr uint64_t dynamicOffsetAlignment = 256;
+
+// Workgroups of cs_cull, one thread per object
+constexpr uint32_t cullWorkgroupSize = 64;
+
+// Dispatches have at most this many workgroups per dimension
+constexpr uint32_t maxWorkgroupsPerDimension = 65535;
+
+wgpu::BindGroupLayout createBindGroupLayout(wgpu::Device device, wgpu::StringView label, const std::vector<wgpu::BindGroupLayoutEntry>& entries) {
+    wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+    bindGroupLayoutDesc.label = label;
+    bindGroupLayoutDesc.entryCount = (uint32_t)entries.size();
+    bindGroupLayoutDesc.entries = entries.data();
+    return device.createBindGroupLayout(bindGroupLayoutDesc);
+}
+
+wgpu::PipelineLayout createPipelineLayout(wgpu::Device device, wgpu::BindGroupLayout& bindGroupLayout) {
+    wgpu::PipelineLayoutDescriptor pipelineLayoutDesc;
+    pipelineLayoutDesc.label = "GPU culling pipeline layout"_wgpu;
+    pipelineLayoutDesc.bindGroupLayoutCount = 1;
+    pipelineLayoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
+    return device.createPipelineLayout(pipelineLayoutDesc);
+}
+
+wgpu::ComputePipeline createComputePipeline(
+    wgpu::Device device, wgpu::ShaderModule shaderModule,
+    wgpu::BindGroupLayout& bindGroupLayout, wgpu::StringView entryPoint
+) {
+    wgpu::PipelineLayout pipelineLayout = createPipelineLayout(device, bindGroupLayout);
+    wgpu::ComputePipelineDescriptor pipelineDesc;
+    pipelineDesc.label = "GPU culling pipeline"_wgpu;
+    pipelineDesc.layout = pipelineLayout;
+    pipelineDesc.compute.module = shaderModule;
+    pipelineDesc.compute.entryPoint = entryPoint;
+    pipelineDesc.compute.constantCount = 0;
+    pipelineDesc.compute.constants = nullptr;
+    wgpu::ComputePipeline pipeline = device.createComputePipeline(pipelineDesc);
+    pipelineLayout.release();
+    return pipeline;
+}
+
+wgpu::BindGroupLayoutEntry bufferLayout(uint32_t binding, wgpu::ShaderStage visibility, wgpu::BufferBindingType type) {
+    wgpu::BindGroupLayoutEntry entry;
+    entry.binding = binding;
+    entry.visibility = visibility;
+    entry.buffer.type = type;
+    return entry;
+}
+
+wgpu::BindGroupLayoutEntry textureLayout(uint32_t binding, wgpu::ShaderStage visibility, wgpu::TextureSampleType sampleType) {
+    wgpu::BindGroupLayoutEntry entry;
+    entry.binding = binding;
+    entry.visibility = visibility;
+    entry.texture.sampleType = sampleType;
+    entry.texture.viewDimension = wgpu::TextureViewDimension::_2D;
+    return entry;
+}
+
+wgpu::BindGroupEntry bufferBinding(uint32_t binding, wgpu::Buffer buffer, uint64_t size) {
+    wgpu::BindGroupEntry entry;
+    entry.binding = binding;
+    entry.buffer = buffer;
+    entry.offset = 0;
+    entry.size = size;
+    return entry;
+}
+
+wgpu::BindGroupEntry textureBinding(uint32_t binding, wgpu::TextureView view) {
+    wgpu::BindGroupEntry entry;
+    entry.binding = binding;
+    entry.textureView = view;
+    return entry;
+}
+
+wgpu::BindGroup createBindGroup(wgpu::Device device, wgpu::BindGroupLayout layout, const std::vector<wgpu::BindGroupEntry>& entries) {
+    wgpu::BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.label = "GPU culling bind group"_wgpu;
+    bindGroupDesc.layout = layout;
+    bindGroupDesc.entryCount = (uint32_t)entries.size();
+    bindGroupDesc.entries = entries.data();
+    return device.createBindGroup(bindGroupDesc);
+}
+
+} // namespace
+
+bool GpuCuller::initialize(
+    wgpu::Device device,
+    const std::filesystem::path& shaderPath,
+    wgpu::TextureFormat colorFormat,
+    wgpu::TextureFormat depthFormat,
+    wgpu::Buffer ringBuffer,
+    uint32_t readbackRingSize
+) {
+    this->device = device;
+    this->ringBuffer = ringBuffer;
+    queue = device.getQueue();
+
+    // The culling pass binds every visible list at once
+    wgpu::Limits limits;
+    device.getLimits(&limits);
+    maxStorageBytes = std::min<uint64_t>(limits.maxStorageBufferBindingSize, limits.maxBufferSize);
+
+    wgpu::ShaderModule shaderModule = ResourceManager::loadShaderModule(shaderPath, device);
+    if (!shaderModule) return false;
+
+    // Binding numbers are unique across the module, see gpu_culling.wgsl
+    wgpu::ShaderStage compute = wgpu::ShaderStage::Compute;
+    wgpu::ShaderStage fragment = wgpu::ShaderStage::Fragment;
+    wgpu::BindGroupLayoutEntry uniformLayout = bufferLayout(0, compute, wgpu::BufferBindingType::Uniform);
+    uniformLayout.buffer.hasDynamicOffset = true;
+    uniformLayout.buffer.minBindingSize = sizeof(Uniforms);
+
+    // === Culling: uniforms, chunks, object transforms, pyramid, then the
+    // draw arguments, visible lists and counts it writes
+    cullLayout = createBindGroupLayout(device, "GPU culling bind group layout"_wgpu, {
+        uniformLayout,
+        bufferLayout(1, compute, wgpu::BufferBindingType::ReadOnlyStorage),
+        bufferLayout(2, compute, wgpu::BufferBindingType::ReadOnlyStorage),
+        textureLayout(3, compute, wgpu::TextureSampleType::UnfilterableFloat),
+        bufferLayout(4, compute, wgpu::BufferBindingType::Storage),
+        bufferLayout(5, compute, wgpu::BufferBindingType::Storage),
+        bufferLayout(6, compute, wgpu::BufferBindingType::Storage),
+    });
+
+    // === Pyramid build, from the depth texture then from the level above
+    wgpu::BindGroupLayoutEntry targetLayout;
+    targetLayout.binding = 9;
+    targetLayout.visibility = compute;
+    targetLayout.storageTexture.access = wgpu::StorageTextureAccess::WriteOnly;
+    targetLayout.storageTexture.format = wgpu::TextureFormat::R32Float;
+    targetLayout.storageTexture.viewDimension = wgpu::TextureViewDimension::_2D;
+    reduceDepthLayout = createBindGroupLayout(device, "Hi-Z depth reduction bind group layout"_wgpu, {
+        textureLayout(7, compute, wgpu::TextureSampleType::Depth),
+        targetLayout,
+    });
+    reduceLayout = createBindGroupLayout(device, "Hi-Z reduction bind group layout"_wgpu, {
+        textureLayout(8, compute, wgpu::TextureSampleType::UnfilterableFloat),
+        targetLayout,
+    });
+
+    // === Debug view of the pyramid
+    uniformLayout.visibility = fragment;
+    displayLayout = createBindGroupLayout(device, "Hi-Z display bind group layout"_wgpu, {
+        uniformLayout,
+        textureLayout(3, fragment, wgpu::TextureSampleType::UnfilterableFloat),
+    });
+
+    cullPipeline = createComputePipeline(device, shaderModule, cullLayout, "cs_cull"_wgpu);
+    reduceDepthPipeline = createComputePipeline(device, shaderModule, reduceDepthLayout, "cs_reduce_depth"_wgpu);
+    reducePipeline = createComputePipeline(device, shaderModule, reduceLayout, "cs_reduce"_wgpu);
+
+    // === Display pipeline, a fullscreen triangle that ignores depth
+    wgpu::PipelineLayout displayPipelineLayout = createPipelineLayout(device, displayLayout);
+    wgpu::RenderPipelineDescriptor pipelineDesc;
+    pipelineDesc.label = "Hi-Z display pipeline"_wgpu;
+    pipelineDesc.layout = displayPipelineLayout;
+
+    pipelineDesc.vertex.bufferCount = 0;
+    pipelineDesc.vertex.buffers = nullptr;
+    pipelineDesc.vertex.module = shaderModule;
+    pipelineDesc.vertex.entryPoint = "vs_hiz"_wgpu;
+    pipelineDesc.vertex.constantCount = 0;
+    pipelineDesc.vertex.constants = nullptr;
+
+    pipelineDesc.primitive.topology = wgpu::PrimitiveTopology::TriangleList;
+    pipelineDesc.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
+    pipelineDesc.primitive.frontFace = wgpu::FrontFace::CCW;
+    pipelineDesc.primitive.cullMode = wgpu::CullMode::None;
+
+    wgpu::ColorTargetState colorTarget;
+    colorTarget.format = colorFormat;
+    colorTarget.blend = nullptr;
+    colorTarget.writeMask = wgpu::ColorWriteMask::All;
+
+    wgpu::FragmentState fragmentState;
+    fragmentState.module = shaderModule;
+    fragmentState.entryPoint = "fs_hiz"_wgpu;
+    fragmentState.constantCount = 0;
+    fragmentState.constants = nullptr;
+    fragmentState.targetCount = 1;
+    fragmentState.targets = &colorTarget;
+    pipelineDesc.fragment = &fragmentState;
+
+    wgpu::DepthStencilState depthStencilState = wgpu::Default;
+    depthStencilState.depthCompare = wgpu::CompareFunction::Always;
+    depthStencilState.depthWriteEnabled = wgpu::OptionalBool::False;
+    depthStencilState.format = depthFormat;
+    depthStencilState.stencilReadMask = 0;
+    depthStencilState.stencilWriteMask = 0;
+    pipelineDesc.depthStencil = &depthStencilState;
+
+    pipelineDesc.multisample.count = 1;
+    pipelineDesc.multisample.mask = ~0u;
+    pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+    displayPipeline = device.createRenderPipeline(pipelineDesc);
+    displayPipelineLayout.release();
+    shaderModule.release();
+
+    createBuffer(
+        statsBuffer, "GPU culling stats", sizeof(Stats),
+        wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopySrc | wgpu::BufferUsage::CopyDst, nullptr
+    );
+
+    readbackSlots.resize(std::max(readbackRingSize, 1u));
+    for (ReadbackSlot& slot : readbackSlots) {
+        createBuffer(slot.buffer, "GPU culling stats readback", sizeof(Stats), wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead, nullptr);
+    }
+    return true;
+}
+
+void GpuCuller::terminate() {
+    for (ReadbackSlot& slot : readbackSlots) {
+        if (slot.state == SlotState::Mapped && slot.mapSucceeded) slot.buffer.unmap();
+        slot.buffer.release();
+    }
+    readbackSlots.clear();
+    releaseHiZ();
+
+    for (wgpu::Buffer* buffer : { &chunkBuffer, &argsBuffer, &argsResetBuffer, &visibleBuffer, &statsBuffer }) {
+        if (*buffer) buffer->release();
+        *buffer = nullptr;
+    }
+    for (wgpu::BindGroup* bindGroup : { &cullBindGroup, &displayBindGroup }) {
+        if (*bindGroup) bindGroup->release();
+        *bindGroup = nullptr;
+    }
+    for (wgpu::ComputePipeline* pipeline : { &cullPipeline, &reduceDepthPipeline, &reducePipeline }) {
+        if (*pipeline) pipeline->release();
+        *pipeline = nullptr;
+    }
+    for (wgpu::BindGroupLayout* layout : { &cullLayout, &reduceDepthLayout, &reduceLayout, &displayLayout }) {
+        if (*layout) layout->release();
+        *layout = nullptr;
+    }
+    if (displayPipeline) displayPipeline.release();
+    if (queue) queue.release();
+    displayPipeline = nullptr;
+    queue = nullptr;
+    chunks.clear();
+}
+
+void GpuCuller::createBuffer(wgpu::Buffer& buffer, const char* label, uint64_t size, wgpu::BufferUsage usage, const void* data) {
+    if (buffer) buffer.release();
+
+    // Storage bindings must not be empty
+    wgpu::BufferDescriptor bufferDesc;
+    bufferDesc.label = chars_to_wgpu(label);
+    bufferDesc.size = std::max<uint64_t>((size + 3) / 4 * 4, 16);
+    bufferDesc.usage = usage;
+    bufferDesc.mappedAtCreation = false;
+    buffer = device.createBuffer(bufferDesc);
+    if (data && size > 0) queue.writeBuffer(buffer, 0, data, size);
+    bindGroupsDirty = true;
+}
+
+void GpuCuller::releaseHiZ() {
+    for (wgpu::BindGroup& bindGroup : reduceBindGroups) bindGroup.release();
+    for (wgpu::TextureView& view : hiZLevels) view.release();
+    reduceBindGroups.clear();
+    hiZLevels.clear();
+    if (depthView) depthView.release();
+    if (hiZView) hiZView.release();
+    if (hiZTexture) hiZTexture.release();
+    depthView = nullptr;
+    hiZView = nullptr;
+    hiZTexture = nullptr;
+}
+
+void GpuCuller::resize(wgpu::Texture depthTexture, uint32_t width, uint32_t height) {
+    releaseHiZ();
+    width = std::max(width, 1u);
+    height = std::max(height, 1u);
+    depthSize = glm::vec2(width, height);
+
+    // Level 0 is half the depth texture, down to a single texel
+    uint32_t levelWidth = std::max(1u, width / 2);
+    uint32_t levelHeight = std::max(1u, height / 2);
+    uint32_t levelCount = static_cast<uint32_t>(std::bit_width(std::max(levelWidth, levelHeight)));
+
+    wgpu::TextureDescriptor textureDesc;
+    textureDesc.label = "Hi-Z pyramid"_wgpu;
+    textureDesc.dimension = wgpu::TextureDimension::_2D;
+    textureDesc.format = wgpu::TextureFormat::R32Float;
+    textureDesc.size = { levelWidth, levelHeight, 1 };
+    textureDesc.mipLevelCount = levelCount;
+    textureDesc.sampleCount = 1;
+    textureDesc.usage = wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::StorageBinding;
+    textureDesc.viewFormatCount = 0;
+    textureDesc.viewFormats = nullptr;
+    hiZTexture = device.createTexture(textureDesc);
+
+    wgpu::TextureViewDescriptor viewDesc;
+    viewDesc.aspect = wgpu::TextureAspect::All;
+    viewDesc.baseArrayLayer = 0;
+    viewDesc.arrayLayerCount = 1;
+    viewDesc.baseMipLevel = 0;
+    viewDesc.mipLevelCount = levelCount;
+    viewDesc.dimension = wgpu::TextureViewDimension::_2D;
+    viewDesc.format = wgpu::TextureFormat::R32Float;
+    hiZView = hiZTexture.createView(viewDesc);
+
+    viewDesc.mipLevelCount = 1;
+    for (uint32_t level = 0; level < levelCount; level++) {
+        viewDesc.baseMipLevel = level;
+        hiZLevels.push_back(hiZTexture.createView(viewDesc));
+    }
+
+    viewDesc.aspect = wgpu::TextureAspect::DepthOnly;
+    viewDesc.baseMipLevel = 0;
+    viewDesc.format = depthTexture.getFormat();
+    depthView = depthTexture.createView(viewDesc);
+
+    // Level N is read while N+1 is written, level 0 reads the depth
+    reduceBindGroups.push_back(createBindGroup(device, reduceDepthLayout, {
+        textureBinding(7, depthView),
+        textureBinding(9, hiZLevels[0]),
+    }));
+    for (uint32_t level = 1; level < levelCount; level++) {
+        reduceBindGroups.push_back(createBindGroup(device, reduceLayout, {
+            textureBinding(8, hiZLevels[level - 1]),
+            textureBinding(9, hiZLevels[level]),
+        }));
+    }
+
+    bindGroupsDirty = true;
+    hiZReady = false;
+}
+
+bool GpuCuller::update(const SceneInstances& instances) {
+    // The instance buffer moves when it grows
+    if (WGPUBuffer(instances.buffer()) != WGPUBuffer(transformBuffer) || instances.bindingSize() != transformBindingSize) {
+        transformBuffer = instances.buffer();
+        transformBindingSize = instances.bindingSize();
+        bindGroupsDirty = true;
+    }
+    if (instances.layoutVersion() == layoutVersion) return false;
+    layoutVersion = instances.layoutVersion();
+
+    std::vector<SceneInstances::ChunkInstances> chunkInstances;
+    instances.chunkInstances(chunkInstances);
+    if (chunkInstances.size() > maxWorkgroupsPerDimension) {
+        std::cerr << "GPU culling handles " << maxWorkgroupsPerDimension << " chunks at most, "
+                  << chunkInstances.size() - maxWorkgroupsPerDimension << " are not drawn" << std::endl;
+        chunkInstances.resize(maxWorkgroupsPerDimension);
+    }
+
+    chunks.clear();
+    std::vector<DrawArgs> args;
+    maxObjectCount = 0;
+    for (const SceneInstances::ChunkInstances& instance : chunkInstances) {
+        Chunk chunk{};
+        chunk.boundsMin = instance.bounds.min;
+        chunk.boundsMax = instance.bounds.max;
+        chunk.firstSlot = instance.firstInstance;
+        chunk.objectCount = instance.instanceCount;
+        chunks.push_back(chunk);
+        args.push_back({ instance.range.indexCount, 0, instance.range.firstIndex, instance.range.baseVertex, 0 });
+        maxObjectCount = std::max(maxObjectCount, instance.instanceCount);
+    }
+
+    // Each list holds its chunk's objects and starts at a dynamic offset,
+    // so that each draw binds its own with instance indices from 0. The
+    // binding spans the longest list, the buffer ends with room for it
+    // past the last offset.
+    auto listBytes = [](uint32_t objectCount) {
+        uint64_t size = static_cast<uint64_t>(std::max(objectCount, 1u)) * sizeof(uint32_t);
+        return (size + dynamicOffsetAlignment - 1) / dynamicOffsetAlignment * dynamicOffsetAlignment;
+    };
+    visibleBindingBytes = listBytes(maxObjectCount);
+    visibleOffsets.clear();
+    uint64_t visibleBytes = 0;
+    for (Chunk& chunk : chunks) {
+        chunk.outputOffset = static_cast<uint32_t>(visibleBytes / sizeof(uint32_t));
+        visibleOffsets.push_back(static_cast<uint32_t>(std::min<uint64_t>(visibleBytes, UINT32_MAX)));
+        visibleBytes += listBytes(chunk.objectCount);
+    }
+    visibleBytes = (visibleOffsets.empty() ? 0 : visibleOffsets.back()) + visibleBindingBytes;
+
+    // Cull nothing rather than fail creating the buffer or the bind group
+    withinLimits = visibleBytes <= maxStorageBytes;
+    if (!withinLimits) {
+        std::cerr << "GPU culling needs " << visibleBytes << " bytes of visible lists, the device binds "
+                  << maxStorageBytes << " at most; culling on the CPU" << std::endl;
+        chunks.clear();
+        args.clear();
+        visibleOffsets.clear();
+        visibleBindingBytes = dynamicOffsetAlignment;
+        visibleBytes = visibleBindingBytes;
+        maxObjectCount = 0;
+    }
+
+    uint64_t argsSize = args.size() * sizeof(DrawArgs);
+    createBuffer(chunkBuffer, "GPU culling chunks", chunks.size() * sizeof(Chunk), wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Storage, chunks.data());
+    createBuffer(
+        argsBuffer, "GPU culling draw arguments", argsSize,
+        wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Storage | wgpu::BufferUsage::Indirect, args.data()
+    );
+    createBuffer(argsResetBuffer, "GPU culling draw arguments reset", argsSize, wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::CopySrc, args.data());
+    createBuffer(visibleBuffer, "GPU culling visible instances", visibleBytes, wgpu::BufferUsage::Storage, nullptr);
+    return true;
+}
+
+bool GpuCuller::updateBindGroups() {
+    if (!bindGroupsDirty) return cullBindGroup != nullptr;
+    if (!chunkBuffer || !transformBuffer || !hiZView) return false;
+
+    if (cullBindGroup) cullBindGroup.release();
+    cullBindGroup = createBindGroup(device, cullLayout, {
+        bufferBinding(0, ringBuffer, sizeof(Uniforms)),
+        bufferBinding(1, chunkBuffer, chunkBuffer.getSize()),
+        bufferBinding(2, transformBuffer, transformBindingSize),
+        textureBinding(3, hiZView),
+        bufferBinding(4, argsBuffer, argsBuffer.getSize()),
+        bufferBinding(5, visibleBuffer, visibleBuffer.getSize()),
+        bufferBinding(6, statsBuffer, sizeof(Stats)),
+    });
+
+    if (displayBindGroup) displayBindGroup.release();
+    displayBindGroup = createBindGroup(device, displayLayout, {
+        bufferBinding(0, ringBuffer, sizeof(Uniforms)),
+        textureBinding(3, hiZView),
+    });
+
+    bindGroupsDirty = false;
+    return true;
+}
+
+void GpuCuller::prepare(UploadRing& ring, const glm::mat4x4& viewProjection, const glm::mat4x4& projection, uint32_t debugLevel) {
+    frameViewProjection = viewProjection;
+    bool occlusion = occlusionEnabled && hiZReady;
+    hiZReady = false;
+
+    uniforms.previousViewProjection = hiZViewProjection;
+    uniforms.planes = Frustum::fromMatrix(viewProjection).planes;
+    uniforms.depthSize = depthSize;
+    uniforms.occlusion = occlusion ? 1 : 0;
+    // depth = a + b / distance, from the third row of the projection
+    uniforms.depthTerms = glm::vec2(projection[2][2], projection[3][2]);
+    uniforms.debugLevel = debugLevel;
+    uniformsOffset = static_cast<uint32_t>(ring.push(uniforms));
+}
+
+void GpuCuller::cull(wgpu::CommandEncoder encoder) {
+    currentSlot = -1;
+    if (chunks.empty() || !updateBindGroups()) return;
+
+    // Every chunk starts with no instance
+    encoder.copyBufferToBuffer(argsResetBuffer, 0, argsBuffer, 0, chunks.size() * sizeof(DrawArgs));
+    encoder.clearBuffer(statsBuffer, 0, sizeof(Stats));
+
+    wgpu::ComputePassDescriptor computePassDesc;
+    computePassDesc.timestampWrites = nullptr;
+    wgpu::ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+    computePass.setPipeline(cullPipeline);
+    computePass.setBindGroup(0, cullBindGroup, 1, &uniformsOffset);
+    uint32_t objectGroups = std::min((maxObjectCount + cullWorkgroupSize - 1) / cullWorkgroupSize, maxWorkgroupsPerDimension);
+    computePass.dispatchWorkgroups(objectGroups, static_cast<uint32_t>(chunks.size()), 1);
+    computePass.end();
+    computePass.release();
+
+    // Read the counts back unless every slot is still in flight
+    if (!readbackSlots.empty() && readbackSlots[nextSlot].state == SlotState::Free) {
+        currentSlot = static_cast<int>(nextSlot);
+        readbackSlots[nextSlot].state = SlotState::Recording;
+        encoder.copyBufferToBuffer(statsBuffer, 0, readbackSlots[nextSlot].buffer, 0, sizeof(Stats));
+    }
+}
+
+void GpuCuller::draw(wgpu::RenderPassEncoder renderPass, wgpu::BindGroup bindGroup, std::span<const uint32_t> dynamicOffsets, size_t visibleIndex) const {
+    recordDraws(renderPass, bindGroup, dynamicOffsets, visibleIndex);
+}
+
+void GpuCuller::draw(wgpu::RenderBundleEncoder bundle, wgpu::BindGroup bindGroup, std::span<const uint32_t> dynamicOffsets, size_t visibleIndex) const {
+    recordDraws(bundle, bindGroup, dynamicOffsets, visibleIndex);
+}
+
+template <typename Encoder>
+void GpuCuller::recordDraws(Encoder& encoder, wgpu::BindGroup bindGroup, std::span<const uint32_t> dynamicOffsets, size_t visibleIndex) const {
+    if (chunks.empty() || visibleIndex >= dynamicOffsets.size()) return;
+
+    std::vector<uint32_t> offsets(dynamicOffsets.begin(), dynamicOffsets.end());
+    for (size_t chunk = 0; chunk < chunks.size(); chunk++) {
+        offsets[visibleIndex] = visibleOffsets[chunk];
+        encoder.setBindGroup(0, bindGroup, offsets.size(), offsets.data());
+        encoder.drawIndexedIndirect(argsBuffer, chunk * sizeof(DrawArgs));
+    }
+}
+
+void GpuCuller::buildHiZ(wgpu::CommandEncoder encoder) {
+    if (reduceBindGroups.empty()) return;
+
+    // Each dispatch is its own synchronization scope, so a single pass can
+    // walk down the whole pyramid
+    wgpu::ComputePassDescriptor computePassDesc;
+    computePassDesc.timestampWrites = nullptr;
+    wgpu::ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+
+    uint32_t width = static_cast<uint32_t>(depthSize.x);
+    uint32_t height = static_cast<uint32_t>(depthSize.y);
+    for (uint32_t level = 0; level < reduceBindGroups.size(); level++) {
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+
+        computePass.setPipeline(level == 0 ? reduceDepthPipeline : reducePipeline);
+        computePass.setBindGroup(0, reduceBindGroups[level], 0, nullptr);
+        computePass.dispatchWorkgroups((width + 7) / 8, (height + 7) / 8, 1);
+    }
+
+    computePass.end();
+    computePass.release();
+
+    hiZViewProjection = frameViewProjection;
+    hiZReady = true;
+}
+
+void GpuCuller::drawHiZ(wgpu::RenderPassEncoder renderPass) {
+    if (!updateBindGroups()) return;
+
+    renderPass.setPipeline(displayPipeline);
+    renderPass.setBindGroup(0, displayBindGroup, 1, &uniformsOffset);
+    renderPass.draw(3, 1, 0, 0);
+}
+
+void GpuCuller::submitted() {
+    if (currentSlot < 0) return;
+
+    ReadbackSlot& slot = readbackSlots[currentSlot];
+    wgpu::BufferMapCallbackInfo callbackInfo;
+    callbackInfo.nextInChain = nullptr;
+    callbackInfo.mode = wgpu::CallbackMode::AllowProcessEvents;
+    callbackInfo.callback = onBufferMapped;
+    callbackInfo.userdata1 = &slot;
+    callbackInfo.userdata2 = nullptr;
+    slot.state = SlotState::Mapping;
+    slot.buffer.mapAsync(wgpu::MapMode::Read, 0, sizeof(Stats), callbackInfo);
+
+    nextSlot = (nextSlot + 1) % readbackSlots.size();
+    currentSlot = -1;
+}
+
+void GpuCuller::collect() {
+    while (!readbackSlots.empty() && readbackSlots[oldestSlot].state == SlotState::Mapped) {
+        ReadbackSlot& slot = readbackSlots[oldestSlot];
+        if (slot.mapSucceeded) {
+            lastStats = *static_cast<const Stats*>(slot.buffer.getConstMappedRange(0, sizeof(Stats)));
+            slot.buffer.unmap();
+        }
+        slot.state = SlotState::Free;
+        slot.mapSucceeded = false;
+        oldestSlot = (oldestSlot + 1) % readbackSlots.size();
+    }
+}
+
+void GpuCuller::onBufferMapped(WGPUMapAsyncStatus status, WGPUStringView message, void* userdata1, [[maybe_unused]] void* userdata2) {
+    ReadbackSlot& slot = *reinterpret_cast<ReadbackSlot*>(userdata1);
+    if (status != WGPUMapAsyncStatus_Success) {
+        std::cerr << "Could not read back GPU culling counts";
+        if (message.data) std::cerr << ": " << std::string_view(message.data, message.length);
+        std::cerr << std::endl;
+    }
+    slot.mapSucceeded = status == WGPUMapAsyncStatus_Success;
+    slot.state = SlotState::Mapped;
+}
@@ -0,0 +1,248 @@
+#ifndef _GPU_CULLER_H
+#define _GPU_CULLER_H
+
+#include "scene_instances.hpp"
+#include "upload_ring.hpp"
+
+#include <webgpu/webgpu.hpp>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+/**
+ * Culls the objects of SceneInstances on the GPU, so that the CPU records
+ * the same few commands whatever the object count. A compute pass tests
+ * every chunk of every object against the frustum and against a Hi-Z
+ * pyramid, the farthest depth of the previous frame per texel at each
+ * level, and appends the survivors to one visible list per chunk. Each
+ * chunk is drawn with drawIndexedIndirect, its instance count written by
+ * the pass; the vertex shader finds the object through the visible list
+ * (the GPU_CULLING permutation of shader.wgsl).
+ *
+ * The occlusion test reprojects into the previous frame's depth, so an
+ * object coming out from behind another one shows up a frame late.
+ */
+class GpuCuller {
+public:
+    // Chunks of every object, as counted by the last culling pass read back
+    struct Stats {
+        uint32_t visible = 0;
+        uint32_t frustumCulled = 0;
+        uint32_t occlusionCulled = 0;
+    };
+
+    /**
+     * Load the shader and create the pipelines, the debug view drawing into
+     * targets of `colorFormat` and `depthFormat`. Uniforms are read from
+     * `ringBuffer`, the buffer of the upload ring.
+     */
+    bool initialize(
+        wgpu::Device device,
+        const std::filesystem::path& shaderPath,
+        wgpu::TextureFormat colorFormat,
+        wgpu::TextureFormat depthFormat,
+        wgpu::Buffer ringBuffer,
+        uint32_t readbackRingSize = 3
+    );
+
+    // Release every object created so far
+    void terminate();
+
+    /**
+     * Create the pyramid of a `depthTexture` of `width` x `height`, which
+     * must have the TextureBinding usage. Occlusion culling waits for the
+     * next buildHiZ().
+     */
+    void resize(wgpu::Texture depthTexture, uint32_t width, uint32_t height);
+
+    /**
+     * Follow the objects of `instances`, after its upload(). Returns true
+     * when the visible lists had to be recreated, in which case bind groups
+     * using visibleInstanceBuffer() must be created again.
+     */
+    bool update(const SceneInstances& instances);
+
+    /**
+     * False when the visible lists of the objects given to update() would
+     * not fit in one storage binding of the device. Nothing is culled or
+     * drawn then, the objects must be culled on the CPU.
+     */
+    bool fitsDeviceLimits() const { return withinLimits; }
+
+    /**
+     * Write the frame's uniforms into `ring`: the frustum of
+     * `viewProjection`, world space to clip space, and for drawHiZ() the
+     * `debugLevel` of the pyramid to show, its depths as distances given
+     * the `projection` that produced them
+     */
+    void prepare(UploadRing& ring, const glm::mat4x4& viewProjection, const glm::mat4x4& projection, uint32_t debugLevel);
+
+    /**
+     * Record the culling pass against the frustum given to prepare(), and
+     * against the pyramid built by the previous frame's buildHiZ()
+     */
+    void cull(wgpu::CommandEncoder encoder);
+
+    /**
+     * Record one indirect draw per chunk, with the vertex and index buffers
+     * already set. Group 0 is set to `bindGroup` with `dynamicOffsets`, the
+     * one at `visibleIndex` replaced by the offset of the chunk's visible
+     * list.
+     */
+    void draw(wgpu::RenderPassEncoder renderPass, wgpu::BindGroup bindGroup, std::span<const uint32_t> dynamicOffsets, size_t visibleIndex) const;
+
+    // Same, into a render bundle
+    void draw(wgpu::RenderBundleEncoder bundle, wgpu::BindGroup bindGroup, std::span<const uint32_t> dynamicOffsets, size_t visibleIndex) const;
+
+    // Record the build of the pyramid from the depth the frame's draws left
+    void buildHiZ(wgpu::CommandEncoder encoder);
+
+    // Draw the level of the pyramid given to prepare() over the viewport
+    void drawHiZ(wgpu::RenderPassEncoder renderPass);
+
+    // Start reading back the counts of the current frame, once submitted
+    void submitted();
+
+    // Pick up the counts read back since the last call
+    void collect();
+
+    void setOcclusionEnabled(bool enabled) { occlusionEnabled = enabled; }
+    bool isOcclusionEnabled() const { return occlusionEnabled; }
+
+    const Stats& stats() const { return lastStats; }
+
+    // Indirect draws recorded by draw(), one per chunk
+    uint32_t drawCount() const { return static_cast<uint32_t>(chunks.size()); }
+
+    uint32_t hiZLevelCount() const { return static_cast<uint32_t>(hiZLevels.size()); }
+
+    // Visible lists read by the vertex shader, bound with a dynamic offset
+    wgpu::Buffer visibleInstanceBuffer() const { return visibleBuffer; }
+    uint64_t visibleBindingSize() const { return visibleBindingBytes; }
+
+private:
+    struct Uniforms {
+        glm::mat4x4 previousViewProjection;
+        std::array<glm::vec4, 6> planes;
+        glm::vec2 depthSize;
+        glm::vec2 depthTerms;
+        uint32_t occlusion;
+        uint32_t debugLevel;
+        uint32_t _pad[2];
+    };
+    static_assert(sizeof(Uniforms) % 16 == 0);
+    static_assert(sizeof(Uniforms) <= 256, "maxUniformBufferBindingSize");
+
+    // Layout of Chunk in gpu_culling.wgsl
+    struct Chunk {
+        glm::vec3 boundsMin;
+        uint32_t firstSlot;
+        glm::vec3 boundsMax;
+        uint32_t objectCount;
+        uint32_t outputOffset;
+        uint32_t _pad[3];
+    };
+    static_assert(sizeof(Chunk) == 48);
+
+    struct DrawArgs {
+        uint32_t indexCount;
+        uint32_t instanceCount;
+        uint32_t firstIndex;
+        int32_t baseVertex;
+        uint32_t firstInstance;
+    };
+
+    enum class SlotState {
+        Free,
+        Recording,
+        Mapping,
+        Mapped,
+    };
+
+    struct ReadbackSlot {
+        wgpu::Buffer buffer;
+        SlotState state = SlotState::Free;
+        bool mapSucceeded = false;
+    };
+
+    // (Re)create `buffer`, never empty
+    void createBuffer(wgpu::Buffer& buffer, const char* label, uint64_t size, wgpu::BufferUsage usage, const void* data);
+    void releaseHiZ();
+    // Create the bind groups again if what they use changed
+    bool updateBindGroups();
+    // Shared by the draw() of passes and bundles
+    template <typename Encoder>
+    void recordDraws(Encoder& encoder, wgpu::BindGroup bindGroup, std::span<const uint32_t> dynamicOffsets, size_t visibleIndex) const;
+
+    static void onBufferMapped(WGPUMapAsyncStatus status, WGPUStringView message, void* userdata1, void* userdata2);
+
+private:
+    wgpu::Device device;
+    wgpu::Queue queue;
+
+    wgpu::BindGroupLayout cullLayout;
+    wgpu::BindGroupLayout reduceDepthLayout;
+    wgpu::BindGroupLayout reduceLayout;
+    wgpu::BindGroupLayout displayLayout;
+    wgpu::ComputePipeline cullPipeline;
+    wgpu::ComputePipeline reduceDepthPipeline;
+    wgpu::ComputePipeline reducePipeline;
+    wgpu::RenderPipeline displayPipeline;
+
+    // Of the upload ring, the uniforms are at uniformsOffset this frame
+    wgpu::Buffer ringBuffer;
+    uint32_t uniformsOffset = 0;
+    wgpu::Buffer chunkBuffer;
+    wgpu::Buffer argsBuffer;
+    // Arguments with no instance, copied over argsBuffer before each pass
+    wgpu::Buffer argsResetBuffer;
+    wgpu::Buffer visibleBuffer;
+    wgpu::Buffer statsBuffer;
+    wgpu::BindGroup cullBindGroup;
+    wgpu::BindGroup displayBindGroup;
+    bool bindGroupsDirty = true;
+    // Instance buffer of SceneInstances, it moves as it grows
+    wgpu::Buffer transformBuffer;
+    uint64_t transformBindingSize = 0;
+    uint32_t layoutVersion = UINT32_MAX;
+
+    std::vector<Chunk> chunks;
+    // Byte offset of each chunk's visible list, a multiple of the dynamic
+    // offset alignment. Every list is as long as its chunk's objects, the
+    // binding spans the longest.
+    std::vector<uint32_t> visibleOffsets;
+    uint64_t visibleBindingBytes = 256;
+    uint32_t maxObjectCount = 0;
+    // Largest storage binding the device allows
+    uint64_t maxStorageBytes = 0;
+    bool withinLimits = true;
+
+    // The pyramid, its whole view and one view and build bind group per level
+    wgpu::Texture hiZTexture;
+    wgpu::TextureView hiZView;
+    wgpu::TextureView depthView;
+    std::vector<wgpu::TextureView> hiZLevels;
+    std::vector<wgpu::BindGroup> reduceBindGroups;
+    glm::vec2 depthSize = glm::vec2(0.0f);
+
+    Uniforms uniforms{};
+    // View projection of the current frame, and of the one the pyramid
+    // was built from
+    glm::mat4x4 frameViewProjection = glm::mat4x4(1.0f);
+    glm::mat4x4 hiZViewProjection = glm::mat4x4(1.0f);
+    bool occlusionEnabled = true;
+    // Set by buildHiZ() for the next frame's cull() only
+    bool hiZReady = false;
+
+    std::vector<ReadbackSlot> readbackSlots;
+    size_t nextSlot = 0;
+    size_t oldestSlot = 0;
+    int currentSlot = -1;
+    Stats lastStats;
+};
+
+#endif // _GPU_CULLER_H
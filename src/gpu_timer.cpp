@@ -0,0 +1,145 @@
+#include "gpu_timer.hpp"
+#include "webgpu_utils.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <string_view>
+
+namespace {
+
+// resolveQuerySet destination offsets must be a multiple of this
+constexpr uint64_t queryResolveAlignment = 256;
+
+} // namespace
+
+bool GpuTimer::initialize(wgpu::Device device, uint32_t passCount, uint32_t ringSize) {
+    if (!device.hasFeature(wgpu::FeatureName::TimestampQuery)) {
+        return false;
+    }
+
+    this->passCount = passCount;
+    slots.resize(std::max(ringSize, 1u));
+
+    // Two timestamps per pass and per slot
+    uint32_t queriesPerSlot = 2 * passCount;
+    wgpu::QuerySetDescriptor querySetDesc;
+    querySetDesc.label = "Pass timestamps"_wgpu;
+    querySetDesc.type = wgpu::QueryType::Timestamp;
+    querySetDesc.count = queriesPerSlot * static_cast<uint32_t>(slots.size());
+    querySet = device.createQuerySet(querySetDesc);
+
+    uint64_t slotSize = queriesPerSlot * sizeof(uint64_t);
+    slotStride = (slotSize + queryResolveAlignment - 1) / queryResolveAlignment * queryResolveAlignment;
+
+    wgpu::BufferDescriptor bufferDesc;
+    bufferDesc.label = "Timestamp resolve buffer"_wgpu;
+    bufferDesc.size = slotStride * slots.size();
+    bufferDesc.usage = wgpu::BufferUsage::QueryResolve | wgpu::BufferUsage::CopySrc;
+    bufferDesc.mappedAtCreation = false;
+    resolveBuffer = device.createBuffer(bufferDesc);
+
+    bufferDesc.label = "Timestamp readback buffer"_wgpu;
+    bufferDesc.size = slotSize;
+    bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::MapRead;
+    for (Slot& slot : slots) {
+        slot.readbackBuffer = device.createBuffer(bufferDesc);
+    }
+
+    writes.resize(passCount);
+    durations.resize(passCount);
+    return true;
+}
+
+void GpuTimer::terminate() {
+    for (Slot& slot : slots) {
+        if (slot.state == SlotState::Mapped && slot.mapSucceeded) slot.readbackBuffer.unmap();
+        slot.readbackBuffer.release();
+    }
+    slots.clear();
+    if (resolveBuffer) resolveBuffer.release();
+    if (querySet) querySet.release();
+    resolveBuffer = nullptr;
+    querySet = nullptr;
+}
+
+bool GpuTimer::beginFrame(uint64_t frameIndex) {
+    currentSlot = -1;
+    if (!isAvailable() || slots[nextSlot].state != SlotState::Free) return false;
+
+    currentSlot = static_cast<int>(nextSlot);
+    Slot& slot = slots[nextSlot];
+    slot.state = SlotState::Recording;
+    slot.frameIndex = frameIndex;
+
+    uint32_t firstQuery = 2 * passCount * static_cast<uint32_t>(currentSlot);
+    for (uint32_t pass = 0; pass < passCount; pass++) {
+        writes[pass].querySet = querySet;
+        writes[pass].beginningOfPassWriteIndex = firstQuery + 2 * pass;
+        writes[pass].endOfPassWriteIndex = firstQuery + 2 * pass + 1;
+    }
+    return true;
+}
+
+const wgpu::RenderPassTimestampWrites* GpuTimer::renderPassWrites(uint32_t pass) const {
+    if (currentSlot < 0 || pass >= passCount) return nullptr;
+    return &writes[pass];
+}
+
+void GpuTimer::resolve(wgpu::CommandEncoder encoder) {
+    if (currentSlot < 0) return;
+
+    uint64_t offset = slotStride * static_cast<uint64_t>(currentSlot);
+    encoder.resolveQuerySet(querySet, 2 * passCount * static_cast<uint32_t>(currentSlot), 2 * passCount, resolveBuffer, offset);
+    encoder.copyBufferToBuffer(resolveBuffer, offset, slots[currentSlot].readbackBuffer, 0, 2 * passCount * sizeof(uint64_t));
+}
+
+void GpuTimer::submitted() {
+    if (currentSlot < 0) return;
+
+    Slot& slot = slots[currentSlot];
+    wgpu::BufferMapCallbackInfo callbackInfo;
+    callbackInfo.nextInChain = nullptr;
+    callbackInfo.mode = wgpu::CallbackMode::AllowProcessEvents;
+    callbackInfo.callback = onBufferMapped;
+    callbackInfo.userdata1 = &slot;
+    callbackInfo.userdata2 = nullptr;
+    slot.state = SlotState::Mapping;
+    slot.readbackBuffer.mapAsync(wgpu::MapMode::Read, 0, slot.readbackBuffer.getSize(), callbackInfo);
+
+    nextSlot = (nextSlot + 1) % slots.size();
+    currentSlot = -1;
+}
+
+void GpuTimer::collect(const std::function<void(uint64_t, std::span<const double>)>& sink) {
+    while (!slots.empty() && slots[oldestSlot].state == SlotState::Mapped) {
+        Slot& slot = slots[oldestSlot];
+        if (slot.mapSucceeded) {
+            const uint64_t* timestamps = static_cast<const uint64_t*>(
+                slot.readbackBuffer.getConstMappedRange(0, 2 * passCount * sizeof(uint64_t))
+            );
+            // Timestamps are in nanoseconds; a pass whose end is not after its
+            // beginning (clock reset, pass skipped) counts as zero
+            for (uint32_t pass = 0; pass < passCount; pass++) {
+                uint64_t begin = timestamps[2 * pass];
+                uint64_t end = timestamps[2 * pass + 1];
+                durations[pass] = end > begin ? static_cast<double>(end - begin) * 1e-6 : 0.0;
+            }
+            slot.readbackBuffer.unmap();
+            sink(slot.frameIndex, durations);
+        }
+        slot.state = SlotState::Free;
+        slot.mapSucceeded = false;
+        oldestSlot = (oldestSlot + 1) % slots.size();
+    }
+}
+
+void GpuTimer::onBufferMapped(WGPUMapAsyncStatus status, WGPUStringView message, void* userdata1, [[maybe_unused]] void* userdata2) {
+    Slot& slot = *reinterpret_cast<Slot*>(userdata1);
+    if (status != WGPUMapAsyncStatus_Success) {
+        std::cerr << "Could not read back GPU timestamps of frame " << slot.frameIndex;
+        if (message.data) std::cerr << ": " << std::string_view(message.data, message.length);
+        std::cerr << std::endl;
+    }
+    slot.mapSucceeded = status == WGPUMapAsyncStatus_Success;
+    slot.state = SlotState::Mapped;
+}
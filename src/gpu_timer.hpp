@@ -0,0 +1,91 @@
+#ifndef _GPU_TIMER_H
+#define _GPU_TIMER_H
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+/**
+ * Measures the GPU duration of a fixed set of passes with timestamp queries.
+ * Each frame writes its timestamps into its own slot of a ring; the slot is
+ * resolved, copied to a MapRead buffer and mapped asynchronously, and the
+ * durations are handed out by collect() a few frames later. A frame that
+ * finds every slot still in flight is not timed rather than waited for.
+ */
+class GpuTimer {
+public:
+    /**
+     * Create the queries for `passCount` passes per frame, return false when
+     * the device lacks the TimestampQuery feature
+     */
+    bool initialize(wgpu::Device device, uint32_t passCount, uint32_t ringSize = 4);
+
+    // Release every object created by initialize()
+    void terminate();
+
+    bool isAvailable() const { return querySet != nullptr; }
+
+    /**
+     * Pick the slot of frame `frameIndex`, false if the frame is not timed
+     */
+    bool beginFrame(uint64_t frameIndex);
+
+    /**
+     * Timestamp writes for `pass` of the current frame, null when the frame
+     * is not timed
+     */
+    const wgpu::RenderPassTimestampWrites* renderPassWrites(uint32_t pass) const;
+
+    /**
+     * Record the resolve of the current frame's queries, after its last
+     * timed pass
+     */
+    void resolve(wgpu::CommandEncoder encoder);
+
+    // Start reading back the current frame, once its commands are submitted
+    void submitted();
+
+    /**
+     * Call `sink(frameIndex, passMilliseconds)` for every frame read back
+     * since the last call, oldest first. Map callbacks only run while the
+     * device is polled.
+     */
+    void collect(const std::function<void(uint64_t, std::span<const double>)>& sink);
+
+private:
+    enum class SlotState {
+        Free,
+        Recording,
+        Mapping,
+        Mapped,
+    };
+
+    struct Slot {
+        wgpu::Buffer readbackBuffer;
+        SlotState state = SlotState::Free;
+        bool mapSucceeded = false;
+        uint64_t frameIndex = 0;
+    };
+
+    static void onBufferMapped(WGPUMapAsyncStatus status, WGPUStringView message, void* userdata1, void* userdata2);
+
+private:
+    wgpu::QuerySet querySet;
+    wgpu::Buffer resolveBuffer;
+    uint32_t passCount = 0;
+    // Bytes between the slots of resolveBuffer
+    uint64_t slotStride = 0;
+
+    std::vector<Slot> slots;
+    size_t nextSlot = 0;
+    size_t oldestSlot = 0;
+    // Slot of the current frame, or -1 when it is not timed
+    int currentSlot = -1;
+    std::vector<wgpu::RenderPassTimestampWrites> writes;
+    std::vector<double> durations;
+};
+
+#endif // _GPU_TIMER_H
@@ -0,0 +1,13 @@
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * 64 bit non-cryptographic hash of `size` bytes (XXH64), used to key
+ * on-disk caches
+ */
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+#endif // _HASH_H
@@ -1,10 +1,28 @@
 
 #include "app.hpp"
 
-int main() {
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// usage: App [--headless] [--frames count] [--output directory] [--software] [--path-tracer]
+int main(int argc, char** argv) {
+    ApplicationOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--headless") == 0) options.headless = true;
+        else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) options.frameCount = static_cast<uint32_t>(std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc) options.outputDirectory = argv[++i];
+        else if (std::strcmp(argv[i], "--software") == 0) options.forceFallbackAdapter = true;
+        else if (std::strcmp(argv[i], "--path-tracer") == 0) options.pathTraced = true;
+        else {
+            std::cerr << "Unknown argument: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
     Application app;
 
-    if (!app.Initialize()) {
+    if (!app.Initialize(options)) {
         return 1;
     }
 
@@ -15,4 +33,4 @@ int main() {
     app.Terminate();
 
     return 0;
-}
\ No newline at end of file
+}
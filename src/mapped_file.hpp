@@ -0,0 +1,41 @@
+#ifndef _MAPPED_FILE_H
+#define _MAPPED_FILE_H
+
+#include <cstddef>
+#include <filesystem>
+
+/**
+ * Read-only memory mapping of a whole file. Other handles may write to the
+ * file while it is mapped, and their writes show through the mapping.
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    // Map the file at `path`, return false if it cannot be opened
+    bool open(const std::filesystem::path& path);
+
+    // Unmap the file, safe to call when nothing is mapped
+    void close();
+
+    bool isOpen() const { return opened; }
+    const unsigned char* data() const { return mapped; }
+    size_t size() const { return length; }
+
+private:
+    const unsigned char* mapped = nullptr;
+    size_t length = 0;
+    bool opened = false;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+#endif // _MAPPED_FILE_H
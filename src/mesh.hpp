@@ -0,0 +1,104 @@
+#ifndef _MESH_H
+#define _MESH_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+struct VertexAttributes {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec3 color;
+    glm::vec2 uv;
+};
+
+/**
+ * A contiguous range of the index buffer, one per OBJ shape
+ */
+struct SubMesh {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+};
+
+/**
+ * Axis aligned bounding box
+ */
+struct Bounds {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+    void extend(const glm::vec3& point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    bool isEmpty() const { return min.x > max.x; }
+};
+
+/**
+ * Spatially compact range of the index buffer, culled as a whole. Chunks
+ * tile the sub-meshes, never straddling two of them.
+ */
+struct MeshChunk {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    Bounds bounds;
+};
+
+/**
+ * Level of detail of a mesh, a range of the index buffer drawing it with
+ * fewer triangles over the same vertices. Level 0 is the full mesh.
+ */
+struct MeshLod {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    // Distance from this level's surface to the full mesh, in model units,
+    // as estimated by the simplifier
+    float error;
+};
+
+/**
+ * GPU-ready indexed triangle mesh
+ */
+struct Mesh {
+    std::vector<VertexAttributes> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<SubMesh> subMeshes;
+    std::vector<MeshChunk> chunks;
+    // Empty or starting with the full mesh, whose indices come first;
+    // sub-meshes and chunks only cover level 0
+    std::vector<MeshLod> lods;
+    Bounds bounds;
+};
+
+/**
+ * Non-owning view of mesh arrays, either from a Mesh or from a mapped cache
+ */
+struct MeshView {
+    std::span<const VertexAttributes> vertices;
+    std::span<const uint32_t> indices;
+    std::span<const SubMesh> subMeshes;
+    std::span<const MeshChunk> chunks;
+    std::span<const MeshLod> lods;
+    Bounds bounds;
+
+    MeshView() = default;
+    MeshView(const Mesh& mesh)
+        : vertices(mesh.vertices)
+        , indices(mesh.indices)
+        , subMeshes(mesh.subMeshes)
+        , chunks(mesh.chunks)
+        , lods(mesh.lods)
+        , bounds(mesh.bounds)
+    {}
+
+    // Indices of the full mesh, without those of the coarser levels
+    std::span<const uint32_t> baseIndices() const {
+        return lods.empty() ? indices : indices.first(lods[0].indexCount);
+    }
+};
+
+#endif // _MESH_H
@@ -0,0 +1,247 @@
+#include "mesh_cache.hpp"
+#include "hash.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+
+namespace {
+
+// Bump whenever the layout or the content of the cached arrays changes
+constexpr uint32_t meshCacheVersion = 4;
+constexpr char meshCacheMagic[8] = { 'W', 'G', 'P', 'U', 'M', 'S', 'H', '\0' };
+constexpr uint64_t sectionAlignment = 16;
+
+struct MeshCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t vertexStride;
+
+    // Identity of the source the cache was built from
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint64_t sourceHash;
+    // Settings the mesh was processed with, see MeshOptimizerOptions::key()
+    uint64_t buildKey;
+
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    uint64_t subMeshCount;
+    uint64_t chunkCount;
+    uint64_t lodCount;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint64_t subMeshOffset;
+    uint64_t chunkOffset;
+    uint64_t lodOffset;
+
+    float boundsMin[3];
+    float boundsMax[3];
+
+    // Combined hash of the five arrays
+    uint64_t payloadHash;
+};
+
+struct SourceInfo {
+    uint64_t size;
+    int64_t mtime;
+};
+
+uint64_t alignUp(uint64_t value) {
+    return (value + sectionAlignment - 1) & ~(sectionAlignment - 1);
+}
+
+bool statSource(const std::filesystem::path& source, SourceInfo& info) {
+    std::error_code error;
+    info.size = std::filesystem::file_size(source, error);
+    if (error) return false;
+    auto mtime = std::filesystem::last_write_time(source, error);
+    if (error) return false;
+    info.mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+    return true;
+}
+
+uint64_t hashSections(
+    std::span<const VertexAttributes> vertices,
+    std::span<const uint32_t> indices,
+    std::span<const SubMesh> subMeshes,
+    std::span<const MeshChunk> chunks,
+    std::span<const MeshLod> lods
+) {
+    uint64_t hash = hashBytes(vertices.data(), vertices.size_bytes());
+    hash = hashBytes(indices.data(), indices.size_bytes(), hash);
+    hash = hashBytes(subMeshes.data(), subMeshes.size_bytes(), hash);
+    hash = hashBytes(chunks.data(), chunks.size_bytes(), hash);
+    return hashBytes(lods.data(), lods.size_bytes(), hash);
+}
+
+bool hashSource(const std::filesystem::path& source, uint64_t& hash) {
+    MappedFile file;
+    if (!file.open(source)) return false;
+    hash = hashBytes(file.data(), file.size());
+    return true;
+}
+
+// Rewrite the source mtime recorded in the header of the cache at `path`
+bool updateSourceMtime(const std::filesystem::path& path, int64_t mtime) {
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file.is_open()) return false;
+    file.seekp(static_cast<std::streamoff>(offsetof(MeshCacheHeader, sourceMtime)));
+    file.write(reinterpret_cast<const char*>(&mtime), sizeof(mtime));
+    return static_cast<bool>(file);
+}
+
+} // namespace
+
+std::filesystem::path MeshCache::cachePath(const std::filesystem::path& source) {
+    std::filesystem::path path = source;
+    path += ".meshcache";
+    return path;
+}
+
+bool MeshCache::write(const std::filesystem::path& source, const MeshView& mesh, uint64_t buildKey) {
+    MeshCacheHeader header{};
+    std::memcpy(header.magic, meshCacheMagic, sizeof(header.magic));
+    header.version = meshCacheVersion;
+    header.vertexStride = sizeof(VertexAttributes);
+
+    SourceInfo info;
+    if (!statSource(source, info) || !hashSource(source, header.sourceHash)) return false;
+    header.sourceSize = info.size;
+    header.sourceMtime = info.mtime;
+    header.buildKey = buildKey;
+
+    header.vertexCount = mesh.vertices.size();
+    header.indexCount = mesh.indices.size();
+    header.subMeshCount = mesh.subMeshes.size();
+    header.chunkCount = mesh.chunks.size();
+    header.lodCount = mesh.lods.size();
+    header.vertexOffset = alignUp(sizeof(MeshCacheHeader));
+    header.indexOffset = alignUp(header.vertexOffset + mesh.vertices.size_bytes());
+    header.subMeshOffset = alignUp(header.indexOffset + mesh.indices.size_bytes());
+    header.chunkOffset = alignUp(header.subMeshOffset + mesh.subMeshes.size_bytes());
+    header.lodOffset = alignUp(header.chunkOffset + mesh.chunks.size_bytes());
+
+    std::memcpy(header.boundsMin, &mesh.bounds.min, sizeof(header.boundsMin));
+    std::memcpy(header.boundsMax, &mesh.bounds.max, sizeof(header.boundsMax));
+
+    header.payloadHash = hashSections(mesh.vertices, mesh.indices, mesh.subMeshes, mesh.chunks, mesh.lods);
+
+    std::filesystem::path path = cachePath(source);
+    std::filesystem::path tempPath = path;
+    tempPath += ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return false;
+
+        const char padding[sectionAlignment] = {};
+        auto writeSection = [&](uint64_t offset, const void* data, size_t size) {
+            file.write(padding, static_cast<std::streamsize>(offset - static_cast<uint64_t>(file.tellp())));
+            if (size > 0) file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        };
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writeSection(header.vertexOffset, mesh.vertices.data(), mesh.vertices.size_bytes());
+        writeSection(header.indexOffset, mesh.indices.data(), mesh.indices.size_bytes());
+        writeSection(header.subMeshOffset, mesh.subMeshes.data(), mesh.subMeshes.size_bytes());
+        writeSection(header.chunkOffset, mesh.chunks.data(), mesh.chunks.size_bytes());
+        writeSection(header.lodOffset, mesh.lods.data(), mesh.lods.size_bytes());
+        if (!file) return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    if (error) {
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+    return true;
+}
+
+bool MeshCache::open(const std::filesystem::path& source, MappedFile& file, MeshView& mesh, uint64_t buildKey) {
+    SourceInfo info;
+    if (!statSource(source, info)) return false;
+    if (!file.open(cachePath(source))) return false;
+
+    MeshCacheHeader header;
+    if (file.size() < sizeof(header)) {
+        file.close();
+        return false;
+    }
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    bool valid = std::memcmp(header.magic, meshCacheMagic, sizeof(header.magic)) == 0
+        && header.version == meshCacheVersion
+        && header.vertexStride == sizeof(VertexAttributes)
+        && header.sourceSize == info.size
+        && header.buildKey == buildKey;
+
+    // A different mtime alone does not make the cache stale (e.g. after a
+    // fresh checkout), only a different content hash does
+    bool mtimeChanged = header.sourceMtime != info.mtime;
+    if (valid && mtimeChanged) {
+        uint64_t sourceHash;
+        valid = hashSource(source, sourceHash) && sourceHash == header.sourceHash;
+    }
+
+    // Sections must lie inside the file
+    auto sectionFits = [&](uint64_t offset, uint64_t count, size_t elementSize) {
+        return offset >= sizeof(header)
+            && offset % sectionAlignment == 0
+            && offset <= file.size()
+            && count <= (file.size() - offset) / elementSize;
+    };
+    valid = valid
+        && sectionFits(header.vertexOffset, header.vertexCount, sizeof(VertexAttributes))
+        && sectionFits(header.indexOffset, header.indexCount, sizeof(uint32_t))
+        && sectionFits(header.subMeshOffset, header.subMeshCount, sizeof(SubMesh))
+        && sectionFits(header.chunkOffset, header.chunkCount, sizeof(MeshChunk))
+        && sectionFits(header.lodOffset, header.lodCount, sizeof(MeshLod));
+    if (!valid) {
+        file.close();
+        return false;
+    }
+
+    const unsigned char* data = file.data();
+    mesh.vertices = { reinterpret_cast<const VertexAttributes*>(data + header.vertexOffset), header.vertexCount };
+    mesh.indices = { reinterpret_cast<const uint32_t*>(data + header.indexOffset), header.indexCount };
+    mesh.subMeshes = { reinterpret_cast<const SubMesh*>(data + header.subMeshOffset), header.subMeshCount };
+    mesh.chunks = { reinterpret_cast<const MeshChunk*>(data + header.chunkOffset), header.chunkCount };
+    mesh.lods = { reinterpret_cast<const MeshLod*>(data + header.lodOffset), header.lodCount };
+    std::memcpy(&mesh.bounds.min, header.boundsMin, sizeof(header.boundsMin));
+    std::memcpy(&mesh.bounds.max, header.boundsMax, sizeof(header.boundsMax));
+
+    // Catch truncated or corrupted contents
+    valid = hashSections(mesh.vertices, mesh.indices, mesh.subMeshes, mesh.chunks, mesh.lods) == header.payloadHash;
+
+    // Sub-mesh and chunk ranges must lie inside the index array
+    for (const SubMesh& subMesh : mesh.subMeshes) {
+        valid = valid && static_cast<uint64_t>(subMesh.firstIndex) + subMesh.indexCount <= header.indexCount;
+    }
+    for (const MeshChunk& chunk : mesh.chunks) {
+        valid = valid && static_cast<uint64_t>(chunk.firstIndex) + chunk.indexCount <= header.indexCount;
+    }
+    // Level 0 is the full mesh at the start of the index array
+    valid = valid && (mesh.lods.empty() || mesh.lods[0].firstIndex == 0);
+    for (const MeshLod& lod : mesh.lods) {
+        valid = valid && static_cast<uint64_t>(lod.firstIndex) + lod.indexCount <= header.indexCount;
+    }
+
+    if (!valid) {
+        mesh = MeshView();
+        file.close();
+        return false;
+    }
+
+    // The hash vouched for the source, record its new mtime so that the
+    // next launches skip hashing it. Only the header changes, which the
+    // mesh does not point into; the mapping lets other handles write.
+    if (mtimeChanged && !updateSourceMtime(cachePath(source), info.mtime)) {
+        std::cerr << "Could not record the new mtime of " << source << " in its mesh cache, "
+                  << "it will be hashed again on the next launch" << std::endl;
+    }
+
+    return true;
+}
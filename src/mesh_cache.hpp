@@ -0,0 +1,43 @@
+#ifndef _MESH_CACHE_H
+#define _MESH_CACHE_H
+
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+
+#include <cstdint>
+#include <filesystem>
+
+/**
+ * Versioned binary copy of a loaded mesh, stored next to its source file.
+ * The file holds the final vertex, index, sub-mesh, chunk and level of
+ * detail arrays so that it can be memory mapped and uploaded without any
+ * parsing.
+ *
+ * Layout (native endianness): a MeshCacheHeader followed by the vertex,
+ * index, sub-mesh, chunk and level of detail arrays at 16 byte aligned
+ * offsets.
+ */
+class MeshCache {
+public:
+    /**
+     * Path of the cache file belonging to `source`
+     */
+    static std::filesystem::path cachePath(const std::filesystem::path& source);
+
+    /**
+     * Write the cache of `source`. The file is written under a temporary
+     * name and renamed, so readers never see a partial cache. `buildKey`
+     * identifies the settings the mesh was processed with.
+     */
+    static bool write(const std::filesystem::path& source, const MeshView& mesh, uint64_t buildKey);
+
+    /**
+     * Map the cache of `source` into `file` and point `mesh` into it.
+     * Returns false when the cache is missing, was built from a different
+     * version of the source or with another `buildKey`, or is corrupt.
+     * A source touched without changing records its new mtime in the cache.
+     */
+    static bool open(const std::filesystem::path& source, MappedFile& file, MeshView& mesh, uint64_t buildKey);
+};
+
+#endif // _MESH_CACHE_H
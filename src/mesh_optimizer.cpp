@@ -0,0 +1,498 @@
+#include "mesh_optimizer.hpp"
+#include "hash.hpp"
+#include "mesh_simplifier.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+namespace {
+
+constexpr size_t vertexWordCount = sizeof(VertexAttributes) / sizeof(uint32_t);
+static_assert(sizeof(VertexAttributes) % sizeof(uint32_t) == 0);
+
+// Adding +0 turns -0 into +0 so that both weld together
+VertexAttributes canonicalize(const VertexAttributes& v) {
+    VertexAttributes c;
+    c.position = v.position + 0.0f;
+    c.normal = v.normal + 0.0f;
+    c.color = v.color + 0.0f;
+    c.uv = v.uv + 0.0f;
+    return c;
+}
+
+uint64_t hashVertex(const VertexAttributes& v) {
+    uint32_t words[vertexWordCount];
+    std::memcpy(words, &v, sizeof(VertexAttributes));
+
+    uint64_t h = 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < vertexWordCount; i++) {
+        h = (h ^ words[i]) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    // Final avalanche (murmur3 fmix64)
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+constexpr uint32_t invalidIndex = std::numeric_limits<uint32_t>::max();
+
+/**
+ * FIFO cache simulated with timestamps: a vertex is still cached when fewer
+ * than `cacheSize` misses happened since it was last loaded. Returns the
+ * misses caused by one triangle.
+ */
+uint32_t updateCache(
+    const uint32_t* triangle, uint32_t cacheSize,
+    std::vector<uint32_t>& timestamps, uint32_t& timestamp
+) {
+    uint32_t misses = 0;
+    for (int i = 0; i < 3; i++) {
+        uint32_t v = triangle[i];
+        if (timestamp - timestamps[v] > cacheSize) {
+            timestamps[v] = timestamp++;
+            misses++;
+        }
+    }
+    return misses;
+}
+
+// Next vertex to fan around once no candidate is left: the most recently
+// touched vertex that still has triangles, or else the next one in order
+uint32_t skipDeadEnd(
+    std::vector<uint32_t>& deadEnd, const std::vector<uint32_t>& liveTriangles,
+    uint32_t& inputCursor
+) {
+    while (!deadEnd.empty()) {
+        uint32_t v = deadEnd.back();
+        deadEnd.pop_back();
+        if (liveTriangles[v] > 0) return v;
+    }
+    while (inputCursor < liveTriangles.size()) {
+        uint32_t v = inputCursor++;
+        if (liveTriangles[v] > 0) return v;
+    }
+    return invalidIndex;
+}
+
+// Rebase the indices of a sub-mesh onto the first vertex they use, and
+// return that vertex and the count up to the last one. The welder numbers
+// vertices in the order corners arrive, so a sub-mesh uses a mostly
+// contiguous run of them and the passes size their per vertex arrays by
+// that run rather than by the whole mesh.
+std::pair<uint32_t, uint32_t> localizeIndices(std::span<uint32_t> indices) {
+    if (indices.empty()) return { 0u, 0u };
+    auto [low, high] = std::minmax_element(indices.begin(), indices.end());
+    uint32_t first = *low;
+    uint32_t count = *high - first + 1;
+    for (uint32_t& index : indices) index -= first;
+    return { first, count };
+}
+
+// Reorder the triangles of one sub-mesh into chunks, see
+// MeshOptimizer::buildChunks()
+void splitIntoChunks(
+    std::span<uint32_t> indices, std::span<const VertexAttributes> vertices,
+    uint32_t firstIndex, uint32_t maxTriangles, std::vector<MeshChunk>& chunks
+) {
+    uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+    if (triangleCount == 0) return;
+
+    std::vector<glm::vec3> centroids(triangleCount);
+    for (uint32_t t = 0; t < triangleCount; t++) {
+        centroids[t] = (vertices[indices[3 * t + 0]].position
+            + vertices[indices[3 * t + 1]].position
+            + vertices[indices[3 * t + 2]].position) / 3.0f;
+    }
+
+    // Split ranges of `order` until they are small enough, the right half
+    // is pushed first so that leaves come out left to right
+    std::vector<uint32_t> order(triangleCount);
+    std::iota(order.begin(), order.end(), 0u);
+    uint32_t limit = maxTriangles == 0 ? triangleCount : maxTriangles;
+    std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0u, triangleCount } };
+    std::vector<std::pair<uint32_t, uint32_t>> leaves;
+    while (!stack.empty()) {
+        auto [begin, end] = stack.back();
+        stack.pop_back();
+        if (end - begin <= limit) {
+            leaves.push_back({ begin, end });
+            continue;
+        }
+
+        Bounds centroidBounds;
+        for (uint32_t i = begin; i < end; i++) {
+            centroidBounds.extend(centroids[order[i]]);
+        }
+        glm::vec3 size = centroidBounds.max - centroidBounds.min;
+        int axis = size.x >= size.y && size.x >= size.z ? 0 : (size.y >= size.z ? 1 : 2);
+
+        uint32_t middle = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](uint32_t a, uint32_t b) {
+            return centroids[a][axis] < centroids[b][axis];
+        });
+        stack.push_back({ middle, end });
+        stack.push_back({ begin, middle });
+    }
+
+    std::vector<uint32_t> source(indices.begin(), indices.end());
+    uint32_t cursor = 0;
+    for (auto [begin, end] : leaves) {
+        // Back to the order the triangles had
+        std::sort(order.begin() + begin, order.begin() + end);
+
+        MeshChunk chunk{ firstIndex + 3 * cursor, 3 * (end - begin), Bounds() };
+        for (uint32_t i = begin; i < end; i++) {
+            for (uint32_t k = 0; k < 3; k++) {
+                uint32_t v = source[3 * order[i] + k];
+                indices[3 * cursor + k] = v;
+                chunk.bounds.extend(vertices[v].position);
+            }
+            cursor++;
+        }
+        chunks.push_back(chunk);
+    }
+}
+
+} // namespace
+
+uint64_t MeshOptimizerOptions::key() const {
+    uint32_t fields[6] = {
+        cacheSize, reduceOverdraw ? 1u : 0u, std::bit_cast<uint32_t>(overdrawThreshold), chunkTriangleCount,
+        lodCount, std::bit_cast<uint32_t>(lodTriangleRatio)
+    };
+    return hashBytes(fields, sizeof(fields));
+}
+
+VertexWelder::VertexWelder(
+    std::vector<VertexAttributes>& vertices,
+    std::vector<uint32_t>& indices,
+    size_t expectedCorners
+)
+    : vertices(vertices)
+    , indices(indices)
+{
+    vertices.clear();
+    indices.clear();
+    indices.reserve(expectedCorners);
+
+    // Keep the load factor under 1/2 assuming every corner is unique
+    rehash(std::bit_ceil(std::max<size_t>(2 * expectedCorners, 64)));
+}
+
+uint32_t VertexWelder::insert(const VertexAttributes& corner) {
+    if (2 * (vertices.size() + 1) > slots.size()) {
+        rehash(2 * slots.size());
+    }
+
+    VertexAttributes vertex = canonicalize(corner);
+    uint64_t hash = hashVertex(vertex);
+
+    size_t mask = slots.size() - 1;
+    size_t slot = static_cast<size_t>(hash) & mask;
+    while (slots[slot] != 0) {
+        uint32_t candidate = slots[slot] - 1;
+        if (hashes[candidate] == hash && std::memcmp(&vertices[candidate], &vertex, sizeof(VertexAttributes)) == 0) {
+            indices.push_back(candidate);
+            return candidate;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    uint32_t index = static_cast<uint32_t>(vertices.size());
+    vertices.push_back(vertex);
+    hashes.push_back(hash);
+    slots[slot] = index + 1;
+    indices.push_back(index);
+    return index;
+}
+
+void VertexWelder::rehash(size_t slotCount) {
+    slots.assign(slotCount, 0);
+    size_t mask = slotCount - 1;
+    for (uint32_t i = 0; i < hashes.size(); i++) {
+        size_t slot = static_cast<size_t>(hashes[i]) & mask;
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = i + 1;
+    }
+}
+
+MeshOptimizerReport MeshOptimizer::optimize(Mesh& mesh, const MeshOptimizerOptions& options) {
+    MeshOptimizerReport report;
+    report.before = analyzeVertexCache(mesh.indices, mesh.vertices.size(), options.cacheSize);
+
+    // Sub-meshes are independent index ranges, each optimized over the
+    // vertices it uses only
+    ThreadPool::shared().parallelFor(mesh.subMeshes.size(), 1, [&](size_t begin, size_t end) {
+        std::vector<uint32_t> clusters;
+        for (size_t i = begin; i < end; i++) {
+            const SubMesh& subMesh = mesh.subMeshes[i];
+            std::span<uint32_t> indices(mesh.indices.data() + subMesh.firstIndex, subMesh.indexCount);
+            auto [firstVertex, vertexCount] = localizeIndices(indices);
+            std::span<const VertexAttributes> vertices(mesh.vertices.data() + firstVertex, vertexCount);
+
+            optimizeVertexCache(indices, vertexCount, options.cacheSize, options.reduceOverdraw ? &clusters : nullptr);
+            if (options.reduceOverdraw) {
+                optimizeOverdraw(indices, vertices, clusters, options.cacheSize, options.overdrawThreshold);
+            }
+            for (uint32_t& index : indices) index += firstVertex;
+        }
+    });
+
+    buildChunks(mesh, options.chunkTriangleCount);
+    optimizeVertexFetch(mesh.vertices, mesh.indices);
+
+    report.after = analyzeVertexCache(mesh.indices, mesh.vertices.size(), options.cacheSize);
+
+    // Coarser levels reuse the vertices of the full mesh, their triangles
+    // in an order of their own
+    MeshSimplifier::buildLods(mesh, options.lodCount, options.lodTriangleRatio);
+    for (size_t level = 1; level < mesh.lods.size(); level++) {
+        std::span<uint32_t> indices(mesh.indices.data() + mesh.lods[level].firstIndex, mesh.lods[level].indexCount);
+        optimizeVertexCache(indices, mesh.vertices.size(), options.cacheSize);
+    }
+    return report;
+}
+
+void MeshOptimizer::buildChunks(Mesh& mesh, uint32_t maxTriangles) {
+    std::vector<std::vector<MeshChunk>> subMeshChunks(mesh.subMeshes.size());
+    ThreadPool::shared().parallelFor(mesh.subMeshes.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const SubMesh& subMesh = mesh.subMeshes[i];
+            std::span<uint32_t> indices(mesh.indices.data() + subMesh.firstIndex, subMesh.indexCount);
+            splitIntoChunks(indices, mesh.vertices, subMesh.firstIndex, maxTriangles, subMeshChunks[i]);
+        }
+    });
+
+    mesh.chunks.clear();
+    for (const std::vector<MeshChunk>& chunks : subMeshChunks) {
+        mesh.chunks.insert(mesh.chunks.end(), chunks.begin(), chunks.end());
+    }
+}
+
+VertexCacheStats MeshOptimizer::analyzeVertexCache(
+    std::span<const uint32_t> indices,
+    size_t vertexCount,
+    uint32_t cacheSize
+) {
+    VertexCacheStats stats;
+    if (indices.size() < 3 || vertexCount == 0) return stats;
+
+    std::vector<uint32_t> timestamps(vertexCount, 0);
+    uint32_t timestamp = cacheSize + 1;
+    uint64_t misses = 0;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        misses += updateCache(&indices[i], cacheSize, timestamps, timestamp);
+    }
+
+    stats.acmr = static_cast<float>(static_cast<double>(misses) / static_cast<double>(indices.size() / 3));
+    stats.atvr = static_cast<float>(static_cast<double>(misses) / static_cast<double>(vertexCount));
+    return stats;
+}
+
+void MeshOptimizer::optimizeVertexCache(
+    std::span<uint32_t> indices,
+    size_t vertexCount,
+    uint32_t cacheSize,
+    std::vector<uint32_t>* clusters
+) {
+    size_t triangleCount = indices.size() / 3;
+    if (clusters) clusters->clear();
+    if (triangleCount == 0) return;
+
+    // Triangles around each vertex, in compressed rows
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < 3 * triangleCount; i++) {
+        adjacencyOffsets[indices[i] + 1]++;
+    }
+    std::vector<uint32_t> liveTriangles(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        liveTriangles[v] = adjacencyOffsets[v + 1];
+        adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    }
+    std::vector<uint32_t> adjacency(3 * triangleCount);
+    {
+        std::vector<uint32_t> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < 3 * triangleCount; i++) {
+            adjacency[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    }
+
+    std::vector<uint32_t> cacheTimestamps(vertexCount, 0);
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    std::vector<uint32_t> deadEnd;
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> output;
+    deadEnd.reserve(3 * triangleCount);
+    output.reserve(3 * triangleCount);
+
+    uint32_t timestamp = cacheSize + 1;
+    uint32_t inputCursor = 0;
+    uint32_t fanningVertex = indices[0];
+    if (clusters) clusters->push_back(0);
+
+    while (true) {
+        // Emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (uint32_t k = adjacencyOffsets[fanningVertex]; k < adjacencyOffsets[fanningVertex + 1]; k++) {
+            uint32_t t = adjacency[k];
+            if (emitted[t]) continue;
+            for (int j = 0; j < 3; j++) {
+                uint32_t v = indices[3 * t + j];
+                output.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (timestamp - cacheTimestamps[v] > cacheSize) {
+                    cacheTimestamps[v] = timestamp++;
+                }
+            }
+            emitted[t] = 1;
+        }
+
+        // Prefer the oldest neighbor that stays in cache while its own
+        // remaining triangles are emitted
+        uint32_t next = invalidIndex;
+        int64_t bestPriority = -1;
+        for (uint32_t v : candidates) {
+            if (liveTriangles[v] == 0) continue;
+            int64_t priority = 0;
+            uint32_t age = timestamp - cacheTimestamps[v];
+            if (age + 2 * liveTriangles[v] <= cacheSize) {
+                priority = age;
+            }
+            if (priority > bestPriority) {
+                bestPriority = priority;
+                next = v;
+            }
+        }
+
+        if (next == invalidIndex) {
+            next = skipDeadEnd(deadEnd, liveTriangles, inputCursor);
+            if (next == invalidIndex) break;
+            if (clusters) clusters->push_back(static_cast<uint32_t>(output.size() / 3));
+        }
+        fanningVertex = next;
+    }
+
+    std::copy(output.begin(), output.end(), indices.begin());
+}
+
+void MeshOptimizer::optimizeOverdraw(
+    std::span<uint32_t> indices,
+    std::span<const VertexAttributes> vertices,
+    std::span<const uint32_t> clusters,
+    uint32_t cacheSize,
+    float threshold
+) {
+    uint32_t triangleCount = static_cast<uint32_t>(indices.size() / 3);
+    if (triangleCount == 0 || clusters.empty()) return;
+
+    // === Split clusters wherever the run so far already has an ACMR within
+    // `threshold` of the whole cluster's, flushing the cache at each cut
+    std::vector<uint32_t> timestamps(vertices.size(), 0);
+    uint32_t timestamp = cacheSize + 1;
+    std::vector<uint32_t> softClusters;
+    for (size_t c = 0; c < clusters.size(); c++) {
+        uint32_t start = clusters[c];
+        uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+        if (start >= end) continue;
+
+        timestamp += cacheSize + 1;
+        uint32_t clusterMisses = 0;
+        for (uint32_t t = start; t < end; t++) {
+            clusterMisses += updateCache(&indices[3 * t], cacheSize, timestamps, timestamp);
+        }
+        float clusterThreshold = threshold * static_cast<float>(clusterMisses) / static_cast<float>(end - start);
+
+        softClusters.push_back(start);
+        timestamp += cacheSize + 1;
+        uint32_t runningMisses = 0;
+        uint32_t runningTriangles = 0;
+        for (uint32_t t = start; t < end; t++) {
+            runningMisses += updateCache(&indices[3 * t], cacheSize, timestamps, timestamp);
+            runningTriangles++;
+            if (static_cast<float>(runningMisses) <= clusterThreshold * static_cast<float>(runningTriangles)) {
+                softClusters.push_back(t + 1);
+                timestamp += cacheSize + 1;
+                runningMisses = 0;
+                runningTriangles = 0;
+            }
+        }
+        if (softClusters.back() == end) softClusters.pop_back();
+    }
+
+    // === Sort clusters by how much they point away from the centroid
+    glm::vec3 meshCentroid(0.0f);
+    for (uint32_t index : indices) {
+        meshCentroid += vertices[index].position;
+    }
+    meshCentroid /= static_cast<float>(indices.size());
+
+    size_t clusterCount = softClusters.size();
+    std::vector<float> sortKeys(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++) {
+        uint32_t start = softClusters[c];
+        uint32_t end = c + 1 < clusterCount ? softClusters[c + 1] : triangleCount;
+
+        // Area weighted centroid and average normal of the cluster
+        glm::vec3 centroid(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+        for (uint32_t t = start; t < end; t++) {
+            const glm::vec3& p0 = vertices[indices[3 * t + 0]].position;
+            const glm::vec3& p1 = vertices[indices[3 * t + 1]].position;
+            const glm::vec3& p2 = vertices[indices[3 * t + 2]].position;
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float triangleArea = glm::length(n);
+            centroid += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += n;
+            area += triangleArea;
+        }
+        centroid = area > 0.0f ? centroid / area : centroid;
+        float normalLength = glm::length(normal);
+        normal = normalLength > 0.0f ? normal / normalLength : normal;
+
+        sortKeys[c] = glm::dot(centroid - meshCentroid, normal);
+    }
+
+    std::vector<uint32_t> order(clusterCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return sortKeys[a] > sortKeys[b];
+    });
+
+    std::vector<uint32_t> sorted;
+    sorted.reserve(3 * triangleCount);
+    for (uint32_t c : order) {
+        uint32_t start = softClusters[c];
+        uint32_t end = c + 1 < clusterCount ? softClusters[c + 1] : triangleCount;
+        sorted.insert(sorted.end(), indices.begin() + 3 * start, indices.begin() + 3 * end);
+    }
+    std::copy(sorted.begin(), sorted.end(), indices.begin());
+}
+
+void MeshOptimizer::optimizeVertexFetch(
+    std::vector<VertexAttributes>& vertices,
+    std::span<uint32_t> indices
+) {
+    std::vector<uint32_t> remap(vertices.size(), invalidIndex);
+    std::vector<VertexAttributes> reordered;
+    reordered.reserve(vertices.size());
+    for (uint32_t& index : indices) {
+        if (remap[index] == invalidIndex) {
+            remap[index] = static_cast<uint32_t>(reordered.size());
+            reordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(reordered);
+}
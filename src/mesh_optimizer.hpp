@@ -0,0 +1,153 @@
+#ifndef _MESH_OPTIMIZER_H
+#define _MESH_OPTIMIZER_H
+
+#include "mesh.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/**
+ * Streams triangle corners into an indexed vertex list, merging corners
+ * whose position, normal, color and uv are bitwise identical (-0 and +0
+ * compare equal).
+ */
+class VertexWelder {
+public:
+    /**
+     * Append to `vertices` and `indices`, which are cleared.
+     * `expectedCorners` sizes the hash table up front.
+     */
+    VertexWelder(
+        std::vector<VertexAttributes>& vertices,
+        std::vector<uint32_t>& indices,
+        size_t expectedCorners = 0
+    );
+
+    /**
+     * Add one triangle corner and return its vertex index
+     */
+    uint32_t insert(const VertexAttributes& corner);
+
+    size_t cornerCount() const { return indices.size(); }
+    size_t vertexCount() const { return vertices.size(); }
+
+private:
+    void rehash(size_t slotCount);
+
+private:
+    std::vector<VertexAttributes>& vertices;
+    std::vector<uint32_t>& indices;
+
+    // Open addressing table of vertex index + 1, 0 marks an empty slot
+    std::vector<uint32_t> slots;
+    std::vector<uint64_t> hashes;
+};
+
+/**
+ * Post-transform vertex cache efficiency of an index buffer, simulated with
+ * a FIFO cache
+ */
+struct VertexCacheStats {
+    // Average cache miss ratio, vertex shader runs per triangle (0.5 to 3)
+    float acmr = 0.0f;
+    // Average transform to vertex ratio, vertex shader runs per vertex (1 is ideal)
+    float atvr = 0.0f;
+};
+
+struct MeshOptimizerOptions {
+    // Entries of the simulated FIFO post-transform cache
+    uint32_t cacheSize = 16;
+    // Also order triangle clusters so that outward facing ones draw first
+    bool reduceOverdraw = true;
+    // Clusters are cut wherever the ACMR of the triangles since the last cut
+    // is within this factor of the ACMR of the whole cluster. Larger values
+    // give more, smaller clusters: less overdraw, more vertex shading.
+    float overdrawThreshold = 1.05f;
+    // Triangles per culling chunk at most, see MeshOptimizer::buildChunks().
+    // Smaller chunks cull tighter but cost more tests and draw calls.
+    uint32_t chunkTriangleCount = 2048;
+    // Levels of detail to build, the full mesh included, see
+    // MeshSimplifier::buildLods(). One builds none.
+    uint32_t lodCount = 1;
+    // Triangles of each level relative to the previous one
+    float lodTriangleRatio = 0.5f;
+
+    // Identifies these options, so that cached meshes built with other
+    // options are rebuilt
+    uint64_t key() const;
+};
+
+struct MeshOptimizerReport {
+    VertexCacheStats before;
+    VertexCacheStats after;
+};
+
+/**
+ * Reordering passes run on a welded mesh before it is cached and uploaded
+ */
+class MeshOptimizer {
+public:
+    /**
+     * Run every pass on each sub-mesh (triangles never leave their sub-mesh),
+     * split the sub-meshes into chunks, then reorder the vertices, and report the cache efficiency before and
+     * after. The levels of detail are built last, after the full mesh.
+     */
+    static MeshOptimizerReport optimize(Mesh& mesh, const MeshOptimizerOptions& options);
+
+    /**
+     * Cache statistics of `indices`, which reference `vertexCount` vertices
+     */
+    static VertexCacheStats analyzeVertexCache(
+        std::span<const uint32_t> indices,
+        size_t vertexCount,
+        uint32_t cacheSize
+    );
+
+    /**
+     * Reorder triangles for vertex cache locality with Tipsify (Sander et
+     * al., "Fast Triangle Reordering for Vertex Locality and Reduced
+     * Overdraw"). When `clusters` is given it receives the first triangle of
+     * every run that starts after a dead end.
+     */
+    static void optimizeVertexCache(
+        std::span<uint32_t> indices,
+        size_t vertexCount,
+        uint32_t cacheSize,
+        std::vector<uint32_t>* clusters = nullptr
+    );
+
+    /**
+     * Split the `clusters` of a cache optimized index buffer further where
+     * that costs less than `threshold` in ACMR, then sort them so that those
+     * pointing outward from the centroid of the mesh are drawn first
+     */
+    static void optimizeOverdraw(
+        std::span<uint32_t> indices,
+        std::span<const VertexAttributes> vertices,
+        std::span<const uint32_t> clusters,
+        uint32_t cacheSize,
+        float threshold
+    );
+
+    /**
+     * Split every sub-mesh into chunks of at most `maxTriangles` triangles,
+     * halving it at the median triangle centroid along its longest axis,
+     * and fill `mesh.chunks` with their ranges and bounds. Triangles keep
+     * their relative order within a chunk, so that a cache optimized order
+     * mostly survives. Zero makes one chunk per sub-mesh.
+     */
+    static void buildChunks(Mesh& mesh, uint32_t maxTriangles);
+
+    /**
+     * Renumber vertices in the order the index buffer first uses them, so
+     * that vertex fetches walk memory linearly. Unused vertices are dropped.
+     */
+    static void optimizeVertexFetch(
+        std::vector<VertexAttributes>& vertices,
+        std::span<uint32_t> indices
+    );
+};
+
+#endif // _MESH_OPTIMIZER_H
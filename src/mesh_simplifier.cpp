@@ -0,0 +1,666 @@
+#include "mesh_simplifier.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+constexpr uint32_t invalidIndex = std::numeric_limits<uint32_t>::max();
+
+// Normal, color and uv components
+constexpr size_t attributeCount = 8;
+
+// Borders are held in place by planes through their edges, perpendicular
+// to the triangle, weighted this many times the squared edge length
+constexpr float borderWeight = 10.0f;
+
+// Collapses turning a triangle by more than about 75 degrees are rejected,
+// which also catches folds and flips
+constexpr float minNormalCosine = 0.25f;
+
+/**
+ * Weighted sum of squared distances to planes, Q(p) = p^T A p + 2 b.p + c
+ * with A symmetric
+ */
+struct Quadric {
+    float a00 = 0.0f, a01 = 0.0f, a02 = 0.0f, a11 = 0.0f, a12 = 0.0f, a22 = 0.0f;
+    float b0 = 0.0f, b1 = 0.0f, b2 = 0.0f;
+    float c = 0.0f;
+    // Area of the triangles whose planes were added
+    float weight = 0.0f;
+
+    // Plane dot(n, p) + d = 0 of unit normal `n`
+    void addPlane(const glm::vec3& n, float d, float w) {
+        a00 += w * n.x * n.x; a01 += w * n.x * n.y; a02 += w * n.x * n.z;
+        a11 += w * n.y * n.y; a12 += w * n.y * n.z; a22 += w * n.z * n.z;
+        b0 += w * n.x * d; b1 += w * n.y * d; b2 += w * n.z * d;
+        c += w * d * d;
+    }
+
+    void add(const Quadric& q) {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+        b0 += q.b0; b1 += q.b1; b2 += q.b2;
+        c += q.c;
+        weight += q.weight;
+    }
+
+    float evaluate(const glm::vec3& p) const {
+        float r = a00 * p.x * p.x + a11 * p.y * p.y + a22 * p.z * p.z
+            + 2.0f * (a01 * p.x * p.y + a02 * p.x * p.z + a12 * p.y * p.z)
+            + 2.0f * (b0 * p.x + b1 * p.y + b2 * p.z)
+            + c;
+        // Rounding can take it slightly below zero
+        return std::max(r, 0.0f);
+    }
+};
+
+/**
+ * Weighted sum of the squared differences between an attribute value s and
+ * its linear interpolation g.p + d over each triangle:
+ * E(p, s) = p^T G p + 2 (sum g d).p + sum d^2 - 2 s (sum g . p + sum d) + s^2 sum w
+ * with every sum weighted. The last weight sum is Quadric::weight.
+ */
+struct AttributeQuadric {
+    float g00 = 0.0f, g01 = 0.0f, g02 = 0.0f, g11 = 0.0f, g12 = 0.0f, g22 = 0.0f;
+    glm::vec3 gd = glm::vec3(0.0f);
+    float dd = 0.0f;
+    glm::vec3 g = glm::vec3(0.0f);
+    float d = 0.0f;
+
+    void addGradient(const glm::vec3& gradient, float offset, float w) {
+        const glm::vec3& n = gradient;
+        g00 += w * n.x * n.x; g01 += w * n.x * n.y; g02 += w * n.x * n.z;
+        g11 += w * n.y * n.y; g12 += w * n.y * n.z; g22 += w * n.z * n.z;
+        gd += w * offset * n;
+        dd += w * offset * offset;
+        g += w * n;
+        d += w * offset;
+    }
+
+    void add(const AttributeQuadric& q) {
+        g00 += q.g00; g01 += q.g01; g02 += q.g02; g11 += q.g11; g12 += q.g12; g22 += q.g22;
+        gd += q.gd;
+        dd += q.dd;
+        g += q.g;
+        d += q.d;
+    }
+
+    float evaluate(const glm::vec3& p, float s, float weight) const {
+        float r = g00 * p.x * p.x + g11 * p.y * p.y + g22 * p.z * p.z
+            + 2.0f * (g01 * p.x * p.y + g02 * p.x * p.z + g12 * p.y * p.z)
+            + 2.0f * glm::dot(gd, p) + dd
+            - 2.0f * s * (glm::dot(g, p) + d)
+            + s * s * weight;
+        return std::max(r, 0.0f);
+    }
+};
+
+uint64_t edgeKey(uint32_t a, uint32_t b) {
+    return (static_cast<uint64_t>(a) << 32) | b;
+}
+
+bool containsEdge(const std::vector<uint64_t>& sortedEdges, uint64_t key) {
+    return std::binary_search(sortedEdges.begin(), sortedEdges.end(), key);
+}
+
+/**
+ * One simplification of a triangle list, run towards smaller and smaller
+ * targets. Each pass picks the cheapest collapse of every vertex, then makes
+ * them in order of cost, skipping those next to a collapse already made in
+ * the pass so that the costs and flip checks stay exact.
+ */
+class Simplifier {
+public:
+    Simplifier(std::span<const VertexAttributes> vertices, std::span<const uint32_t> indices, const MeshSimplifierOptions& options);
+
+    // Collapse until at most `targetIndexCount` indices are left, or no
+    // collapse is under the error limit
+    void run(size_t targetIndexCount);
+
+    const std::vector<uint32_t>& indices() const { return triangles; }
+
+    // Largest error of the collapses made so far, in model units
+    float error() const { return std::sqrt(maxError) * scale; }
+
+private:
+    enum class Kind : uint8_t {
+        Manifold,
+        Border,
+        Seam,
+        Locked,
+    };
+
+    struct Collapse {
+        uint32_t from;
+        uint32_t to;
+        float cost;
+        // Squared distance part of the cost
+        float error;
+    };
+
+    void groupWedges();
+    void classify();
+    void computeQuadrics();
+    void buildAdjacency();
+
+    // Whether `from` may collapse onto `to`, and the other side's collapse
+    // for seams
+    bool canCollapse(uint32_t from, uint32_t to, uint32_t& partnerFrom, uint32_t& partnerTo) const;
+    float cost(uint32_t from, uint32_t to, float& error) const;
+    // Cheapest collapse of `from`, onto invalidIndex if it has none
+    Collapse cheapestCollapse(uint32_t from) const;
+    bool flips(uint32_t from, uint32_t to) const;
+    // Triangles of `from` that the collapse removes
+    uint32_t removedTriangles(uint32_t from, uint32_t to) const;
+    void lockRing(uint32_t vertex);
+    // Follow a collapse along a border or seam in the links of its neighbors
+    void relink(uint32_t from, uint32_t to);
+
+    // One pass, returns false when no collapse could be made
+    bool pass(size_t targetTriangleCount);
+
+private:
+    MeshSimplifierOptions options;
+    size_t vertexCount;
+    // Positions scaled into the unit cube, and weighted attributes
+    std::vector<glm::vec3> positions;
+    std::vector<float> attributes;
+    float scale = 1.0f;
+
+    std::vector<uint32_t> triangles;
+
+    // First vertex at the same position, and the other copy of seam vertices
+    std::vector<uint32_t> positionIds;
+    std::vector<uint32_t> wedgePartners;
+    std::vector<uint32_t> wedgeCounts;
+    std::vector<Kind> kinds;
+    // Directed edges between positions, sorted
+    std::vector<uint64_t> positionEdges;
+    // Neighbors along the open edge leaving and entering border and seam
+    // vertices
+    std::vector<uint32_t> openNext;
+    std::vector<uint32_t> openPrevious;
+
+    std::vector<Quadric> quadrics;
+    std::vector<AttributeQuadric> attributeQuadrics;
+
+    // Triangles around each vertex, rebuilt every pass
+    std::vector<uint32_t> adjacencyOffsets;
+    std::vector<uint32_t> adjacency;
+
+    // Cheapest collapse of each vertex, computed again only for the
+    // vertices around those collapsed in the previous pass
+    std::vector<Collapse> cheapest;
+    std::vector<uint8_t> stale;
+
+    // Scratch state of a pass
+    std::vector<Collapse> collapses;
+    std::vector<uint32_t> remap;
+    std::vector<uint8_t> locked;
+
+    float maxError = 0.0f;
+};
+
+Simplifier::Simplifier(std::span<const VertexAttributes> vertices, std::span<const uint32_t> indices, const MeshSimplifierOptions& options)
+    : options(options)
+    , vertexCount(vertices.size())
+    , triangles(indices.begin(), indices.end())
+{
+    Bounds bounds;
+    for (uint32_t index : indices) bounds.extend(vertices[index].position);
+    if (!bounds.isEmpty()) {
+        glm::vec3 size = bounds.max - bounds.min;
+        scale = std::max(std::max(size.x, size.y), size.z);
+    }
+    if (scale <= 0.0f) scale = 1.0f;
+
+    positions.resize(vertexCount);
+    attributes.resize(vertexCount * attributeCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        const VertexAttributes& vertex = vertices[v];
+        // Adding +0 turns -0 into +0 so that both group together
+        positions[v] = (vertex.position - (bounds.isEmpty() ? glm::vec3(0.0f) : bounds.min)) / scale + 0.0f;
+        float* a = &attributes[v * attributeCount];
+        for (int i = 0; i < 3; i++) a[i] = vertex.normal[i] * options.normalWeight;
+        for (int i = 0; i < 3; i++) a[3 + i] = vertex.color[i] * options.colorWeight;
+        for (int i = 0; i < 2; i++) a[6 + i] = vertex.uv[i] * options.uvWeight;
+    }
+
+    groupWedges();
+    classify();
+    computeQuadrics();
+    cheapest.resize(vertexCount);
+    stale.assign(vertexCount, 1);
+}
+
+void Simplifier::groupWedges() {
+    // Sort by position bits so that copies of a vertex end up side by side
+    auto key = [&](uint32_t v) {
+        const glm::vec3& p = positions[v];
+        return std::array<uint32_t, 3>{ std::bit_cast<uint32_t>(p.x), std::bit_cast<uint32_t>(p.y), std::bit_cast<uint32_t>(p.z) };
+    };
+    std::vector<uint32_t> order(vertexCount);
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return key(a) < key(b); });
+
+    positionIds.assign(vertexCount, invalidIndex);
+    wedgePartners.assign(vertexCount, invalidIndex);
+    wedgeCounts.assign(vertexCount, 1);
+    size_t begin = 0;
+    while (begin < vertexCount) {
+        size_t end = begin + 1;
+        while (end < vertexCount && key(order[end]) == key(order[begin])) end++;
+
+        uint32_t id = *std::min_element(order.begin() + begin, order.begin() + end);
+        for (size_t i = begin; i < end; i++) {
+            positionIds[order[i]] = id;
+            wedgeCounts[order[i]] = static_cast<uint32_t>(end - begin);
+        }
+        if (end - begin == 2) {
+            wedgePartners[order[begin]] = order[begin + 1];
+            wedgePartners[order[begin + 1]] = order[begin];
+        }
+        begin = end;
+    }
+}
+
+void Simplifier::classify() {
+    // Directed edges between vertices, sorted with repeats, and between
+    // positions
+    std::vector<uint64_t> edges;
+    edges.reserve(triangles.size());
+    positionEdges.clear();
+    positionEdges.reserve(triangles.size());
+    for (size_t t = 0; t < triangles.size(); t += 3) {
+        for (size_t k = 0; k < 3; k++) {
+            uint32_t a = triangles[t + k];
+            uint32_t b = triangles[t + (k + 1) % 3];
+            edges.push_back(edgeKey(a, b));
+            positionEdges.push_back(edgeKey(positionIds[a], positionIds[b]));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    std::sort(positionEdges.begin(), positionEdges.end());
+    positionEdges.erase(std::unique(positionEdges.begin(), positionEdges.end()), positionEdges.end());
+
+    std::vector<uint32_t> openOut(vertexCount, 0);
+    std::vector<uint32_t> openIn(vertexCount, 0);
+    std::vector<uint8_t> referenced(vertexCount, 0);
+    std::vector<uint8_t> seamsOnly(vertexCount, 1);
+    std::vector<uint8_t> nonManifold(vertexCount, 0);
+    openNext.assign(vertexCount, invalidIndex);
+    openPrevious.assign(vertexCount, invalidIndex);
+    for (size_t t = 0; t < triangles.size(); t += 3) {
+        for (size_t k = 0; k < 3; k++) {
+            uint32_t a = triangles[t + k];
+            uint32_t b = triangles[t + (k + 1) % 3];
+            referenced[a] = 1;
+
+            // An edge used twice in the same direction joins more than two
+            // triangles or folds the surface
+            auto [first, last] = std::equal_range(edges.begin(), edges.end(), edgeKey(a, b));
+            if (last - first > 1) {
+                nonManifold[a] = 1;
+                nonManifold[b] = 1;
+            }
+            if (containsEdge(edges, edgeKey(b, a))) continue;
+
+            // Open at the vertex level: a seam if the other side uses other
+            // copies of the same positions, a border otherwise
+            bool seam = containsEdge(positionEdges, edgeKey(positionIds[b], positionIds[a]));
+            openOut[a]++;
+            openIn[b]++;
+            openNext[a] = b;
+            openPrevious[b] = a;
+            if (!seam) {
+                seamsOnly[a] = 0;
+                seamsOnly[b] = 0;
+            }
+        }
+    }
+
+    kinds.assign(vertexCount, Kind::Locked);
+    for (size_t v = 0; v < vertexCount; v++) {
+        if (!referenced[v] || nonManifold[v]) continue;
+        bool open = openOut[v] == 1 && openIn[v] == 1 && openNext[v] != openPrevious[v];
+        if (wedgeCounts[v] == 1) {
+            if (openOut[v] == 0 && openIn[v] == 0) kinds[v] = Kind::Manifold;
+            else if (open && !seamsOnly[v]) kinds[v] = Kind::Border;
+        }
+        else if (wedgeCounts[v] == 2 && open && seamsOnly[v]) {
+            kinds[v] = Kind::Seam;
+        }
+    }
+
+    // Both copies of a seam vertex move together or not at all
+    for (size_t v = 0; v < vertexCount; v++) {
+        if (kinds[v] == Kind::Seam && kinds[wedgePartners[v]] != Kind::Seam) kinds[v] = Kind::Locked;
+    }
+}
+
+void Simplifier::computeQuadrics() {
+    quadrics.assign(vertexCount, Quadric());
+    attributeQuadrics.assign(vertexCount * attributeCount, AttributeQuadric());
+    for (size_t t = 0; t < triangles.size(); t += 3) {
+        const uint32_t* corners = &triangles[t];
+        glm::vec3 p0 = positions[corners[0]];
+        glm::vec3 e1 = positions[corners[1]] - p0;
+        glm::vec3 e2 = positions[corners[2]] - p0;
+        glm::vec3 normal = glm::cross(e1, e2);
+        float length = glm::length(normal);
+        if (length <= 0.0f) continue;
+        normal /= length;
+        float area = 0.5f * length;
+
+        Quadric plane;
+        plane.addPlane(normal, -glm::dot(normal, p0), area);
+        plane.weight = area;
+        for (size_t k = 0; k < 3; k++) quadrics[corners[k]].add(plane);
+
+        // Gradient of each attribute in the triangle's plane, the g such
+        // that g.e1 and g.e2 are its differences along the edges
+        float a = glm::dot(e1, e1);
+        float b = glm::dot(e1, e2);
+        float c = glm::dot(e2, e2);
+        float determinant = a * c - b * b;
+        if (determinant > 0.0f) {
+            for (size_t i = 0; i < attributeCount; i++) {
+                float s0 = attributes[corners[0] * attributeCount + i];
+                float ds1 = attributes[corners[1] * attributeCount + i] - s0;
+                float ds2 = attributes[corners[2] * attributeCount + i] - s0;
+                float alpha = (ds1 * c - ds2 * b) / determinant;
+                float beta = (ds2 * a - ds1 * b) / determinant;
+                glm::vec3 gradient = alpha * e1 + beta * e2;
+                float offset = s0 - glm::dot(gradient, p0);
+
+                AttributeQuadric quadric;
+                quadric.addGradient(gradient, offset, area);
+                for (size_t k = 0; k < 3; k++) attributeQuadrics[corners[k] * attributeCount + i].add(quadric);
+            }
+        }
+
+        for (size_t k = 0; k < 3; k++) {
+            uint32_t from = corners[k];
+            uint32_t to = corners[(k + 1) % 3];
+            if (containsEdge(positionEdges, edgeKey(positionIds[to], positionIds[from]))) continue;
+
+            glm::vec3 edge = positions[to] - positions[from];
+            glm::vec3 side = glm::cross(edge, normal);
+            float sideLength = glm::length(side);
+            if (sideLength <= 0.0f) continue;
+            side /= sideLength;
+
+            Quadric border;
+            border.addPlane(side, -glm::dot(side, positions[from]), borderWeight * glm::dot(edge, edge));
+            quadrics[from].add(border);
+            quadrics[to].add(border);
+        }
+    }
+}
+
+void Simplifier::buildAdjacency() {
+    adjacencyOffsets.assign(vertexCount + 1, 0);
+    for (uint32_t index : triangles) adjacencyOffsets[index + 1]++;
+    for (size_t v = 0; v < vertexCount; v++) adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+
+    adjacency.resize(triangles.size());
+    std::vector<uint32_t> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < triangles.size(); i++) {
+        adjacency[cursor[triangles[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+}
+
+bool Simplifier::canCollapse(uint32_t from, uint32_t to, uint32_t& partnerFrom, uint32_t& partnerTo) const {
+    partnerFrom = invalidIndex;
+    partnerTo = invalidIndex;
+    if (positionIds[from] == positionIds[to]) return false;
+
+    switch (kinds[from]) {
+        case Kind::Manifold:
+            return true;
+        case Kind::Border:
+            return to == openNext[from] || to == openPrevious[from];
+        case Kind::Seam: {
+            // The other copy collapses along the other side of the seam,
+            // which runs the opposite way
+            partnerFrom = wedgePartners[from];
+            if (to == openNext[from]) partnerTo = openPrevious[partnerFrom];
+            else if (to == openPrevious[from]) partnerTo = openNext[partnerFrom];
+            else return false;
+            return partnerTo != invalidIndex && positionIds[partnerTo] == positionIds[to];
+        }
+        case Kind::Locked:
+            break;
+    }
+    return false;
+}
+
+float Simplifier::cost(uint32_t from, uint32_t to, float& error) const {
+    const Quadric& quadric = quadrics[from];
+    const glm::vec3& p = positions[to];
+    float distance = quadric.evaluate(p);
+    float attribute = 0.0f;
+    for (size_t i = 0; i < attributeCount; i++) {
+        attribute += attributeQuadrics[from * attributeCount + i].evaluate(p, attributes[to * attributeCount + i], quadric.weight);
+    }
+
+    // Normalized by area, the mean squared distance to the planes around
+    float weight = std::max(quadric.weight, 1e-12f);
+    error = distance / weight;
+    return (distance + attribute) / weight;
+}
+
+Simplifier::Collapse Simplifier::cheapestCollapse(uint32_t from) const {
+    Collapse best{ from, invalidIndex, std::numeric_limits<float>::max(), 0.0f };
+    if (kinds[from] == Kind::Locked) return best;
+
+    for (uint32_t i = adjacencyOffsets[from]; i < adjacencyOffsets[from + 1]; i++) {
+        const uint32_t* corners = &triangles[3 * adjacency[i]];
+        for (int k = 0; k < 3; k++) {
+            uint32_t to = corners[k];
+            if (to == from || to == best.to) continue;
+            uint32_t partnerFrom, partnerTo;
+            if (!canCollapse(from, to, partnerFrom, partnerTo)) continue;
+
+            float error;
+            float collapseCost = cost(from, to, error);
+            if (partnerFrom != invalidIndex) {
+                float partnerError;
+                collapseCost += cost(partnerFrom, partnerTo, partnerError);
+                error = std::max(error, partnerError);
+            }
+            if (collapseCost < best.cost) best = { from, to, collapseCost, error };
+        }
+    }
+    return best;
+}
+
+bool Simplifier::flips(uint32_t from, uint32_t to) const {
+    const glm::vec3& target = positions[to];
+    for (uint32_t i = adjacencyOffsets[from]; i < adjacencyOffsets[from + 1]; i++) {
+        const uint32_t* corners = &triangles[3 * adjacency[i]];
+        if (corners[0] == to || corners[1] == to || corners[2] == to) continue;
+
+        glm::vec3 p[3];
+        glm::vec3 q[3];
+        for (int k = 0; k < 3; k++) {
+            p[k] = positions[corners[k]];
+            q[k] = corners[k] == from ? target : p[k];
+        }
+        glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+        if (glm::dot(before, before) <= 0.0f) continue;
+        if (glm::dot(before, after) <= minNormalCosine * glm::length(before) * glm::length(after)) return true;
+    }
+    return false;
+}
+
+uint32_t Simplifier::removedTriangles(uint32_t from, uint32_t to) const {
+    uint32_t count = 0;
+    for (uint32_t i = adjacencyOffsets[from]; i < adjacencyOffsets[from + 1]; i++) {
+        const uint32_t* corners = &triangles[3 * adjacency[i]];
+        if (corners[0] == to || corners[1] == to || corners[2] == to) count++;
+    }
+    return count;
+}
+
+void Simplifier::lockRing(uint32_t vertex) {
+    for (uint32_t i = adjacencyOffsets[vertex]; i < adjacencyOffsets[vertex + 1]; i++) {
+        const uint32_t* corners = &triangles[3 * adjacency[i]];
+        for (int k = 0; k < 3; k++) locked[corners[k]] = 1;
+    }
+}
+
+void Simplifier::relink(uint32_t from, uint32_t to) {
+    if (kinds[from] != Kind::Border && kinds[from] != Kind::Seam) return;
+    if (to == openNext[from]) {
+        openPrevious[to] = openPrevious[from];
+        openNext[openPrevious[from]] = to;
+    }
+    else {
+        openNext[to] = openNext[from];
+        openPrevious[openNext[from]] = to;
+    }
+}
+
+bool Simplifier::pass(size_t targetTriangleCount) {
+    size_t triangleCount = triangles.size() / 3;
+    buildAdjacency();
+
+    // Costs only change around the collapses of the previous pass: the
+    // vertices there were locked, and are stale now
+    collapses.clear();
+    float errorLimit = options.maxError * options.maxError;
+    for (uint32_t from = 0; from < vertexCount; from++) {
+        if (stale[from]) {
+            cheapest[from] = cheapestCollapse(from);
+            stale[from] = 0;
+        }
+        const Collapse& best = cheapest[from];
+        if (best.to != invalidIndex && best.error <= errorLimit) collapses.push_back(best);
+    }
+    if (collapses.empty()) return false;
+
+    std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+    // A collapse removes about two triangles. Going a little past the cost
+    // of the collapses needed leaves room for those skipped as locked,
+    // while a quarter of the candidates at most keeps to the cheapest ones.
+    size_t needed = (triangleCount - targetTriangleCount + 1) / 2;
+    size_t limit = std::min(needed + needed / 2, collapses.size() / 4);
+    float costLimit = collapses[std::min(limit, collapses.size() - 1)].cost;
+
+    remap.resize(vertexCount);
+    std::iota(remap.begin(), remap.end(), 0u);
+    locked.assign(vertexCount, 0);
+    size_t removed = 0;
+    bool collapsed = false;
+    for (const Collapse& collapse : collapses) {
+        if (triangleCount - removed <= targetTriangleCount || collapse.cost > costLimit) break;
+
+        uint32_t from = collapse.from;
+        uint32_t to = collapse.to;
+        uint32_t partnerFrom, partnerTo;
+        canCollapse(from, to, partnerFrom, partnerTo);
+        bool seam = partnerFrom != invalidIndex;
+        if (locked[from] || locked[to] || (seam && (locked[partnerFrom] || locked[partnerTo]))) continue;
+        if (flips(from, to) || (seam && flips(partnerFrom, partnerTo))) continue;
+
+        remap[from] = to;
+        quadrics[to].add(quadrics[from]);
+        for (size_t i = 0; i < attributeCount; i++) {
+            attributeQuadrics[to * attributeCount + i].add(attributeQuadrics[from * attributeCount + i]);
+        }
+        removed += removedTriangles(from, to);
+        relink(from, to);
+        lockRing(from);
+        if (seam) {
+            remap[partnerFrom] = partnerTo;
+            quadrics[partnerTo].add(quadrics[partnerFrom]);
+            for (size_t i = 0; i < attributeCount; i++) {
+                attributeQuadrics[partnerTo * attributeCount + i].add(attributeQuadrics[partnerFrom * attributeCount + i]);
+            }
+            removed += removedTriangles(partnerFrom, partnerTo);
+            relink(partnerFrom, partnerTo);
+            lockRing(partnerFrom);
+        }
+        maxError = std::max(maxError, collapse.error);
+        collapsed = true;
+    }
+
+    // Collapsed vertices are locked for the rest of the pass, so one remap
+    // step reaches their target. Triangles with two corners at the same
+    // place are gone.
+    size_t write = 0;
+    for (size_t t = 0; t < triangles.size(); t += 3) {
+        uint32_t a = remap[triangles[t + 0]];
+        uint32_t b = remap[triangles[t + 1]];
+        uint32_t c = remap[triangles[t + 2]];
+        if (positionIds[a] == positionIds[b] || positionIds[b] == positionIds[c] || positionIds[c] == positionIds[a]) continue;
+        triangles[write++] = a;
+        triangles[write++] = b;
+        triangles[write++] = c;
+    }
+    triangles.resize(write);
+    stale.swap(locked);
+    return collapsed;
+}
+
+void Simplifier::run(size_t targetIndexCount) {
+    size_t targetTriangleCount = targetIndexCount / 3;
+    while (triangles.size() / 3 > targetTriangleCount) {
+        if (!pass(targetTriangleCount)) break;
+    }
+}
+
+} // namespace
+
+float MeshSimplifier::simplify(
+    std::span<const VertexAttributes> vertices,
+    std::span<const uint32_t> indices,
+    size_t targetIndexCount,
+    std::vector<uint32_t>& destination,
+    const MeshSimplifierOptions& options
+) {
+    Simplifier simplifier(vertices, indices, options);
+    simplifier.run(targetIndexCount);
+    destination = simplifier.indices();
+    return simplifier.error();
+}
+
+void MeshSimplifier::buildLods(
+    Mesh& mesh,
+    uint32_t levelCount,
+    float triangleRatio,
+    const MeshSimplifierOptions& options
+) {
+    // Levels built before are replaced
+    if (!mesh.lods.empty()) mesh.indices.resize(mesh.lods[0].indexCount);
+    mesh.lods.clear();
+    uint32_t baseIndexCount = static_cast<uint32_t>(mesh.indices.size());
+    mesh.lods.push_back({ 0, baseIndexCount, 0.0f });
+    if (levelCount <= 1 || baseIndexCount == 0) return;
+
+    // Each level continues from the previous one, so that the quadrics keep
+    // measuring against the full mesh
+    Simplifier simplifier(mesh.vertices, mesh.indices, options);
+    size_t targetTriangleCount = baseIndexCount / 3;
+    for (uint32_t level = 1; level < levelCount; level++) {
+        targetTriangleCount = static_cast<size_t>(static_cast<float>(targetTriangleCount) * triangleRatio);
+        simplifier.run(3 * targetTriangleCount);
+
+        // Stop when a level no longer shrinks much, the rest of the mesh
+        // being locked or over the error limit
+        const std::vector<uint32_t>& indices = simplifier.indices();
+        float previousCount = static_cast<float>(mesh.lods.back().indexCount);
+        if (indices.empty() || static_cast<float>(indices.size()) > 0.5f * (1.0f + triangleRatio) * previousCount) break;
+
+        uint32_t firstIndex = static_cast<uint32_t>(mesh.indices.size());
+        mesh.indices.insert(mesh.indices.end(), indices.begin(), indices.end());
+        mesh.lods.push_back({ firstIndex, static_cast<uint32_t>(indices.size()), simplifier.error() });
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef _MESH_SIMPLIFIER_H
+#define _MESH_SIMPLIFIER_H
+
+#include "mesh.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+struct MeshSimplifierOptions {
+    // Weight of the attribute errors against the position error, which is
+    // measured with the mesh scaled to fit a unit cube
+    float normalWeight = 0.5f;
+    float colorWeight = 0.5f;
+    float uvWeight = 1.0f;
+    // Collapses moving the surface by more than this fraction of the mesh
+    // extent are never made, even short of the target
+    float maxError = 0.05f;
+};
+
+/**
+ * Triangle count reduction by edge collapses ordered by quadric error
+ * (Garland and Heckbert, "Surface Simplification Using Quadric Error
+ * Metrics"), extended to the vertex attributes as in Hoppe, "New Quadric
+ * Metric for Simplifying Meshes with Appearance Attributes".
+ *
+ * A collapse moves a vertex onto one of its neighbors, so the simplified
+ * index buffers reference a subset of the original vertices and share
+ * their vertex buffer. Vertices on a border only move along it, those on
+ * an attribute seam move along it together with their copy on the other
+ * side, and vertices where the mesh is not manifold never move.
+ */
+class MeshSimplifier {
+public:
+    /**
+     * Simplify the triangle list `indices` down to `targetIndexCount`
+     * indices at most, or as close as `options.maxError` allows, into
+     * `destination`. Returns the error of the result in model units, see
+     * MeshLod::error.
+     */
+    static float simplify(
+        std::span<const VertexAttributes> vertices,
+        std::span<const uint32_t> indices,
+        size_t targetIndexCount,
+        std::vector<uint32_t>& destination,
+        const MeshSimplifierOptions& options = {}
+    );
+
+    /**
+     * Fill `mesh.lods` with the full mesh followed by up to `levelCount` - 1
+     * coarser levels, each with about `triangleRatio` times the triangles of
+     * the previous one, and append their indices. Levels come from a single
+     * simplification run, and the chain stops early when it no longer
+     * shrinks.
+     */
+    static void buildLods(
+        Mesh& mesh,
+        uint32_t levelCount,
+        float triangleRatio,
+        const MeshSimplifierOptions& options = {}
+    );
+};
+
+#endif // _MESH_SIMPLIFIER_H
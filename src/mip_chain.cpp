@@ -0,0 +1,382 @@
+#include "mip_chain.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define MIP_CHAIN_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MIP_CHAIN_TARGET_AVX2
+#else
+#define MIP_CHAIN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+
+// Below this many destination pixels a task is not worth scheduling
+constexpr size_t minPixelsPerTask = 32 * 1024;
+
+constexpr size_t srgbEncodeTableSize = 1 << 14;
+
+struct SrgbTables {
+    std::array<float, 256> decode;
+    std::array<unsigned char, srgbEncodeTableSize> encode;
+
+    SrgbTables() {
+        for (size_t i = 0; i < decode.size(); i++) {
+            float c = static_cast<float>(i) / 255.0f;
+            decode[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for (size_t i = 0; i < encode.size(); i++) {
+            float l = static_cast<float>(i) / static_cast<float>(srgbEncodeTableSize - 1);
+            float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+            encode[i] = static_cast<unsigned char>(std::clamp(c * 255.0f + 0.5f, 0.0f, 255.0f));
+        }
+    }
+};
+
+const SrgbTables& srgbTables() {
+    static const SrgbTables tables;
+    return tables;
+}
+
+inline unsigned char encodeSrgb(const SrgbTables& tables, float linear) {
+    float scaled = std::clamp(linear, 0.0f, 1.0f) * static_cast<float>(srgbEncodeTableSize - 1);
+    return tables.encode[static_cast<size_t>(scaled + 0.5f)];
+}
+
+inline unsigned char encodeUnorm(float value) {
+    return static_cast<unsigned char>(std::clamp(value * 255.0f + 0.5f, 0.0f, 255.0f));
+}
+
+/**
+ * Source texels (and their weights) that contribute to one destination
+ * texel along one axis. Halving an odd size uses a 3 tap polyphase box so
+ * that the whole source footprint is covered.
+ */
+struct Taps {
+    uint32_t index[3];
+    float weight[3];
+    uint32_t count;
+};
+
+Taps computeTaps(uint32_t dst, uint32_t srcSize, uint32_t dstSize) {
+    Taps taps{};
+    if (srcSize == 1) {
+        taps.index[0] = 0;
+        taps.weight[0] = 1.0f;
+        taps.count = 1;
+    }
+    else if (srcSize % 2 == 0) {
+        taps.index[0] = 2 * dst;
+        taps.index[1] = 2 * dst + 1;
+        taps.weight[0] = taps.weight[1] = 0.5f;
+        taps.count = 2;
+    }
+    else {
+        float n = static_cast<float>(srcSize);
+        taps.index[0] = 2 * dst;
+        taps.index[1] = 2 * dst + 1;
+        taps.index[2] = 2 * dst + 2;
+        taps.weight[0] = static_cast<float>(dstSize - dst) / n;
+        taps.weight[1] = static_cast<float>(dstSize) / n;
+        taps.weight[2] = static_cast<float>(dst + 1) / n;
+        taps.count = 3;
+    }
+    return taps;
+}
+
+// === Float texel helpers (general filter) ===
+
+#if defined(MIP_CHAIN_X86)
+using Texel = __m128;
+
+inline Texel texelZero() { return _mm_setzero_ps(); }
+
+inline Texel texelMulAdd(Texel acc, Texel value, float weight) {
+    return _mm_add_ps(acc, _mm_mul_ps(value, _mm_set1_ps(weight)));
+}
+
+inline Texel loadTexel(const unsigned char* p, MipFilter filter, const SrgbTables& tables) {
+    if (filter == MipFilter::BoxSRGB) {
+        return _mm_set_ps(p[3] * (1.0f / 255.0f), tables.decode[p[2]], tables.decode[p[1]], tables.decode[p[0]]);
+    }
+    int packed;
+    std::memcpy(&packed, p, 4);
+    __m128i zero = _mm_setzero_si128();
+    __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+    return _mm_mul_ps(_mm_cvtepi32_ps(wide), _mm_set1_ps(1.0f / 255.0f));
+}
+
+inline void storeTexel(unsigned char* p, Texel value, MipFilter filter, const SrgbTables& tables) {
+    if (filter == MipFilter::BoxSRGB) {
+        alignas(16) float c[4];
+        _mm_store_ps(c, value);
+        p[0] = encodeSrgb(tables, c[0]);
+        p[1] = encodeSrgb(tables, c[1]);
+        p[2] = encodeSrgb(tables, c[2]);
+        p[3] = encodeUnorm(c[3]);
+        return;
+    }
+    __m128i rounded = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+    __m128i packed = _mm_packus_epi16(_mm_packs_epi32(rounded, rounded), rounded);
+    int bytes = _mm_cvtsi128_si32(packed);
+    std::memcpy(p, &bytes, 4);
+}
+#else
+struct Texel {
+    float c[4];
+};
+
+inline Texel texelZero() { return Texel{}; }
+
+inline Texel texelMulAdd(Texel acc, Texel value, float weight) {
+    for (int i = 0; i < 4; i++) acc.c[i] += value.c[i] * weight;
+    return acc;
+}
+
+inline Texel loadTexel(const unsigned char* p, MipFilter filter, const SrgbTables& tables) {
+    Texel texel;
+    for (int i = 0; i < 4; i++) texel.c[i] = p[i] * (1.0f / 255.0f);
+    if (filter == MipFilter::BoxSRGB) {
+        for (int i = 0; i < 3; i++) texel.c[i] = tables.decode[p[i]];
+    }
+    return texel;
+}
+
+inline void storeTexel(unsigned char* p, Texel value, MipFilter filter, const SrgbTables& tables) {
+    for (int i = 0; i < 4; i++) p[i] = encodeUnorm(value.c[i]);
+    if (filter == MipFilter::BoxSRGB) {
+        for (int i = 0; i < 3; i++) p[i] = encodeSrgb(tables, value.c[i]);
+    }
+}
+#endif
+
+void filterRowGeneral(
+    const unsigned char* src, uint32_t srcWidth, uint32_t srcHeight,
+    unsigned char* dst, uint32_t dstWidth, uint32_t dstHeight,
+    uint32_t y, const Taps* columnTaps, MipFilter filter
+) {
+    const SrgbTables& tables = srgbTables();
+    Taps rowTaps = computeTaps(y, srcHeight, dstHeight);
+    unsigned char* out = dst + 4 * static_cast<size_t>(y) * dstWidth;
+
+    for (uint32_t x = 0; x < dstWidth; x++) {
+        const Taps& cols = columnTaps[x];
+        Texel acc = texelZero();
+        for (uint32_t ty = 0; ty < rowTaps.count; ty++) {
+            const unsigned char* row = src + 4 * static_cast<size_t>(rowTaps.index[ty]) * srcWidth;
+            for (uint32_t tx = 0; tx < cols.count; tx++) {
+                Texel value = loadTexel(row + 4 * static_cast<size_t>(cols.index[tx]), filter, tables);
+                acc = texelMulAdd(acc, value, rowTaps.weight[ty] * cols.weight[tx]);
+            }
+        }
+        storeTexel(out + 4 * static_cast<size_t>(x), acc, filter, tables);
+    }
+}
+
+// === Integer 2x2 box kernels (even sizes, Box filter) ===
+
+void boxRowScalar(
+    const unsigned char* row0, const unsigned char* row1,
+    unsigned char* dst, uint32_t begin, uint32_t dstWidth
+) {
+    for (uint32_t x = begin; x < dstWidth; x++) {
+        const unsigned char* a = row0 + 8 * static_cast<size_t>(x);
+        const unsigned char* b = row1 + 8 * static_cast<size_t>(x);
+        unsigned char* p = dst + 4 * static_cast<size_t>(x);
+        for (int c = 0; c < 4; c++) {
+            p[c] = static_cast<unsigned char>((a[c] + a[c + 4] + b[c] + b[c + 4] + 2) / 4);
+        }
+    }
+}
+
+#if defined(MIP_CHAIN_X86)
+// 4 destination pixels per iteration. Returns the number of pixels written.
+uint32_t boxRowSSE2(
+    const unsigned char* row0, const unsigned char* row1,
+    unsigned char* dst, uint32_t dstWidth
+) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(2);
+
+    uint32_t x = 0;
+    for (; x + 4 <= dstWidth; x += 4) {
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * static_cast<size_t>(x)));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * static_cast<size_t>(x) + 16));
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * static_cast<size_t>(x)));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * static_cast<size_t>(x) + 16));
+
+        // Vertical sums of source pixels (0,1) (2,3) (4,5) (6,7) as 16 bit
+        __m128i v01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+        __m128i v23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+        __m128i v45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+        __m128i v67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+        // Horizontal pairs: even source pixels + odd source pixels
+        __m128i s01 = _mm_add_epi16(_mm_unpacklo_epi64(v01, v23), _mm_unpackhi_epi64(v01, v23));
+        __m128i s23 = _mm_add_epi16(_mm_unpacklo_epi64(v45, v67), _mm_unpackhi_epi64(v45, v67));
+
+        s01 = _mm_srli_epi16(_mm_add_epi16(s01, bias), 2);
+        s23 = _mm_srli_epi16(_mm_add_epi16(s23, bias), 2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * static_cast<size_t>(x)), _mm_packus_epi16(s01, s23));
+    }
+    return x;
+}
+
+// 8 destination pixels per iteration. Returns the number of pixels written.
+MIP_CHAIN_TARGET_AVX2
+uint32_t boxRowAVX2(
+    const unsigned char* row0, const unsigned char* row1,
+    unsigned char* dst, uint32_t dstWidth
+) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bias = _mm256_set1_epi16(2);
+
+    uint32_t x = 0;
+    for (; x + 8 <= dstWidth; x += 8) {
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + 8 * static_cast<size_t>(x)));
+        __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + 8 * static_cast<size_t>(x) + 32));
+        __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + 8 * static_cast<size_t>(x)));
+        __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + 8 * static_cast<size_t>(x) + 32));
+
+        // Per 128 bit lane this is the SSE2 kernel: lo = pixels (0,1|4,5), hi = (2,3|6,7)
+        __m256i lo0 = _mm256_add_epi16(_mm256_unpacklo_epi8(a0, zero), _mm256_unpacklo_epi8(b0, zero));
+        __m256i hi0 = _mm256_add_epi16(_mm256_unpackhi_epi8(a0, zero), _mm256_unpackhi_epi8(b0, zero));
+        __m256i lo1 = _mm256_add_epi16(_mm256_unpacklo_epi8(a1, zero), _mm256_unpacklo_epi8(b1, zero));
+        __m256i hi1 = _mm256_add_epi16(_mm256_unpackhi_epi8(a1, zero), _mm256_unpackhi_epi8(b1, zero));
+
+        // Destination pixels (0,1|2,3) and (4,5|6,7)
+        __m256i s0 = _mm256_add_epi16(_mm256_unpacklo_epi64(lo0, hi0), _mm256_unpackhi_epi64(lo0, hi0));
+        __m256i s1 = _mm256_add_epi16(_mm256_unpacklo_epi64(lo1, hi1), _mm256_unpackhi_epi64(lo1, hi1));
+
+        s0 = _mm256_srli_epi16(_mm256_add_epi16(s0, bias), 2);
+        s1 = _mm256_srli_epi16(_mm256_add_epi16(s1, bias), 2);
+
+        // packus interleaves lanes as (0,1,4,5|2,3,6,7), restore pixel order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(s0, s1), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 4 * static_cast<size_t>(x)), packed);
+    }
+    return x;
+}
+
+bool cpuHasAvx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+void filterRowBox2x2(
+    const unsigned char* src, uint32_t srcWidth,
+    unsigned char* dst, uint32_t dstWidth, uint32_t y
+) {
+    const unsigned char* row0 = src + 4 * static_cast<size_t>(2 * y) * srcWidth;
+    const unsigned char* row1 = row0 + 4 * static_cast<size_t>(srcWidth);
+    unsigned char* out = dst + 4 * static_cast<size_t>(y) * dstWidth;
+
+    uint32_t done = 0;
+#if defined(MIP_CHAIN_X86)
+    static const bool hasAvx2 = cpuHasAvx2();
+    if (hasAvx2) {
+        done = boxRowAVX2(row0, row1, out, dstWidth);
+    }
+    else {
+        done = boxRowSSE2(row0, row1, out, dstWidth);
+    }
+#endif
+    boxRowScalar(row0, row1, out, done, dstWidth);
+}
+
+} // namespace
+
+uint32_t MipChainBuilder::levelCount(uint32_t width, uint32_t height) {
+    return std::bit_width(std::max(width, height));
+}
+
+void MipChainBuilder::build(
+    const unsigned char* pixelData,
+    uint32_t width, uint32_t height,
+    uint32_t mipLevelCount,
+    MipFilter filter,
+    MipChain& chain
+) {
+    mipLevelCount = std::clamp(mipLevelCount, 1u, levelCount(width, height));
+
+    // Lay out every level in a single allocation
+    chain.basePixels = pixelData;
+    chain.levels.resize(mipLevelCount);
+    chain.levels[0] = { width, height, 0, 0.0 };
+    size_t storageSize = 0;
+    for (uint32_t level = 1; level < mipLevelCount; level++) {
+        const MipLevel& previous = chain.levels[level - 1];
+        MipLevel& current = chain.levels[level];
+        current.width = std::max(1u, previous.width / 2);
+        current.height = std::max(1u, previous.height / 2);
+        current.offset = storageSize;
+        current.buildTimeMs = 0.0;
+        storageSize += 4 * static_cast<size_t>(current.width) * current.height;
+    }
+    chain.storage.resize(storageSize);
+    if (mipLevelCount == 1) return;
+
+    // Column taps are shared by all rows of a level, size them for the largest one
+    std::vector<Taps> columnTaps(chain.levels[1].width);
+
+    ThreadPool& pool = ThreadPool::shared();
+    for (uint32_t level = 1; level < mipLevelCount; level++) {
+        auto start = std::chrono::steady_clock::now();
+
+        const MipLevel& previous = chain.levels[level - 1];
+        const MipLevel& current = chain.levels[level];
+        const unsigned char* src = chain.levelData(level - 1);
+        unsigned char* dst = chain.storage.data() + current.offset;
+
+        bool box2x2 = filter == MipFilter::Box
+            && previous.width == 2 * current.width
+            && previous.height == 2 * current.height;
+
+        if (!box2x2) {
+            for (uint32_t x = 0; x < current.width; x++) {
+                columnTaps[x] = computeTaps(x, previous.width, current.width);
+            }
+        }
+
+        size_t rowsPerTask = std::max<size_t>(1, minPixelsPerTask / current.width);
+        pool.parallelFor(current.height, rowsPerTask, [&](size_t begin, size_t end) {
+            for (size_t y = begin; y < end; y++) {
+                if (box2x2) {
+                    filterRowBox2x2(src, previous.width, dst, current.width, static_cast<uint32_t>(y));
+                }
+                else {
+                    filterRowGeneral(
+                        src, previous.width, previous.height,
+                        dst, current.width, current.height,
+                        static_cast<uint32_t>(y), columnTaps.data(), filter
+                    );
+                }
+            }
+        });
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        chain.levels[level].buildTimeMs = elapsed.count();
+    }
+}
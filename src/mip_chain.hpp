@@ -0,0 +1,68 @@
+#ifndef _MIP_CHAIN_H
+#define _MIP_CHAIN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Downsampling filter used to build the mip chain
+ */
+enum class MipFilter {
+    // Average texel values as stored
+    Box,
+    // Average the RGB channels in linear space for sRGB encoded images
+    BoxSRGB,
+};
+
+struct MipLevel {
+    uint32_t width;
+    uint32_t height;
+    // Byte offset of the level inside MipChain::storage (unused for level 0)
+    size_t offset;
+    // Wall time spent building this level
+    double buildTimeMs;
+};
+
+/**
+ * An RGBA8 mip chain. Level 0 references the caller's source pixels, all
+ * following levels live back to back in one `storage` allocation.
+ */
+struct MipChain {
+    std::vector<MipLevel> levels;
+    std::vector<unsigned char> storage;
+    const unsigned char* basePixels = nullptr;
+
+    const unsigned char* levelData(uint32_t level) const {
+        return level == 0 ? basePixels : storage.data() + levels[level].offset;
+    }
+
+    size_t levelSize(uint32_t level) const {
+        return 4 * static_cast<size_t>(levels[level].width) * levels[level].height;
+    }
+};
+
+class MipChainBuilder {
+public:
+    /**
+     * Number of levels in a full chain for a `width` x `height` image
+     */
+    static uint32_t levelCount(uint32_t width, uint32_t height);
+
+    /**
+     * Build `mipLevelCount` levels from the RGBA8 image in `pixelData`. Every
+     * level is half the size of the previous one (rounded down, at least 1)
+     * and odd sizes are filtered so no source row or column is dropped.
+     * Rows of each level are split across ThreadPool::shared(). The storage
+     * of `chain` is reused when it is already large enough.
+     */
+    static void build(
+        const unsigned char* pixelData,
+        uint32_t width, uint32_t height,
+        uint32_t mipLevelCount,
+        MipFilter filter,
+        MipChain& chain
+    );
+};
+
+#endif // _MIP_CHAIN_H
@@ -0,0 +1,154 @@
+#include "mipmap_generator.hpp"
+#include "resource_manager.hpp"
+#include "webgpu_utils.hpp"
+
+#include <algorithm>
+#include <vector>
+
+bool MipMapGenerator::initialize(wgpu::Device device, const std::filesystem::path& shaderPath) {
+    this->device = device;
+
+    shaderModule = ResourceManager::loadShaderModule(shaderPath, device);
+    if (!shaderModule) return false;
+
+    std::vector<wgpu::BindGroupLayoutEntry> bindingLayouts(2);
+    // === Previous level
+    wgpu::BindGroupLayoutEntry& previousLevelLayout = bindingLayouts[0];
+    previousLevelLayout.binding = 0;
+    previousLevelLayout.visibility = wgpu::ShaderStage::Compute;
+    previousLevelLayout.texture.sampleType = wgpu::TextureSampleType::Float;
+    previousLevelLayout.texture.viewDimension = wgpu::TextureViewDimension::_2D;
+
+    // === Next level
+    wgpu::BindGroupLayoutEntry& nextLevelLayout = bindingLayouts[1];
+    nextLevelLayout.binding = 1;
+    nextLevelLayout.visibility = wgpu::ShaderStage::Compute;
+    nextLevelLayout.storageTexture.access = wgpu::StorageTextureAccess::WriteOnly;
+    nextLevelLayout.storageTexture.format = wgpu::TextureFormat::RGBA8Unorm;
+    nextLevelLayout.storageTexture.viewDimension = wgpu::TextureViewDimension::_2D;
+
+    wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+    bindGroupLayoutDesc.label = "Mipmap bind group layout"_wgpu;
+    bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayouts.size();
+    bindGroupLayoutDesc.entries = bindingLayouts.data();
+    bindGroupLayout = device.createBindGroupLayout(bindGroupLayoutDesc);
+
+    wgpu::PipelineLayoutDescriptor pipelineLayoutDesc;
+    pipelineLayoutDesc.label = "Mipmap pipeline layout"_wgpu;
+    pipelineLayoutDesc.bindGroupLayoutCount = 1;
+    pipelineLayoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
+    pipelineLayout = device.createPipelineLayout(pipelineLayoutDesc);
+
+    return true;
+}
+
+void MipMapGenerator::terminate() {
+    for (auto& pipeline : pipelines) {
+        if (pipeline) pipeline.release();
+        pipeline = nullptr;
+    }
+    if (pipelineLayout) pipelineLayout.release();
+    if (bindGroupLayout) bindGroupLayout.release();
+    if (shaderModule) shaderModule.release();
+    pipelineLayout = nullptr;
+    bindGroupLayout = nullptr;
+    shaderModule = nullptr;
+}
+
+wgpu::ComputePipeline MipMapGenerator::getPipeline(MipFilter filter) {
+    wgpu::ComputePipeline& pipeline = pipelines[static_cast<size_t>(filter)];
+    if (pipeline) return pipeline;
+
+    wgpu::ConstantEntry srgbConstant;
+    srgbConstant.key = "srgb"_wgpu;
+    srgbConstant.value = filter == MipFilter::BoxSRGB ? 1.0 : 0.0;
+
+    wgpu::ComputePipelineDescriptor pipelineDesc;
+    pipelineDesc.label = "Mipmap pipeline"_wgpu;
+    pipelineDesc.layout = pipelineLayout;
+    pipelineDesc.compute.module = shaderModule;
+    pipelineDesc.compute.entryPoint = "cs_main"_wgpu;
+    pipelineDesc.compute.constantCount = 1;
+    pipelineDesc.compute.constants = &srgbConstant;
+    pipeline = device.createComputePipeline(pipelineDesc);
+
+    return pipeline;
+}
+
+void MipMapGenerator::generate(
+    wgpu::Texture texture,
+    wgpu::Extent3D textureSize,
+    uint32_t mipLevelCount,
+    MipFilter filter
+) {
+    if (mipLevelCount < 2) return;
+
+    wgpu::ComputePipeline pipeline = getPipeline(filter);
+
+    // One view per level, level N is read while N+1 is written
+    std::vector<wgpu::TextureView> levelViews(mipLevelCount);
+    for (uint32_t level = 0; level < mipLevelCount; level++) {
+        wgpu::TextureViewDescriptor viewDesc;
+        viewDesc.aspect = wgpu::TextureAspect::All;
+        viewDesc.baseArrayLayer = 0;
+        viewDesc.arrayLayerCount = 1;
+        viewDesc.baseMipLevel = level;
+        viewDesc.mipLevelCount = 1;
+        viewDesc.dimension = wgpu::TextureViewDimension::_2D;
+        viewDesc.format = wgpu::TextureFormat::RGBA8Unorm;
+        levelViews[level] = texture.createView(viewDesc);
+    }
+
+    std::vector<wgpu::BindGroup> bindGroups(mipLevelCount - 1);
+    for (uint32_t level = 1; level < mipLevelCount; level++) {
+        std::vector<wgpu::BindGroupEntry> bindings(2);
+        bindings[0].binding = 0;
+        bindings[0].textureView = levelViews[level - 1];
+        bindings[1].binding = 1;
+        bindings[1].textureView = levelViews[level];
+
+        wgpu::BindGroupDescriptor bindGroupDesc;
+        bindGroupDesc.label = "Mipmap bind group"_wgpu;
+        bindGroupDesc.layout = bindGroupLayout;
+        bindGroupDesc.entryCount = (uint32_t)bindings.size();
+        bindGroupDesc.entries = bindings.data();
+        bindGroups[level - 1] = device.createBindGroup(bindGroupDesc);
+    }
+
+    wgpu::CommandEncoderDescriptor encoderDesc = {};
+    encoderDesc.label = "Mipmap command encoder"_wgpu;
+    wgpu::CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+
+    // Each dispatch is its own synchronization scope, so a single pass can
+    // walk down the whole chain
+    wgpu::ComputePassDescriptor computePassDesc;
+    computePassDesc.timestampWrites = nullptr;
+    wgpu::ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+    computePass.setPipeline(pipeline);
+
+    uint32_t width = textureSize.width;
+    uint32_t height = textureSize.height;
+    for (uint32_t level = 1; level < mipLevelCount; level++) {
+        width = std::max(1u, width / 2);
+        height = std::max(1u, height / 2);
+
+        computePass.setBindGroup(0, bindGroups[level - 1], 0, nullptr);
+        computePass.dispatchWorkgroups((width + 7) / 8, (height + 7) / 8, 1);
+    }
+
+    computePass.end();
+    computePass.release();
+
+    wgpu::CommandBufferDescriptor cmdBufferDesc = {};
+    cmdBufferDesc.label = "Mipmap command buffer"_wgpu;
+    wgpu::CommandBuffer command = encoder.finish(cmdBufferDesc);
+    encoder.release();
+
+    wgpu::Queue queue = device.getQueue();
+    queue.submit(command);
+    command.release();
+    queue.release();
+
+    for (auto& bindGroup : bindGroups) bindGroup.release();
+    for (auto& view : levelViews) view.release();
+}
@@ -0,0 +1,48 @@
+#ifndef _MIPMAP_GENERATOR_H
+#define _MIPMAP_GENERATOR_H
+
+#include "mip_chain.hpp"
+
+#include <webgpu/webgpu.hpp>
+
+#include <array>
+#include <filesystem>
+
+/**
+ * Fills the mip chain of an RGBA8 texture on the GPU from its level 0 with
+ * a compute shader. The pipelines are created on first use and reused for
+ * every texture generated with the same filter.
+ */
+class MipMapGenerator {
+public:
+    // Load the shader and create the layouts, return true if it went all right
+    bool initialize(wgpu::Device device, const std::filesystem::path& shaderPath);
+
+    // Release every object created by initialize() and generate()
+    void terminate();
+
+    /**
+     * Write levels 1 to `mipLevelCount - 1` of `texture`, which needs the
+     * TextureBinding and StorageBinding usages
+     */
+    void generate(
+        wgpu::Texture texture,
+        wgpu::Extent3D textureSize,
+        uint32_t mipLevelCount,
+        MipFilter filter
+    );
+
+private:
+    wgpu::ComputePipeline getPipeline(MipFilter filter);
+
+private:
+    wgpu::Device device;
+    wgpu::ShaderModule shaderModule;
+    wgpu::BindGroupLayout bindGroupLayout;
+    wgpu::PipelineLayout pipelineLayout;
+
+    // One pipeline per MipFilter
+    std::array<wgpu::ComputePipeline, 2> pipelines{};
+};
+
+#endif // _MIPMAP_GENERATOR_H
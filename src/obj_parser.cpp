@@ -0,0 +1,575 @@
+#include "obj_parser.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+// Smaller chunks are not worth a task of their own
+constexpr size_t minChunkBytes = 256 * 1024;
+// More chunks than threads so that uneven chunks still balance out
+constexpr size_t chunksPerThread = 8;
+
+enum RelativeFlags : uint8_t {
+    RelativePosition = 1 << 0,
+    RelativeTexcoord = 1 << 1,
+    RelativeNormal = 1 << 2,
+};
+
+// Face corner as written in the file. Negative indices count back from the
+// attributes read so far in the chunk and are flagged, they become absolute
+// once the attribute counts of the previous chunks are known.
+struct RawCorner {
+    int32_t position;
+    int32_t texcoord;
+    int32_t normal;
+    uint8_t relative;
+};
+
+struct Chunk {
+    const char* begin;
+    const char* end;
+    size_t lineCount = 0;
+    // Line of the first parse error within the chunk, 1-based, 0 if none
+    size_t errorLine = 0;
+    bool invalidIndex = false;
+
+    std::vector<float> positions;
+    std::vector<float> colors;
+    std::vector<float> normals;
+    std::vector<float> texcoords;
+    std::vector<RawCorner> faceCorners;
+    std::vector<uint32_t> faceSizes;
+    // Number of faces read before each `g` or `o` line
+    std::vector<uint32_t> groupBreaks;
+
+    // Triangulated corners, and their count before each group break
+    std::vector<ObjCorner> corners;
+    std::vector<size_t> shapeBreaks;
+
+    // Offsets of this chunk in the merged arrays, in elements
+    size_t positionBase = 0;
+    size_t normalBase = 0;
+    size_t texcoordBase = 0;
+    size_t cornerBase = 0;
+};
+
+bool isSpace(char c) { return c == ' ' || c == '\t'; }
+bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+const char* skipSpaces(const char* p, const char* end) {
+    while (p < end && isSpace(*p)) p++;
+    return p;
+}
+
+/**
+ * Read the next blank separated real like tinyobj's parseReal: `value` is
+ * left untouched when the token does not start with a number. Going through
+ * a double before rounding to float matches what tinyobj stores.
+ */
+bool parseReal(const char*& p, const char* end, float& value) {
+    const char* first = skipSpaces(p, end);
+    const char* last = first;
+    while (last < end && !isSpace(*last) && *last != '\r') last++;
+    p = last;
+
+    // from_chars rejects a leading '+' but accepts inf and nan, tinyobj
+    // does the opposite
+    const char* digits = first;
+    if (digits < last && (*digits == '+' || *digits == '-')) digits++;
+    if (digits == last || !(isDigit(*digits) || *digits == '.')) return false;
+    if (*first == '+') first++;
+
+    double number;
+    auto [ptr, ec] = std::from_chars(first, last, number);
+    if (ec != std::errc()) return false;
+    value = static_cast<float>(number);
+    return true;
+}
+
+// Read one index of a face corner, 0 when there is none (as atoi would)
+int parseIndex(const char*& p, const char* end) {
+    const char* first = p;
+    if (end - first > 1 && first[0] == '+' && isDigit(first[1])) first++;
+    int value = 0;
+    std::from_chars(first, end, value);
+    while (p < end && *p != '/' && !isSpace(*p) && *p != '\r') p++;
+    return value;
+}
+
+// Make a 1-based OBJ index 0-based, following tinyobj's fixIndex. A zero
+// index maps to -1 and is only accepted for optional attributes.
+bool fixIndex(int index, size_t localCount, bool allowZero, uint8_t flag, int32_t& result, uint8_t& relative) {
+    if (index > 0) {
+        result = index - 1;
+        return true;
+    }
+    if (index == 0) {
+        result = -1;
+        return allowZero;
+    }
+    result = static_cast<int32_t>(localCount) + index;
+    relative |= flag;
+    return true;
+}
+
+bool parseFace(const char* p, const char* end, Chunk& chunk) {
+    size_t positionCount = chunk.positions.size() / 3;
+    size_t normalCount = chunk.normals.size() / 3;
+    size_t texcoordCount = chunk.texcoords.size() / 2;
+
+    uint32_t size = 0;
+    p = skipSpaces(p, end);
+    while (p < end && *p != '#' && *p != '\r') {
+        RawCorner corner{ -1, -1, -1, 0 };
+        if (!fixIndex(parseIndex(p, end), positionCount, false, RelativePosition, corner.position, corner.relative)) {
+            return false;
+        }
+        if (p < end && *p == '/') {
+            p++;
+            if (p < end && *p == '/') {
+                // i//k
+                p++;
+                fixIndex(parseIndex(p, end), normalCount, true, RelativeNormal, corner.normal, corner.relative);
+            }
+            else {
+                // i/j or i/j/k
+                fixIndex(parseIndex(p, end), texcoordCount, true, RelativeTexcoord, corner.texcoord, corner.relative);
+                if (p < end && *p == '/') {
+                    p++;
+                    fixIndex(parseIndex(p, end), normalCount, true, RelativeNormal, corner.normal, corner.relative);
+                }
+            }
+        }
+        chunk.faceCorners.push_back(corner);
+        size++;
+        while (p < end && (isSpace(*p) || *p == '\r')) p++;
+    }
+    chunk.faceSizes.push_back(size);
+    return true;
+}
+
+bool parseLine(const char* p, const char* end, Chunk& chunk) {
+    p = skipSpaces(p, end);
+    if (end - p < 2) return true;
+
+    if (p[0] == 'v' && isSpace(p[1])) {
+        p += 2;
+        float x = 0.0f, y = 0.0f, z = 0.0f;
+        parseReal(p, end, x);
+        parseReal(p, end, y);
+        parseReal(p, end, z);
+
+        // Same fallbacks as tinyobj's parseVertexWithColor, where a fourth
+        // component alone is read as red
+        float r, g, b;
+        if (!parseReal(p, end, r)) {
+            r = g = b = 1.0f;
+        }
+        else if (!parseReal(p, end, g)) {
+            g = b = 1.0f;
+        }
+        else if (!parseReal(p, end, b)) {
+            r = g = b = 1.0f;
+        }
+
+        chunk.positions.insert(chunk.positions.end(), { x, y, z });
+        chunk.colors.insert(chunk.colors.end(), { r, g, b });
+    }
+    else if (p[0] == 'v' && p[1] == 'n' && end - p > 2 && isSpace(p[2])) {
+        p += 3;
+        float x = 0.0f, y = 0.0f, z = 0.0f;
+        parseReal(p, end, x);
+        parseReal(p, end, y);
+        parseReal(p, end, z);
+        chunk.normals.insert(chunk.normals.end(), { x, y, z });
+    }
+    else if (p[0] == 'v' && p[1] == 't' && end - p > 2 && isSpace(p[2])) {
+        p += 3;
+        float u = 0.0f, v = 0.0f;
+        parseReal(p, end, u);
+        parseReal(p, end, v);
+        chunk.texcoords.insert(chunk.texcoords.end(), { u, v });
+    }
+    else if (p[0] == 'f' && isSpace(p[1])) {
+        return parseFace(p + 2, end, chunk);
+    }
+    else if ((p[0] == 'g' || p[0] == 'o') && isSpace(p[1])) {
+        chunk.groupBreaks.push_back(static_cast<uint32_t>(chunk.faceSizes.size()));
+    }
+    return true;
+}
+
+void parseChunk(Chunk& chunk) {
+    const char* p = chunk.begin;
+    while (p < chunk.end) {
+        const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', chunk.end - p));
+        const char* next = lineEnd ? lineEnd + 1 : chunk.end;
+        if (!lineEnd) lineEnd = chunk.end;
+        if (lineEnd > p && lineEnd[-1] == '\r') lineEnd--;
+
+        chunk.lineCount++;
+        if (!parseLine(p, lineEnd, chunk)) {
+            chunk.errorLine = chunk.lineCount;
+            return;
+        }
+        p = next;
+    }
+}
+
+/**
+ * Cut `text` after newlines into roughly even chunks
+ */
+std::vector<Chunk> splitChunks(std::string_view text, size_t threadCount) {
+    size_t chunkCount = threadCount > 1
+        ? std::clamp<size_t>(text.size() / minChunkBytes, 1, threadCount * chunksPerThread)
+        : 1;
+
+    std::vector<Chunk> chunks;
+    chunks.reserve(chunkCount);
+    const char* begin = text.data();
+    const char* end = begin + text.size();
+    const char* start = begin;
+    for (size_t i = 0; i < chunkCount && start < end; i++) {
+        const char* chunkEnd = end;
+        if (i + 1 < chunkCount) {
+            chunkEnd = std::max(start, begin + text.size() * (i + 1) / chunkCount);
+            const char* newline = static_cast<const char*>(std::memchr(chunkEnd, '\n', end - chunkEnd));
+            chunkEnd = newline ? newline + 1 : end;
+        }
+        Chunk& chunk = chunks.emplace_back();
+        chunk.begin = start;
+        chunk.end = chunkEnd;
+        start = chunkEnd;
+    }
+    return chunks;
+}
+
+// Turn a chunk relative corner into an absolute one, false if it points
+// outside of the attribute arrays
+bool resolveCorner(
+    const RawCorner& raw, const Chunk& chunk, const ObjGeometry& geometry, ObjCorner& corner
+) {
+    corner.position = raw.position;
+    corner.texcoord = raw.texcoord;
+    corner.normal = raw.normal;
+    if (raw.relative & RelativePosition) corner.position += static_cast<int32_t>(chunk.positionBase);
+    if (raw.relative & RelativeTexcoord) corner.texcoord += static_cast<int32_t>(chunk.texcoordBase);
+    if (raw.relative & RelativeNormal) corner.normal += static_cast<int32_t>(chunk.normalBase);
+
+    bool validTexcoord = corner.texcoord >= (raw.relative & RelativeTexcoord ? 0 : -1)
+        && static_cast<int64_t>(corner.texcoord) < static_cast<int64_t>(geometry.texcoords.size() / 2);
+    bool validNormal = corner.normal >= (raw.relative & RelativeNormal ? 0 : -1)
+        && static_cast<int64_t>(corner.normal) < static_cast<int64_t>(geometry.normals.size() / 3);
+    return corner.position >= 0
+        && static_cast<size_t>(corner.position) < geometry.positions.size() / 3
+        && validTexcoord && validNormal;
+}
+
+// Port of the built-in ear clipping of tinyobj's exportGroupsToShape, kept
+// operation for operation so that both produce the same triangles
+void earClip(
+    const ObjCorner* face, size_t npolys, const std::vector<float>& v,
+    std::vector<ObjCorner>& remaining, std::vector<ObjCorner>& out
+) {
+    // Project on the two axes of largest extent of the first non
+    // degenerate corner
+    size_t axes[2] = { 1, 2 };
+    for (size_t k = 0; k < npolys; ++k) {
+        size_t vi0 = static_cast<size_t>(face[(k + 0) % npolys].position);
+        size_t vi1 = static_cast<size_t>(face[(k + 1) % npolys].position);
+        size_t vi2 = static_cast<size_t>(face[(k + 2) % npolys].position);
+        float e0x = v[vi1 * 3 + 0] - v[vi0 * 3 + 0];
+        float e0y = v[vi1 * 3 + 1] - v[vi0 * 3 + 1];
+        float e0z = v[vi1 * 3 + 2] - v[vi0 * 3 + 2];
+        float e1x = v[vi2 * 3 + 0] - v[vi1 * 3 + 0];
+        float e1y = v[vi2 * 3 + 1] - v[vi1 * 3 + 1];
+        float e1z = v[vi2 * 3 + 2] - v[vi1 * 3 + 2];
+        float cx = std::fabs(e0y * e1z - e0z * e1y);
+        float cy = std::fabs(e0z * e1x - e0x * e1z);
+        float cz = std::fabs(e0x * e1y - e0y * e1x);
+        const float epsilon = std::numeric_limits<float>::epsilon();
+        if (cx > epsilon || cy > epsilon || cz > epsilon) {
+            if (!(cx > cy && cx > cz)) {
+                axes[0] = 0;
+                if (cz > cx && cz > cy) {
+                    axes[1] = 1;
+                }
+            }
+            break;
+        }
+    }
+
+    remaining.assign(face, face + npolys);
+    size_t guessVert = 0;
+    ObjCorner ind[3];
+    float vx[3];
+    float vy[3];
+
+    // How many ears can be tried without the polygon shrinking
+    size_t remainingIterations = npolys;
+    size_t previousRemainingVertices = npolys;
+
+    while (remaining.size() > 3 && remainingIterations > 0) {
+        npolys = remaining.size();
+        if (guessVert >= npolys) {
+            guessVert -= npolys;
+        }
+
+        if (previousRemainingVertices != npolys) {
+            previousRemainingVertices = npolys;
+            remainingIterations = npolys;
+        }
+        else {
+            remainingIterations--;
+        }
+
+        for (size_t k = 0; k < 3; k++) {
+            ind[k] = remaining[(guessVert + k) % npolys];
+            size_t vi = static_cast<size_t>(ind[k].position);
+            vx[k] = v[vi * 3 + axes[0]];
+            vy[k] = v[vi * 3 + axes[1]];
+        }
+
+        float e0x = vx[1] - vx[0];
+        float e0y = vy[1] - vy[0];
+        float e1x = vx[2] - vx[1];
+        float e1y = vy[2] - vy[1];
+        float cross = e0x * e1y - e0y * e1x;
+
+        float area = (vx[0] * vy[1] - vy[0] * vx[1]) * 0.5f;
+        if (cross * area < 0.0f) {
+            guessVert += 1;
+            continue;
+        }
+
+        // Reject the ear if any other vertex lies inside it
+        bool overlap = false;
+        for (size_t otherVert = 3; otherVert < npolys; ++otherVert) {
+            size_t ovi = static_cast<size_t>(remaining[(guessVert + otherVert) % npolys].position);
+            float tx = v[ovi * 3 + axes[0]];
+            float ty = v[ovi * 3 + axes[1]];
+
+            bool inside = false;
+            for (int i = 0, j = 2; i < 3; j = i++) {
+                if (((vy[i] > ty) != (vy[j] > ty))
+                    && (tx < (vx[j] - vx[i]) * (ty - vy[i]) / (vy[j] - vy[i]) + vx[i])) {
+                    inside = !inside;
+                }
+            }
+            if (inside) {
+                overlap = true;
+                break;
+            }
+        }
+
+        if (overlap) {
+            guessVert += 1;
+            continue;
+        }
+
+        out.insert(out.end(), { ind[0], ind[1], ind[2] });
+        remaining.erase(remaining.begin() + (guessVert + 1) % npolys);
+    }
+
+    if (remaining.size() == 3) {
+        out.insert(out.end(), remaining.begin(), remaining.end());
+    }
+}
+
+// Split every face of the chunk into triangles, as tinyobj does with
+// triangulation on
+void triangulateChunk(Chunk& chunk, const ObjGeometry& geometry) {
+    const std::vector<float>& v = geometry.positions;
+    std::vector<ObjCorner> face;
+    std::vector<ObjCorner> remaining;
+    chunk.corners.reserve(chunk.faceCorners.size() * 3 / 2);
+
+    size_t nextBreak = 0;
+    size_t firstCorner = 0;
+    for (size_t f = 0; f < chunk.faceSizes.size(); f++) {
+        while (nextBreak < chunk.groupBreaks.size() && chunk.groupBreaks[nextBreak] == f) {
+            chunk.shapeBreaks.push_back(chunk.corners.size());
+            nextBreak++;
+        }
+
+        size_t npolys = chunk.faceSizes[f];
+        face.resize(npolys);
+        for (size_t k = 0; k < npolys; k++) {
+            if (!resolveCorner(chunk.faceCorners[firstCorner + k], chunk, geometry, face[k])) {
+                chunk.invalidIndex = true;
+                return;
+            }
+        }
+        firstCorner += npolys;
+
+        if (npolys < 3) continue;
+
+        if (npolys == 3) {
+            chunk.corners.insert(chunk.corners.end(), face.begin(), face.end());
+        }
+        else if (npolys == 4) {
+            // Cut along the shorter diagonal
+            size_t vi0 = static_cast<size_t>(face[0].position);
+            size_t vi1 = static_cast<size_t>(face[1].position);
+            size_t vi2 = static_cast<size_t>(face[2].position);
+            size_t vi3 = static_cast<size_t>(face[3].position);
+            float e02x = v[vi2 * 3 + 0] - v[vi0 * 3 + 0];
+            float e02y = v[vi2 * 3 + 1] - v[vi0 * 3 + 1];
+            float e02z = v[vi2 * 3 + 2] - v[vi0 * 3 + 2];
+            float e13x = v[vi3 * 3 + 0] - v[vi1 * 3 + 0];
+            float e13y = v[vi3 * 3 + 1] - v[vi1 * 3 + 1];
+            float e13z = v[vi3 * 3 + 2] - v[vi1 * 3 + 2];
+            float sqr02 = e02x * e02x + e02y * e02y + e02z * e02z;
+            float sqr13 = e13x * e13x + e13y * e13y + e13z * e13z;
+
+            if (sqr02 < sqr13) {
+                chunk.corners.insert(chunk.corners.end(), { face[0], face[1], face[2], face[0], face[2], face[3] });
+            }
+            else {
+                chunk.corners.insert(chunk.corners.end(), { face[0], face[1], face[3], face[1], face[2], face[3] });
+            }
+        }
+        else {
+            earClip(face.data(), npolys, v, remaining, chunk.corners);
+        }
+    }
+    for (; nextBreak < chunk.groupBreaks.size(); nextBreak++) {
+        chunk.shapeBreaks.push_back(chunk.corners.size());
+    }
+
+    chunk.faceCorners = {};
+    chunk.faceSizes = {};
+}
+
+template <typename T>
+void moveInto(std::vector<T>& source, std::vector<T>& destination, size_t offset) {
+    std::copy(source.begin(), source.end(), destination.begin() + offset);
+    source = {};
+}
+
+} // namespace
+
+bool ObjParser::parse(
+    const std::filesystem::path& path,
+    ObjGeometry& geometry,
+    ThreadPool* pool
+) {
+    MappedFile file;
+    if (!file.open(path)) {
+        std::cerr << "Could not open OBJ file: " << path << std::endl;
+        return false;
+    }
+    std::string_view text(reinterpret_cast<const char*>(file.data()), file.size());
+    return parseText(text, geometry, pool);
+}
+
+bool ObjParser::parseText(
+    std::string_view text,
+    ObjGeometry& geometry,
+    ThreadPool* pool
+) {
+    std::vector<Chunk> chunks = splitChunks(text, pool ? pool->size() + 1 : 1);
+
+    auto forEachChunk = [&](const std::function<void(Chunk&)>& body) {
+        if (pool) {
+            pool->parallelFor(chunks.size(), 1, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) body(chunks[i]);
+            });
+        }
+        else {
+            for (Chunk& chunk : chunks) body(chunk);
+        }
+    };
+
+    // === Parse every chunk on its own
+    forEachChunk(parseChunk);
+
+    size_t lineCount = 0;
+    for (const Chunk& chunk : chunks) {
+        if (chunk.errorLine != 0) {
+            std::cerr << "Failed to parse `f' line (e.g. a zero value for vertex index). Line "
+                      << lineCount + chunk.errorLine << "." << std::endl;
+            return false;
+        }
+        lineCount += chunk.lineCount;
+    }
+
+    // === Place the chunks one after the other
+    size_t positionCount = 0;
+    size_t normalCount = 0;
+    size_t texcoordCount = 0;
+    for (Chunk& chunk : chunks) {
+        chunk.positionBase = positionCount;
+        chunk.normalBase = normalCount;
+        chunk.texcoordBase = texcoordCount;
+        positionCount += chunk.positions.size() / 3;
+        normalCount += chunk.normals.size() / 3;
+        texcoordCount += chunk.texcoords.size() / 2;
+    }
+    if (positionCount > static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+        std::cerr << "Too many vertices in OBJ file" << std::endl;
+        return false;
+    }
+
+    geometry.positions.resize(3 * positionCount);
+    geometry.colors.resize(3 * positionCount);
+    geometry.normals.resize(3 * normalCount);
+    geometry.texcoords.resize(2 * texcoordCount);
+    forEachChunk([&](Chunk& chunk) {
+        moveInto(chunk.positions, geometry.positions, 3 * chunk.positionBase);
+        moveInto(chunk.colors, geometry.colors, 3 * chunk.positionBase);
+        moveInto(chunk.normals, geometry.normals, 3 * chunk.normalBase);
+        moveInto(chunk.texcoords, geometry.texcoords, 2 * chunk.texcoordBase);
+    });
+
+    // === Resolve indices and triangulate, which needs every position
+    forEachChunk([&](Chunk& chunk) { triangulateChunk(chunk, geometry); });
+
+    size_t cornerCount = 0;
+    for (Chunk& chunk : chunks) {
+        if (chunk.invalidIndex) {
+            std::cerr << "OBJ face references a vertex, normal or texture coordinate that does not exist" << std::endl;
+            return false;
+        }
+        chunk.cornerBase = cornerCount;
+        cornerCount += chunk.corners.size();
+    }
+    if (cornerCount > std::numeric_limits<uint32_t>::max()) {
+        std::cerr << "Too many triangles in OBJ file" << std::endl;
+        return false;
+    }
+
+    geometry.corners.resize(cornerCount);
+    forEachChunk([&](Chunk& chunk) {
+        moveInto(chunk.corners, geometry.corners, chunk.cornerBase);
+    });
+
+    // Groups without any triangle do not make a shape, like in tinyobj
+    geometry.shapes.clear();
+    size_t shapeStart = 0;
+    auto closeShape = [&](size_t shapeEnd) {
+        if (shapeEnd > shapeStart) {
+            SubMesh shape;
+            shape.firstIndex = static_cast<uint32_t>(shapeStart);
+            shape.indexCount = static_cast<uint32_t>(shapeEnd - shapeStart);
+            geometry.shapes.push_back(shape);
+        }
+        shapeStart = shapeEnd;
+    };
+    for (const Chunk& chunk : chunks) {
+        for (size_t shapeBreak : chunk.shapeBreaks) {
+            closeShape(chunk.cornerBase + shapeBreak);
+        }
+    }
+    closeShape(cornerCount);
+
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef _OBJ_PARSER_H
+#define _OBJ_PARSER_H
+
+#include "mesh.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+class ThreadPool;
+
+/**
+ * Attribute indices of one triangle corner, -1 when the face did not
+ * reference a normal or a texture coordinate
+ */
+struct ObjCorner {
+    int32_t position;
+    int32_t texcoord;
+    int32_t normal;
+};
+
+/**
+ * Raw content of an OBJ file with every face triangulated. Colors hold one
+ * rgb triple per position, 1,1,1 where the `v` line has none.
+ */
+struct ObjGeometry {
+    std::vector<float> positions;
+    std::vector<float> colors;
+    std::vector<float> normals;
+    std::vector<float> texcoords;
+    std::vector<ObjCorner> corners;
+    // Range of `corners` covered by each non-empty `g`/`o` group
+    std::vector<SubMesh> shapes;
+};
+
+/**
+ * OBJ reader producing the same triangles as tinyobj::LoadObj (quads split
+ * along their shorter diagonal, larger polygons ear clipped). The file is
+ * memory mapped and cut at line boundaries into chunks that are parsed, then
+ * triangulated, in parallel; each chunk only needs the attribute counts of
+ * the chunks before it to resolve relative indices.
+ *
+ * Materials, lines and points are ignored.
+ */
+class ObjParser {
+public:
+    /**
+     * Parse the file at `path` into `geometry`. Chunks run on `pool`, or on
+     * the calling thread alone when it is null.
+     */
+    static bool parse(
+        const std::filesystem::path& path,
+        ObjGeometry& geometry,
+        ThreadPool* pool
+    );
+
+    /**
+     * Parse OBJ text already in memory, see above
+     */
+    static bool parseText(
+        std::string_view text,
+        ObjGeometry& geometry,
+        ThreadPool* pool
+    );
+};
+
+#endif // _OBJ_PARSER_H
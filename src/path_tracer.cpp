@@ -0,0 +1,279 @@
+#include "path_tracer.hpp"
+#include "bvh.hpp"
+#include "resource_manager.hpp"
+#include "thread_pool.hpp"
+#include "webgpu_utils.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// The shader reads vertices as 11 floats: position, normal, color, uv
+static_assert(sizeof(VertexAttributes) == 11 * sizeof(float));
+
+bool PathTracer::initialize(
+    wgpu::Device device,
+    const std::filesystem::path& shaderPath,
+    wgpu::TextureFormat colorFormat,
+    wgpu::TextureFormat depthFormat
+) {
+    this->device = device;
+    queue = device.getQueue();
+
+    wgpu::ShaderModule shaderModule = ResourceManager::loadShaderModule(shaderPath, device);
+    if (!shaderModule) return false;
+
+    std::vector<wgpu::BindGroupLayoutEntry> bindingLayouts(9);
+    // === Uniforms, also read by the display pass
+    bindingLayouts[0].binding = 0;
+    bindingLayouts[0].visibility = wgpu::ShaderStage::Compute | wgpu::ShaderStage::Fragment;
+    bindingLayouts[0].buffer.type = wgpu::BufferBindingType::Uniform;
+    bindingLayouts[0].buffer.minBindingSize = sizeof(Uniforms);
+
+    // === Lighting uniforms of the raster pipeline
+    bindingLayouts[1].binding = 1;
+    bindingLayouts[1].visibility = wgpu::ShaderStage::Compute;
+    bindingLayouts[1].buffer.type = wgpu::BufferBindingType::Uniform;
+
+    // === BVH nodes, triangles in leaf order, vertices and indices
+    for (uint32_t binding = 2; binding <= 5; binding++) {
+        bindingLayouts[binding].binding = binding;
+        bindingLayouts[binding].visibility = wgpu::ShaderStage::Compute;
+        bindingLayouts[binding].buffer.type = wgpu::BufferBindingType::ReadOnlyStorage;
+    }
+
+    // === Base color texture and its sampler
+    bindingLayouts[6].binding = 6;
+    bindingLayouts[6].visibility = wgpu::ShaderStage::Compute;
+    bindingLayouts[6].texture.sampleType = wgpu::TextureSampleType::Float;
+    bindingLayouts[6].texture.viewDimension = wgpu::TextureViewDimension::_2D;
+
+    bindingLayouts[7].binding = 7;
+    bindingLayouts[7].visibility = wgpu::ShaderStage::Compute;
+    bindingLayouts[7].sampler.type = wgpu::SamplerBindingType::Filtering;
+
+    // === Accumulated radiance, written by the trace pass and read by the
+    // display pass
+    bindingLayouts[8].binding = 8;
+    bindingLayouts[8].visibility = wgpu::ShaderStage::Compute | wgpu::ShaderStage::Fragment;
+    bindingLayouts[8].buffer.type = wgpu::BufferBindingType::Storage;
+
+    wgpu::BindGroupLayoutDescriptor bindGroupLayoutDesc{};
+    bindGroupLayoutDesc.label = "Path tracer bind group layout"_wgpu;
+    bindGroupLayoutDesc.entryCount = (uint32_t)bindingLayouts.size();
+    bindGroupLayoutDesc.entries = bindingLayouts.data();
+    bindGroupLayout = device.createBindGroupLayout(bindGroupLayoutDesc);
+
+    wgpu::PipelineLayoutDescriptor pipelineLayoutDesc;
+    pipelineLayoutDesc.label = "Path tracer pipeline layout"_wgpu;
+    pipelineLayoutDesc.bindGroupLayoutCount = 1;
+    pipelineLayoutDesc.bindGroupLayouts = (WGPUBindGroupLayout*)&bindGroupLayout;
+    pipelineLayout = device.createPipelineLayout(pipelineLayoutDesc);
+
+    // === Trace pipeline
+    wgpu::ComputePipelineDescriptor computePipelineDesc;
+    computePipelineDesc.label = "Path tracer pipeline"_wgpu;
+    computePipelineDesc.layout = pipelineLayout;
+    computePipelineDesc.compute.module = shaderModule;
+    computePipelineDesc.compute.entryPoint = "cs_main"_wgpu;
+    computePipelineDesc.compute.constantCount = 0;
+    computePipelineDesc.compute.constants = nullptr;
+    tracePipeline = device.createComputePipeline(computePipelineDesc);
+
+    // === Display pipeline, a fullscreen triangle that ignores depth
+    wgpu::RenderPipelineDescriptor pipelineDesc;
+    pipelineDesc.label = "Path tracer display pipeline"_wgpu;
+    pipelineDesc.layout = pipelineLayout;
+
+    pipelineDesc.vertex.bufferCount = 0;
+    pipelineDesc.vertex.buffers = nullptr;
+    pipelineDesc.vertex.module = shaderModule;
+    pipelineDesc.vertex.entryPoint = "vs_display"_wgpu;
+    pipelineDesc.vertex.constantCount = 0;
+    pipelineDesc.vertex.constants = nullptr;
+
+    pipelineDesc.primitive.topology = wgpu::PrimitiveTopology::TriangleList;
+    pipelineDesc.primitive.stripIndexFormat = wgpu::IndexFormat::Undefined;
+    pipelineDesc.primitive.frontFace = wgpu::FrontFace::CCW;
+    pipelineDesc.primitive.cullMode = wgpu::CullMode::None;
+
+    wgpu::ColorTargetState colorTarget;
+    colorTarget.format = colorFormat;
+    colorTarget.blend = nullptr;
+    colorTarget.writeMask = wgpu::ColorWriteMask::All;
+
+    wgpu::FragmentState fragmentState;
+    fragmentState.module = shaderModule;
+    fragmentState.entryPoint = "fs_display"_wgpu;
+    fragmentState.constantCount = 0;
+    fragmentState.constants = nullptr;
+    fragmentState.targetCount = 1;
+    fragmentState.targets = &colorTarget;
+    pipelineDesc.fragment = &fragmentState;
+
+    wgpu::DepthStencilState depthStencilState = wgpu::Default;
+    depthStencilState.depthCompare = wgpu::CompareFunction::Always;
+    depthStencilState.depthWriteEnabled = wgpu::OptionalBool::False;
+    depthStencilState.format = depthFormat;
+    depthStencilState.stencilReadMask = 0;
+    depthStencilState.stencilWriteMask = 0;
+    pipelineDesc.depthStencil = &depthStencilState;
+
+    pipelineDesc.multisample.count = 1;
+    pipelineDesc.multisample.mask = ~0u;
+    pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+    displayPipeline = device.createRenderPipeline(pipelineDesc);
+
+    shaderModule.release();
+
+    createBuffer(uniformBuffer, sizeof(Uniforms), wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Uniform, nullptr);
+    return true;
+}
+
+void PathTracer::terminate() {
+    for (wgpu::Buffer* buffer : { &uniformBuffer, &nodeBuffer, &triangleBuffer, &vertexBuffer, &indexBuffer, &accumulationBuffer }) {
+        if (*buffer) buffer->release();
+        *buffer = nullptr;
+    }
+    if (bindGroup) bindGroup.release();
+    if (displayPipeline) displayPipeline.release();
+    if (tracePipeline) tracePipeline.release();
+    if (pipelineLayout) pipelineLayout.release();
+    if (bindGroupLayout) bindGroupLayout.release();
+    if (queue) queue.release();
+    bindGroup = nullptr;
+    displayPipeline = nullptr;
+    tracePipeline = nullptr;
+    pipelineLayout = nullptr;
+    bindGroupLayout = nullptr;
+    queue = nullptr;
+}
+
+void PathTracer::createBuffer(wgpu::Buffer& buffer, uint64_t size, wgpu::BufferUsage usage, const void* data) {
+    if (buffer) buffer.release();
+
+    // Storage bindings must not be empty
+    wgpu::BufferDescriptor bufferDesc;
+    bufferDesc.size = std::max<uint64_t>(size, 16);
+    bufferDesc.usage = usage;
+    bufferDesc.mappedAtCreation = false;
+    buffer = device.createBuffer(bufferDesc);
+    if (data && size > 0) queue.writeBuffer(buffer, 0, data, size);
+    bindGroupDirty = true;
+}
+
+bool PathTracer::uploadScene(const MeshView& mesh) {
+    // Always the full mesh, never a coarser level of detail
+    std::span<const uint32_t> indices = mesh.baseIndices();
+    Bvh bvh;
+    BvhBuildStats stats;
+    if (!BvhBuilder::build(mesh.vertices, indices, bvh, &ThreadPool::shared(), {}, &stats)) {
+        return false;
+    }
+
+#ifdef PRINT_EXTRA_INFO
+    std::cout << "Built BVH in " << stats.buildMilliseconds << " ms: " << stats.nodeCount << " nodes, "
+              << stats.leafCount << " leaves, depth " << stats.maxDepth << ", SAH cost " << stats.sahCost << std::endl;
+#endif
+
+    // An empty scene still needs a root, a leaf holding one degenerate
+    // triangle that every ray misses
+    if (bvh.nodes.empty()) {
+        BvhNode root{};
+        root.leftFirst = 0;
+        root.triangleCount = 1;
+        bvh.nodes.push_back(root);
+        bvh.triangles.push_back(BvhTriangle{});
+    }
+
+    wgpu::BufferUsage usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Storage;
+    createBuffer(nodeBuffer, bvh.nodes.size() * sizeof(BvhNode), usage, bvh.nodes.data());
+    createBuffer(triangleBuffer, bvh.triangles.size() * sizeof(BvhTriangle), usage, bvh.triangles.data());
+    createBuffer(vertexBuffer, mesh.vertices.size_bytes(), usage, mesh.vertices.data());
+    createBuffer(indexBuffer, indices.size_bytes(), usage, indices.data());
+
+    reset();
+    return true;
+}
+
+void PathTracer::setShading(wgpu::TextureView baseColor, wgpu::Sampler sampler, wgpu::Buffer lightingUniforms) {
+    this->baseColor = baseColor;
+    this->sampler = sampler;
+    this->lightingUniforms = lightingUniforms;
+    bindGroupDirty = true;
+    reset();
+}
+
+void PathTracer::resize(uint32_t width, uint32_t height) {
+    if (width == this->width && height == this->height && accumulationBuffer) return;
+    this->width = width;
+    this->height = height;
+
+    // One vec4f of summed radiance per pixel
+    uint64_t size = static_cast<uint64_t>(std::max(width, 1u)) * std::max(height, 1u) * 4 * sizeof(float);
+    createBuffer(accumulationBuffer, size, wgpu::BufferUsage::Storage, nullptr);
+    reset();
+}
+
+bool PathTracer::updateBindGroup() {
+    if (!bindGroupDirty) return bindGroup != nullptr;
+    if (!nodeBuffer || !accumulationBuffer || !baseColor || !sampler || !lightingUniforms) return false;
+
+    std::vector<wgpu::BindGroupEntry> bindings(9);
+    wgpu::Buffer buffers[9] = { uniformBuffer, lightingUniforms, nodeBuffer, triangleBuffer, vertexBuffer, indexBuffer, nullptr, nullptr, accumulationBuffer };
+    for (uint32_t binding = 0; binding < bindings.size(); binding++) {
+        bindings[binding].binding = binding;
+        if (buffers[binding]) {
+            bindings[binding].buffer = buffers[binding];
+            bindings[binding].offset = 0;
+            bindings[binding].size = buffers[binding].getSize();
+        }
+    }
+    bindings[6].textureView = baseColor;
+    bindings[7].sampler = sampler;
+
+    if (bindGroup) bindGroup.release();
+    wgpu::BindGroupDescriptor bindGroupDesc;
+    bindGroupDesc.label = "Path tracer bind group"_wgpu;
+    bindGroupDesc.layout = bindGroupLayout;
+    bindGroupDesc.entryCount = (uint32_t)bindings.size();
+    bindGroupDesc.entries = bindings.data();
+    bindGroup = device.createBindGroup(bindGroupDesc);
+    bindGroupDirty = false;
+    return true;
+}
+
+void PathTracer::trace(wgpu::CommandEncoder encoder, const View& view) {
+    if (!updateBindGroup()) return;
+
+    Uniforms uniforms;
+    uniforms.inverseViewProjection = glm::inverse(view.projectionMatrix * view.viewMatrix);
+    uniforms.modelMatrix = view.modelMatrix;
+    uniforms.inverseModelMatrix = glm::inverse(view.modelMatrix);
+    uniforms.cameraWorldPosition = glm::vec4(view.cameraWorldPosition, 1.0f);
+    uniforms.sampleIndex = sampleIndex;
+    uniforms.width = width;
+    uniforms.height = height;
+    uniforms.maxBounces = maxBounces;
+    queue.writeBuffer(uniformBuffer, 0, &uniforms, sizeof(Uniforms));
+
+    wgpu::ComputePassDescriptor computePassDesc;
+    computePassDesc.timestampWrites = nullptr;
+    wgpu::ComputePassEncoder computePass = encoder.beginComputePass(computePassDesc);
+    computePass.setPipeline(tracePipeline);
+    computePass.setBindGroup(0, bindGroup, 0, nullptr);
+    computePass.dispatchWorkgroups((width + 7) / 8, (height + 7) / 8, 1);
+    computePass.end();
+    computePass.release();
+
+    sampleIndex++;
+}
+
+void PathTracer::draw(wgpu::RenderPassEncoder renderPass) {
+    if (!updateBindGroup()) return;
+
+    renderPass.setPipeline(displayPipeline);
+    renderPass.setBindGroup(0, bindGroup, 0, nullptr);
+    renderPass.draw(3, 1, 0, 0);
+}
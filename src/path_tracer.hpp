@@ -0,0 +1,122 @@
+#ifndef _PATH_TRACER_H
+#define _PATH_TRACER_H
+
+#include "mesh.hpp"
+
+#include <webgpu/webgpu.hpp>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <filesystem>
+
+/**
+ * Progressive path tracer running in a compute shader. The mesh is uploaded
+ * as a BVH in storage buffers; every trace() adds one sample per pixel to a
+ * float accumulation buffer and draw() shows the running average with a
+ * fullscreen triangle.
+ */
+class PathTracer {
+public:
+    /**
+     * Camera and model transforms of the frame to trace, the same matrices
+     * as the raster pipeline uses
+     */
+    struct View {
+        glm::mat4x4 projectionMatrix;
+        glm::mat4x4 viewMatrix;
+        glm::mat4x4 modelMatrix;
+        glm::vec3 cameraWorldPosition;
+    };
+
+    // Load the shader and create the pipelines, return true if it went all right
+    bool initialize(
+        wgpu::Device device,
+        const std::filesystem::path& shaderPath,
+        wgpu::TextureFormat colorFormat,
+        wgpu::TextureFormat depthFormat
+    );
+
+    // Release every object created by the other methods
+    void terminate();
+
+    /**
+     * Build the BVH of `mesh` and upload it together with the vertex
+     * attributes, which are read when shading hits
+     */
+    bool uploadScene(const MeshView& mesh);
+
+    /**
+     * Base color texture and lights, shared with the raster pipeline
+     */
+    void setShading(wgpu::TextureView baseColor, wgpu::Sampler sampler, wgpu::Buffer lightingUniforms);
+
+    // Reallocate the accumulation buffer for a new framebuffer size
+    void resize(uint32_t width, uint32_t height);
+
+    // Drop the accumulated samples, the next trace() starts over
+    void reset() { sampleIndex = 0; }
+
+    /**
+     * Record the compute pass adding one sample per pixel
+     */
+    void trace(wgpu::CommandEncoder encoder, const View& view);
+
+    /**
+     * Draw the accumulated image, in a render pass with the color and depth
+     * formats given to initialize()
+     */
+    void draw(wgpu::RenderPassEncoder renderPass);
+
+    // Samples per pixel accumulated so far
+    uint32_t sampleCount() const { return sampleIndex; }
+
+    // Indirect bounces per path, after the camera ray
+    void setMaxBounces(uint32_t bounces) { maxBounces = bounces; reset(); }
+
+private:
+    struct Uniforms {
+        glm::mat4x4 inverseViewProjection;
+        glm::mat4x4 modelMatrix;
+        glm::mat4x4 inverseModelMatrix;
+        glm::vec4 cameraWorldPosition;
+        uint32_t sampleIndex;
+        uint32_t width;
+        uint32_t height;
+        uint32_t maxBounces;
+    };
+    static_assert(sizeof(Uniforms) % 16 == 0);
+    static_assert(sizeof(Uniforms) <= 256, "maxUniformBufferBindingSize");
+
+    void createBuffer(wgpu::Buffer& buffer, uint64_t size, wgpu::BufferUsage usage, const void* data);
+    bool updateBindGroup();
+
+private:
+    wgpu::Device device;
+    wgpu::Queue queue;
+    wgpu::BindGroupLayout bindGroupLayout;
+    wgpu::PipelineLayout pipelineLayout;
+    wgpu::ComputePipeline tracePipeline;
+    wgpu::RenderPipeline displayPipeline;
+
+    wgpu::Buffer uniformBuffer;
+    wgpu::Buffer nodeBuffer;
+    wgpu::Buffer triangleBuffer;
+    wgpu::Buffer vertexBuffer;
+    wgpu::Buffer indexBuffer;
+    wgpu::Buffer accumulationBuffer;
+
+    // Not owned
+    wgpu::TextureView baseColor;
+    wgpu::Sampler sampler;
+    wgpu::Buffer lightingUniforms;
+
+    wgpu::BindGroup bindGroup;
+    bool bindGroupDirty = true;
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t sampleIndex = 0;
+    uint32_t maxBounces = 4;
+};
+
+#endif // _PATH_TRACER_H
@@ -0,0 +1,329 @@
+#include "pipeline_cache.hpp"
+#include "hash.hpp"
+#include "resource_manager.hpp"
+#include "thread_pool.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::string_view toStringView(WGPUStringView view) {
+    if (!view.data) return {};
+    return view.length == WGPU_STRLEN ? std::string_view(view.data) : std::string_view(view.data, view.length);
+}
+
+uint64_t hashEntryPoint(WGPUShaderModule module, WGPUStringView entryPoint, uint64_t seed) {
+    // Cached modules live as long as the cache, their handle identifies them
+    uint64_t hash = hashBytes(&module, sizeof(module), seed);
+    std::string_view name = toStringView(entryPoint);
+    return hashBytes(name.data(), name.size(), hash);
+}
+
+#if defined(WEBGPU_BACKEND_WGPU)
+/**
+ * A render pipeline descriptor along with everything it points to, for a
+ * compilation that outlives the caller's descriptor. Extension chains are
+ * not followed. The layout is referenced until the copy is destroyed, the
+ * modules belong to the cache, which outlives its compilations.
+ */
+class OwnedPipelineDescriptor {
+public:
+    explicit OwnedPipelineDescriptor(const WGPURenderPipelineDescriptor& source)
+        : descriptor(source)
+    {
+        descriptor.nextInChain = nullptr;
+        descriptor.label = copyString(source.label, label);
+        if (descriptor.layout) wgpuPipelineLayoutAddRef(descriptor.layout);
+
+        descriptor.vertex.entryPoint = copyString(source.vertex.entryPoint, vertexEntryPoint);
+        descriptor.vertex.constants = copyConstants(source.vertex.constants, source.vertex.constantCount, vertexConstants);
+        buffers.assign(source.vertex.buffers, source.vertex.buffers + source.vertex.bufferCount);
+        attributes.resize(buffers.size());
+        for (size_t i = 0; i < buffers.size(); i++) {
+            attributes[i].assign(buffers[i].attributes, buffers[i].attributes + buffers[i].attributeCount);
+            buffers[i].attributes = attributes[i].data();
+        }
+        descriptor.vertex.buffers = buffers.data();
+
+        if (source.fragment) {
+            fragment = *source.fragment;
+            fragment.entryPoint = copyString(source.fragment->entryPoint, fragmentEntryPoint);
+            fragment.constants = copyConstants(source.fragment->constants, source.fragment->constantCount, fragmentConstants);
+            targets.assign(fragment.targets, fragment.targets + fragment.targetCount);
+            blends.resize(targets.size());
+            for (size_t i = 0; i < targets.size(); i++) {
+                if (!targets[i].blend) continue;
+                blends[i] = *targets[i].blend;
+                targets[i].blend = &blends[i];
+            }
+            fragment.targets = targets.data();
+            descriptor.fragment = &fragment;
+        }
+
+        if (source.depthStencil) {
+            depthStencil = *source.depthStencil;
+            descriptor.depthStencil = &depthStencil;
+        }
+    }
+
+    ~OwnedPipelineDescriptor() {
+        if (descriptor.layout) wgpuPipelineLayoutRelease(descriptor.layout);
+    }
+
+    OwnedPipelineDescriptor(const OwnedPipelineDescriptor&) = delete;
+    OwnedPipelineDescriptor& operator=(const OwnedPipelineDescriptor&) = delete;
+
+    const WGPURenderPipelineDescriptor* get() const { return &descriptor; }
+
+private:
+    struct Constants {
+        std::vector<std::string> keys;
+        std::vector<WGPUConstantEntry> entries;
+    };
+
+    static WGPUStringView copyString(WGPUStringView view, std::string& storage) {
+        if (!view.data) return view;
+        storage = toStringView(view);
+        return { storage.data(), storage.size() };
+    }
+
+    static const WGPUConstantEntry* copyConstants(const WGPUConstantEntry* constants, size_t count, Constants& storage) {
+        storage.keys.resize(count);
+        storage.entries.assign(constants, constants + count);
+        for (size_t i = 0; i < count; i++) {
+            storage.entries[i].key = copyString(constants[i].key, storage.keys[i]);
+        }
+        return storage.entries.data();
+    }
+
+private:
+    WGPURenderPipelineDescriptor descriptor;
+    std::string label;
+    std::string vertexEntryPoint;
+    std::string fragmentEntryPoint;
+    Constants vertexConstants;
+    Constants fragmentConstants;
+    std::vector<WGPUVertexBufferLayout> buffers;
+    std::vector<std::vector<WGPUVertexAttribute>> attributes;
+    WGPUFragmentState fragment{};
+    std::vector<WGPUColorTargetState> targets;
+    std::vector<WGPUBlendState> blends;
+    WGPUDepthStencilState depthStencil{};
+};
+#endif
+
+} // namespace
+
+void PipelineCache::initialize(wgpu::Device device) {
+    this->device = device;
+}
+
+void PipelineCache::terminate() {
+    // Keep what the pool compiled, no one is waiting for it anymore
+    for (std::unique_ptr<PendingPipeline>& pending : compiling) {
+        WGPURenderPipeline pipeline = pending->task.get();
+        if (pipeline) insert(pending->key, pipeline);
+    }
+    compiling.clear();
+
+    // Callbacks of pending pipelines reference the cache
+    while (pendingCount > 0) {
+#if defined(WEBGPU_BACKEND_DAWN)
+        device.tick();
+#elif defined(WEBGPU_BACKEND_WGPU)
+        device.poll(false, nullptr);
+#endif
+        std::this_thread::yield();
+    }
+
+    for (auto& [key, pipeline] : pipelines) pipeline.release();
+    for (auto& [key, module] : modules) module.release();
+    pipelines.clear();
+    modules.clear();
+}
+
+wgpu::ShaderModule PipelineCache::shaderModule(const std::string& source, const ShaderPermutation& permutation) {
+    uint64_t key = hashBytes(source.data(), source.size(), permutation.moduleKey());
+    auto found = modules.find(key);
+    if (found != modules.end()) {
+        statistics.moduleHits++;
+        return found->second;
+    }
+
+    statistics.moduleMisses++;
+    std::string processed;
+    if (!ShaderPreprocessor::process(source, permutation.defines, processed)) return nullptr;
+    wgpu::ShaderModule module = ResourceManager::createShaderModule(processed, device);
+    if (module) modules.emplace(key, module);
+    return module;
+}
+
+void PipelineCache::renderPipeline(
+    const wgpu::RenderPipelineDescriptor& descriptor,
+    const ShaderPermutation& permutation,
+    uint64_t stateKey,
+    PipelineCallback onReady
+) {
+    uint64_t key = hashBytes(&stateKey, sizeof(stateKey), permutation.key());
+    key = hashEntryPoint(descriptor.vertex.module, descriptor.vertex.entryPoint, key);
+    if (descriptor.fragment) {
+        key = hashEntryPoint(descriptor.fragment->module, descriptor.fragment->entryPoint, key);
+    }
+
+    auto found = pipelines.find(key);
+    if (found != pipelines.end()) {
+        statistics.pipelineHits++;
+        onReady(found->second);
+        return;
+    }
+    statistics.pipelineMisses++;
+
+    // Specialize both stages, the constants only need to exist in the module
+    std::vector<WGPUConstantEntry> constants(permutation.constants.size());
+    for (size_t i = 0; i < constants.size(); i++) {
+        const std::string& name = permutation.constants[i].first;
+        constants[i].nextInChain = nullptr;
+        constants[i].key = { name.data(), name.size() };
+        constants[i].value = permutation.constants[i].second;
+    }
+
+    wgpu::RenderPipelineDescriptor specialized = descriptor;
+    specialized.vertex.constantCount = constants.size();
+    specialized.vertex.constants = constants.data();
+    WGPUFragmentState fragment;
+    if (descriptor.fragment) {
+        fragment = *descriptor.fragment;
+        fragment.constantCount = constants.size();
+        fragment.constants = constants.data();
+        specialized.fragment = &fragment;
+    }
+
+#if defined(WEBGPU_BACKEND_WGPU)
+    // wgpu-native does not implement createRenderPipelineAsync but its
+    // device can be used from any thread, compile on the pool rather than
+    // stall the frame
+    auto owned = std::make_shared<OwnedPipelineDescriptor>(specialized);
+    WGPUDevice deviceHandle = device;
+    auto pending = std::make_unique<PendingPipeline>(PendingPipeline{ this, key, std::move(onReady), {} });
+    pending->task = ThreadPool::shared().submit([deviceHandle, owned]() {
+        return wgpuDeviceCreateRenderPipeline(deviceHandle, owned->get());
+    });
+    compiling.push_back(std::move(pending));
+#else
+    pendingCount++;
+    wgpu::CreateRenderPipelineAsyncCallbackInfo callbackInfo;
+    callbackInfo.nextInChain = nullptr;
+    callbackInfo.mode = wgpu::CallbackMode::AllowProcessEvents;
+    callbackInfo.callback = onPipelineCreated;
+    callbackInfo.userdata1 = new PendingPipeline{ this, key, std::move(onReady), {} };
+    callbackInfo.userdata2 = nullptr;
+    device.createRenderPipelineAsync(specialized, callbackInfo);
+#endif
+}
+
+void PipelineCache::collect() {
+    // Callbacks may request more pipelines, only those done so far are run
+    std::vector<std::unique_ptr<PendingPipeline>> done;
+    for (auto it = compiling.begin(); it != compiling.end();) {
+        if ((*it)->task.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            done.push_back(std::move(*it));
+            it = compiling.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    for (std::unique_ptr<PendingPipeline>& pending : done) {
+        wgpu::RenderPipeline pipeline = pending->task.get();
+        pending->onReady(pipeline ? insert(pending->key, pipeline) : pipeline);
+    }
+}
+
+wgpu::RenderPipeline PipelineCache::insert(uint64_t key, wgpu::RenderPipeline pipeline) {
+    auto [entry, inserted] = pipelines.emplace(key, pipeline);
+    if (!inserted) pipeline.release();
+    return entry->second;
+}
+
+void PipelineCache::onPipelineCreated(
+    WGPUCreatePipelineAsyncStatus status, WGPURenderPipeline pipeline,
+    WGPUStringView message, void* userdata1, [[maybe_unused]] void* userdata2
+) {
+    PendingPipeline* pending = reinterpret_cast<PendingPipeline*>(userdata1);
+    PipelineCache& cache = *pending->cache;
+    cache.pendingCount--;
+
+    if (status != WGPUCreatePipelineAsyncStatus_Success) {
+        std::cerr << "Could not create the render pipeline: " << toStringView(message) << std::endl;
+        pending->onReady(nullptr);
+    }
+    else {
+        pending->onReady(cache.insert(pending->key, pipeline));
+    }
+    delete pending;
+}
+
+#if defined(WEBGPU_BACKEND_DAWN)
+std::filesystem::path PipelineBlobStore::blobPath(const void* key, size_t keySize) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hashBytes(key, keySize)));
+    return directory / name;
+}
+
+size_t PipelineBlobStore::load(const void* key, size_t keySize, void* value, size_t valueSize) const {
+    if (directory.empty()) return 0;
+
+    std::ifstream file(blobPath(key, keySize), std::ios::binary);
+    if (!file.is_open()) return 0;
+
+    // Layout: key size, key, then the blob
+    uint64_t storedKeySize = 0;
+    file.read(reinterpret_cast<char*>(&storedKeySize), sizeof(storedKeySize));
+    if (!file || storedKeySize != keySize) return 0;
+    std::vector<char> storedKey(keySize);
+    file.read(storedKey.data(), static_cast<std::streamsize>(keySize));
+    if (!file || std::memcmp(storedKey.data(), key, keySize) != 0) return 0;
+
+    std::streamoff start = file.tellg();
+    file.seekg(0, std::ios::end);
+    size_t blobSize = static_cast<size_t>(file.tellg() - start);
+    if (value && valueSize >= blobSize) {
+        file.seekg(start);
+        file.read(static_cast<char*>(value), static_cast<std::streamsize>(blobSize));
+        if (!file) return 0;
+    }
+    return blobSize;
+}
+
+void PipelineBlobStore::store(const void* key, size_t keySize, const void* value, size_t valueSize) const {
+    if (directory.empty()) return;
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    std::filesystem::path path = blobPath(key, keySize);
+    // The backend may store from several threads
+    std::filesystem::path tempPath = path;
+    tempPath += "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return;
+        uint64_t storedKeySize = keySize;
+        file.write(reinterpret_cast<const char*>(&storedKeySize), sizeof(storedKeySize));
+        file.write(static_cast<const char*>(key), static_cast<std::streamsize>(keySize));
+        file.write(static_cast<const char*>(value), static_cast<std::streamsize>(valueSize));
+        if (!file) return;
+    }
+    std::filesystem::rename(tempPath, path, error);
+    if (error) std::filesystem::remove(tempPath, error);
+}
+#endif
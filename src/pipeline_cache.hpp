@@ -0,0 +1,131 @@
+#ifndef _PIPELINE_CACHE_H
+#define _PIPELINE_CACHE_H
+
+#include "shader_permutation.hpp"
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Shader modules and render pipelines built for each shader permutation,
+ * kept until terminate() so that switching back to a permutation costs
+ * nothing. Returned handles are owned by the cache.
+ */
+class PipelineCache {
+public:
+    // Receives the pipeline, or null when it could not be created
+    using PipelineCallback = std::function<void(wgpu::RenderPipeline pipeline)>;
+
+    struct Stats {
+        uint32_t moduleHits = 0;
+        uint32_t moduleMisses = 0;
+        uint32_t pipelineHits = 0;
+        uint32_t pipelineMisses = 0;
+    };
+
+public:
+    void initialize(wgpu::Device device);
+
+    // Wait for the pipelines still compiling and release everything
+    void terminate();
+
+    /**
+     * Module of the WGSL `source` preprocessed with the defines of
+     * `permutation`, compiled once per source and set of defines. Null if
+     * the source does not preprocess.
+     */
+    wgpu::ShaderModule shaderModule(const std::string& source, const ShaderPermutation& permutation);
+
+    /**
+     * Pipeline of `descriptor` with the constants of `permutation` set on
+     * its vertex and fragment stages. `stateKey` must identify the rest of
+     * the descriptor (layout, vertex buffers, formats, ...), the modules
+     * and entry points are part of the key already. `onReady` runs right
+     * away on a hit, otherwise once the pipeline is compiled in the
+     * background: by createRenderPipelineAsync where the backend has it,
+     * from the device's event processing, or on ThreadPool::shared() on
+     * wgpu-native, which does not implement it, from collect().
+     */
+    void renderPipeline(
+        const wgpu::RenderPipelineDescriptor& descriptor,
+        const ShaderPermutation& permutation,
+        uint64_t stateKey,
+        PipelineCallback onReady
+    );
+
+    /**
+     * Run the callbacks of the pipelines compiled on the thread pool since
+     * the last call, on the calling thread. Does nothing on backends that
+     * compile asynchronously themselves.
+     */
+    void collect();
+
+    size_t pipelineCount() const { return pipelines.size(); }
+
+    const Stats& stats() const { return statistics; }
+
+private:
+    struct PendingPipeline {
+        PipelineCache* cache;
+        uint64_t key;
+        PipelineCallback onReady;
+        // Compilation on the thread pool, on wgpu-native
+        std::future<WGPURenderPipeline> task;
+    };
+
+    // Keep `pipeline` under `key` unless another request stored one first
+    wgpu::RenderPipeline insert(uint64_t key, wgpu::RenderPipeline pipeline);
+
+    static void onPipelineCreated(
+        WGPUCreatePipelineAsyncStatus status, WGPURenderPipeline pipeline,
+        WGPUStringView message, void* userdata1, void* userdata2
+    );
+
+private:
+    wgpu::Device device;
+    std::unordered_map<uint64_t, wgpu::ShaderModule> modules;
+    std::unordered_map<uint64_t, wgpu::RenderPipeline> pipelines;
+    uint32_t pendingCount = 0;
+    // Compiling on the thread pool, waiting for collect()
+    std::vector<std::unique_ptr<PendingPipeline>> compiling;
+    Stats statistics;
+};
+
+#if defined(WEBGPU_BACKEND_DAWN)
+/**
+ * Directory of binary blobs keyed by byte strings, backing Dawn's own cache
+ * of compiled shaders and pipelines through DawnCacheDeviceDescriptor, so
+ * that warm launches skip the driver compilation. wgpu-native exposes no
+ * such cache. Each blob is a file named after the hash of its key, which it
+ * also stores to rule out collisions.
+ */
+class PipelineBlobStore {
+public:
+    void setDirectory(const std::filesystem::path& directory) { this->directory = directory; }
+
+    /**
+     * Size of the blob stored under `key`, zero if there is none. The blob
+     * is copied to `value` when `valueSize` is large enough.
+     */
+    size_t load(const void* key, size_t keySize, void* value, size_t valueSize) const;
+
+    void store(const void* key, size_t keySize, const void* value, size_t valueSize) const;
+
+private:
+    std::filesystem::path blobPath(const void* key, size_t keySize) const;
+
+private:
+    std::filesystem::path directory;
+};
+#endif
+
+#endif // _PIPELINE_CACHE_H
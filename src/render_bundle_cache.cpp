@@ -0,0 +1,68 @@
+#include "render_bundle_cache.hpp"
+#include "webgpu_utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+void RenderBundleCache::initialize(wgpu::Device device, wgpu::TextureFormat colorFormat, wgpu::TextureFormat depthFormat, size_t capacity) {
+    terminate();
+    this->device = device;
+    this->colorFormat = colorFormat;
+    this->depthFormat = depthFormat;
+    this->capacity = std::max<size_t>(capacity, 1);
+    statistics = Stats();
+}
+
+void RenderBundleCache::terminate() {
+    invalidate();
+}
+
+void RenderBundleCache::invalidate() {
+    for (Entry& entry : entries) {
+        if (entry.bundle) entry.bundle.release();
+    }
+    entries.clear();
+    nextEvicted = 0;
+}
+
+wgpu::RenderBundle RenderBundleCache::bundle(std::span<const uint32_t> dynamicOffsets, const Recorder& record) {
+    for (const Entry& entry : entries) {
+        if (std::equal(entry.dynamicOffsets.begin(), entry.dynamicOffsets.end(), dynamicOffsets.begin(), dynamicOffsets.end())) {
+            statistics.replayCount++;
+            return entry.bundle;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    wgpu::RenderBundleEncoderDescriptor encoderDesc;
+    encoderDesc.label = "Scene bundle encoder"_wgpu;
+    encoderDesc.colorFormatCount = 1;
+    encoderDesc.colorFormats = &colorFormat;
+    encoderDesc.depthStencilFormat = depthFormat;
+    encoderDesc.sampleCount = 1;
+    encoderDesc.depthReadOnly = false;
+    encoderDesc.stencilReadOnly = false;
+    wgpu::RenderBundleEncoder encoder = device.createRenderBundleEncoder(encoderDesc);
+    if (!encoder) return nullptr;
+    record(encoder);
+
+    wgpu::RenderBundleDescriptor bundleDesc;
+    bundleDesc.label = "Scene bundle"_wgpu;
+    wgpu::RenderBundle recorded = encoder.finish(bundleDesc);
+    encoder.release();
+    if (!recorded) return nullptr;
+    statistics.recordCount++;
+    statistics.replayCount++;
+    statistics.recordMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    Entry entry{ std::vector<uint32_t>(dynamicOffsets.begin(), dynamicOffsets.end()), recorded };
+    if (entries.size() < capacity) {
+        entries.push_back(std::move(entry));
+    }
+    else {
+        entries[nextEvicted].bundle.release();
+        entries[nextEvicted] = std::move(entry);
+        nextEvicted = (nextEvicted + 1) % capacity;
+    }
+    return recorded;
+}
@@ -0,0 +1,78 @@
+#ifndef _RENDER_BUNDLE_CACHE_H
+#define _RENDER_BUNDLE_CACHE_H
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+/**
+ * Draws recorded once into render bundles and replayed with
+ * executeBundles, so that a pass showing the same geometry frame after
+ * frame does not encode its draws again. The owner calls invalidate()
+ * whenever what the bundles draw, or the pipelines, bind groups and
+ * buffers they set, change.
+ *
+ * A bundle captures the dynamic offsets of its bind groups, and per-frame
+ * data comes at a different offset in each region of the upload ring, so
+ * bundles are kept per set of offsets, a few at most.
+ */
+class RenderBundleCache {
+public:
+    using Recorder = std::function<void(wgpu::RenderBundleEncoder encoder)>;
+
+    struct Stats {
+        // Bundles recorded, and bundles handed out for replay, recordings
+        // included, since initialize()
+        uint32_t recordCount = 0;
+        uint64_t replayCount = 0;
+        // CPU time of the last recording
+        double recordMilliseconds = 0.0;
+    };
+
+public:
+    /**
+     * Bundles are drawn into passes with a single `colorFormat` target and
+     * a `depthFormat` attachment, without multisampling. At most
+     * `capacity` of them are kept, one per set of dynamic offsets.
+     */
+    void initialize(wgpu::Device device, wgpu::TextureFormat colorFormat, wgpu::TextureFormat depthFormat, size_t capacity);
+
+    // Release every bundle
+    void terminate();
+
+    // Release every bundle, for the next bundle() to record anew
+    void invalidate();
+
+    /**
+     * The bundle recorded for `dynamicOffsets`, recording it with `record`
+     * if there is none. Null if it could not be recorded.
+     */
+    wgpu::RenderBundle bundle(std::span<const uint32_t> dynamicOffsets, const Recorder& record);
+
+    size_t bundleCount() const { return entries.size(); }
+
+    const Stats& stats() const { return statistics; }
+
+private:
+    struct Entry {
+        std::vector<uint32_t> dynamicOffsets;
+        wgpu::RenderBundle bundle;
+    };
+
+private:
+    wgpu::Device device;
+    WGPUTextureFormat colorFormat = WGPUTextureFormat_Undefined;
+    wgpu::TextureFormat depthFormat = wgpu::TextureFormat::Undefined;
+    size_t capacity = 1;
+
+    std::vector<Entry> entries;
+    // Entry replaced when all are taken
+    size_t nextEvicted = 0;
+    Stats statistics;
+};
+
+#endif // _RENDER_BUNDLE_CACHE_H
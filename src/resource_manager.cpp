@@ -1,13 +1,17 @@
 
 #include "resource_manager.hpp"
+#include "hash.hpp"
+#include "mesh_cache.hpp"
+#include "mesh_optimizer.hpp"
+#include "mipmap_generator.hpp"
+#include "obj_parser.hpp"
+#include "thread_pool.hpp"
 
 #include "stb_image.h"
-#include "tiny_obj_loader.h"
 
 #include <iostream>
 #include <fstream>
 #include <sstream>
-#include <bit>
 
 bool ResourceManager::loadGeometry(
     const std::filesystem::path& path,
@@ -72,89 +76,309 @@ bool ResourceManager::loadGeometry(
 
 bool ResourceManager::loadGeometryFromObj(
     const std::filesystem::path& path,
-    std::vector<VertexAttributes>& vertexData
+    Mesh& mesh,
+    const MeshOptimizerOptions& options
 ) {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
+    ObjGeometry obj;
+    if (!ObjParser::parse(path, obj, &ThreadPool::shared())) {
+        return false;
+    }
 
-    std::string warn;
-    std::string err;
+    size_t cornerCount = obj.corners.size();
+
+    // Fill in vertices and indices, merging identical corners
+    VertexWelder welder(mesh.vertices, mesh.indices, cornerCount);
+    VertexAttributes corner;
+    mesh.subMeshes = obj.shapes;
+    mesh.bounds = Bounds();
+    for (const ObjCorner& idx : obj.corners) {
+        corner.position = {
+            obj.positions[3 * idx.position + 0],
+            -obj.positions[3 * idx.position + 2],
+            obj.positions[3 * idx.position + 1]
+        };
+
+        corner.color = {
+            obj.colors[3 * idx.position + 0],
+            obj.colors[3 * idx.position + 1],
+            obj.colors[3 * idx.position + 2]
+        };
+
+        // Corners without a normal or uv get zeros
+        corner.normal = glm::vec3(0.0f);
+        if (idx.normal >= 0) {
+            corner.normal = {
+                obj.normals[3 * idx.normal + 0],
+                -obj.normals[3 * idx.normal + 2],
+                obj.normals[3 * idx.normal + 1]
+            };
+        }
 
-    bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.c_str());
+        corner.uv = glm::vec2(0.0f);
+        if (idx.texcoord >= 0) {
+            corner.uv = {
+                obj.texcoords[2 * idx.texcoord + 0],
+                1.0f - obj.texcoords[2 * idx.texcoord + 1]
+            };
+        }
 
-    if (!warn.empty()) {
-        std::cout << warn << std::endl;
+        welder.insert(corner);
+        mesh.bounds.extend(corner.position);
     }
 
-    if (!err.empty()) {
-        std::cerr << err << std::endl;
+#ifdef PRINT_EXTRA_INFO
+    if (!mesh.vertices.empty()) {
+        std::cout << "Welded " << cornerCount << " corners into " << mesh.vertices.size() << " vertices ("
+                  << static_cast<double>(cornerCount) / static_cast<double>(mesh.vertices.size())
+                  << "x reduction)" << std::endl;
     }
+#endif
 
-    if (!ret) {
-        return false;
-    }
+    MeshOptimizerReport report = MeshOptimizer::optimize(mesh, options);
+#ifdef PRINT_EXTRA_INFO
+    std::cout << "Vertex cache ACMR " << report.before.acmr << " -> " << report.after.acmr
+              << ", ATVR " << report.before.atvr << " -> " << report.after.atvr << std::endl;
+#else
+    (void)report;
+#endif
 
-    // Fill in vertexData here
-    vertexData.clear();
-    for (const auto& shape : shapes) {
-        size_t offset = vertexData.size();
-        vertexData.resize(offset + shape.mesh.indices.size());
-        for (size_t i = 0; i < shape.mesh.indices.size(); i++) {
-            const tinyobj::index_t& idx = shape.mesh.indices[i];
-
-            vertexData[offset + i].position = {
-                attrib.vertices[3 * idx.vertex_index + 0],
-                -attrib.vertices[3 * idx.vertex_index + 2],
-                attrib.vertices[3 * idx.vertex_index + 1]
-            };
+    return true;
+}
 
-            vertexData[offset + i].normal = {
-                attrib.normals[3 * idx.normal_index + 0],
-                -attrib.normals[3 * idx.normal_index + 2],
-                attrib.normals[3 * idx.normal_index + 1]
-            };
+bool ResourceManager::loadMesh(
+    const std::filesystem::path& path,
+    Mesh& mesh,
+    MappedFile& cacheFile,
+    MeshView& view,
+    const MeshOptimizerOptions& options
+) {
+    uint64_t buildKey = options.key();
+    if (MeshCache::open(path, cacheFile, view, buildKey)) {
+#ifdef PRINT_EXTRA_INFO
+        std::cout << "Loaded mesh cache " << MeshCache::cachePath(path) << std::endl;
+#endif
+        return true;
+    }
 
-            vertexData[offset + i].color = {
-                attrib.colors[3 * idx.vertex_index + 0],
-                attrib.colors[3 * idx.vertex_index + 1],
-                attrib.colors[3 * idx.vertex_index + 2]
-            };
+    if (!loadGeometryFromObj(path, mesh, options)) return false;
+    view = MeshView(mesh);
 
-            vertexData[offset + i].uv = {
-                attrib.texcoords[2 * idx.texcoord_index + 0],
-                1.0f - attrib.texcoords[2 * idx.texcoord_index + 1]
-            };
-        }
+    if (!MeshCache::write(path, view, buildKey)) {
+        std::cerr << "Could not write mesh cache at: " << MeshCache::cachePath(path) << std::endl;
     }
-
     return true;
 }
 
+void DecodedTexture::PixelDeleter::operator()(unsigned char* pixels) const {
+    stbi_image_free(pixels);
+}
+
 wgpu::Texture ResourceManager::loadTexture(
     const std::filesystem::path& path,
     wgpu::Device device,
-    wgpu::TextureView* pTextureView
+    wgpu::TextureView* pTextureView,
+    MipFilter mipFilter,
+    MipMapGenerator* mipMapGenerator
+) {
+    DecodedTexture decoded;
+    if (!decodeTexture(path, decoded, mipMapGenerator == nullptr, mipFilter)) return nullptr;
+    return createTexture(decoded, device, pTextureView, mipFilter, mipMapGenerator);
+}
+
+bool ResourceManager::decodeTexture(
+    const std::filesystem::path& path,
+    DecodedTexture& texture,
+    bool buildMipChain,
+    MipFilter mipFilter
 ) {
     int width, height, channels;
-    unsigned char* pixelData = stbi_load(path.string().c_str(), &width, &height, &channels, 4 /* force 4 channels */);
-    if (nullptr == pixelData) return nullptr;
+    texture.pixels.reset(stbi_load(path.string().c_str(), &width, &height, &channels, 4 /* force 4 channels */));
+    if (nullptr == texture.pixels) return false;
+
+    texture.width = static_cast<uint32_t>(width);
+    texture.height = static_cast<uint32_t>(height);
+    texture.mipChain = {};
+    if (buildMipChain) {
+        uint32_t mipLevelCount = MipChainBuilder::levelCount(texture.width, texture.height);
+        MipChainBuilder::build(texture.pixels.get(), texture.width, texture.height, mipLevelCount, mipFilter, texture.mipChain);
+    }
+    return true;
+}
+
+wgpu::Texture ResourceManager::createTexture(
+    const DecodedTexture& decoded,
+    wgpu::Device device,
+    wgpu::TextureView* pTextureView,
+    MipFilter mipFilter,
+    MipMapGenerator* mipMapGenerator
+) {
+    if (nullptr == decoded.pixels) return nullptr;
+
+    // A chain built ahead of time wins over the GPU path
+    bool generateOnGpu = mipMapGenerator && decoded.mipChain.levels.empty();
 
     wgpu::TextureDescriptor desc;
     desc.dimension = wgpu::TextureDimension::_2D;
     desc.format = wgpu::TextureFormat::RGBA8Unorm;
     desc.sampleCount = 1;
-    desc.size = { (unsigned int)width, (unsigned int)height, 1 };
-    desc.mipLevelCount = std::bit_width(std::max(desc.size.width, desc.size.height));
-    desc.usage = wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopyDst;
+    desc.size = { decoded.width, decoded.height, 1 };
+    desc.mipLevelCount = MipChainBuilder::levelCount(desc.size.width, desc.size.height);
+    desc.usage = generateOnGpu
+        ? wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopyDst | wgpu::TextureUsage::StorageBinding
+        : wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopyDst;
     desc.viewFormatCount = 0;
     desc.viewFormats = nullptr;
     wgpu::Texture texture = device.createTexture(desc);
 
     // Upload data to the GPU texture 
-    writeMipMaps(device, texture, desc.size, desc.mipLevelCount, pixelData);
+    if (generateOnGpu) {
+        writeBaseLevel(device, texture, desc.size, decoded.pixels.get());
+        mipMapGenerator->generate(texture, desc.size, desc.mipLevelCount, mipFilter);
+    }
+    else if (decoded.mipChain.levels.empty()) {
+        MipChain chain;
+        MipChainBuilder::build(decoded.pixels.get(), desc.size.width, desc.size.height, desc.mipLevelCount, mipFilter, chain);
+        writeMipChain(device, texture, chain);
+    }
+    else {
+        writeMipChain(device, texture, decoded.mipChain);
+    }
+
+    if (pTextureView) {
+        wgpu::TextureViewDescriptor textureViewDesc;
+        textureViewDesc.aspect = wgpu::TextureAspect::All;
+        textureViewDesc.baseArrayLayer = 0;
+        textureViewDesc.arrayLayerCount = 1;
+        textureViewDesc.baseMipLevel = 0;
+        textureViewDesc.mipLevelCount = desc.mipLevelCount;
+        textureViewDesc.dimension = wgpu::TextureViewDimension::_2D;
+        textureViewDesc.format = desc.format;
+        *pTextureView = texture.createView(textureViewDesc);
+    }
+
+    return texture;
+}
+
+namespace {
+
+// Identifies the settings a compressed texture cache was built with
+uint64_t compressionKey(bool highQuality, MipFilter mipFilter) {
+    uint32_t fields[2] = { highQuality ? 1u : 0u, static_cast<uint32_t>(mipFilter) };
+    return hashBytes(fields, sizeof(fields));
+}
+
+} // namespace
+
+bool ResourceManager::loadCompressedTexture(
+    const std::filesystem::path& path,
+    CompressedTexture& texture,
+    bool highQuality,
+    MipFilter mipFilter
+) {
+    // Only the header is read to check the size
+    int width, height, channels;
+    if (!stbi_info(path.string().c_str(), &width, &height, &channels)) return false;
+    if (width % BlockCompressor::blockSize != 0 || height % BlockCompressor::blockSize != 0) return false;
+
+    uint64_t buildKey = compressionKey(highQuality, mipFilter);
+    if (TextureCache::open(path, texture, buildKey)) {
+#ifdef PRINT_EXTRA_INFO
+        std::cout << "Loaded texture cache " << TextureCache::cachePath(path) << std::endl;
+#endif
+        return true;
+    }
+
+    DecodedTexture decoded;
+    if (!decodeTexture(path, decoded, true, mipFilter)) return false;
+
+    // BC1 has no alpha worth the name
+    bool opaque = BlockCompressor::isOpaque(decoded.pixels.get(), decoded.width, decoded.height);
+    compressTexture(decoded, opaque && !highQuality ? BlockFormat::BC1 : BlockFormat::BC7, texture);
+
+    if (!TextureCache::write(path, texture, buildKey)) {
+        std::cerr << "Could not write texture cache at: " << TextureCache::cachePath(path) << std::endl;
+    }
+    return true;
+}
+
+void ResourceManager::compressTexture(
+    const DecodedTexture& decoded,
+    BlockFormat format,
+    CompressedTexture& texture
+) {
+    MipChain builtChain;
+    const MipChain* chain = &decoded.mipChain;
+    if (chain->levels.empty()) {
+        uint32_t mipLevelCount = MipChainBuilder::levelCount(decoded.width, decoded.height);
+        MipChainBuilder::build(decoded.pixels.get(), decoded.width, decoded.height, mipLevelCount, MipFilter::Box, builtChain);
+        chain = &builtChain;
+    }
 
-    stbi_image_free(pixelData);
+    texture.format = format;
+    texture.file.close();
+    texture.levels.clear();
+    size_t offset = 0;
+    for (const MipLevel& mip : chain->levels) {
+        size_t size = BlockCompressor::compressedSize(mip.width, mip.height, format);
+        texture.levels.push_back({ mip.width, mip.height, offset, size });
+        offset += size;
+    }
+
+    texture.storage.resize(offset);
+    for (uint32_t level = 0; level < texture.levels.size(); level++) {
+        const CompressedLevel& compressed = texture.levels[level];
+        BlockCompressor::compress(
+            chain->levelData(level), compressed.width, compressed.height, format,
+            texture.storage.data() + compressed.offset
+        );
+    }
+}
+
+wgpu::Texture ResourceManager::createCompressedTexture(
+    const CompressedTexture& compressed,
+    wgpu::Device device,
+    wgpu::TextureView* pTextureView
+) {
+    if (compressed.levels.empty()) return nullptr;
+
+    wgpu::TextureDescriptor desc;
+    desc.dimension = wgpu::TextureDimension::_2D;
+    desc.format = compressed.format == BlockFormat::BC1
+        ? wgpu::TextureFormat::BC1RGBAUnorm
+        : wgpu::TextureFormat::BC7RGBAUnorm;
+    desc.sampleCount = 1;
+    desc.size = { compressed.levels[0].width, compressed.levels[0].height, 1 };
+    desc.mipLevelCount = static_cast<uint32_t>(compressed.levels.size());
+    desc.usage = wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopyDst;
+    desc.viewFormatCount = 0;
+    desc.viewFormats = nullptr;
+    wgpu::Texture texture = device.createTexture(desc);
+
+    wgpu::Queue queue = device.getQueue();
+
+    wgpu::TexelCopyTextureInfo destination;
+    destination.texture = texture;
+    destination.origin = { 0, 0, 0 };
+    destination.aspect = wgpu::TextureAspect::All;
+
+    wgpu::TexelCopyBufferLayout source;
+    source.offset = 0;
+
+    // Copies cover whole blocks, also on levels smaller than a block
+    uint32_t blockBytes = BlockCompressor::blockBytes(compressed.format);
+    for (uint32_t level = 0; level < compressed.levels.size(); level++) {
+        const CompressedLevel& mip = compressed.levels[level];
+        uint32_t blocksX = (mip.width + BlockCompressor::blockSize - 1) / BlockCompressor::blockSize;
+        uint32_t blocksY = (mip.height + BlockCompressor::blockSize - 1) / BlockCompressor::blockSize;
+
+        destination.mipLevel = level;
+        source.bytesPerRow = blocksX * blockBytes;
+        source.rowsPerImage = blocksY;
+        wgpu::Extent3D extent = { blocksX * BlockCompressor::blockSize, blocksY * BlockCompressor::blockSize, 1 };
+        queue.writeTexture(destination, compressed.levelData(level), mip.size, source, extent);
+    }
+
+    queue.release();
 
     if (pTextureView) {
         wgpu::TextureViewDescriptor textureViewDesc;
@@ -180,22 +404,26 @@ wgpu::ShaderModule ResourceManager::loadShaderModule(
         std::cerr << "Could not load shader file at: " << path << std::endl;
         return nullptr;
     }
+    return createShaderModule(shaderSource, device);
+}
 
+wgpu::ShaderModule ResourceManager::createShaderModule(
+    const std::string& source,
+    wgpu::Device device
+) {
     wgpu::ShaderModuleDescriptor desc;
     wgpu::ShaderSourceWGSL shaderSrc;
     shaderSrc.chain.next = nullptr;
     shaderSrc.chain.sType = wgpu::SType::ShaderSourceWGSL;
-    shaderSrc.code = wgpu::StringView(shaderSource.c_str());
+    shaderSrc.code = wgpu::StringView(source.c_str());
     desc.nextInChain = &shaderSrc.chain;
     return device.createShaderModule(desc);
 }
 
-void ResourceManager::writeMipMaps(
+void ResourceManager::writeMipChain(
     wgpu::Device device,
     wgpu::Texture texture,
-    wgpu::Extent3D textureSize,
-    [[maybe_unused]] uint32_t mipLevelCount, // not used yet
-    const unsigned char* pixelData)
+    const MipChain& chain)
 {
     // Get device queue
     wgpu::Queue queue = device.getQueue();
@@ -208,52 +436,51 @@ void ResourceManager::writeMipMaps(
     wgpu::TexelCopyBufferLayout source;
     source.offset = 0;
 
-    // Create image data
-    wgpu::Extent3D mipLevelSize = textureSize;
-    std::vector<unsigned char> previousLevelPixels;
-    wgpu::Extent3D previousMipLevelSize;
-    for (uint32_t level = 0; level < mipLevelCount; level++) {
-        // Pixel data for the current level
-        std::vector<unsigned char> pixels(4 * mipLevelSize.width * mipLevelSize.height);
-        if (level == 0) {
-            // We cannot really avoid this copy since we need this
-            // in previousLevelPixels at the next iteration
-            memcpy(pixels.data(), pixelData, pixels.size());
-        }
-        else {
-            // Create mip level data
-            for (uint32_t i = 0; i < mipLevelSize.width; ++i) {
-                for (uint32_t j = 0; j < mipLevelSize.height; ++j) {
-                    unsigned char* p = &pixels[4 * (j * mipLevelSize.width + i)];
-                    // Get the corresponding 4 pixels from the previous level
-                    unsigned char* p00 = &previousLevelPixels[4 * ((2 * j + 0) * previousMipLevelSize.width + (2 * i + 0))];
-                    unsigned char* p01 = &previousLevelPixels[4 * ((2 * j + 0) * previousMipLevelSize.width + (2 * i + 1))];
-                    unsigned char* p10 = &previousLevelPixels[4 * ((2 * j + 1) * previousMipLevelSize.width + (2 * i + 0))];
-                    unsigned char* p11 = &previousLevelPixels[4 * ((2 * j + 1) * previousMipLevelSize.width + (2 * i + 1))];
-                    // Average
-                    p[0] = (p00[0] + p01[0] + p10[0] + p11[0]) / 4;
-                    p[1] = (p00[1] + p01[1] + p10[1] + p11[1]) / 4;
-                    p[2] = (p00[2] + p01[2] + p10[2] + p11[2]) / 4;
-                    p[3] = (p00[3] + p01[3] + p10[3] + p11[3]) / 4;
-                }
-            }
+    for (uint32_t level = 0; level < chain.levels.size(); level++) {
+        const MipLevel& mip = chain.levels[level];
+
+#ifdef PRINT_EXTRA_INFO
+        if (level > 0) {
+            std::cout << "Mip level " << level << " (" << mip.width << "x" << mip.height << ") built in "
+                      << mip.buildTimeMs << " ms" << std::endl;
         }
+#endif
 
         // Upload data to the GPU texture
         destination.mipLevel = level;
-        source.bytesPerRow = 4 * mipLevelSize.width;
-        source.rowsPerImage = mipLevelSize.height;
-        queue.writeTexture(destination, pixels.data(), pixels.size(), source, mipLevelSize);
-
-        previousLevelPixels = std::move(pixels);
-        previousMipLevelSize = mipLevelSize;
-        mipLevelSize.width /= 2;
-        mipLevelSize.height /= 2;
+        source.bytesPerRow = 4 * mip.width;
+        source.rowsPerImage = mip.height;
+        queue.writeTexture(destination, chain.levelData(level), chain.levelSize(level), source, { mip.width, mip.height, 1 });
     }
 
     queue.release();
 }
 
+void ResourceManager::writeBaseLevel(
+    wgpu::Device device,
+    wgpu::Texture texture,
+    wgpu::Extent3D textureSize,
+    const unsigned char* pixelData)
+{
+    wgpu::Queue queue = device.getQueue();
+
+    wgpu::TexelCopyTextureInfo destination;
+    destination.texture = texture;
+    destination.mipLevel = 0;
+    destination.origin = { 0, 0, 0 };
+    destination.aspect = wgpu::TextureAspect::All;
+
+    wgpu::TexelCopyBufferLayout source;
+    source.offset = 0;
+    source.bytesPerRow = 4 * textureSize.width;
+    source.rowsPerImage = textureSize.height;
+
+    size_t size = 4 * static_cast<size_t>(textureSize.width) * textureSize.height;
+    queue.writeTexture(destination, pixelData, size, source, textureSize);
+
+    queue.release();
+}
+
 bool ResourceManager::readShaderFile(
     const std::filesystem::path& path,
     std::string& contents
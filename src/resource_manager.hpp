@@ -2,17 +2,36 @@
 #define _RESOURCE_MANAGER_H
 
 
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+#include "mesh_optimizer.hpp"
+#include "mip_chain.hpp"
+#include "texture_cache.hpp"
+
 #include <webgpu/webgpu.hpp>
 #include <glm/glm.hpp>
 
 #include <filesystem>
+#include <memory>
+#include <string>
 #include <vector>
 
-struct VertexAttributes {
-    glm::vec3 position;
-    glm::vec3 normal;
-    glm::vec3 color;
-    glm::vec2 uv;
+class MipMapGenerator;
+
+/**
+ * The CPU half of loading a texture, which needs no device: the decoded
+ * RGBA8 pixels and, unless the GPU builds it, their mip chain
+ */
+struct DecodedTexture {
+    struct PixelDeleter {
+        void operator()(unsigned char* pixels) const;
+    };
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    std::unique_ptr<unsigned char, PixelDeleter> pixels;
+    // Empty when the chain is left to the GPU
+    MipChain mipChain;
 };
 
 class ResourceManager {
@@ -29,34 +48,110 @@ public:
     );
 
     /**
-     * Load an OBJ file from `path` and populate the std::vector<VertexAttributes>
+     * Load an OBJ file from `path`, merge identical vertices and populate
+     * the vertices, triangle list indices, per-shape sub-meshes and bounds
+     * of `mesh`. Triangles and vertices are then reordered with `options`.
      */
     static bool loadGeometryFromObj(
         const std::filesystem::path& path,
-        std::vector<VertexAttributes>& vertexData
+        Mesh& mesh,
+        const MeshOptimizerOptions& options = {}
+    );
+
+    /**
+     * Load a mesh through its binary cache. If the cache of `path` is valid
+     * it is mapped into `cacheFile`, otherwise the OBJ is parsed into `mesh`
+     * and the cache is rewritten. Either way `view` points at the data to
+     * upload and stays valid as long as `mesh` and `cacheFile` live.
+     * Caches built with other `options` are rebuilt.
+     */
+    static bool loadMesh(
+        const std::filesystem::path& path,
+        Mesh& mesh,
+        MappedFile& cacheFile,
+        MeshView& view,
+        const MeshOptimizerOptions& options = {}
     );
 
     /**
-     * Load an image file into a wgpu::Texture
+     * Load an image file into a wgpu::Texture, `mipFilter` selects how the
+     * mip chain is downsampled. When `mipMapGenerator` is given only level 0
+     * is uploaded and the rest of the chain is built on the GPU.
      */
     static wgpu::Texture loadTexture(
         const std::filesystem::path& path, 
         wgpu::Device device,
-        wgpu::TextureView* pTextureView = nullptr
+        wgpu::TextureView* pTextureView = nullptr,
+        MipFilter mipFilter = MipFilter::Box,
+        MipMapGenerator* mipMapGenerator = nullptr
+    );
+
+    /**
+     * Decode the image at `path`, and build its mip chain with `mipFilter`
+     * if `buildMipChain` is set. Safe to run on any thread.
+     */
+    static bool decodeTexture(
+        const std::filesystem::path& path,
+        DecodedTexture& texture,
+        bool buildMipChain,
+        MipFilter mipFilter = MipFilter::Box
+    );
+
+    /**
+     * Create and fill the texture of `decoded`, as loadTexture() does. A
+     * missing mip chain is built on the GPU by `mipMapGenerator` if given,
+     * otherwise on the CPU.
+     */
+    static wgpu::Texture createTexture(
+        const DecodedTexture& decoded,
+        wgpu::Device device,
+        wgpu::TextureView* pTextureView = nullptr,
+        MipFilter mipFilter = MipFilter::Box,
+        MipMapGenerator* mipMapGenerator = nullptr
+    );
+
+    /**
+     * Load the block compressed mip chain of the image at `path` from its
+     * KTX2 cache, or decode, compress and cache it. Opaque images use BC1
+     * unless `highQuality` is set, the others BC7. Returns false for images
+     * whose size is not a multiple of the block size, which WebGPU cannot
+     * sample compressed. Safe to run on any thread.
+     */
+    static bool loadCompressedTexture(
+        const std::filesystem::path& path,
+        CompressedTexture& texture,
+        bool highQuality,
+        MipFilter mipFilter = MipFilter::Box
+    );
+
+    /**
+     * Compress every level of the mip chain of `decoded`
+     */
+    static void compressTexture(
+        const DecodedTexture& decoded,
+        BlockFormat format,
+        CompressedTexture& texture
     );
 
+    /**
+     * Create and fill a texture from a compressed chain. The device must
+     * have the TextureCompressionBC feature.
+     */
+    static wgpu::Texture createCompressedTexture(
+        const CompressedTexture& compressed,
+        wgpu::Device device,
+        wgpu::TextureView* pTextureView = nullptr
+    );
 
     static wgpu::ShaderModule loadShaderModule(
         const std::filesystem::path& path,
         wgpu::Device device
     );
 
-private:
-
-    static void writeMipMaps(
-        wgpu::Device device, wgpu::Texture texture, 
-        wgpu::Extent3D textureSize, uint32_t mipLevelCount,
-        const unsigned char* pixelData
+    // Create a WGSL shader module from source already read
+    static wgpu::ShaderModule createShaderModule(
+        const std::string& source,
+        wgpu::Device device
     );
 
     /**
@@ -67,6 +162,23 @@ private:
         std::string& contents
     );
 
+private:
+
+    /**
+     * Upload every level of a mip chain built on the CPU
+     */
+    static void writeMipChain(
+        wgpu::Device device, wgpu::Texture texture, const MipChain& chain
+    );
+
+    /**
+     * Upload only level 0 of an RGBA8 image
+     */
+    static void writeBaseLevel(
+        wgpu::Device device, wgpu::Texture texture,
+        wgpu::Extent3D textureSize, const unsigned char* pixelData
+    );
+
 };
 
 #endif
\ No newline at end of file
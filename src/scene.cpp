@@ -0,0 +1,35 @@
+// Must match app.hpp, before anything pulls in glm
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_FORCE_LEFT_HANDED
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include "scene.hpp"
+#include "config.hpp"
+
+#include <cmath>
+
+glm::vec3 Scene::cameraWorldPosition(const CameraState& camera) {
+    float cx = glm::cos(camera.angles.x);
+    float cy = glm::cos(camera.angles.y);
+    float sx = glm::sin(camera.angles.x);
+    float sy = glm::sin(camera.angles.y);
+    return glm::vec3(cx * cy, sx * cy, sy) * std::exp(-camera.zoom);
+}
+
+glm::mat4x4 Scene::viewMatrix(const CameraState& camera) {
+    return glm::lookAt(cameraWorldPosition(camera), glm::vec3(0.0f), glm::vec3(0, 0, 1));
+}
+
+glm::mat4x4 Scene::projectionMatrix(float aspectRatio) {
+    return glm::perspective(45 * PI / 180, aspectRatio, 0.01f, 100.0f);
+}
+
+SceneLights Scene::defaultLights() {
+    SceneLights lights;
+    lights.directions[0] = { 0.5f, -0.9f, 0.1f, 0.0f };
+    lights.directions[1] = { 0.2f, 0.4f, 0.3f, 0.0f };
+    lights.colors[0] = { 1.0f, 0.9f, 0.6f, 1.0f };
+    lights.colors[1] = { 0.6f, 0.9f, 1.0f, 1.0f };
+    return lights;
+}
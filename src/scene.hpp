@@ -0,0 +1,46 @@
+#ifndef _SCENE_H
+#define _SCENE_H
+
+#include <glm/glm.hpp>
+
+#include <array>
+
+/**
+ * Orbit camera around the origin
+ */
+struct CameraState {
+    glm::vec2 angles = { 0.8f, 0.5f };
+    float zoom = -1.2f;
+};
+
+/**
+ * Two directional lights, the layout of the shaders' LightingUniforms
+ */
+struct SceneLights {
+    std::array<glm::vec4, 2> directions;
+    std::array<glm::vec4, 2> colors;
+};
+static_assert(sizeof(SceneLights) % 16 == 0);
+
+/**
+ * Camera and lighting setup shared by the renderers, so that the raster, GPU
+ * path traced and CPU reference images show the same view
+ */
+class Scene {
+public:
+    static glm::vec3 cameraWorldPosition(const CameraState& camera);
+
+    static glm::mat4x4 viewMatrix(const CameraState& camera);
+
+    /**
+     * Left handed projection with depth in [0, 1], as WebGPU expects
+     */
+    static glm::mat4x4 projectionMatrix(float aspectRatio);
+
+    // Aspect ratio the app window is rendered with
+    static constexpr float defaultAspectRatio = 640.0f / 480.0f;
+
+    static SceneLights defaultLights();
+};
+
+#endif // _SCENE_H
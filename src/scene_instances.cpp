@@ -0,0 +1,346 @@
+#include "scene_instances.hpp"
+#include "webgpu_utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+
+// Dirty slots at most this far apart are written together, trading a few
+// unchanged matrices for fewer writeBuffer calls
+constexpr uint32_t dirtyRunGap = 8;
+
+// Longest of the axes `transform` maps the unit ones to
+float maxScale(const glm::mat4x4& transform) {
+    return std::sqrt(std::max(
+        glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+        std::max(glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])), glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2])))
+    ));
+}
+
+} // namespace
+
+bool SceneInstances::initialize(wgpu::Device device, uint32_t capacity) {
+    this->device = device;
+    this->capacity = std::max(capacity, 1u);
+
+    wgpu::BufferDescriptor bufferDesc;
+    bufferDesc.label = "Instance transforms"_wgpu;
+    bufferDesc.size = bindingSize();
+    bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::Storage;
+    bufferDesc.mappedAtCreation = false;
+    instanceBuffer = device.createBuffer(bufferDesc);
+    return instanceBuffer != nullptr;
+}
+
+void SceneInstances::terminate() {
+    if (instanceBuffer) instanceBuffer.release();
+    instanceBuffer = nullptr;
+}
+
+uint32_t SceneInstances::addMesh(
+    const MeshRange& range, const Bounds& bounds,
+    std::span<const MeshChunk> chunks, std::span<const MeshLod> lods
+) {
+    MeshEntry entry;
+    entry.range = range;
+    entry.bounds = bounds;
+    entry.lods.push_back(range);
+    entry.lodErrors.push_back(0.0f);
+    for (size_t level = 1; level < std::min(lods.size(), maxLodCount); level++) {
+        entry.lods.push_back({ lods[level].firstIndex, lods[level].indexCount, range.baseVertex });
+        entry.lodErrors.push_back(lods[level].error);
+    }
+    if (chunks.empty()) {
+        entry.chunks.push_back(range);
+        entry.chunkBoxes.push_back(bounds);
+        entry.chunkBounds.resize(1);
+        entry.chunkBounds.set(0, bounds);
+    }
+    else {
+        entry.chunkBounds.resize(chunks.size());
+        for (size_t i = 0; i < chunks.size(); i++) {
+            entry.chunks.push_back({ chunks[i].firstIndex, chunks[i].indexCount, range.baseVertex });
+            entry.chunkBoxes.push_back(chunks[i].bounds);
+            entry.chunkBounds.set(i, chunks[i].bounds);
+        }
+    }
+    meshes.push_back(std::move(entry));
+    return static_cast<uint32_t>(meshes.size() - 1);
+}
+
+SceneInstances::ObjectId SceneInstances::addObject(uint32_t mesh, const glm::mat4x4& transform) {
+    ObjectId id;
+    if (!freeObjects.empty()) {
+        id = freeObjects.back();
+        freeObjects.pop_back();
+    }
+    else {
+        id = static_cast<ObjectId>(objects.size());
+        objects.emplace_back();
+    }
+
+    MeshEntry& entry = meshes[mesh];
+    objects[id] = { transform, mesh, static_cast<uint32_t>(entry.objects.size()), 0, true };
+    entry.objects.push_back(id);
+    liveObjectCount++;
+    layoutChanged = true;
+    return id;
+}
+
+void SceneInstances::removeObject(ObjectId object) {
+    Object& removed = objects[object];
+    if (!removed.alive) return;
+
+    // Swap with the last object of the mesh, order within a mesh is free
+    std::vector<ObjectId>& meshObjects = meshes[removed.mesh].objects;
+    ObjectId last = meshObjects.back();
+    meshObjects[removed.meshIndex] = last;
+    objects[last].meshIndex = removed.meshIndex;
+    meshObjects.pop_back();
+
+    removed.alive = false;
+    freeObjects.push_back(object);
+    liveObjectCount--;
+    layoutChanged = true;
+}
+
+void SceneInstances::clearObjects() {
+    for (MeshEntry& entry : meshes) {
+        entry.objects.clear();
+    }
+    objects.clear();
+    freeObjects.clear();
+    liveObjectCount = 0;
+    layoutChanged = true;
+}
+
+void SceneInstances::setTransform(ObjectId object, const glm::mat4x4& transform) {
+    Object& target = objects[object];
+    // Its slot may belong to another object by now
+    if (!target.alive) return;
+    target.transform = transform;
+
+    // A pending layout rewrites every slot anyway
+    if (layoutChanged) return;
+    transforms[target.slot] = transform;
+    objectBounds.set(target.slot, meshes[target.mesh].bounds, transform);
+    slotScales[target.slot] = maxScale(transform);
+    if (!slotDirty[target.slot]) {
+        slotDirty[target.slot] = 1;
+        dirtySlots.push_back(target.slot);
+    }
+}
+
+bool SceneInstances::upload(wgpu::Queue queue) {
+    uploadedBytes = 0;
+    bool recreated = false;
+
+    if (layoutChanged) {
+        layout();
+        layoutChanged = false;
+        dirtySlots.clear();
+
+        if (transforms.size() > capacity) {
+            // Grow geometrically so that adding objects one at a time does
+            // not recreate the buffer every frame
+            capacity = std::max(static_cast<uint32_t>(transforms.size()), 2 * capacity);
+            terminate();
+            initialize(device, capacity);
+            recreated = true;
+        }
+        if (!transforms.empty()) {
+            uploadedBytes = transforms.size() * sizeof(glm::mat4x4);
+            queue.writeBuffer(instanceBuffer, 0, transforms.data(), uploadedBytes);
+        }
+        return recreated;
+    }
+
+    if (dirtySlots.empty()) return false;
+
+    std::sort(dirtySlots.begin(), dirtySlots.end());
+    size_t begin = 0;
+    while (begin < dirtySlots.size()) {
+        size_t end = begin + 1;
+        while (end < dirtySlots.size() && dirtySlots[end] - dirtySlots[end - 1] <= dirtyRunGap) end++;
+
+        uint32_t firstSlot = dirtySlots[begin];
+        uint64_t size = static_cast<uint64_t>(dirtySlots[end - 1] - firstSlot + 1) * sizeof(glm::mat4x4);
+        queue.writeBuffer(instanceBuffer, firstSlot * sizeof(glm::mat4x4), &transforms[firstSlot], size);
+        uploadedBytes += size;
+        begin = end;
+    }
+
+    for (uint32_t slot : dirtySlots) {
+        slotDirty[slot] = 0;
+    }
+    dirtySlots.clear();
+    return false;
+}
+
+void SceneInstances::cull(const glm::mat4x4& viewProjection, const LodView& lodView) {
+    auto start = std::chrono::steady_clock::now();
+    std::swap(drawList, previousDrawList);
+    drawList.clear();
+    stats = CullingStats();
+
+    uint64_t chunkCount = 0;
+    for (const MeshEntry& entry : meshes) {
+        chunkCount += entry.objects.size() * entry.chunks.size();
+    }
+
+    Frustum frustum = Frustum::fromMatrix(viewProjection);
+    if (!cullingEnabled) {
+        insideSlots.resize(transforms.size());
+        for (uint32_t slot = 0; slot < insideSlots.size(); slot++) {
+            insideSlots[slot] = slot;
+        }
+        intersectingSlots.clear();
+    }
+    else {
+        FrustumCuller::classify(frustum, objectBounds, insideSlots, intersectingSlots);
+    }
+
+    // Objects entirely inside draw whole, runs of consecutive slots of the
+    // same mesh and level of detail in a single instanced draw unless
+    // instancing is off
+    slotLods.resize(insideSlots.size());
+    for (size_t i = 0; i < insideSlots.size(); i++) {
+        slotLods[i] = selectLod(insideSlots[i], lodView);
+    }
+    size_t run = 0;
+    while (run < insideSlots.size()) {
+        uint32_t first = insideSlots[run];
+        uint32_t mesh = slotMeshes[first];
+        uint32_t lod = slotLods[run];
+        size_t end = run + 1;
+        while (instancingEnabled && end < insideSlots.size() && insideSlots[end] == insideSlots[end - 1] + 1
+            && slotMeshes[insideSlots[end]] == mesh && slotLods[end] == lod) {
+            end++;
+        }
+        addDraw(mesh, lod, first, first + static_cast<uint32_t>(end - run));
+        stats.visibleObjects += static_cast<uint32_t>(end - run);
+        stats.visibleChunks += static_cast<uint32_t>((end - run) * meshes[mesh].chunks.size());
+        stats.lodObjects[lod] += static_cast<uint32_t>(end - run);
+        run = end;
+    }
+
+    // Objects crossing the frustum draw their visible chunks, merging those
+    // that follow each other in the index buffer. Coarser levels are not
+    // chunked and draw whole.
+    for (uint32_t slot : intersectingSlots) {
+        const MeshEntry& entry = meshes[slotMeshes[slot]];
+        if (entry.range.indexCount == 0) continue;
+        uint32_t lod = selectLod(slot, lodView);
+        if (lod > 0) {
+            drawList.push_back({ entry.lods[lod], 1, slot });
+            stats.visibleObjects++;
+            stats.visibleChunks += static_cast<uint32_t>(entry.chunks.size());
+            stats.lodObjects[lod]++;
+            continue;
+        }
+
+        FrustumCuller::cull(frustum.transformed(transforms[slot]), entry.chunkBounds, visibleChunks);
+        if (visibleChunks.empty()) continue;
+        stats.visibleObjects++;
+        stats.visibleChunks += static_cast<uint32_t>(visibleChunks.size());
+        stats.lodObjects[0]++;
+
+        size_t chunk = 0;
+        while (chunk < visibleChunks.size()) {
+            MeshRange range = entry.chunks[visibleChunks[chunk]];
+            chunk++;
+            while (chunk < visibleChunks.size() && entry.chunks[visibleChunks[chunk]].firstIndex == range.firstIndex + range.indexCount) {
+                range.indexCount += entry.chunks[visibleChunks[chunk]].indexCount;
+                chunk++;
+            }
+            drawList.push_back({ range, 1, slot });
+        }
+    }
+
+    for (const DrawRange& draw : drawList) {
+        stats.triangles += static_cast<uint64_t>(draw.range.indexCount / 3) * draw.instanceCount;
+    }
+    bool sameDraws = std::equal(drawList.begin(), drawList.end(), previousDrawList.begin(), previousDrawList.end(), [](const DrawRange& a, const DrawRange& b) {
+        return a.range.firstIndex == b.range.firstIndex && a.range.indexCount == b.range.indexCount && a.range.baseVertex == b.range.baseVertex
+            && a.instanceCount == b.instanceCount && a.firstInstance == b.firstInstance;
+    });
+    if (!sameDraws) drawListCount++;
+    stats.culledObjects = static_cast<uint32_t>(liveObjectCount) - stats.visibleObjects;
+    stats.culledChunks = static_cast<uint32_t>(chunkCount) - stats.visibleChunks;
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void SceneInstances::draw(wgpu::RenderPassEncoder renderPass) const {
+    recordDraws(renderPass);
+}
+
+void SceneInstances::draw(wgpu::RenderBundleEncoder bundle) const {
+    recordDraws(bundle);
+}
+
+template <typename Encoder>
+void SceneInstances::recordDraws(Encoder& encoder) const {
+    for (const DrawRange& draw : drawList) {
+        encoder.drawIndexed(
+            draw.range.indexCount, draw.instanceCount,
+            draw.range.firstIndex, draw.range.baseVertex, draw.firstInstance
+        );
+    }
+}
+
+void SceneInstances::chunkInstances(std::vector<ChunkInstances>& chunks) const {
+    chunks.clear();
+    for (const MeshEntry& entry : meshes) {
+        if (entry.objects.empty() || entry.range.indexCount == 0) continue;
+        for (size_t chunk = 0; chunk < entry.chunks.size(); chunk++) {
+            chunks.push_back({ entry.chunks[chunk], entry.chunkBoxes[chunk], entry.firstInstance, static_cast<uint32_t>(entry.objects.size()) });
+        }
+    }
+}
+
+uint32_t SceneInstances::selectLod(uint32_t slot, const LodView& lodView) const {
+    const MeshEntry& entry = meshes[slotMeshes[slot]];
+    if (lodView.pixelScale <= 0.0f || entry.lods.size() < 2) return 0;
+
+    // The error projects to error * pixelScale / distance pixels, bounded
+    // using the nearest point of the object, and levels are ordered by
+    // increasing error
+    float distance = objectBounds.distance(slot, lodView.eye);
+    float limit = lodView.threshold * distance / (lodView.pixelScale * slotScales[slot]);
+    uint32_t lod = 0;
+    while (lod + 1 < entry.lods.size() && entry.lodErrors[lod + 1] <= limit) {
+        lod++;
+    }
+    return lod;
+}
+
+void SceneInstances::addDraw(uint32_t mesh, uint32_t lod, uint32_t begin, uint32_t end) {
+    const MeshEntry& entry = meshes[mesh];
+    if (begin == end || entry.range.indexCount == 0) return;
+    drawList.push_back({ entry.lods[lod], end - begin, begin });
+}
+
+void SceneInstances::layout() {
+    layoutCount++;
+    transforms.resize(liveObjectCount);
+    slotDirty.assign(liveObjectCount, 0);
+    objectBounds.resize(liveObjectCount);
+    slotMeshes.resize(liveObjectCount);
+    slotScales.resize(liveObjectCount);
+
+    uint32_t slot = 0;
+    for (uint32_t mesh = 0; mesh < meshes.size(); mesh++) {
+        MeshEntry& entry = meshes[mesh];
+        entry.firstInstance = slot;
+        for (ObjectId id : entry.objects) {
+            objects[id].slot = slot;
+            transforms[slot] = objects[id].transform;
+            objectBounds.set(slot, entry.bounds, transforms[slot]);
+            slotMeshes[slot] = mesh;
+            slotScales[slot] = maxScale(transforms[slot]);
+            slot++;
+        }
+    }
+}
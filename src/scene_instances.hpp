@@ -0,0 +1,261 @@
+#ifndef _SCENE_INSTANCES_H
+#define _SCENE_INSTANCES_H
+
+#include "frustum_culler.hpp"
+#include "mesh.hpp"
+
+#include <webgpu/webgpu.hpp>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/**
+ * Where a mesh lives in the shared vertex and index buffers
+ */
+struct MeshRange {
+    uint32_t firstIndex = 0;
+    uint32_t indexCount = 0;
+    int32_t baseVertex = 0;
+};
+
+/**
+ * What SceneInstances::cull() needs to pick levels of detail: the eye in
+ * the space of the object transforms, and the pixels covered by a unit
+ * length seen at unit distance, i.e. half the viewport height times the
+ * projection's vertical focal length. Zero keeps every object at full
+ * detail.
+ */
+struct LodView {
+    glm::vec3 eye = glm::vec3(0.0f);
+    float pixelScale = 0.0f;
+    // Largest error on screen, in pixels
+    float threshold = 1.0f;
+};
+
+/**
+ * Objects placing meshes in the scene, each with its own model matrix. The
+ * matrices live in one storage buffer read by the vertex shader through
+ * instance_index, with the objects of a mesh kept contiguous so that every
+ * mesh is drawn with a single instanced draw, whatever its object count.
+ *
+ * Moving an object only re-uploads its matrix; adding or removing objects
+ * lays the buffer out again and re-uploads all of it on the next upload().
+ *
+ * cull() keeps the draws to what the camera sees: objects are tested
+ * against the frustum by their world bounds, and the chunks of those
+ * crossing its boundary by their model space bounds, against the frustum
+ * brought into the object's space. Objects entirely inside stay batched
+ * in instanced draws.
+ *
+ * Given a LodView, cull() also draws each visible object at the coarsest
+ * level of detail of its mesh whose error stays under a pixel threshold on
+ * screen. Objects drawn at a coarser level skip chunk culling, their level
+ * being a single range.
+ */
+class SceneInstances {
+public:
+    using ObjectId = uint32_t;
+
+    // Levels of detail kept per mesh, coarser ones are ignored
+    static constexpr size_t maxLodCount = 8;
+
+    struct CullingStats {
+        uint32_t visibleObjects = 0;
+        uint32_t culledObjects = 0;
+        // Chunks of every object, those of culled objects count as culled
+        uint32_t visibleChunks = 0;
+        uint32_t culledChunks = 0;
+        // Visible objects per level of detail, and the triangles drawn
+        std::array<uint32_t, maxLodCount> lodObjects = {};
+        uint64_t triangles = 0;
+        double milliseconds = 0.0;
+    };
+
+    /**
+     * A chunk of a mesh and the objects drawing it, for culling elsewhere
+     * than in cull(): they are in slots [firstInstance, firstInstance +
+     * instanceCount) of buffer()
+     */
+    struct ChunkInstances {
+        MeshRange range;
+        Bounds bounds;
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+    };
+
+    // Create the storage buffer for `capacity` objects, it grows as needed
+    bool initialize(wgpu::Device device, uint32_t capacity = 1024);
+
+    // Release the storage buffer
+    void terminate();
+
+    /**
+     * Register a mesh and return its index, for addObject(). Its `chunks`
+     * index the same buffer as `range` and tile it; without any, the whole
+     * range is culled as one chunk of `bounds`. Its `lods`, if any, start
+     * with `range` itself, as Mesh::lods, and index the same buffer.
+     */
+    uint32_t addMesh(
+        const MeshRange& range, const Bounds& bounds,
+        std::span<const MeshChunk> chunks = {}, std::span<const MeshLod> lods = {}
+    );
+
+    ObjectId addObject(uint32_t mesh, const glm::mat4x4& transform);
+
+    void removeObject(ObjectId object);
+
+    // Remove every object, keeping the meshes
+    void clearObjects();
+
+    void setTransform(ObjectId object, const glm::mat4x4& transform);
+
+    const glm::mat4x4& transform(ObjectId object) const { return objects[object].transform; }
+
+    /**
+     * Write the matrices changed since the last call. Returns true when the
+     * buffer had to be recreated to grow, in which case bind groups using
+     * it must be created again.
+     */
+    bool upload(wgpu::Queue queue);
+
+    wgpu::Buffer buffer() const { return instanceBuffer; }
+
+    // Size to bind, never zero even without objects
+    uint64_t bindingSize() const { return static_cast<uint64_t>(capacity) * sizeof(glm::mat4x4); }
+
+    /**
+     * Build the draw list of the objects in the frustum of `viewProjection`,
+     * which maps world space to clip space, at the levels of detail `lodView`
+     * calls for. Call after upload(). When culling is disabled, every object
+     * is drawn, those of a mesh at the same level in a single draw.
+     */
+    void cull(const glm::mat4x4& viewProjection, const LodView& lodView = {});
+
+    void setCullingEnabled(bool enabled) { cullingEnabled = enabled; }
+    bool isCullingEnabled() const { return cullingEnabled; }
+
+    // Without instancing, cull() gives every object a draw of its own
+    void setInstancingEnabled(bool enabled) { instancingEnabled = enabled; }
+    bool isInstancingEnabled() const { return instancingEnabled; }
+
+    /**
+     * Record the draw list of the last cull(), with the vertex and index
+     * buffers and a bind group using buffer() already set
+     */
+    void draw(wgpu::RenderPassEncoder renderPass) const;
+
+    // Same, into a render bundle
+    void draw(wgpu::RenderBundleEncoder bundle) const;
+
+    size_t objectCount() const { return liveObjectCount; }
+    size_t meshCount() const { return meshes.size(); }
+
+    // Draw calls recorded by draw()
+    uint32_t drawCount() const { return static_cast<uint32_t>(drawList.size()); }
+
+    // Changes whenever cull() builds a draw list different from the last
+    uint32_t drawListVersion() const { return drawListCount; }
+
+    // Counts and time of the last cull()
+    const CullingStats& cullingStats() const { return stats; }
+
+    // Bytes written by the last upload()
+    uint64_t lastUploadBytes() const { return uploadedBytes; }
+
+    // Chunks of the meshes that have objects, as laid out by the last
+    // upload(), all at full detail
+    void chunkInstances(std::vector<ChunkInstances>& chunks) const;
+
+    // Changes whenever upload() lays the objects out again
+    uint32_t layoutVersion() const { return layoutCount; }
+
+private:
+    struct MeshEntry {
+        MeshRange range;
+        Bounds bounds;
+        // Index ranges of the chunks and their model space bounds, as
+        // listed and ready for the culler
+        std::vector<MeshRange> chunks;
+        std::vector<Bounds> chunkBoxes;
+        BoundsList chunkBounds;
+        // Index ranges of the levels of detail from the full mesh on, and
+        // their error in model units
+        std::vector<MeshRange> lods;
+        std::vector<float> lodErrors;
+        std::vector<ObjectId> objects;
+        // Slot of the first object in the instance buffer
+        uint32_t firstInstance = 0;
+    };
+
+    struct DrawRange {
+        MeshRange range;
+        uint32_t instanceCount;
+        uint32_t firstInstance;
+    };
+
+    struct Object {
+        glm::mat4x4 transform;
+        uint32_t mesh;
+        // Position in MeshEntry::objects
+        uint32_t meshIndex;
+        // Position in the instance buffer
+        uint32_t slot;
+        bool alive;
+    };
+
+    // Assign contiguous slots per mesh and refill `transforms`
+    void layout();
+
+    // Level of detail `lodView` calls for to draw the object in `slot`
+    uint32_t selectLod(uint32_t slot, const LodView& lodView) const;
+
+    // Append the draw of the objects of `mesh` in slots [begin, end), at
+    // level of detail `lod`
+    void addDraw(uint32_t mesh, uint32_t lod, uint32_t begin, uint32_t end);
+
+    // Shared by the draw() of passes and bundles
+    template <typename Encoder>
+    void recordDraws(Encoder& encoder) const;
+
+private:
+    wgpu::Device device;
+    wgpu::Buffer instanceBuffer;
+    uint32_t capacity = 0;
+
+    std::vector<MeshEntry> meshes;
+    std::vector<Object> objects;
+    std::vector<ObjectId> freeObjects;
+    size_t liveObjectCount = 0;
+
+    // CPU copy of the instance buffer
+    std::vector<glm::mat4x4> transforms;
+    bool layoutChanged = false;
+    uint32_t layoutCount = 0;
+    std::vector<uint32_t> dirtySlots;
+    std::vector<uint8_t> slotDirty;
+    uint64_t uploadedBytes = 0;
+
+    // World bounds of each slot, its mesh, and the largest scale of its
+    // transform, which the error of a level of detail grows by
+    BoundsList objectBounds;
+    std::vector<uint32_t> slotMeshes;
+    std::vector<float> slotScales;
+
+    bool cullingEnabled = true;
+    bool instancingEnabled = true;
+    std::vector<DrawRange> drawList;
+    // The draw list of the cull() before, to tell whether it changed
+    std::vector<DrawRange> previousDrawList;
+    uint32_t drawListCount = 0;
+    CullingStats stats;
+    // Scratch lists of cull(), kept to reuse their memory
+    std::vector<uint32_t> insideSlots;
+    std::vector<uint32_t> intersectingSlots;
+    std::vector<uint32_t> visibleChunks;
+    std::vector<uint32_t> slotLods;
+};
+
+#endif // _SCENE_INSTANCES_H
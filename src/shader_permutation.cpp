@@ -0,0 +1,116 @@
+#include "shader_permutation.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+uint64_t hashString(const std::string& value, uint64_t seed) {
+    // The size separates "ab" + "c" from "a" + "bc"
+    uint64_t size = value.size();
+    return hashBytes(value.data(), value.size(), hashBytes(&size, sizeof(size), seed));
+}
+
+struct Block {
+    // Whether the lines of the block are kept
+    bool active;
+    // Whether the enclosing block is kept, an #else cannot do better
+    bool parentActive;
+    bool inElse;
+};
+
+} // namespace
+
+ShaderPermutation& ShaderPermutation::define(const std::string& name) {
+    if (!isDefined(name)) defines.push_back(name);
+    return *this;
+}
+
+ShaderPermutation& ShaderPermutation::set(const std::string& name, double value) {
+    for (auto& [constantName, constantValue] : constants) {
+        if (constantName == name) {
+            constantValue = value;
+            return *this;
+        }
+    }
+    constants.emplace_back(name, value);
+    return *this;
+}
+
+bool ShaderPermutation::isDefined(const std::string& name) const {
+    return std::find(defines.begin(), defines.end(), name) != defines.end();
+}
+
+uint64_t ShaderPermutation::moduleKey() const {
+    std::vector<std::string> sorted = defines;
+    std::sort(sorted.begin(), sorted.end());
+    uint64_t hash = 0;
+    for (const std::string& name : sorted) hash = hashString(name, hash);
+    return hash;
+}
+
+uint64_t ShaderPermutation::key() const {
+    std::vector<std::pair<std::string, double>> sorted = constants;
+    std::sort(sorted.begin(), sorted.end());
+    uint64_t hash = moduleKey();
+    for (const auto& [name, value] : sorted) {
+        hash = hashString(name, hash);
+        hash = hashBytes(&value, sizeof(value), hash);
+    }
+    return hash;
+}
+
+bool ShaderPreprocessor::process(
+    const std::string& source,
+    const std::vector<std::string>& defines,
+    std::string& output
+) {
+    output.clear();
+    output.reserve(source.size());
+
+    std::vector<Block> blocks;
+    bool active = true;
+    std::istringstream lines(source);
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(lines, line)) {
+        lineNumber++;
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] != '#') {
+            if (active) output += line;
+            output += '\n';
+            continue;
+        }
+
+        std::istringstream directive(line.substr(start + 1));
+        std::string keyword, name;
+        directive >> keyword >> name;
+        if ((keyword == "ifdef" || keyword == "ifndef") && !name.empty()) {
+            bool defined = std::find(defines.begin(), defines.end(), name) != defines.end();
+            bool enabled = keyword == "ifdef" ? defined : !defined;
+            blocks.push_back({ active && enabled, active, false });
+        }
+        else if (keyword == "else" && !blocks.empty() && !blocks.back().inElse) {
+            Block& block = blocks.back();
+            block.active = block.parentActive && !block.active;
+            block.inElse = true;
+        }
+        else if (keyword == "endif" && !blocks.empty()) {
+            blocks.pop_back();
+        }
+        else {
+            std::cerr << "Invalid shader directive at line " << lineNumber << ": " << line << std::endl;
+            return false;
+        }
+        active = blocks.empty() || blocks.back().active;
+        output += '\n';
+    }
+
+    if (!blocks.empty()) {
+        std::cerr << "Missing #endif at the end of the shader" << std::endl;
+        return false;
+    }
+    return true;
+}
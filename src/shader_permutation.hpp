@@ -0,0 +1,48 @@
+#ifndef _SHADER_PERMUTATION_H
+#define _SHADER_PERMUTATION_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * One specialization of a WGSL source: the feature flags tested by its
+ * `#ifdef` blocks, which select the shader module, and the values of its
+ * `override` constants, which select the pipeline
+ */
+struct ShaderPermutation {
+    std::vector<std::string> defines;
+    std::vector<std::pair<std::string, double>> constants;
+
+    ShaderPermutation& define(const std::string& name);
+
+    // Set the `override` constant `name`, replacing any previous value
+    ShaderPermutation& set(const std::string& name, double value);
+
+    bool isDefined(const std::string& name) const;
+
+    // Hash of the defines, whatever their order
+    uint64_t moduleKey() const;
+
+    // Hash of the defines and the constants
+    uint64_t key() const;
+};
+
+class ShaderPreprocessor {
+public:
+    /**
+     * Keep the lines of `source` enabled by `defines`. Directives are
+     * `#ifdef NAME`, `#ifndef NAME`, `#else` and `#endif`, alone on their
+     * line and possibly nested. Removed lines and directives are left
+     * empty so that compiler messages keep their line numbers. Returns
+     * false and prints the line on an unknown or unbalanced directive.
+     */
+    static bool process(
+        const std::string& source,
+        const std::vector<std::string>& defines,
+        std::string& output
+    );
+};
+
+#endif // _SHADER_PERMUTATION_H
@@ -0,0 +1,215 @@
+/**
+ * GPU culling of the objects of SceneInstances, see GpuCuller.
+ *
+ * cs_cull runs one thread per object and chunk of its mesh: the chunk is
+ * kept when its world bounds are in the frustum and not behind the Hi-Z
+ * pyramid of the previous frame, and then appended to the visible list of
+ * its chunk, whose indirect draw counts it as an instance.
+ *
+ * cs_reduce_depth and cs_reduce build the pyramid, each level holding the
+ * farthest depth of the texels it covers. vs_hiz/fs_hiz show one level.
+ */
+
+struct CullingUniforms {
+    // World space to clip space of the frame the Hi-Z was built from
+    previousViewProjection: mat4x4f,
+    // Frustum of the current frame in world space, see Frustum
+    planes: array<vec4f, 6>,
+    // Size of the depth texture the Hi-Z was built from
+    depthSize: vec2f,
+    // Terms a and b of depth = a + b / distance, for the debug view
+    depthTerms: vec2f,
+    occlusion: u32,
+    debugLevel: u32,
+}
+
+struct Chunk {
+    boundsMin: vec3f,
+    // Slot of the first object of the mesh in instanceTransforms
+    firstSlot: u32,
+    boundsMax: vec3f,
+    objectCount: u32,
+    // Where the chunk's visible list starts in visibleInstances
+    outputOffset: u32,
+}
+
+// Arguments of drawIndexedIndirect
+struct DrawArgs {
+    indexCount: u32,
+    instanceCount: atomic<u32>,
+    firstIndex: u32,
+    baseVertex: i32,
+    firstInstance: u32,
+}
+
+// Chunks of every object, as counted by cs_cull
+struct CullingStats {
+    visible: atomic<u32>,
+    frustumCulled: atomic<u32>,
+    occlusionCulled: atomic<u32>,
+}
+
+@group(0) @binding(0) var<uniform> uCulling: CullingUniforms;
+@group(0) @binding(1) var<storage, read> chunks: array<Chunk>;
+@group(0) @binding(2) var<storage, read> instanceTransforms: array<mat4x4f>;
+// Every level of the pyramid
+@group(0) @binding(3) var hiZ: texture_2d<f32>;
+@group(0) @binding(4) var<storage, read_write> drawArgs: array<DrawArgs>;
+@group(0) @binding(5) var<storage, read_write> visibleInstances: array<u32>;
+@group(0) @binding(6) var<storage, read_write> stats: CullingStats;
+
+// Pyramid build, from the depth texture or from the previous level
+@group(0) @binding(7) var depthSource: texture_depth_2d;
+@group(0) @binding(8) var hiZSource: texture_2d<f32>;
+@group(0) @binding(9) var hiZTarget: texture_storage_2d<r32float, write>;
+
+/**
+ * Whether the box is behind what the previous frame drew. Its projected
+ * rectangle is covered by 2x2 texels of the level where texels are at least
+ * as large, and the box is hidden when its nearest point is farther than
+ * the farthest depth of these texels.
+ */
+fn isOccluded(boxMin: vec3f, boxMax: vec3f) -> bool {
+    var pixelMin = vec2f(3.4e38);
+    var pixelMax = vec2f(-3.4e38);
+    var nearest = 1.0;
+    for (var i = 0u; i < 8u; i++) {
+        let corner = select(boxMin, boxMax, vec3<bool>((i & 1u) != 0u, (i & 2u) != 0u, (i & 4u) != 0u));
+        let clip = uCulling.previousViewProjection * vec4f(corner, 1.0);
+        // Crossing the camera plane, the projection is unbounded
+        if (clip.w <= 0.0) {
+            return false;
+        }
+        let ndc = clip.xyz / clip.w;
+        let pixel = (ndc.xy * vec2f(0.5, -0.5) + 0.5) * uCulling.depthSize;
+        pixelMin = min(pixelMin, pixel);
+        pixelMax = max(pixelMax, pixel);
+        nearest = min(nearest, ndc.z);
+    }
+
+    // The previous frame did not see the part outside of its viewport
+    if (any(pixelMin < vec2f(0.0)) || any(pixelMax >= uCulling.depthSize)) {
+        return false;
+    }
+    let first = vec2u(pixelMin);
+    let last = vec2u(pixelMax);
+
+    // Level 0 halves the depth texture, and the last texel of a row or
+    // column covers the odd one out, hence the clamp
+    let levelCount = textureNumLevels(hiZ);
+    var level = 0u;
+    loop {
+        let span = (last >> vec2u(level + 1u)) - (first >> vec2u(level + 1u));
+        if (all(span <= vec2u(1u)) || level + 1u >= levelCount) {
+            break;
+        }
+        level++;
+    }
+    let size = textureDimensions(hiZ, level);
+    let a = min(first >> vec2u(level + 1u), size - 1u);
+    let b = min(last >> vec2u(level + 1u), size - 1u);
+    let farthest = max(
+        max(textureLoad(hiZ, a, level).r, textureLoad(hiZ, vec2u(b.x, a.y), level).r),
+        max(textureLoad(hiZ, vec2u(a.x, b.y), level).r, textureLoad(hiZ, b, level).r)
+    );
+    return nearest > farthest;
+}
+
+@compute @workgroup_size(64)
+fn cs_cull(@builtin(global_invocation_id) id: vec3u) {
+    let chunk = chunks[id.y];
+    if (id.x >= chunk.objectCount) {
+        return;
+    }
+    let slot = chunk.firstSlot + id.x;
+    let transform = instanceTransforms[slot];
+
+    // World bounds as BoundsList::set computes them
+    let center = 0.5 * (chunk.boundsMin + chunk.boundsMax);
+    let extent = 0.5 * (chunk.boundsMax - chunk.boundsMin);
+    let worldCenter = (transform * vec4f(center, 1.0)).xyz;
+    let worldExtent = abs(transform[0].xyz) * extent.x + abs(transform[1].xyz) * extent.y + abs(transform[2].xyz) * extent.z;
+
+    for (var p = 0u; p < 6u; p++) {
+        let plane = uCulling.planes[p];
+        let signedDistance = dot(plane.xyz, worldCenter) + plane.w;
+        let radius = dot(abs(plane.xyz), worldExtent);
+        if (signedDistance + radius < 0.0) {
+            atomicAdd(&stats.frustumCulled, 1u);
+            return;
+        }
+    }
+
+    if (uCulling.occlusion != 0u && isOccluded(worldCenter - worldExtent, worldCenter + worldExtent)) {
+        atomicAdd(&stats.occlusionCulled, 1u);
+        return;
+    }
+
+    let index = atomicAdd(&drawArgs[id.y].instanceCount, 1u);
+    visibleInstances[chunk.outputOffset + index] = slot;
+    atomicAdd(&stats.visible, 1u);
+}
+
+/**
+ * Last source texel reduced into `texel`: the footprint is 2x2, widened to 3
+ * on the last row and column of an odd sized source so that none is skipped
+ */
+fn footprintEnd(texel: vec2u, sourceSize: vec2u, targetSize: vec2u) -> vec2u {
+    let widened = (texel == targetSize - 1u) & ((sourceSize & vec2u(1u)) == vec2u(1u));
+    return min(2u * texel + 1u + select(vec2u(0u), vec2u(1u), widened), sourceSize - 1u);
+}
+
+@compute @workgroup_size(8, 8)
+fn cs_reduce_depth(@builtin(global_invocation_id) id: vec3u) {
+    let targetSize = textureDimensions(hiZTarget);
+    if (any(id.xy >= targetSize)) {
+        return;
+    }
+    let end = footprintEnd(id.xy, textureDimensions(depthSource), targetSize);
+    var farthest = 0.0;
+    for (var y = 2u * id.y; y <= end.y; y++) {
+        for (var x = 2u * id.x; x <= end.x; x++) {
+            farthest = max(farthest, textureLoad(depthSource, vec2u(x, y), 0));
+        }
+    }
+    textureStore(hiZTarget, id.xy, vec4f(farthest, 0.0, 0.0, 0.0));
+}
+
+@compute @workgroup_size(8, 8)
+fn cs_reduce(@builtin(global_invocation_id) id: vec3u) {
+    let targetSize = textureDimensions(hiZTarget);
+    if (any(id.xy >= targetSize)) {
+        return;
+    }
+    let end = footprintEnd(id.xy, textureDimensions(hiZSource), targetSize);
+    var farthest = 0.0;
+    for (var y = 2u * id.y; y <= end.y; y++) {
+        for (var x = 2u * id.x; x <= end.x; x++) {
+            farthest = max(farthest, textureLoad(hiZSource, vec2u(x, y), 0).r);
+        }
+    }
+    textureStore(hiZTarget, id.xy, vec4f(farthest, 0.0, 0.0, 0.0));
+}
+
+@vertex
+fn vs_hiz(@builtin(vertex_index) vertexIndex: u32) -> @builtin(position) vec4f {
+    // Triangle covering the whole viewport
+    let uv = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+    return vec4f(uv * 2.0 - 1.0, 0.0, 1.0);
+}
+
+@fragment
+fn fs_hiz(@builtin(position) position: vec4f) -> @location(0) vec4f {
+    let level = min(uCulling.debugLevel, textureNumLevels(hiZ) - 1u);
+    let texel = min(vec2u(position.xy) >> vec2u(level + 1u), textureDimensions(hiZ, level) - 1u);
+    let depth = textureLoad(hiZ, texel, level).r;
+
+    // Distance on a log scale, white at the near plane and black at the far one
+    let a = uCulling.depthTerms.x;
+    let b = uCulling.depthTerms.y;
+    let near = -b / a;
+    let far = b / (1.0 - a);
+    let viewDistance = b / min(depth - a, -1e-7);
+    let t = log(viewDistance / near) / log(far / near);
+    return vec4f(vec3f(1.0 - clamp(t, 0.0, 1.0)), 1.0);
+}
@@ -0,0 +1,138 @@
+/**
+ * Light lists of the clusters of the view frustum, see ClusteredLights.
+ *
+ * cs_assign runs one thread per cluster. The workgroup brings the lights
+ * into view space a batch at a time, into workgroup memory, and each thread
+ * keeps those reaching the bounds of its cluster.
+ */
+
+struct ClusterUniforms {
+    // World space to view space
+    viewMatrix: mat4x4f,
+    // Clip space to view space
+    inverseProjection: mat4x4f,
+    gridSize: vec3u,
+    lightCount: u32,
+    screenSize: vec2f,
+    // Slice of view depth z is log(z) * sliceScale + sliceBias
+    sliceScale: f32,
+    sliceBias: f32,
+    near: f32,
+    far: f32,
+}
+
+// See LocalLight
+struct Light {
+    position: vec3f,
+    range: f32,
+    color: vec3f,
+    spotScale: f32,
+    direction: vec3f,
+    spotOffset: f32,
+}
+
+// Per cluster, a count followed by the indices of its lights
+const maxLightsPerCluster = 127u;
+const clusterStride = maxLightsPerCluster + 1u;
+const workgroupSize = 64u;
+
+@group(0) @binding(0) var<uniform> uClusters: ClusterUniforms;
+@group(0) @binding(1) var<storage, read> lights: array<Light>;
+@group(0) @binding(2) var<storage, read_write> clusterLights: array<u32>;
+
+// View space position and range of the batch, and for spot lights the cone
+// axis and the cosine of its angle, 2 for point lights
+var<workgroup> batchSpheres: array<vec4f, workgroupSize>;
+var<workgroup> batchCones: array<vec4f, workgroupSize>;
+
+// Point at view depth 1 on the ray through `ndc`
+fn viewRay(ndc: vec2f) -> vec3f {
+    let p = uClusters.inverseProjection * vec4f(ndc, 0.0, 1.0);
+    let v = p.xyz / p.w;
+    return v / v.z;
+}
+
+// Depth of the near side of `slice`, the far side of the previous one
+fn sliceDepth(slice: u32) -> f32 {
+    let t = f32(slice) / f32(uClusters.gridSize.z);
+    return uClusters.near * pow(uClusters.far / uClusters.near, t);
+}
+
+/**
+ * Whether the cone of a spot light reaches a sphere (Wronski, "Cull that
+ * cone!"), the cone being `axis` from `apex` with an angle of cosine
+ * `cosAngle`, cut at `range`
+ */
+fn coneReachesSphere(apex: vec3f, axis: vec3f, cosAngle: f32, range: f32, center: vec3f, radius: f32) -> bool {
+    let v = center - apex;
+    let lengthSquared = dot(v, v);
+    let along = dot(v, axis);
+    let sinAngle = sqrt(max(1.0 - cosAngle * cosAngle, 0.0));
+    let closest = cosAngle * sqrt(max(lengthSquared - along * along, 0.0)) - along * sinAngle;
+    return !(closest > radius || along > radius + range || along < -radius);
+}
+
+@compute @workgroup_size(64)
+fn cs_assign(@builtin(global_invocation_id) id: vec3u, @builtin(local_invocation_index) local: u32) {
+    let grid = uClusters.gridSize;
+    let cluster = id.x;
+    let inGrid = cluster < grid.x * grid.y * grid.z;
+
+    // Bounds of the cluster in view space, from its tile at the near and
+    // far depths of its slice. Tiles go down the screen, NDC up.
+    let tile = vec3u(cluster % grid.x, (cluster / grid.x) % grid.y, cluster / (grid.x * grid.y));
+    let tileSize = 2.0 / vec2f(grid.xy);
+    let ndcMin = vec2f(-1.0 + f32(tile.x) * tileSize.x, 1.0 - f32(tile.y + 1u) * tileSize.y);
+    let ndcMax = ndcMin + tileSize;
+    let depths = vec2f(sliceDepth(tile.z), sliceDepth(tile.z + 1u));
+    var boxMin = vec3f(3.4e38);
+    var boxMax = vec3f(-3.4e38);
+    for (var i = 0u; i < 4u; i++) {
+        let ray = viewRay(select(ndcMin, ndcMax, vec2<bool>((i & 1u) != 0u, (i & 2u) != 0u)));
+        boxMin = min(boxMin, min(ray * depths.x, ray * depths.y));
+        boxMax = max(boxMax, max(ray * depths.x, ray * depths.y));
+    }
+    let center = 0.5 * (boxMin + boxMax);
+    let radius = length(0.5 * (boxMax - boxMin));
+
+    let base = cluster * clusterStride;
+    var count = 0u;
+    for (var first = 0u; first < uClusters.lightCount; first += workgroupSize) {
+        let index = first + local;
+        if (index < uClusters.lightCount) {
+            let light = lights[index];
+            let position = (uClusters.viewMatrix * vec4f(light.position, 1.0)).xyz;
+            batchSpheres[local] = vec4f(position, light.range);
+            if (light.spotScale > 0.0) {
+                let axis = normalize((uClusters.viewMatrix * vec4f(light.direction, 0.0)).xyz);
+                batchCones[local] = vec4f(axis, -light.spotOffset / light.spotScale);
+            }
+            else {
+                batchCones[local] = vec4f(0.0, 0.0, 1.0, 2.0);
+            }
+        }
+        workgroupBarrier();
+
+        if (inGrid) {
+            let batchSize = min(workgroupSize, uClusters.lightCount - first);
+            for (var j = 0u; j < batchSize && count < maxLightsPerCluster; j++) {
+                let sphere = batchSpheres[j];
+                let offset = clamp(sphere.xyz, boxMin, boxMax) - sphere.xyz;
+                if (dot(offset, offset) > sphere.w * sphere.w) {
+                    continue;
+                }
+                let cone = batchCones[j];
+                if (cone.w <= 1.0 && !coneReachesSphere(sphere.xyz, cone.xyz, cone.w, sphere.w, center, radius)) {
+                    continue;
+                }
+                clusterLights[base + 1u + count] = first + j;
+                count++;
+            }
+        }
+        workgroupBarrier();
+    }
+
+    if (inGrid) {
+        clusterLights[base] = count;
+    }
+}
@@ -0,0 +1,78 @@
+/**
+ * Build mip level N+1 from level N. Mirrors the CPU MipChainBuilder: even
+ * sizes use a 2 tap box, odd sizes a 3 tap polyphase box so no texel of the
+ * previous level is dropped.
+ */
+
+// Average RGB in linear space for sRGB encoded content
+override srgb: bool = false;
+
+@group(0) @binding(0)
+var previousLevel: texture_2d<f32>;
+@group(0) @binding(1)
+var nextLevel: texture_storage_2d<rgba8unorm, write>;
+
+/**
+ * Source texels (and their weights) contributing to one destination texel
+ * along one axis
+ */
+struct Taps {
+    index: vec3u,
+    weight: vec3f,
+    count: u32,
+}
+
+fn computeTaps(dst: u32, srcSize: u32, dstSize: u32) -> Taps {
+    if (srcSize == 1u) {
+        return Taps(vec3u(0u), vec3f(1.0, 0.0, 0.0), 1u);
+    }
+    if (srcSize % 2u == 0u) {
+        return Taps(vec3u(2u * dst, 2u * dst + 1u, 0u), vec3f(0.5, 0.5, 0.0), 2u);
+    }
+    let n = f32(srcSize);
+    return Taps(
+        vec3u(2u * dst, 2u * dst + 1u, 2u * dst + 2u),
+        vec3f(f32(dstSize - dst) / n, f32(dstSize) / n, f32(dst + 1u) / n),
+        3u
+    );
+}
+
+fn decode(c: vec4f) -> vec4f {
+    if (!srgb) {
+        return c;
+    }
+    let low = c.rgb / 12.92;
+    let high = pow((c.rgb + 0.055) / 1.055, vec3f(2.4));
+    return vec4f(select(high, low, c.rgb <= vec3f(0.04045)), c.a);
+}
+
+fn encode(c: vec4f) -> vec4f {
+    if (!srgb) {
+        return c;
+    }
+    let l = clamp(c.rgb, vec3f(0.0), vec3f(1.0));
+    let low = l * 12.92;
+    let high = 1.055 * pow(l, vec3f(1.0 / 2.4)) - 0.055;
+    return vec4f(select(high, low, l <= vec3f(0.0031308)), c.a);
+}
+
+@compute @workgroup_size(8, 8)
+fn cs_main(@builtin(global_invocation_id) id: vec3u) {
+    let dstSize = textureDimensions(nextLevel);
+    if (id.x >= dstSize.x || id.y >= dstSize.y) {
+        return;
+    }
+    let srcSize = textureDimensions(previousLevel, 0);
+
+    let tx = computeTaps(id.x, srcSize.x, dstSize.x);
+    let ty = computeTaps(id.y, srcSize.y, dstSize.y);
+
+    var acc = vec4f(0.0);
+    for (var j = 0u; j < ty.count; j++) {
+        for (var i = 0u; i < tx.count; i++) {
+            let texel = textureLoad(previousLevel, vec2u(tx.index[i], ty.index[j]), 0);
+            acc += decode(texel) * (tx.weight[i] * ty.weight[j]);
+        }
+    }
+    textureStore(nextLevel, id.xy, encode(acc));
+}
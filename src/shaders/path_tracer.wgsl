@@ -0,0 +1,356 @@
+/**
+ * Progressive path tracer over the BVH built by BvhBuilder. cs_main adds one
+ * sample per pixel to the accumulation buffer, vs_display/fs_display show
+ * the running average.
+ *
+ * Surfaces are Lambertian with the base color texture as albedo, lit by the
+ * two directional lights of the raster pipeline (sampled directly, with
+ * shadow rays) and by a uniform environment.
+ */
+
+struct PathTracerUniforms {
+    // Clip space to world space
+    inverseViewProjection: mat4x4f,
+    // The BVH is in model space, rays are moved into it
+    modelMatrix: mat4x4f,
+    inverseModelMatrix: mat4x4f,
+    cameraWorldPosition: vec4f,
+    // Index of the sample being added, 0 restarts the accumulation
+    sampleIndex: u32,
+    width: u32,
+    height: u32,
+    maxBounces: u32,
+};
+
+struct LightingUniforms {
+    directions: array<vec4f, 2>,
+    colors: array<vec4f, 2>,
+}
+
+// Same layout as BvhNode and BvhTriangle in bvh.hpp
+struct BvhNode {
+    boundsMin: vec3f,
+    leftFirst: u32,
+    boundsMax: vec3f,
+    triangleCount: u32,
+};
+
+struct BvhTriangle {
+    v0: vec3f,
+    primitive: u32,
+    v1: vec3f,
+    padding0: u32,
+    v2: vec3f,
+    padding1: u32,
+};
+
+struct Ray {
+    origin: vec3f,
+    direction: vec3f,
+    inverseDirection: vec3f,
+};
+
+struct Hit {
+    t: f32,
+    u: f32,
+    v: f32,
+    triangle: u32,
+};
+
+@group(0) @binding(0)
+var<uniform> uPathTracer: PathTracerUniforms;
+@group(0) @binding(1)
+var<uniform> uLighting: LightingUniforms;
+@group(0) @binding(2)
+var<storage, read> nodes: array<BvhNode>;
+@group(0) @binding(3)
+var<storage, read> triangles: array<BvhTriangle>;
+// VertexAttributes as 11 floats: position, normal, color, uv
+@group(0) @binding(4)
+var<storage, read> vertices: array<f32>;
+@group(0) @binding(5)
+var<storage, read> indices: array<u32>;
+@group(0) @binding(6)
+var baseColorTexture: texture_2d<f32>;
+@group(0) @binding(7)
+var textureSampler: sampler;
+// Summed radiance in rgb, sample count in a
+@group(0) @binding(8)
+var<storage, read_write> accumulation: array<vec4f>;
+
+const pi = 3.14159265359;
+const noHit = 3.0e38;
+const noTriangle = 0xffffffffu;
+// bvhMaxDepth in bvh.hpp
+const maxStackSize = 64u;
+// Radiance of rays that leave the scene, the raster clear color
+const environment = vec3f(0.05);
+
+// === Random numbers
+
+fn pcgHash(value: u32) -> u32 {
+    let state = value * 747796405u + 2891336453u;
+    let word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+fn random(state: ptr<function, u32>) -> f32 {
+    *state = pcgHash(*state);
+    return f32(*state >> 8u) / 16777216.0;
+}
+
+// Cosine weighted direction around `normal`
+fn sampleHemisphere(normal: vec3f, state: ptr<function, u32>) -> vec3f {
+    let r1 = random(state);
+    let r2 = random(state);
+    let phi = 2.0 * pi * r1;
+    let radius = sqrt(r2);
+    let local = vec3f(radius * cos(phi), radius * sin(phi), sqrt(max(0.0, 1.0 - r2)));
+
+    // Orthonormal basis (Duff et al., "Building an Orthonormal Basis, Revisited")
+    let s = select(-1.0, 1.0, normal.z >= 0.0);
+    let a = -1.0 / (s + normal.z);
+    let b = normal.x * normal.y * a;
+    let tangent = vec3f(1.0 + s * normal.x * normal.x * a, s * b, -s * normal.x);
+    let bitangent = vec3f(b, s + normal.y * normal.y * a, -normal.y);
+    return normalize(local.x * tangent + local.y * bitangent + local.z * normal);
+}
+
+// === BVH traversal
+
+fn makeRay(origin: vec3f, direction: vec3f) -> Ray {
+    // Keep the slab test finite for axis aligned directions
+    let safe = select(direction, vec3f(1e-20), abs(direction) < vec3f(1e-20));
+    return Ray(origin, direction, 1.0 / safe);
+}
+
+// Entry distance into the node bounds, noHit on a miss
+fn intersectBounds(node: BvhNode, ray: Ray, tMax: f32) -> f32 {
+    let t0 = (node.boundsMin - ray.origin) * ray.inverseDirection;
+    let t1 = (node.boundsMax - ray.origin) * ray.inverseDirection;
+    let tNear = min(t0, t1);
+    let tFar = max(t0, t1);
+    let tEntry = max(max(tNear.x, tNear.y), max(tNear.z, 0.0));
+    let tExit = min(min(tFar.x, tFar.y), min(tFar.z, tMax));
+    return select(noHit, tEntry, tEntry <= tExit);
+}
+
+// Möller-Trumbore, updates `hit` when closer
+fn intersectTriangle(triangle: BvhTriangle, ray: Ray, hit: ptr<function, Hit>) -> bool {
+    let edge1 = triangle.v1 - triangle.v0;
+    let edge2 = triangle.v2 - triangle.v0;
+    let p = cross(ray.direction, edge2);
+    let determinant = dot(edge1, p);
+    if (determinant == 0.0) {
+        return false;
+    }
+
+    let inverseDeterminant = 1.0 / determinant;
+    let s = ray.origin - triangle.v0;
+    let u = dot(s, p) * inverseDeterminant;
+    let q = cross(s, edge1);
+    let v = dot(ray.direction, q) * inverseDeterminant;
+    let t = dot(edge2, q) * inverseDeterminant;
+    if (u < 0.0 || v < 0.0 || u + v > 1.0 || t <= 0.0 || t >= (*hit).t) {
+        return false;
+    }
+
+    (*hit).t = t;
+    (*hit).u = u;
+    (*hit).v = v;
+    return true;
+}
+
+// Closest hit below `tMax`, or the first one found when `anyHit` is set
+fn traverse(ray: Ray, tMax: f32, anyHit: bool) -> Hit {
+    var hit = Hit(tMax, 0.0, 0.0, noTriangle);
+    var stack: array<u32, maxStackSize>;
+    var stackSize = 0u;
+    if (intersectBounds(nodes[0], ray, hit.t) < noHit) {
+        stack[0] = 0u;
+        stackSize = 1u;
+    }
+
+    while (stackSize > 0u) {
+        stackSize--;
+        let node = nodes[stack[stackSize]];
+
+        if (node.triangleCount > 0u) {
+            for (var i = node.leftFirst; i < node.leftFirst + node.triangleCount; i++) {
+                if (intersectTriangle(triangles[i], ray, &hit)) {
+                    hit.triangle = i;
+                    if (anyHit) {
+                        return hit;
+                    }
+                }
+            }
+            continue;
+        }
+
+        // Push the farther child first so that the nearer one is visited next
+        let tLeft = intersectBounds(nodes[node.leftFirst], ray, hit.t);
+        let tRight = intersectBounds(nodes[node.leftFirst + 1u], ray, hit.t);
+        let leftIsNear = tLeft <= tRight;
+        let nearChild = select(node.leftFirst + 1u, node.leftFirst, leftIsNear);
+        let farChild = select(node.leftFirst, node.leftFirst + 1u, leftIsNear);
+        if (max(tLeft, tRight) < noHit) {
+            stack[stackSize] = farChild;
+            stackSize++;
+        }
+        if (min(tLeft, tRight) < noHit) {
+            stack[stackSize] = nearChild;
+            stackSize++;
+        }
+    }
+    return hit;
+}
+
+// === Shading
+
+fn vertexAttribute(index: u32, offset: u32) -> vec3f {
+    let base = index * 11u + offset;
+    return vec3f(vertices[base], vertices[base + 1u], vertices[base + 2u]);
+}
+
+fn vertexUv(index: u32) -> vec2f {
+    let base = index * 11u + 9u;
+    return vec2f(vertices[base], vertices[base + 1u]);
+}
+
+struct SurfacePoint {
+    // Model space, for the next rays
+    position: vec3f,
+    geometricNormal: vec3f,
+    // World space, for lighting
+    normal: vec3f,
+    albedo: vec3f,
+};
+
+fn surfacePoint(ray: Ray, hit: Hit) -> SurfacePoint {
+    let triangle = triangles[hit.triangle];
+    let i0 = indices[3u * triangle.primitive + 0u];
+    let i1 = indices[3u * triangle.primitive + 1u];
+    let i2 = indices[3u * triangle.primitive + 2u];
+    let w = 1.0 - hit.u - hit.v;
+
+    var point: SurfacePoint;
+    point.position = ray.origin + hit.t * ray.direction;
+
+    // Both normals face the incoming ray
+    let geometricNormal = normalize(cross(triangle.v1 - triangle.v0, triangle.v2 - triangle.v0));
+    point.geometricNormal = select(geometricNormal, -geometricNormal, dot(geometricNormal, ray.direction) > 0.0);
+
+    var normal = w * vertexAttribute(i0, 3u) + hit.u * vertexAttribute(i1, 3u) + hit.v * vertexAttribute(i2, 3u);
+    if (dot(normal, normal) == 0.0) {
+        normal = point.geometricNormal;
+    }
+    normal = select(normal, -normal, dot(normal, point.geometricNormal) < 0.0);
+    point.normal = toWorld(normal);
+
+    let uv = w * vertexUv(i0) + hit.u * vertexUv(i1) + hit.v * vertexUv(i2);
+    point.albedo = textureSampleLevel(baseColorTexture, textureSampler, uv, 0.0).rgb;
+    return point;
+}
+
+fn toModel(direction: vec3f) -> vec3f {
+    return (uPathTracer.inverseModelMatrix * vec4f(direction, 0.0)).xyz;
+}
+
+fn toWorld(direction: vec3f) -> vec3f {
+    return normalize((uPathTracer.modelMatrix * vec4f(direction, 0.0)).xyz);
+}
+
+// Start point of rays leaving `point`, off the surface
+fn offsetOrigin(point: SurfacePoint) -> vec3f {
+    let scale = max(max(abs(point.position.x), abs(point.position.y)), abs(point.position.z));
+    return point.position + point.geometricNormal * (1e-4 + scale * 1e-5);
+}
+
+fn tracePath(cameraRay: Ray, state: ptr<function, u32>) -> vec3f {
+    var ray = cameraRay;
+    var radiance = vec3f(0.0);
+    var throughput = vec3f(1.0);
+
+    for (var bounce = 0u; bounce <= uPathTracer.maxBounces; bounce++) {
+        let hit = traverse(ray, noHit, false);
+        if (hit.triangle == noTriangle) {
+            radiance += throughput * environment;
+            break;
+        }
+
+        let point = surfacePoint(ray, hit);
+        let origin = offsetOrigin(point);
+
+        // Direct light, with the same intensity convention as fs_main
+        for (var i = 0u; i < 2u; i++) {
+            let direction = normalize(uLighting.directions[i].xyz);
+            let cosine = dot(direction, point.normal);
+            if (cosine <= 0.0) {
+                continue;
+            }
+            let shadow = traverse(makeRay(origin, toModel(direction)), noHit, true);
+            if (shadow.triangle == noTriangle) {
+                radiance += throughput * point.albedo * uLighting.colors[i].rgb * cosine;
+            }
+        }
+
+        // Continue along a cosine weighted direction, whose pdf cancels the
+        // cosine and 1/pi of the Lambertian BRDF
+        throughput *= point.albedo;
+        if (bounce >= 2u) {
+            // Russian roulette
+            let survival = clamp(max(throughput.r, max(throughput.g, throughput.b)), 0.05, 1.0);
+            if (random(state) >= survival) {
+                break;
+            }
+            throughput /= survival;
+        }
+        let worldDirection = sampleHemisphere(point.normal, state);
+        ray = makeRay(origin, toModel(worldDirection));
+    }
+    return radiance;
+}
+
+@compute @workgroup_size(8, 8)
+fn cs_main(@builtin(global_invocation_id) id: vec3u) {
+    if (id.x >= uPathTracer.width || id.y >= uPathTracer.height) {
+        return;
+    }
+    let pixelIndex = id.y * uPathTracer.width + id.x;
+    var state = pcgHash(pixelIndex ^ pcgHash(uPathTracer.sampleIndex));
+
+    // Jittered camera ray through the pixel, y down in pixels and up in NDC
+    let pixel = vec2f(id.xy) + vec2f(random(&state), random(&state));
+    let size = vec2f(f32(uPathTracer.width), f32(uPathTracer.height));
+    let ndc = vec2f(2.0 * pixel.x / size.x - 1.0, 1.0 - 2.0 * pixel.y / size.y);
+    let farPoint = uPathTracer.inverseViewProjection * vec4f(ndc, 1.0, 1.0);
+    let worldDirection = normalize(farPoint.xyz / farPoint.w - uPathTracer.cameraWorldPosition.xyz);
+
+    let origin = (uPathTracer.inverseModelMatrix * vec4f(uPathTracer.cameraWorldPosition.xyz, 1.0)).xyz;
+    let radiance = tracePath(makeRay(origin, toModel(worldDirection)), &state);
+
+    let previous = select(accumulation[pixelIndex], vec4f(0.0), uPathTracer.sampleIndex == 0u);
+    accumulation[pixelIndex] = previous + vec4f(radiance, 1.0);
+}
+
+// === Display
+
+@vertex
+fn vs_display(@builtin(vertex_index) vertexIndex: u32) -> @builtin(position) vec4f {
+    // Triangle covering the whole viewport
+    let uv = vec2f(f32((vertexIndex << 1u) & 2u), f32(vertexIndex & 2u));
+    return vec4f(uv * 2.0 - 1.0, 0.0, 1.0);
+}
+
+@fragment
+fn fs_display(@builtin(position) position: vec4f) -> @location(0) vec4f {
+    let pixel = vec2u(position.xy);
+    if (pixel.x >= uPathTracer.width || pixel.y >= uPathTracer.height) {
+        return vec4f(environment, 1.0);
+    }
+    let sum = accumulation[pixel.y * uPathTracer.width + pixel.x];
+    let color = sum.rgb / max(sum.a, 1.0);
+
+    // Same output transform as fs_main
+    return vec4f(pow(color, vec3f(2.2)), 1.0);
+}
@@ -8,6 +8,9 @@ struct MyUniforms {
     color: vec4f,
     cameraWorldPosition: vec3f,
     time: f32,
+    // Dequantization of packed positions, xyz only
+    positionScale: vec4f,
+    positionOffset: vec4f,
 };
 
 /**
@@ -21,6 +24,18 @@ struct VertexInput {
     @location(3) uv: vec2f,
 };
 
+/**
+ * Compact layout of VertexPacker: position quantized against the mesh bounds
+ * (unorm16 or float16), octahedral snorm16 normal, unorm8 color and float16
+ * uv. The vertex formats expand everything to floats.
+ */
+struct PackedVertexInput {
+    @location(0) position: vec4f,
+    @location(1) normal: vec2f,
+    @location(2) color: vec4f,
+    @location(3) uv: vec2f,
+};
+
 /**
  * A structure with fields labeled with builtins and locations can also be used
  * as *output* of the vertex shader, which is also the input of the fragment
@@ -42,8 +57,47 @@ struct LightingUniforms {
     colors: array<vec4f, 2>,
 }
 
+/**
+ * Point and spot lights and their clusters, see ClusteredLights and
+ * light_clustering.wgsl
+ */
+struct Light {
+    position: vec3f,
+    range: f32,
+    color: vec3f,
+    spotScale: f32,
+    direction: vec3f,
+    spotOffset: f32,
+}
+
+struct ClusterUniforms {
+    viewMatrix: mat4x4f,
+    inverseProjection: mat4x4f,
+    gridSize: vec3u,
+    lightCount: u32,
+    screenSize: vec2f,
+    sliceScale: f32,
+    sliceBias: f32,
+    near: f32,
+    far: f32,
+}
+
 const pi = 3.14159265359;
 
+// Per cluster, a count followed by the indices of its lights
+const maxLightsPerCluster = 127u;
+const clusterStride = maxLightsPerCluster + 1u;
+
+// Specialization of the shading, set per pipeline by the shader permutation.
+// Features are toggled with #ifdef SPECULAR and #ifdef GAMMA_CORRECTION,
+// GPU_CULLING reads objects through visibleInstances, CLUSTERED_LIGHTS adds
+// the local lights of the fragment's cluster and LIGHT_HEATMAP shows how
+// many there are instead.
+override lightCount: i32 = 2; // at most the size of LightingUniforms
+override hardness: f32 = 16.0;
+override kd: f32 = 1.0; // strength of diffuse effect
+override ks: f32 = 0.5; // strength of specular effect
+
 @group(0) @binding(0) 
 var<uniform> uMyUniforms: MyUniforms;
 @group(0) @binding(1) 
@@ -52,51 +106,149 @@ var baseColorTexture: texture_2d<f32>;
 var textureSampler: sampler;
 @group(0) @binding(3)
 var<uniform> uLighting: LightingUniforms;
+// Model matrix of each object, grouped by mesh, applied before modelMatrix
+@group(0) @binding(4)
+var<storage, read> instanceTransforms: array<mat4x4f>;
+// With #ifdef GPU_CULLING, the objects GpuCuller kept for the chunk drawn
+@group(0) @binding(5)
+var<storage, read> visibleInstances: array<u32>;
+// With #ifdef CLUSTERED_LIGHTS, the lights and the list of each cluster
+@group(0) @binding(6)
+var<storage, read> lights: array<Light>;
+@group(0) @binding(7)
+var<storage, read> clusterLights: array<u32>;
+@group(0) @binding(8)
+var<uniform> uClusters: ClusterUniforms;
 
-@vertex
-fn vs_main(in: VertexInput) -> VertexOutput {
+fn transformVertex(position: vec3f, normal: vec3f, color: vec3f, uv: vec2f, instanceIndex: u32) -> VertexOutput {
 	var out: VertexOutput;
 
-    let worldPosition = uMyUniforms.modelMatrix * vec4f(in.position, 1.0);
+#ifdef GPU_CULLING
+    let modelMatrix = uMyUniforms.modelMatrix * instanceTransforms[visibleInstances[instanceIndex]];
+#else
+    let modelMatrix = uMyUniforms.modelMatrix * instanceTransforms[instanceIndex];
+#endif
+    let worldPosition = modelMatrix * vec4f(position, 1.0);
     out.position = uMyUniforms.projectionMatrix * uMyUniforms.viewMatrix * worldPosition;
 
     let cameraWorldPosition = uMyUniforms.cameraWorldPosition;
     out.viewDirection = cameraWorldPosition - worldPosition.xyz;
 
-    out.normal = (uMyUniforms.modelMatrix * vec4f(in.normal, 0.0)).xyz;
-    out.uv = in.uv;
-	out.color = in.color;
+    out.normal = (modelMatrix * vec4f(normal, 0.0)).xyz;
+    out.uv = uv;
+	out.color = color;
 	return out;
 }
 
+/**
+ * Inverse of the octahedral mapping, folds the lower hemisphere back
+ */
+fn decodeOctahedral(e: vec2f) -> vec3f {
+    var n = vec3f(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+    let t = max(-n.z, 0.0);
+    n.x += select(t, -t, n.x >= 0.0);
+    n.y += select(t, -t, n.y >= 0.0);
+    return normalize(n);
+}
+
+@vertex
+fn vs_main(in: VertexInput, @builtin(instance_index) instanceIndex: u32) -> VertexOutput {
+    return transformVertex(in.position, in.normal, in.color, in.uv, instanceIndex);
+}
+
+@vertex
+fn vs_main_packed(in: PackedVertexInput, @builtin(instance_index) instanceIndex: u32) -> VertexOutput {
+    let position = in.position.xyz * uMyUniforms.positionScale.xyz + uMyUniforms.positionOffset.xyz;
+    return transformVertex(position, decodeOctahedral(in.normal), in.color.rgb, in.uv, instanceIndex);
+}
+
+/**
+ * Cluster of a fragment at `pixel` on the screen and `worldPosition`, whose
+ * depth picks the slice
+ */
+fn clusterIndex(pixel: vec2f, worldPosition: vec3f) -> u32 {
+    let grid = uClusters.gridSize;
+    let depth = (uClusters.viewMatrix * vec4f(worldPosition, 1.0)).z;
+    let tile = min(vec2u(pixel / uClusters.screenSize * vec2f(grid.xy)), grid.xy - 1u);
+    let slice = u32(clamp(log(max(depth, uClusters.near)) * uClusters.sliceScale + uClusters.sliceBias, 0.0, f32(grid.z - 1u)));
+    return (slice * grid.y + tile.y) * grid.x + tile.x;
+}
+
+/**
+ * Diffuse and specular light of the local lights listed at `base` in
+ * clusterLights, fading smoothly to nothing at their range
+ */
+fn shadeLocalLights(base: u32, worldPosition: vec3f, normal: vec3f, viewDirection: vec3f, baseColor: vec3f) -> vec3f {
+    var color = vec3f(0.0);
+    let count = clusterLights[base];
+    for (var i = 0u; i < count; i++) {
+        let light = lights[clusterLights[base + 1u + i]];
+        let toLight = light.position - worldPosition;
+        let lightDistance = length(toLight);
+        if (lightDistance >= light.range) {
+            continue;
+        }
+        let direction = toLight / lightDistance;
+        let fade = 1.0 - lightDistance * lightDistance / (light.range * light.range);
+        let spot = saturate(dot(-direction, light.direction) * light.spotScale + light.spotOffset);
+        let radiance = light.color * fade * fade * spot * spot;
+
+        color += baseColor * kd * max(0.0, dot(direction, normal)) * radiance;
+#ifdef SPECULAR
+        let RoV = max(0.0, dot(reflect(-direction, normal), viewDirection));
+        color += ks * pow(RoV, hardness) * radiance;
+#endif
+    }
+    return color;
+}
+
+// Blue through green and yellow to red as `t` goes from 0 to 1
+fn heatmap(t: f32) -> vec3f {
+    let x = saturate(t);
+    return saturate(vec3f(2.0 * x - 0.5, 1.5 - abs(4.0 * x - 2.0), 1.5 - 3.0 * x));
+}
+
 @fragment
 fn fs_main(in: VertexOutput) -> @location(0) vec4f {
     // Sample texture
     let baseColor = textureSample(baseColorTexture, textureSampler, in.uv).rgb;
-    let kd = 1.0; // strength of diffuse effect
-    let ks = 0.5; // strength of specular effect
 
     var color = vec3f(0.0);
     let normal = normalize(in.normal);
-    for (var i: i32 = 0; i < 2; i++) {
+    for (var i: i32 = 0; i < min(lightCount, 2); i++) {
         // Get normalized light direction
         let direction = normalize(uLighting.directions[i].xyz);
 
         // Diffuse lighting
         let lightColor = uLighting.colors[i].rgb;
         let diffuse = max(0.0, dot(direction, normal)) * lightColor;
+        color += baseColor * kd * diffuse;
 
+#ifdef SPECULAR
         // Specular lighting
         let R = reflect(direction, normal);
         let V = normalize(in.viewDirection);
         let RoV = max(0.0, dot(R, V));
-        let hardness = 16.0;
         let specular = vec3f(pow(RoV, hardness));
-
-        color += baseColor * kd * diffuse + ks * specular;
+        color += ks * specular;
+#endif
     }
 
+#ifdef CLUSTERED_LIGHTS
+    let worldPosition = uMyUniforms.cameraWorldPosition - in.viewDirection;
+    let base = clusterIndex(in.position.xy, worldPosition) * clusterStride;
+    color += shadeLocalLights(base, worldPosition, normal, normalize(in.viewDirection), baseColor);
+#ifdef LIGHT_HEATMAP
+    // Saturated red from 32 lights on, white for a full list
+    let clusterCount = clusterLights[base];
+    let heat = select(heatmap(f32(clusterCount) / 32.0), vec3f(1.0), clusterCount >= maxLightsPerCluster);
+    color = mix(color, heat, 0.75);
+#endif
+#endif
+
+#ifdef GAMMA_CORRECTION
     // apply gamma correction
-    let corrected_color = pow(color, vec3f(2.2));
-    return vec4f(corrected_color, 1.0);
+    color = pow(color, vec3f(2.2));
+#endif
+    return vec4f(color, 1.0);
 }
\ No newline at end of file
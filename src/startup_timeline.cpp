@@ -0,0 +1,64 @@
+#include "startup_timeline.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+namespace {
+
+// Characters of the widest bar in print()
+constexpr int timelineWidth = 40;
+
+} // namespace
+
+void StartupTimeline::start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    origin = std::chrono::steady_clock::now();
+    stageList.clear();
+}
+
+double StartupTimeline::elapsedMilliseconds() const {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - origin).count();
+}
+
+size_t StartupTimeline::begin(const std::string& name) {
+    double now = elapsedMilliseconds();
+    std::lock_guard<std::mutex> lock(mutex);
+    stageList.push_back({ name, now, -1.0 });
+    return stageList.size() - 1;
+}
+
+void StartupTimeline::end(size_t stage) {
+    double now = elapsedMilliseconds();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stage < stageList.size()) stageList[stage].endMilliseconds = now;
+}
+
+std::vector<StartupTimeline::Stage> StartupTimeline::stages() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stageList;
+}
+
+void StartupTimeline::print(std::ostream& out) const {
+    std::vector<Stage> snapshot = stages();
+    double total = 0.0;
+    size_t nameWidth = 5;
+    for (const Stage& stage : snapshot) {
+        total = std::max(total, std::max(stage.startMilliseconds, stage.endMilliseconds));
+        nameWidth = std::max(nameWidth, stage.name.size());
+    }
+
+    out << std::fixed << std::setprecision(1);
+    out << "Startup stages (ms)" << std::endl;
+    for (const Stage& stage : snapshot) {
+        double end = stage.endMilliseconds < 0.0 ? total : stage.endMilliseconds;
+        int first = total > 0.0 ? static_cast<int>(stage.startMilliseconds / total * timelineWidth) : 0;
+        int last = total > 0.0 ? static_cast<int>(end / total * timelineWidth) : 0;
+        out << "  " << std::left << std::setw(static_cast<int>(nameWidth)) << stage.name << std::right
+            << std::setw(9) << stage.startMilliseconds
+            << std::setw(9) << end
+            << std::setw(9) << end - stage.startMilliseconds
+            << (stage.endMilliseconds < 0.0 ? "+ " : "  ")
+            << std::string(static_cast<size_t>(first), ' ')
+            << std::string(static_cast<size_t>(std::max(last - first, 1)), '#') << std::endl;
+    }
+}
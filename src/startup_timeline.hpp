@@ -0,0 +1,68 @@
+#ifndef _STARTUP_TIMELINE_H
+#define _STARTUP_TIMELINE_H
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Wall time of the startup stages, relative to a common origin, so that
+ * overlapping stages show which one is on the critical path. Stages may
+ * begin and end on any thread.
+ */
+class StartupTimeline {
+public:
+    struct Stage {
+        std::string name;
+        double startMilliseconds = 0.0;
+        // Negative while the stage runs
+        double endMilliseconds = -1.0;
+    };
+
+public:
+    // Set the origin of every later time to now
+    void start();
+
+    // Milliseconds since start()
+    double elapsedMilliseconds() const;
+
+    // Open a stage and return its handle for end()
+    size_t begin(const std::string& name);
+
+    void end(size_t stage);
+
+    // Time `task()` as a stage, returning its result
+    template <typename F>
+    auto measure(const std::string& name, F&& task) {
+        size_t stage = begin(name);
+        if constexpr (std::is_void_v<decltype(task())>) {
+            task();
+            end(stage);
+        }
+        else {
+            auto result = task();
+            end(stage);
+            return result;
+        }
+    }
+
+    // Copy of the stages so far, in the order they began
+    std::vector<Stage> stages() const;
+
+    /**
+     * Print every stage with its start, end and duration, and a bar placing
+     * it on the timeline
+     */
+    void print(std::ostream& out) const;
+
+private:
+    mutable std::mutex mutex;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::vector<Stage> stageList;
+};
+
+#endif // _STARTUP_TIMELINE_H
@@ -0,0 +1,318 @@
+#include "texture_cache.hpp"
+#include "hash.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string_view>
+#include <system_error>
+
+namespace {
+
+// Bump whenever the encoder output for the same settings changes
+constexpr uint32_t textureCacheVersion = 1;
+
+constexpr unsigned char ktx2Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+// VkFormat values of the block formats
+constexpr uint32_t vkFormatBC1RgbUnorm = 131;
+constexpr uint32_t vkFormatBC7Unorm = 145;
+
+// Data format descriptor values, see the Khronos Data Format Specification
+constexpr uint32_t dfdModelBC1A = 128;
+constexpr uint32_t dfdModelBC7 = 134;
+constexpr uint32_t dfdPrimariesBT709 = 1;
+constexpr uint32_t dfdTransferLinear = 1;
+
+constexpr char writerKey[] = "KTXwriter";
+constexpr char writerValue[] = "WGPURaytracer";
+constexpr char recordKey[] = "WGPURaytracer.cache";
+
+// Layout (little endian, as every target of the app): header, level index,
+// data format descriptor, key/value data, then the levels from the
+// smallest up
+struct Ktx2Header {
+    unsigned char identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+static_assert(sizeof(Ktx2Header) == 80);
+
+struct Ktx2LevelIndex {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+// Value of the `recordKey` entry
+struct CacheRecord {
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint64_t sourceHash;
+    uint64_t buildKey;
+    // Hash of the level data, from level 0 down
+    uint64_t payloadHash;
+};
+
+struct SourceInfo {
+    uint64_t size;
+    int64_t mtime;
+};
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+bool statSource(const std::filesystem::path& source, SourceInfo& info) {
+    std::error_code error;
+    info.size = std::filesystem::file_size(source, error);
+    if (error) return false;
+    auto mtime = std::filesystem::last_write_time(source, error);
+    if (error) return false;
+    info.mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+    return true;
+}
+
+bool hashSource(const std::filesystem::path& source, uint64_t& hash) {
+    MappedFile file;
+    if (!file.open(source)) return false;
+    hash = hashBytes(file.data(), file.size());
+    return true;
+}
+
+uint64_t hashLevels(const CompressedTexture& texture) {
+    uint64_t hash = 0;
+    for (uint32_t level = 0; level < texture.levels.size(); level++) {
+        hash = hashBytes(texture.levelData(level), texture.levels[level].size, hash);
+    }
+    return hash;
+}
+
+// Descriptor of a single plane, single sample block format
+std::vector<uint32_t> dataFormatDescriptor(BlockFormat format) {
+    uint32_t bytesPerBlock = BlockCompressor::blockBytes(format);
+    uint32_t blockDimension = BlockCompressor::blockSize - 1;
+    return {
+        // dfdTotalSize
+        44,
+        // vendorId and descriptorType
+        0,
+        // versionNumber and descriptorBlockSize
+        2 | (40 << 16),
+        (format == BlockFormat::BC1 ? dfdModelBC1A : dfdModelBC7) | (dfdPrimariesBT709 << 8) | (dfdTransferLinear << 16),
+        blockDimension | (blockDimension << 8),
+        bytesPerBlock,
+        0,
+        // Sample: the whole block, channel 0 (color)
+        (8 * bytesPerBlock - 1) << 16,
+        0,
+        0,
+        0xFFFFFFFFu,
+    };
+}
+
+void appendKeyValue(std::vector<unsigned char>& data, std::string_view key, const void* value, size_t valueSize) {
+    uint32_t length = static_cast<uint32_t>(key.size() + 1 + valueSize);
+    const unsigned char* lengthBytes = reinterpret_cast<const unsigned char*>(&length);
+    data.insert(data.end(), lengthBytes, lengthBytes + sizeof(length));
+    data.insert(data.end(), key.begin(), key.end());
+    data.push_back(0);
+    const unsigned char* valueBytes = static_cast<const unsigned char*>(value);
+    data.insert(data.end(), valueBytes, valueBytes + valueSize);
+    data.resize(alignUp(data.size(), 4), 0);
+}
+
+// Find the value of `key` in the key/value data
+bool findKeyValue(const unsigned char* data, size_t size, std::string_view key, const unsigned char*& value, size_t& valueSize) {
+    size_t offset = 0;
+    while (offset + sizeof(uint32_t) <= size) {
+        uint32_t length;
+        std::memcpy(&length, data + offset, sizeof(length));
+        offset += sizeof(length);
+        if (length > size - offset) return false;
+
+        const char* entry = reinterpret_cast<const char*>(data + offset);
+        size_t keyLength = std::find(entry, entry + length, '\0') - entry;
+        if (keyLength < length && std::string_view(entry, keyLength) == key) {
+            value = data + offset + keyLength + 1;
+            valueSize = length - keyLength - 1;
+            return true;
+        }
+        offset = alignUp(offset + length, 4);
+    }
+    return false;
+}
+
+} // namespace
+
+size_t CompressedTexture::totalSize() const {
+    size_t size = 0;
+    for (const CompressedLevel& level : levels) size += level.size;
+    return size;
+}
+
+std::filesystem::path TextureCache::cachePath(const std::filesystem::path& source) {
+    std::filesystem::path path = source;
+    path += ".ktx2";
+    return path;
+}
+
+bool TextureCache::write(const std::filesystem::path& source, const CompressedTexture& texture, uint64_t buildKey) {
+    if (texture.levels.empty()) return false;
+
+    CacheRecord record{};
+    record.version = textureCacheVersion;
+    SourceInfo info;
+    if (!statSource(source, info) || !hashSource(source, record.sourceHash)) return false;
+    record.sourceSize = info.size;
+    record.sourceMtime = info.mtime;
+    record.buildKey = buildKey;
+    record.payloadHash = hashLevels(texture);
+
+    uint32_t levelCount = static_cast<uint32_t>(texture.levels.size());
+    std::vector<uint32_t> dfd = dataFormatDescriptor(texture.format);
+    std::vector<unsigned char> kvd;
+    appendKeyValue(kvd, writerKey, writerValue, sizeof(writerValue));
+    appendKeyValue(kvd, recordKey, &record, sizeof(record));
+
+    Ktx2Header header{};
+    std::memcpy(header.identifier, ktx2Identifier, sizeof(header.identifier));
+    header.vkFormat = texture.format == BlockFormat::BC1 ? vkFormatBC1RgbUnorm : vkFormatBC7Unorm;
+    header.typeSize = 1;
+    header.pixelWidth = texture.levels[0].width;
+    header.pixelHeight = texture.levels[0].height;
+    header.faceCount = 1;
+    header.levelCount = levelCount;
+    header.dfdByteOffset = static_cast<uint32_t>(sizeof(Ktx2Header) + levelCount * sizeof(Ktx2LevelIndex));
+    header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+    header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+    header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+
+    // Levels are aligned to their block size, smallest first
+    uint64_t alignment = BlockCompressor::blockBytes(texture.format);
+    std::vector<Ktx2LevelIndex> levelIndex(levelCount);
+    uint64_t offset = header.kvdByteOffset + header.kvdByteLength;
+    for (uint32_t level = levelCount; level-- > 0;) {
+        offset = alignUp(offset, alignment);
+        levelIndex[level] = { offset, texture.levels[level].size, texture.levels[level].size };
+        offset += texture.levels[level].size;
+    }
+
+    std::filesystem::path path = cachePath(source);
+    std::filesystem::path tempPath = path;
+    tempPath += ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) return false;
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(levelIndex.data()), static_cast<std::streamsize>(levelCount * sizeof(Ktx2LevelIndex)));
+        file.write(reinterpret_cast<const char*>(dfd.data()), header.dfdByteLength);
+        file.write(reinterpret_cast<const char*>(kvd.data()), header.kvdByteLength);
+
+        const char padding[16] = {};
+        for (uint32_t level = levelCount; level-- > 0;) {
+            file.write(padding, static_cast<std::streamsize>(levelIndex[level].byteOffset - static_cast<uint64_t>(file.tellp())));
+            file.write(reinterpret_cast<const char*>(texture.levelData(level)), static_cast<std::streamsize>(texture.levels[level].size));
+        }
+        if (!file) return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    if (error) {
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+    return true;
+}
+
+bool TextureCache::open(const std::filesystem::path& source, CompressedTexture& texture, uint64_t buildKey) {
+    SourceInfo info;
+    if (!statSource(source, info)) return false;
+
+    MappedFile file;
+    if (!file.open(cachePath(source))) return false;
+
+    Ktx2Header header;
+    if (file.size() < sizeof(header)) return false;
+    std::memcpy(&header, file.data(), sizeof(header));
+
+    bool valid = std::memcmp(header.identifier, ktx2Identifier, sizeof(header.identifier)) == 0
+        && (header.vkFormat == vkFormatBC1RgbUnorm || header.vkFormat == vkFormatBC7Unorm)
+        && header.typeSize == 1
+        && header.pixelDepth == 0
+        && header.layerCount == 0
+        && header.faceCount == 1
+        && header.supercompressionScheme == 0
+        && header.levelCount > 0 && header.levelCount <= 32
+        && sizeof(header) + header.levelCount * sizeof(Ktx2LevelIndex) <= file.size()
+        && static_cast<uint64_t>(header.kvdByteOffset) + header.kvdByteLength <= file.size();
+    if (!valid) return false;
+
+    // The source must match the one the cache was built from
+    const unsigned char* recordData;
+    size_t recordSize;
+    CacheRecord record;
+    if (!findKeyValue(file.data() + header.kvdByteOffset, header.kvdByteLength, recordKey, recordData, recordSize)
+        || recordSize != sizeof(record)) {
+        return false;
+    }
+    std::memcpy(&record, recordData, sizeof(record));
+    valid = record.version == textureCacheVersion
+        && record.sourceSize == info.size
+        && record.buildKey == buildKey;
+
+    // A different mtime alone does not make the cache stale (e.g. after a
+    // fresh checkout), only a different content hash does
+    if (valid && record.sourceMtime != info.mtime) {
+        uint64_t sourceHash;
+        valid = hashSource(source, sourceHash) && sourceHash == record.sourceHash;
+    }
+    if (!valid) return false;
+
+    BlockFormat format = header.vkFormat == vkFormatBC1RgbUnorm ? BlockFormat::BC1 : BlockFormat::BC7;
+    std::vector<Ktx2LevelIndex> levelIndex(header.levelCount);
+    std::memcpy(levelIndex.data(), file.data() + sizeof(header), header.levelCount * sizeof(Ktx2LevelIndex));
+
+    std::vector<CompressedLevel> levels(header.levelCount);
+    for (uint32_t level = 0; level < header.levelCount; level++) {
+        uint32_t width = std::max(header.pixelWidth >> level, 1u);
+        uint32_t height = std::max(header.pixelHeight >> level, 1u);
+        const Ktx2LevelIndex& entry = levelIndex[level];
+        if (entry.byteLength != BlockCompressor::compressedSize(width, height, format)
+            || entry.byteOffset > file.size()
+            || entry.byteLength > file.size() - entry.byteOffset) {
+            return false;
+        }
+        levels[level] = { width, height, entry.byteOffset, entry.byteLength };
+    }
+
+    texture.format = format;
+    texture.levels = std::move(levels);
+    texture.storage.clear();
+    texture.file = std::move(file);
+
+    // Catch truncated or corrupted contents
+    if (hashLevels(texture) != record.payloadHash) {
+        texture.levels.clear();
+        texture.file.close();
+        return false;
+    }
+    return true;
+}
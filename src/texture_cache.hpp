@@ -0,0 +1,69 @@
+#ifndef _TEXTURE_CACHE_H
+#define _TEXTURE_CACHE_H
+
+#include "block_compression.hpp"
+#include "mapped_file.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+struct CompressedLevel {
+    uint32_t width;
+    uint32_t height;
+    // Byte offset of the level's blocks from CompressedTexture::data()
+    size_t offset;
+    size_t size;
+};
+
+/**
+ * A block compressed mip chain, either encoded in memory into `storage` or
+ * mapped from a cache file
+ */
+struct CompressedTexture {
+    BlockFormat format = BlockFormat::BC1;
+    std::vector<CompressedLevel> levels;
+    std::vector<unsigned char> storage;
+    MappedFile file;
+
+    const unsigned char* data() const {
+        return file.isOpen() ? file.data() : storage.data();
+    }
+
+    const unsigned char* levelData(uint32_t level) const {
+        return data() + levels[level].offset;
+    }
+
+    // Bytes of every level together
+    size_t totalSize() const;
+};
+
+/**
+ * KTX2 copy of a block compressed texture, stored next to its source image.
+ * The file is a plain KTX2 container (no supercompression) readable by
+ * other tools. A key/value entry records the source size, modification
+ * time and hash, the build key and a hash of the level data, so a stale or
+ * corrupt cache is rebuilt.
+ */
+class TextureCache {
+public:
+    /**
+     * Path of the cache file belonging to `source`
+     */
+    static std::filesystem::path cachePath(const std::filesystem::path& source);
+
+    /**
+     * Write the cache of `source`, under a temporary name then renamed.
+     * `buildKey` identifies the settings the texture was encoded with.
+     */
+    static bool write(const std::filesystem::path& source, const CompressedTexture& texture, uint64_t buildKey);
+
+    /**
+     * Map the cache of `source` into `texture`. Returns false when the
+     * cache is missing, stale, built with another `buildKey` or corrupt.
+     */
+    static bool open(const std::filesystem::path& source, CompressedTexture& texture, uint64_t buildKey);
+};
+
+#endif // _TEXTURE_CACHE_H
@@ -0,0 +1,106 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+ThreadPool::ThreadPool(size_t threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    workers.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; i++) {
+        workers.emplace_back([this]() { workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::parallelFor(
+    size_t count,
+    size_t grainSize,
+    const std::function<void(size_t, size_t)>& body
+) {
+    if (count == 0) return;
+    grainSize = std::max<size_t>(grainSize, 1);
+
+    size_t chunkCount = (count + grainSize - 1) / grainSize;
+    if (chunkCount == 1 || workers.empty()) {
+        body(0, count);
+        return;
+    }
+
+    // Chunks are claimed from a shared counter so that helpers which start
+    // late simply find nothing left to do. The state is reference counted
+    // because such helpers may outlive this call.
+    struct State {
+        std::atomic<size_t> nextChunk{ 0 };
+        std::atomic<size_t> finishedChunks{ 0 };
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    auto state = std::make_shared<State>();
+
+    auto runChunks = [state, count, grainSize, chunkCount, &body]() {
+        size_t chunk;
+        while ((chunk = state->nextChunk.fetch_add(1)) < chunkCount) {
+            size_t begin = chunk * grainSize;
+            size_t end = std::min(begin + grainSize, count);
+            body(begin, end);
+
+            if (state->finishedChunks.fetch_add(1) + 1 == chunkCount) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished.notify_all();
+            }
+        }
+    };
+
+    size_t helperCount = std::min(workers.size(), chunkCount - 1);
+    for (size_t i = 0; i < helperCount; i++) {
+        enqueue(runChunks);
+    }
+
+    // Work on the range from the calling thread as well
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&]() { return state->finishedChunks.load() == chunkCount; });
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    taskAvailable.notify_one();
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskAvailable.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty()) return;
+
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
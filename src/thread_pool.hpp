@@ -0,0 +1,72 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class ThreadPool {
+public:
+    /**
+     * Create a pool with `threadCount` workers. A count of zero uses the
+     * number of hardware threads.
+     */
+    explicit ThreadPool(size_t threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Pool shared by the asset pipeline, created on first use
+     */
+    static ThreadPool& shared();
+
+    /**
+     * Number of worker threads (the calling thread is not counted)
+     */
+    size_t size() const { return workers.size(); }
+
+    /**
+     * Queue `task` on a worker and return a future for its result
+     */
+    template <typename F>
+    auto submit(F&& task) -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+        using Result = std::invoke_result_t<std::decay_t<F>>;
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+        std::future<Result> result = packaged->get_future();
+        enqueue([packaged]() { (*packaged)(); });
+        return result;
+    }
+
+    /**
+     * Call `body(begin, end)` over [0, count) in chunks of at most `grainSize`
+     * items and block until every chunk ran. The calling thread takes chunks
+     * too, so this is safe to call from inside a pool task.
+     */
+    void parallelFor(
+        size_t count,
+        size_t grainSize,
+        const std::function<void(size_t, size_t)>& body
+    );
+
+private:
+    void enqueue(std::function<void()> task);
+    void workerLoop();
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    bool stopping = false;
+};
+
+#endif // _THREAD_POOL_H
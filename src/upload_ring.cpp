@@ -0,0 +1,169 @@
+#include "upload_ring.hpp"
+#include "webgpu_utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string_view>
+#include <thread>
+
+namespace {
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+bool UploadRing::initialize(wgpu::Device device, uint32_t frameCount, uint64_t frameCapacity) {
+    this->device = device;
+
+    // Dynamic offsets must satisfy both alignments, whichever the data is bound as
+    wgpu::Limits limits;
+    device.getLimits(&limits);
+    alignment = std::max<uint64_t>(limits.minUniformBufferOffsetAlignment, limits.minStorageBufferOffsetAlignment);
+    this->frameCapacity = alignUp(std::max<uint64_t>(frameCapacity, alignment), alignment);
+
+    wgpu::BufferDescriptor bufferDesc;
+    bufferDesc.label = "Upload ring"_wgpu;
+    bufferDesc.size = this->frameCapacity * std::max(frameCount, 1u);
+    bufferDesc.usage = wgpu::BufferUsage::CopyDst | wgpu::BufferUsage::CopySrc | wgpu::BufferUsage::Uniform | wgpu::BufferUsage::Storage;
+    bufferDesc.mappedAtCreation = false;
+    ringBuffer = device.createBuffer(bufferDesc);
+    if (!ringBuffer) return false;
+
+    // Staging buffers start mapped, ready for the first frames
+    bufferDesc.label = "Upload ring staging"_wgpu;
+    bufferDesc.size = this->frameCapacity;
+    bufferDesc.usage = wgpu::BufferUsage::MapWrite | wgpu::BufferUsage::CopySrc;
+    bufferDesc.mappedAtCreation = true;
+    slots.resize(std::max(frameCount, 1u));
+    for (Slot& slot : slots) {
+        slot.staging = device.createBuffer(bufferDesc);
+        if (!slot.staging) return false;
+    }
+    currentSlot = 0;
+    return true;
+}
+
+void UploadRing::terminate() {
+    for (Slot& slot : slots) {
+        if (slot.state == SlotState::InFlight) waitForSlot(slot);
+        slot.staging.release();
+    }
+    slots.clear();
+    if (ringBuffer) ringBuffer.release();
+    ringBuffer = nullptr;
+}
+
+void UploadRing::beginFrame() {
+    Slot& slot = slots[currentSlot];
+    cursor = 0;
+
+    // A frame dropped before endFrame() leaves its region to the next one
+    if (slot.state == SlotState::Recording) return;
+
+    if (slot.state == SlotState::InFlight) {
+        auto start = std::chrono::steady_clock::now();
+        waitForSlot(slot);
+        statistics.stallMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    slot.data = slot.mapSucceeded ? static_cast<unsigned char*>(slot.staging.getMappedRange(0, frameCapacity)) : nullptr;
+    slot.state = SlotState::Recording;
+}
+
+UploadRing::Allocation UploadRing::allocate(uint64_t size) {
+    return allocate(size, size);
+}
+
+UploadRing::Allocation UploadRing::allocate(uint64_t size, uint64_t bindingSize) {
+    Slot& slot = slots[currentSlot];
+    uint64_t offset = alignUp(cursor, alignment);
+    if (slot.state != SlotState::Recording || !slot.data || offset + std::max(size, bindingSize) > frameCapacity) {
+        if (!overflowReported) {
+            std::cerr << "Upload ring frame of " << frameCapacity << " bytes is full or not begun" << std::endl;
+            overflowReported = true;
+        }
+        return {};
+    }
+
+    cursor = offset + size;
+    return { currentSlot * frameCapacity + offset, slot.data + offset };
+}
+
+void UploadRing::endFrame(wgpu::CommandEncoder encoder) {
+    Slot& slot = slots[currentSlot];
+    if (slot.state != SlotState::Recording) return;
+
+    if (slot.mapSucceeded) slot.staging.unmap();
+    slot.data = nullptr;
+
+    // Copies are in multiples of 4 bytes
+    uint64_t size = alignUp(cursor, 4);
+    if (size > 0 && slot.mapSucceeded) {
+        encoder.copyBufferToBuffer(slot.staging, 0, ringBuffer, currentSlot * frameCapacity, size);
+    }
+    statistics.frameBytes = size;
+    slot.state = SlotState::Recorded;
+}
+
+void UploadRing::submitted(wgpu::Queue queue) {
+    Slot& slot = slots[currentSlot];
+    if (slot.state != SlotState::Recorded) return;
+
+    slot.state = SlotState::InFlight;
+    slot.workDone = false;
+    slot.mapped = false;
+
+    wgpu::QueueWorkDoneCallbackInfo workDoneInfo;
+    workDoneInfo.nextInChain = nullptr;
+    workDoneInfo.mode = wgpu::CallbackMode::AllowProcessEvents;
+    workDoneInfo.callback = onWorkDone;
+    workDoneInfo.userdata1 = &slot;
+    workDoneInfo.userdata2 = nullptr;
+    queue.onSubmittedWorkDone(workDoneInfo);
+
+    // Remapping also waits for the copy out of the staging buffer
+    wgpu::BufferMapCallbackInfo mapInfo;
+    mapInfo.nextInChain = nullptr;
+    mapInfo.mode = wgpu::CallbackMode::AllowProcessEvents;
+    mapInfo.callback = onBufferMapped;
+    mapInfo.userdata1 = &slot;
+    mapInfo.userdata2 = nullptr;
+    slot.staging.mapAsync(wgpu::MapMode::Write, 0, frameCapacity, mapInfo);
+
+    currentSlot = (currentSlot + 1) % slots.size();
+}
+
+void UploadRing::onWorkDone(WGPUQueueWorkDoneStatus status, void* userdata1, [[maybe_unused]] void* userdata2) {
+    Slot& slot = *reinterpret_cast<Slot*>(userdata1);
+    if (status != WGPUQueueWorkDoneStatus_Success) {
+        std::cerr << "Upload ring frame did not complete (status " << status << ")" << std::endl;
+    }
+    slot.workDone = true;
+    if (slot.mapped) slot.state = SlotState::Free;
+}
+
+void UploadRing::onBufferMapped(WGPUMapAsyncStatus status, WGPUStringView message, void* userdata1, [[maybe_unused]] void* userdata2) {
+    Slot& slot = *reinterpret_cast<Slot*>(userdata1);
+    if (status != WGPUMapAsyncStatus_Success) {
+        std::cerr << "Could not map upload ring staging buffer";
+        if (message.data) std::cerr << ": " << std::string_view(message.data, message.length);
+        std::cerr << std::endl;
+    }
+    slot.mapSucceeded = status == WGPUMapAsyncStatus_Success;
+    slot.mapped = true;
+    if (slot.workDone) slot.state = SlotState::Free;
+}
+
+void UploadRing::waitForSlot(Slot& slot) {
+    while (slot.state == SlotState::InFlight) {
+#if defined(WEBGPU_BACKEND_DAWN)
+        device.tick();
+#elif defined(WEBGPU_BACKEND_WGPU)
+        device.poll(false, nullptr);
+#endif
+        std::this_thread::yield();
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef _UPLOAD_RING_H
+#define _UPLOAD_RING_H
+
+#include <webgpu/webgpu.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/**
+ * Per-frame upload memory for uniforms and other data rewritten every frame.
+ * One device buffer is split into a region per frame in flight, and each
+ * region has a MapWrite staging buffer that the CPU fills directly. At the
+ * end of the frame the staging buffer is copied into its region with a
+ * single copy; the data is then bound with dynamic offsets into buffer().
+ *
+ * A region is reused only once onSubmittedWorkDone reports the frame that
+ * read it as done and its staging buffer is mapped again, so a frame never
+ * overwrites data that the GPU is still reading and no queue.writeBuffer
+ * has to synchronize with in-flight frames.
+ */
+class UploadRing {
+public:
+    struct Allocation {
+        // Offset into buffer(), aligned for dynamic uniform and storage offsets
+        uint64_t offset = 0;
+        // Where to write the data, null when the frame is out of space
+        void* data = nullptr;
+    };
+
+    struct Stats {
+        // Bytes copied by the last frame
+        uint64_t frameBytes = 0;
+        // Time beginFrame() spent waiting for the GPU to release a region
+        double stallMilliseconds = 0.0;
+    };
+
+public:
+    /**
+     * Create `frameCount` regions of at least `frameCapacity` bytes. The
+     * buffer has the Uniform, Storage and CopySrc usages.
+     */
+    bool initialize(wgpu::Device device, uint32_t frameCount, uint64_t frameCapacity);
+
+    // Wait for the frames in flight and release the buffers
+    void terminate();
+
+    /**
+     * Start filling the next region, waiting for the GPU if that region's
+     * previous frame is still in flight
+     */
+    void beginFrame();
+
+    Allocation allocate(uint64_t size);
+
+    /**
+     * Same, for data bound with a binding of `bindingSize` bytes, larger
+     * than the `size` written this frame. The frame keeps room for the
+     * whole binding from the offset but copies the written bytes only.
+     */
+    Allocation allocate(uint64_t size, uint64_t bindingSize);
+
+    // Copy `value` into the frame and return its offset into buffer()
+    template <typename T>
+    uint64_t push(const T& value) {
+        Allocation allocation = allocate(sizeof(T));
+        if (allocation.data) std::memcpy(allocation.data, &value, sizeof(T));
+        return allocation.offset;
+    }
+
+    /**
+     * Record the copy of everything allocated this frame, before any pass
+     * reading it
+     */
+    void endFrame(wgpu::CommandEncoder encoder);
+
+    // Fence the frame, once the command buffer of endFrame() is submitted
+    void submitted(wgpu::Queue queue);
+
+    wgpu::Buffer buffer() const { return ringBuffer; }
+
+    const Stats& stats() const { return statistics; }
+
+private:
+    enum class SlotState {
+        // Staging buffer mapped, nothing allocated
+        Free,
+        // Between beginFrame() and endFrame()
+        Recording,
+        // Copy recorded, waiting for submitted()
+        Recorded,
+        // Waiting for the GPU to finish the frame and for the remap
+        InFlight,
+    };
+
+    struct Slot {
+        wgpu::Buffer staging;
+        SlotState state = SlotState::Free;
+        unsigned char* data = nullptr;
+        bool workDone = true;
+        bool mapped = true;
+        bool mapSucceeded = true;
+    };
+
+    static void onWorkDone(WGPUQueueWorkDoneStatus status, void* userdata1, void* userdata2);
+
+    static void onBufferMapped(WGPUMapAsyncStatus status, WGPUStringView message, void* userdata1, void* userdata2);
+
+    // Poll the device until the frame of `slot` is done and its staging remapped
+    void waitForSlot(Slot& slot);
+
+private:
+    wgpu::Device device;
+    wgpu::Buffer ringBuffer;
+    uint64_t alignment = 256;
+    uint64_t frameCapacity = 0;
+
+    std::vector<Slot> slots;
+    size_t currentSlot = 0;
+    uint64_t cursor = 0;
+    bool overflowReported = false;
+    Stats statistics;
+};
+
+#endif // _UPLOAD_RING_H
@@ -0,0 +1,292 @@
+#include "vertex_packing.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// Vertices per pool task
+constexpr size_t packGrainSize = 16 * 1024;
+
+// Round to nearest even, overflow goes to infinity
+uint16_t floatToHalf(float value) {
+    uint32_t bits = std::bit_cast<uint32_t>(value);
+    uint32_t sign = (bits >> 16) & 0x8000u;
+    uint32_t exponent = (bits >> 23) & 0xFFu;
+    uint32_t mantissa = bits & 0x7FFFFFu;
+
+    if (exponent == 0xFFu) {
+        return static_cast<uint16_t>(sign | 0x7C00u | (mantissa ? 0x200u : 0u));
+    }
+
+    int halfExponent = static_cast<int>(exponent) - 127 + 15;
+    if (halfExponent >= 31) {
+        return static_cast<uint16_t>(sign | 0x7C00u);
+    }
+
+    if (halfExponent <= 0) {
+        // Subnormal half, or zero
+        if (halfExponent < -10) return static_cast<uint16_t>(sign);
+        mantissa |= 0x800000u;
+        uint32_t shift = static_cast<uint32_t>(14 - halfExponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1u))) half++;
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    // A carry out of the mantissa correctly bumps the exponent
+    uint32_t half = (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1FFFu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u))) half++;
+    return static_cast<uint16_t>(sign | half);
+}
+
+float halfToFloat(uint16_t half) {
+    uint32_t sign = (static_cast<uint32_t>(half) & 0x8000u) << 16;
+    uint32_t exponent = (half >> 10) & 0x1Fu;
+    uint32_t mantissa = half & 0x3FFu;
+
+    if (exponent == 0) {
+        float magnitude = std::ldexp(static_cast<float>(mantissa), -24);
+        return sign ? -magnitude : magnitude;
+    }
+    uint32_t bits = exponent == 0x1Fu
+        ? sign | 0x7F800000u | (mantissa << 13)
+        : sign | ((exponent + 112) << 23) | (mantissa << 13);
+    return std::bit_cast<float>(bits);
+}
+
+float signNotZero(float value) {
+    return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+// Same as decodeOctahedral() in shader.wgsl
+glm::vec3 octahedralDecode(glm::vec2 e) {
+    glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+    float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+float snorm16ToFloat(int16_t value) {
+    return std::max(static_cast<float>(value) / 32767.0f, -1.0f);
+}
+
+/**
+ * Project `n` on the octahedron, unfold its lower half, and pick whichever
+ * of the four surrounding snorm16 points decodes closest to `n`
+ */
+void octahedralEncode(glm::vec3 n, int16_t encoded[2]) {
+    float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    if (l1 == 0.0f) {
+        encoded[0] = encoded[1] = 0;
+        return;
+    }
+
+    glm::vec2 p = glm::vec2(n.x, n.y) / l1;
+    if (n.z < 0.0f) {
+        p = glm::vec2(
+            (1.0f - std::abs(p.y)) * signNotZero(p.x),
+            (1.0f - std::abs(p.x)) * signNotZero(p.y)
+        );
+    }
+
+    // Compare distances rather than dot products, which are all too close
+    // to 1 for float to tell apart
+    n = glm::normalize(n);
+    float bestDistance = std::numeric_limits<float>::max();
+    float x = std::clamp(p.x, -1.0f, 1.0f) * 32767.0f;
+    float y = std::clamp(p.y, -1.0f, 1.0f) * 32767.0f;
+    for (float qx : { std::floor(x), std::ceil(x) }) {
+        for (float qy : { std::floor(y), std::ceil(y) }) {
+            int16_t candidate[2] = { static_cast<int16_t>(qx), static_cast<int16_t>(qy) };
+            glm::vec3 decoded = octahedralDecode({ snorm16ToFloat(candidate[0]), snorm16ToFloat(candidate[1]) });
+            glm::vec3 delta = decoded - n;
+            float distance = glm::dot(delta, delta);
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                encoded[0] = candidate[0];
+                encoded[1] = candidate[1];
+            }
+        }
+    }
+}
+
+uint16_t quantizeUnorm16(float value) {
+    return static_cast<uint16_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 65535.0f));
+}
+
+uint8_t quantizeUnorm8(float value) {
+    return static_cast<uint8_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+}
+
+PackedVertex packVertex(
+    const VertexAttributes& v,
+    const VertexQuantization& quantization,
+    PositionEncoding encoding
+) {
+    PackedVertex packed;
+
+    glm::vec3 position = v.position - quantization.offset;
+    for (int i = 0; i < 3; i++) {
+        float scale = quantization.scale[i];
+        float stored = scale > 0.0f ? position[i] / scale : 0.0f;
+        packed.position[i] = encoding == PositionEncoding::Unorm16
+            ? quantizeUnorm16(stored)
+            : floatToHalf(stored);
+    }
+    packed.position[3] = 0;
+
+    octahedralEncode(v.normal, packed.normal);
+
+    for (int i = 0; i < 3; i++) {
+        packed.color[i] = quantizeUnorm8(v.color[i]);
+    }
+    packed.color[3] = 255;
+
+    packed.uv[0] = floatToHalf(v.uv.x);
+    packed.uv[1] = floatToHalf(v.uv.y);
+
+    return packed;
+}
+
+} // namespace
+
+VertexQuantization VertexPacker::quantization(const Bounds& bounds, PositionEncoding encoding) {
+    VertexQuantization quantization;
+    if (bounds.isEmpty()) return quantization;
+
+    if (encoding == PositionEncoding::Unorm16) {
+        quantization.scale = bounds.max - bounds.min;
+        quantization.offset = bounds.min;
+    }
+    else {
+        // Center on the bounds, where float16 is most precise, and scale
+        // into [-1, 1] so that large models cannot overflow
+        glm::vec3 halfExtent = 0.5f * (bounds.max - bounds.min);
+        for (int i = 0; i < 3; i++) {
+            quantization.scale[i] = halfExtent[i] > 0.0f ? halfExtent[i] : 1.0f;
+        }
+        quantization.offset = 0.5f * (bounds.min + bounds.max);
+    }
+    return quantization;
+}
+
+void VertexPacker::pack(
+    std::span<const VertexAttributes> vertices,
+    const VertexQuantization& quantization,
+    PositionEncoding encoding,
+    std::vector<PackedVertex>& packed
+) {
+    packed.resize(vertices.size());
+    ThreadPool::shared().parallelFor(vertices.size(), packGrainSize, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            packed[i] = packVertex(vertices[i], quantization, encoding);
+        }
+    });
+}
+
+VertexAttributes VertexPacker::unpack(
+    const PackedVertex& vertex,
+    const VertexQuantization& quantization,
+    PositionEncoding encoding
+) {
+    VertexAttributes v;
+
+    glm::vec3 stored;
+    for (int i = 0; i < 3; i++) {
+        stored[i] = encoding == PositionEncoding::Unorm16
+            ? static_cast<float>(vertex.position[i]) / 65535.0f
+            : halfToFloat(vertex.position[i]);
+    }
+    v.position = stored * quantization.scale + quantization.offset;
+
+    v.normal = octahedralDecode({ snorm16ToFloat(vertex.normal[0]), snorm16ToFloat(vertex.normal[1]) });
+
+    for (int i = 0; i < 3; i++) {
+        v.color[i] = static_cast<float>(vertex.color[i]) / 255.0f;
+    }
+
+    v.uv = { halfToFloat(vertex.uv[0]), halfToFloat(vertex.uv[1]) };
+
+    return v;
+}
+
+PackingError VertexPacker::measureError(
+    std::span<const VertexAttributes> vertices,
+    std::span<const PackedVertex> packed,
+    const VertexQuantization& quantization,
+    PositionEncoding encoding
+) {
+    PackingError error;
+    for (size_t i = 0; i < vertices.size() && i < packed.size(); i++) {
+        const VertexAttributes& reference = vertices[i];
+        VertexAttributes decoded = unpack(packed[i], quantization, encoding);
+
+        glm::vec3 positionError = glm::abs(decoded.position - reference.position);
+        error.position = std::max({ error.position, positionError.x, positionError.y, positionError.z });
+
+        // Zero normals decode to +z, there is nothing to compare with
+        // (atan2 stays accurate for the tiny angles where acos does not)
+        if (glm::dot(reference.normal, reference.normal) > 0.0f) {
+            glm::vec3 normal = glm::normalize(reference.normal);
+            float angle = std::atan2(glm::length(glm::cross(decoded.normal, normal)), glm::dot(decoded.normal, normal));
+            error.normalDegrees = std::max(error.normalDegrees, glm::degrees(angle));
+        }
+
+        glm::vec3 colorError = glm::abs(decoded.color - reference.color);
+        error.color = std::max({ error.color, colorError.x, colorError.y, colorError.z });
+
+        glm::vec2 uvError = glm::abs(decoded.uv - reference.uv);
+        error.uv = std::max({ error.uv, uvError.x, uvError.y });
+    }
+    return error;
+}
+
+PackingError VertexPacker::errorBound(
+    std::span<const VertexAttributes> vertices,
+    const VertexQuantization& quantization,
+    PositionEncoding encoding
+) {
+    constexpr float epsilon = std::numeric_limits<float>::epsilon();
+    // Half of a float16 ulp, relative
+    constexpr float halfPrecision = 1.0f / 2048.0f;
+    // Half of the smallest float16 subnormal
+    constexpr float halfDenormal = 1.0f / (1 << 25);
+
+    float maxPosition = 0.0f;
+    float maxRelativePosition = 0.0f;
+    float maxUv = 0.0f;
+    for (const VertexAttributes& v : vertices) {
+        glm::vec3 position = glm::abs(v.position);
+        glm::vec3 relative = glm::abs(v.position - quantization.offset);
+        glm::vec2 uv = glm::abs(v.uv);
+        maxPosition = std::max({ maxPosition, position.x, position.y, position.z });
+        maxRelativePosition = std::max({ maxRelativePosition, relative.x, relative.y, relative.z });
+        maxUv = std::max({ maxUv, uv.x, uv.y });
+    }
+
+    PackingError bound;
+    // Quantization step, plus the float rounding of the decode
+    float maxScale = std::max({ quantization.scale.x, quantization.scale.y, quantization.scale.z });
+    float step = encoding == PositionEncoding::Unorm16
+        ? 0.5f * maxScale / 65535.0f
+        : maxRelativePosition * halfPrecision + maxScale * halfDenormal;
+    bound.position = step + 4.0f * epsilon * (maxPosition + maxRelativePosition);
+
+    // Half the diagonal of a snorm16 cell, stretched by at most 2 where the
+    // octahedron unfolds
+    bound.normalDegrees = glm::degrees(2.0f * std::sqrt(2.0f) * 0.5f / 32767.0f) + 1e-4f;
+
+    // Colors are expected in [0, 1]
+    bound.color = 0.5f / 255.0f + epsilon;
+
+    bound.uv = maxUv * halfPrecision + halfDenormal;
+    return bound;
+}
@@ -0,0 +1,108 @@
+#ifndef _VERTEX_PACKING_H
+#define _VERTEX_PACKING_H
+
+#include "mesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/**
+ * How PackedVertex::position is stored
+ */
+enum class PositionEncoding {
+    // unorm16x4 spanning the mesh bounds
+    Unorm16,
+    // float16x4 in [-1, 1] around the center of the mesh bounds
+    Float16,
+};
+
+/**
+ * 20 byte vertex read by `vs_main_packed`
+ */
+struct PackedVertex {
+    // xyz and an unused w, see PositionEncoding
+    uint16_t position[4];
+    // Octahedral encoding, snorm16x2
+    int16_t normal[2];
+    // unorm8x4, alpha is 1
+    uint8_t color[4];
+    // float16x2
+    uint16_t uv[2];
+};
+static_assert(sizeof(PackedVertex) == 20);
+
+/**
+ * Decoded position is `stored * scale + offset`
+ */
+struct VertexQuantization {
+    glm::vec3 scale = glm::vec3(1.0f);
+    glm::vec3 offset = glm::vec3(0.0f);
+};
+
+/**
+ * Largest difference between packed and float attributes
+ */
+struct PackingError {
+    // Absolute, per axis
+    float position = 0.0f;
+    // Angle to the normalized float normal
+    float normalDegrees = 0.0f;
+    // Absolute, per channel
+    float color = 0.0f;
+    // Absolute, per component
+    float uv = 0.0f;
+};
+
+class VertexPacker {
+public:
+    /**
+     * Position transform that maps the stored positions of a mesh with
+     * `bounds` back to model space
+     */
+    static VertexQuantization quantization(const Bounds& bounds, PositionEncoding encoding);
+
+    /**
+     * Pack every vertex into `packed`, split across the shared thread pool
+     */
+    static void pack(
+        std::span<const VertexAttributes> vertices,
+        const VertexQuantization& quantization,
+        PositionEncoding encoding,
+        std::vector<PackedVertex>& packed
+    );
+
+    /**
+     * Decode a vertex the way the vertex shader does (the normal comes back
+     * normalized and the color without alpha)
+     */
+    static VertexAttributes unpack(
+        const PackedVertex& vertex,
+        const VertexQuantization& quantization,
+        PositionEncoding encoding
+    );
+
+    /**
+     * Measure how far the packed vertices drift from the float ones
+     */
+    static PackingError measureError(
+        std::span<const VertexAttributes> vertices,
+        std::span<const PackedVertex> packed,
+        const VertexQuantization& quantization,
+        PositionEncoding encoding
+    );
+
+    /**
+     * Worst error the encoding may introduce on `vertices`, which
+     * measureError() must stay under
+     */
+    static PackingError errorBound(
+        std::span<const VertexAttributes> vertices,
+        const VertexQuantization& quantization,
+        PositionEncoding encoding
+    );
+};
+
+#endif // _VERTEX_PACKING_H